@@ -36,6 +36,8 @@
 #include "netppp.h"
 #include "netip.h"
 #include "nettcp.h"
+#include "netudp.h"
+#include "netloop.h"
 
 #include <stdio.h>
 #include "netdebug.h"
@@ -77,8 +79,14 @@ void netInit(void)
 	explicit_remote = 0;
 	magicInit();
 	ipInit();
+#if LOOP_SUPPORT > 0
+	loopInit();
+#endif
 	pppInit();
 	tcpInit();
+#if UDP_SUPPORT > 0
+	udpInit();
+#endif
 }
 
 /*
@@ -266,7 +266,8 @@ INT rand(void);						/* random number function */
 /* Supported network interface types. */
 typedef enum {
 	IFT_UNSPEC = 0,				/* No interface */
-	IFT_PPP						/* Point-to-Point Protocol */
+	IFT_PPP,					/* Point-to-Point Protocol */
+	IFT_LOOP					/* Loopback */
 } IfType;
 
 
@@ -385,7 +386,12 @@ typedef enum {
 #define PPP_AT			0x29	/* AppleTalk Protocol */
 #define	PPP_VJC_COMP	0x2d	/* VJ compressed TCP */
 #define	PPP_VJC_UNCOMP	0x2f	/* VJ uncompressed TCP */
+#define PPP_FULLHDR		0x61	/* IPHC full header */
+#define PPP_COMPTCP		0x63	/* IPHC compressed TCP */
+#define PPP_COMPNONTCP	0x65	/* IPHC compressed non-TCP */
 #define PPP_COMP		0xfd	/* compressed packet */
+#define PPP_COMPTCPND	0x2063	/* IPHC compressed TCP, no delta */
+#define PPP_CTXSTATE	0x2065	/* IPHC context state */
 #define PPP_IPCP		0x8021	/* IP Control Protocol */
 #define PPP_ATCP		0x8029	/* AppleTalk Control Protocol */
 #define PPP_CCP			0x80fd	/* Compression Control Protocol */
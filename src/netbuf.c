@@ -56,7 +56,11 @@
 /*************************/
 /*** LOCAL DEFINITIONS ***/
 /*************************/
-#define MAXNBUFS 32					/* The number of nBufs allocated. */
+/*
+ * The number of nBufs allocated.  Make sure that there's room for a few
+ * maximum sized frames on top of our base allocation.
+ */
+#define MAXNBUFS (32 + 4 * ((PPP_MAXMRU + NBUFSZ - 1) / NBUFSZ))
 
                                                                     
 /******************************/
@@ -176,6 +180,7 @@ NBuf *nPrepend(
 					memcpy(n0->data, s + plen - NBUFSZ, NBUFSZ);
 				}
 				plen -= NBUFSZ;
+				n0->flags = n->flags;
 				n = n0;
 				nGET(n0);
 			} else {
@@ -191,6 +196,7 @@ NBuf *nPrepend(
 					memcpy(n0->data, s, plen);
 				}
 				plen = 0;
+				n0->flags = n->flags;
 				n = n0;
 				/*** We're done, skip the test.
 				n0 = NULL;
@@ -522,31 +528,36 @@ NBuf *nPullup(NBuf *nIn, u_int len)
 		(void)nFreeChain(nIn);
 		nIn = NULL;
 	} else {
-		/* If there's not enough space at the end, shift the data to the beginning. */
-		if (nTRAILINGSPACE(nIn) < len) {
+		/* 
+		 * If there's not enough space at the end, shift the data down only
+		 * as far as needed so that we keep as much space as we can in front
+		 * for the headers that will be prepended.
+		 */
+		if (nTRAILINGSPACE(nIn) < len - nIn->len) {
 			s = nBUFTOPTR(nIn, char *);
-			d = nIn->data = &nIn->body[0];
+			d = nIn->data = &nIn->body[NBUFSZ - len];
 			for (i = nIn->len; i > 0; i--)
 				*d++ = *s++;
 		}
-		/* Move the data in from successive buffers. */
+		/* Move the missing data in from successive buffers. */
+		len -= nIn->len;
 		nPrev = nIn;
 		nNext = nIn->nextBuf;
 		while (len && nNext) {
 			i = min(len, nNext->len);
 			memcpy(&nIn->data[nIn->len], nNext->data, i);
 			nIn->len += i;
-			/* If this emptied the buffer, free it. */
+			len -= i;
+			/* If this emptied the buffer, free it and carry on with the next. */
 			if ((nNext->len -= i) == 0) {
 				nTmp = nNext;
 				nFREE(nTmp, nNext);
 				nPrev->nextBuf = nNext;
 			} else {
 				nNext->data += i;
+				nPrev = nNext;
+				nNext = nNext->nextBuf;
 			}
-			len -= i;
-			nPrev = nNext;
-			nNext = nNext->nextBuf;
 		}
 	}
 	return nIn;
@@ -608,10 +619,11 @@ NBuf *nSplit(
 		;
 	/* If the chain breaks on the desired boundary, trivial case. */
 	else if (len == nNext->len) {
-		n1 = nNext->nextBuf;
-		nNext->nextBuf = NULL;
-		n1->chainLen = n0->chainLen - off0;
-		n0->chainLen = off0;
+		if ((n1 = nNext->nextBuf) != NULL) {
+			nNext->nextBuf = NULL;
+			n1->chainLen = n0->chainLen - off0;
+			n0->chainLen = off0;
+		}
 	}
 	/* Otherwise we need to split this next buffer. */
 	else {
@@ -623,8 +635,8 @@ NBuf *nSplit(
 			/* Move the data to the end of the new buffer to leave space for
 			 * new headers. */
 			n1->data = &n1->body[NBUFSZ - n1->len];
-			memcpy(n1->data, &n0->data[len], n1->len);
-			n0->len -= n1->len;
+			memcpy(n1->data, &nNext->data[len], n1->len);
+			nNext->len -= n1->len;
 			n1->chainLen = n0->chainLen - off0;
 			n0->chainLen = off0;
 		}
@@ -816,17 +828,25 @@ int nEnqSort(NBufQHdr *qh, NBuf *nb, u_int32 sort)
 	if (!qh || !nb)
 		st = -1;
 	else if (!qh->qHead) {
+		nb->sortOrder = sort;
 		qh->qHead = qh->qTail = nb;
 		nb->nextChain = NULL;
 		st = qh->qLen = 1;
+	} else if ((long)(sort - qh->qHead->sortOrder) < 0) {
+		nb->sortOrder = sort;
+		nb->nextChain = qh->qHead;
+		qh->qHead = nb;
+		st = ++qh->qLen;
 	} else {
 		NBuf *n0;
+		nb->sortOrder = sort;
 		/*** NOTE: Potentially long critical section. ***/
 		for(n0 = qh->qHead; 
-			n0->nextChain && (long)(sort - nb->sortOrder) >= 0;
+			n0->nextChain && (long)(sort - n0->nextChain->sortOrder) >= 0;
 			n0 = n0->nextChain)
 			;
-		nb->nextChain = n0->nextChain;
+		if ((nb->nextChain = n0->nextChain) == NULL)
+			qh->qTail = nb;
 		n0->nextChain = nb;
 		st = ++qh->qLen;
 	}
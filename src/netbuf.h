@@ -37,11 +37,12 @@
 * operations at the expense of consuming more memory.
 *
 *	This buffer structure is based on the mbuf structure in the BSD network
-* codes except that it does not support clusters, types, or flags which were
-* not needed in this stack.  Also, these are designed to be allocated from a
-* static array rather than being malloc'd to avoid the overhead of heap memory
-* management.  This design is for use in real-time embedded systems where the
-* operating parameters are known beforehand and performance is critical.
+* codes except that it does not support clusters or types which were not
+* needed in this stack and has only the flags that loopback needs.  Also,
+* these are designed to be allocated from a static array rather than being
+* malloc'd to avoid the overhead of heap memory management.  This design is
+* for use in real-time embedded systems where the operating parameters are
+* known beforehand and performance is critical.
 *
 *	To set up this buffer system, set the buffer size NBUFSZ in the header
 * file and MAXNBUFS in the program file.  NBUFSZ should be set so that
@@ -68,6 +69,9 @@
  */
 #define NBUFSZ 128				/* Max data size of an nBuf. */
 
+/* nBuf flags. */
+#define NBF_CKSUMOK 0x01		/* Checksums needn't be computed or verified. */
+
 
 /************************
 *** PUBLIC DATA TYPES ***
@@ -80,6 +84,7 @@ typedef struct NBuf_s {
 	u_int	len;				/* Bytes (octets) of data in this nBuf. */
 	u_int	chainLen;			/* Total bytes in this chain - valid on top only. */
 	u_long	sortOrder;			/* Sort order value for sorted queues. */
+	u_int	flags;				/* Buffer flags - valid on top only. */
 	char	body[NBUFSZ];		/* Data area of the nBuf. */
 } NBuf;
 
@@ -142,6 +147,7 @@ void nBufInit (void);
 		(n)->data = (n)->body; \
 		(n)->len = 0; \
 		(n)->chainLen = 0; \
+		(n)->flags = 0; \
 		if (--nBufStats.curFreeBufs.val < nBufStats.minFreeBufs.val) \
 			nBufStats.minFreeBufs.val = nBufStats.curFreeBufs.val; \
 	} \
@@ -157,6 +163,7 @@ void nBufInit (void);
 		(n)->data = (n)->body; \
 		(n)->len = 0; \
 		(n)->chainLen = 0; \
+		(n)->flags = 0; \
 		--curFreeBufs; \
 	} \
 	OS_EXIT_CRITICAL(); \
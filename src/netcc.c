@@ -0,0 +1,323 @@
+/*****************************************************************************
+* netcc.c - Network TCP Congestion Control program file.
+*
+* The authors hereby grant permission to use, copy, modify, distribute,
+* and license this software and its documentation for any purpose, provided
+* that existing copyright notices are retained in all copies and that this
+* notice and the following disclaimer are included verbatim in any
+* distributions. No written agreement, license, or royalty fee is required
+* for any of the authorized uses.
+*
+* THIS SOFTWARE IS PROVIDED BY THE CONTRIBUTORS *AS IS* AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+* IN NO EVENT SHALL THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+* NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+* THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+******************************************************************************
+* THEORY OF OPERATION
+*
+*   The modules are called with the TCB mutex held and must not block.
+* All arithmetic is done in 32 bit integers.  CUBIC keeps time in units of
+* 10 ms and limits the time since the last loss to CUBIC_MAXT so that the
+* cube fits; by then the window will have long reached the offered window.
+*
+*   The delay based module measures one round at a time.  At the end of
+* each round it estimates how many segments are queued in the network from
+* the least RTT seen in the round against the least seen on the connection
+* and adds or removes a segment to keep between DELAY_ALPHA and DELAY_BETA
+* queued.  Slow start ends as soon as more than DELAY_GAMMA are queued.
+*****************************************************************************/
+
+#include "netconf.h"
+#include "net.h"
+#include "netcc.h"
+
+
+/*************************/
+/*** LOCAL DEFINITIONS ***/
+/*************************/
+/*
+ * CUBIC parameters (RFC 8312).  C is 0.4 segments per second cubed and
+ * beta 0.7.  With t in 10 ms units, the window grows by
+ * (t - K)^3 / CUBIC_CDIV segments.
+ */
+#define CUBIC_CDIV 2500000UL		/* 1e6 / C */
+#define CUBIC_MAXT 1600				/* Most time since a loss (10 ms). */
+#define CUBIC_MAXSEGS 1700			/* Most segments K is computed for. */
+
+/*
+ * Delay based parameters in segments queued.
+ */
+#define DELAY_ALPHA 2				/* Grow below this. */
+#define DELAY_BETA 4				/* Shrink above this. */
+#define DELAY_GAMMA 1				/* Leave slow start above this. */
+
+
+/***********************************/
+/*** LOCAL FUNCTION DECLARATIONS ***/
+/***********************************/
+static void renoInit(TCPCC *cc);
+static void renoAck(TCPCC *cc, u_int32_t acked, long rtt);
+static void renoLoss(TCPCC *cc);
+static void renoRTO(TCPCC *cc);
+static void cubicInit(TCPCC *cc);
+static void cubicAck(TCPCC *cc, u_int32_t acked, long rtt);
+static void cubicLoss(TCPCC *cc);
+static void cubicRTO(TCPCC *cc);
+static void delayInit(TCPCC *cc);
+static void delayAck(TCPCC *cc, u_int32_t acked, long rtt);
+static void delayRTO(TCPCC *cc);
+static void ccGrow(TCPCC *cc, u_int32_t expand);
+static u_int32_t cubeRoot(u_int32_t n);
+
+
+/******************************/
+/*** LOCAL DATA STRUCTURES ***/
+/******************************/
+/*
+ * The modules indexed by TCPCC_ code.
+ */
+static TCPCCOps ccTable[] = {
+	{ "RENO", renoInit, renoAck, renoLoss, renoRTO },
+	{ "CUBIC", cubicInit, cubicAck, cubicLoss, cubicRTO },
+	{ "DELAY", delayInit, delayAck, renoLoss, delayRTO }
+};
+
+
+/***********************************/
+/*** PUBLIC FUNCTION DEFINITIONS ***/
+/***********************************/
+/*
+ * Return the operations for a TCPCC_ algorithm code or NULL if it's
+ * unknown.
+ */
+TCPCCOps *ccOps(int alg)
+{
+	if (alg < 0 || alg >= sizeof(ccTable) / sizeof(ccTable[0]))
+		return NULL;
+	return &ccTable[alg];
+}
+
+
+/**********************************/
+/*** LOCAL FUNCTION DEFINITIONS ***/
+/**********************************/
+/*
+ * Reno (RFC 5681).  Slow start below the threshold, then grow by about a
+ * segment per round trip.  Halve the window on a loss and drop to a
+ * single segment on a timeout.
+ */
+static void renoInit(TCPCC *cc)
+{
+	/* Reno keeps no state of its own. */
+}
+
+static void renoAck(TCPCC *cc, u_int32_t acked, long rtt)
+{
+	if (cc->cwind < cc->ssthresh)
+		/* Still doing slow start/CUTE, expand by amount acked */
+		ccGrow(cc, MIN(acked, cc->mss));
+	else
+		/* Steady-state test of extra path capacity */
+		ccGrow(cc, ((u_int32_t)cc->mss * cc->mss) / cc->cwind);
+}
+
+static void renoLoss(TCPCC *cc)
+{
+	cc->ssthresh = cc->flight / 2;
+	cc->ssthresh = MAX(cc->ssthresh, 2 * (u_int32_t)cc->mss);
+}
+
+static void renoRTO(TCPCC *cc)
+{
+	/* Reduce slowstart threshold to half current window */
+	cc->ssthresh = cc->cwind / 2;
+	cc->ssthresh = MAX(cc->ssthresh, cc->mss);
+	/* Shrink congestion window to 1 packet */
+	cc->cwind = cc->mss;
+}
+
+
+/*
+ * CUBIC (RFC 8312).  After a loss the window follows
+ * W(t) = C * (t - K)^3 + wMax, flattening out as it approaches the window
+ * at which the loss occurred and then probing beyond it, but never grows
+ * slower than Reno would have (wEst).
+ */
+static void cubicInit(TCPCC *cc)
+{
+	cc->wMax = 0;
+	cc->epochStart = 0;
+	cc->k = 0;
+	cc->wEst = 0;
+}
+
+static void cubicAck(TCPCC *cc, u_int32_t acked, long rtt)
+{
+	u_int32_t now, t, d, delta, target, segs, expand;
+
+	if (cc->cwind < cc->ssthresh) {
+		ccGrow(cc, MIN(acked, cc->mss));
+		return;
+	}
+
+	now = mtime();
+	if (cc->epochStart == 0) {
+		/* First ACK since a loss or slow start - start a new epoch. */
+		cc->epochStart = now ? now : 1;
+		cc->wEst = cc->cwind;
+		if (cc->cwind < cc->wMax) {
+			segs = (cc->wMax - cc->cwind) / cc->mss;
+			segs = MIN(segs, CUBIC_MAXSEGS);
+			cc->k = cubeRoot(segs * CUBIC_CDIV);
+		} else {
+			cc->k = 0;
+			cc->wMax = cc->cwind;
+		}
+	}
+
+	/* Where the curve will be one round trip from now. */
+	t = (now - cc->epochStart + (rtt > 0 ? rtt : 0)) / 10;
+	t = MIN(t, CUBIC_MAXT);
+	d = t > cc->k ? t - cc->k : cc->k - t;
+	delta = (d * d / 50 * d / 1000) * cc->mss / 50;
+	if (t > cc->k)
+		target = cc->wMax + delta > cc->wMax ? cc->wMax + delta : 0xFFFFFFFFUL;
+	else
+		target = cc->wMax > delta ? cc->wMax - delta : cc->mss;
+	/* Don't grow by more than half the window in a round trip. */
+	target = MIN(target, cc->cwind + cc->cwind / 2);
+
+	/* Spread the growth to the target over the window. */
+	expand = 0;
+	if (target > cc->cwind) {
+		segs = MAX(cc->cwind / cc->mss, 1);
+		expand = (target - cc->cwind) / segs;
+		expand = expand * MIN(acked, 2 * (u_int32_t)cc->mss) / cc->mss;
+	}
+
+	/* TCP friendly region - grow at least as fast as Reno with beta 0.7. */
+	cc->wEst += ((u_int32_t)cc->mss * 9 / 17) * MIN(acked, cc->cwind) / cc->cwind;
+	if (cc->wEst > cc->cwind + expand)
+		expand = cc->wEst - cc->cwind;
+
+	ccGrow(cc, expand);
+}
+
+static void cubicLoss(TCPCC *cc)
+{
+	cc->epochStart = 0;
+	/* Fast convergence - give up bandwidth to newer flows. */
+	if (cc->cwind < cc->wMax)
+		cc->wMax = cc->cwind / 20 * 17;
+	else
+		cc->wMax = cc->cwind;
+	cc->ssthresh = cc->cwind / 10 * 7;
+	cc->ssthresh = MAX(cc->ssthresh, 2 * (u_int32_t)cc->mss);
+}
+
+static void cubicRTO(TCPCC *cc)
+{
+	cubicLoss(cc);
+	cc->cwind = cc->mss;
+}
+
+
+/*
+ * Delay based (Vegas style).  The loss responses are Reno's.
+ */
+static void delayInit(TCPCC *cc)
+{
+	cc->baseRtt = 0;
+	cc->roundRtt = 0;
+	cc->roundStart = 0;
+}
+
+static void delayAck(TCPCC *cc, u_int32_t acked, long rtt)
+{
+	u_int32_t now, segs, queued;
+
+	if (rtt >= 0) {
+		if (cc->baseRtt == 0 || (u_int32_t)rtt < cc->baseRtt)
+			cc->baseRtt = MAX(rtt, 1);
+		if (cc->roundRtt == 0 || (u_int32_t)rtt < cc->roundRtt)
+			cc->roundRtt = MAX(rtt, 1);
+	}
+	if (cc->cwind < cc->ssthresh)
+		ccGrow(cc, MIN(acked, cc->mss));
+
+	now = mtime();
+	if (cc->roundStart == 0)
+		cc->roundStart = now;
+	if (cc->roundRtt == 0 || now - cc->roundStart < cc->roundRtt)
+		return;
+
+	/* End of a round - estimate the segments queued in the network. */
+	segs = MIN(cc->cwind / cc->mss, 0xFFFFUL);
+	queued = segs * MIN(cc->roundRtt - cc->baseRtt, 0xFFFFUL) / cc->roundRtt;
+	if (cc->cwind < cc->ssthresh) {
+		if (queued > DELAY_GAMMA) {
+			/* Queues are building - drop to what the path holds. */
+			cc->cwind = (segs - queued + 1) * (u_int32_t)cc->mss;
+			cc->cwind = MAX(cc->cwind, 2 * (u_int32_t)cc->mss);
+			cc->ssthresh = cc->cwind;
+		}
+	} else if (queued < DELAY_ALPHA) {
+		ccGrow(cc, cc->mss);
+	} else if (queued > DELAY_BETA && cc->cwind > 2 * (u_int32_t)cc->mss) {
+		cc->cwind -= cc->mss;
+	}
+	cc->roundStart = now;
+	cc->roundRtt = 0;
+}
+
+static void delayRTO(TCPCC *cc)
+{
+	renoRTO(cc);
+	cc->roundStart = 0;
+	cc->roundRtt = 0;
+}
+
+
+/*
+ * Expand the congestion window without overflow or going beyond the
+ * offered window.
+ */
+static void ccGrow(TCPCC *cc, u_int32_t expand)
+{
+	if (cc->cwind >= cc->sndWnd)
+		return;
+	/* Guard against arithmetic overflow */
+	if (cc->cwind + expand < cc->cwind)
+		expand = 0xFFFFFFFFUL - cc->cwind;
+
+	/* Don't expand beyond the offered window */
+	if (cc->cwind + expand > cc->sndWnd)
+		expand = cc->sndWnd - cc->cwind;
+	cc->cwind += expand;
+}
+
+/*
+ * Return the integer cube root of n.
+ */
+static u_int32_t cubeRoot(u_int32_t n)
+{
+	u_int32_t r = 0, b;
+	int s;
+
+	for (s = 30; s >= 0; s -= 3) {
+		r <<= 1;
+		b = 3 * r * (r + 1) + 1;
+		if ((n >> s) >= b) {
+			n -= b << s;
+			r++;
+		}
+	}
+	return r;
+}
@@ -0,0 +1,100 @@
+/*****************************************************************************
+* netcc.h - Network TCP Congestion Control header file.
+*
+* The authors hereby grant permission to use, copy, modify, distribute,
+* and license this software and its documentation for any purpose, provided
+* that existing copyright notices are retained in all copies and that this
+* notice and the following disclaimer are included verbatim in any
+* distributions. No written agreement, license, or royalty fee is required
+* for any of the authorized uses.
+*
+* THIS SOFTWARE IS PROVIDED BY THE CONTRIBUTORS *AS IS* AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+* IN NO EVENT SHALL THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+* NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+* THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+******************************************************************************
+* THEORY OF OPERATION
+*
+*   TCP keeps the congestion window and slow start threshold of each
+* connection in a TCPCC structure and calls the connection's congestion
+* control module through its operations table whenever new data is
+* acknowledged, a loss is detected by duplicate acknowledgements, or the
+* retransmission timer expires.  The module sets the window and threshold.
+* Fast recovery itself (window inflation and deflation) stays in TCP.
+*
+*   TCP loads the fields it maintains before each call.  The rest of the
+* structure belongs to the module and is reset by its init function when
+* the module is selected or a connection opened.
+*
+*   Reno is the original behaviour.  CUBIC (RFC 8312) grows the window as
+* a cubic function of the time since the last loss so that it regains a
+* large window quickly on long fat paths.  The delay based module is a
+* Vegas style algorithm that holds the window to a few segments more than
+* the path needs by watching the round trip time rise above its minimum
+* which keeps the queues in front of slow links short.
+*
+*****************************************************************************/
+
+#ifndef NETCC_H
+#define NETCC_H
+
+
+/************************
+*** PUBLIC DATA TYPES ***
+************************/
+/*
+ * The congestion state of a connection.
+ */
+typedef struct TCPCC_s {
+	/* Maintained by the module. */
+	u_int32_t cwind;			/* Congestion window. */
+	u_int32_t ssthresh;			/* Slow start threshold. */
+
+	/* Loaded by TCP before each call. */
+	u_int32_t sndWnd;			/* The peer's offered window. */
+	u_int32_t flight;			/* Bytes sent but not acknowledged. */
+	u_int16_t mss;				/* Maximum segment size. */
+
+	/* Private to the module. */
+	u_int32_t wMax;				/* CUBIC: window before the last loss. */
+	u_int32_t epochStart;		/* CUBIC: time the epoch began (ms) or 0. */
+	u_int32_t k;				/* CUBIC: time to regain wMax (10 ms). */
+	u_int32_t wEst;				/* CUBIC: window Reno would have. */
+	u_int32_t baseRtt;			/* Delay: least RTT seen (ms) or 0. */
+	u_int32_t roundRtt;			/* Delay: least RTT this round (ms) or 0. */
+	u_int32_t roundStart;		/* Delay: time the round began (ms). */
+} TCPCC;
+
+/*
+ * A congestion control module.
+ */
+typedef struct TCPCCOps_s {
+	char *name;					/* Name for trace messages. */
+	void (*init)				/* Reset the module's state. */
+		(TCPCC *cc);
+	void (*onAck)				/* New data acked with an RTT (ms) or -1. */
+		(TCPCC *cc, u_int32_t acked, long rtt);
+	void (*onLoss)				/* Loss detected by duplicate ACKs. */
+		(TCPCC *cc);
+	void (*onRTO)				/* Retransmission timeout. */
+		(TCPCC *cc);
+} TCPCCOps;
+
+
+/***********************
+*** PUBLIC FUNCTIONS ***
+***********************/
+/*
+ * Return the operations for a TCPCC_ algorithm code or NULL if it's
+ * unknown.
+ */
+TCPCCOps *ccOps(int alg);
+
+#endif
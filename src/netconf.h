@@ -21,7 +21,12 @@
 #define CBCP_SUPPORT	 0		/* Set > 0 for CBCP (NOT FUNCTIONAL!) */
 #define CCP_SUPPORT		 0		/* Set > 0 for CCP (NOT FUNCTIONAL!) */
 #define VJ_SUPPORT		 1		/* Set > 0 for VJ header compression. */
+#define IPHC_SUPPORT	 1		/* Set > 0 for IP header compression (needs VJ). */
 #define ECHO_SUPPORT	 0		/* Set > 0 for TCP echo service. */
+#define LQR_SUPPORT		 1		/* Set > 0 for Link Quality Reports (needs STATS). */
+#define PCAP_SUPPORT	 1		/* Set > 0 for PPP frame capture. */
+#define UDP_SUPPORT		 1		/* Set > 0 for UDP. */
+#define LOOP_SUPPORT	 1		/* Set > 0 for a loopback interface task. */
  
 
 #define OURADDR		0xAC100101	/* Local IP address - 0 to negotiate */
@@ -52,14 +57,20 @@
  *	  of living in lcp.h)
  */
 #define	PPP_MTU		512		/* Default MTU (size of Info field) */
-#ifdef XXX
-#define PPP_MAXMTU	65535 - (PPP_HDRLEN + PPP_FCSLEN)
-#else
-#define PPP_MAXMTU	512	/* Largest MTU we allow */
+/*
+ * The largest MTU/MRU that LCP will negotiate.  The default suits serial
+ * links to an ethernet attached peer.  Pty or memory links may raise these
+ * as far as 65535 - (PPP_HDRLEN + PPP_FCSLEN) but remember that the nBuf
+ * pool is sized from PPP_MAXMRU.
+ */
+#ifndef PPP_MAXMTU
+#define PPP_MAXMTU	1500	/* Largest MTU we allow */
 #endif
 #define PPP_MINMTU	64
 #define PPP_MRU		512		/* default MRU = max length of info field */
-#define PPP_MAXMRU	512		/* Largest MRU we allow */
+#ifndef PPP_MAXMRU
+#define PPP_MAXMRU	1500	/* Largest MRU we allow */
+#endif
 #define PPP_MINMRU	128
 
 #define PPP_ADDRESS(p)	(((u_char *)(p))[0])
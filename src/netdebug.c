@@ -37,6 +37,7 @@
 #include "netppp.h"
 #include "netip.h"
 #include "nettcp.h"
+#include "netudp.h"
 
 #include "netdebug.h"
 
@@ -88,7 +89,8 @@ typedef enum {
 	MONDISP_TCP,						/* Display TCP session statistics. */
 	MONDISP_IP,							/* Display IP statistics. */
 	MONDISP_PPP,						/* Display PPP session statistics. */
-	MONDISP_SERIAL						/* Display serial driver statistics. */
+	MONDISP_SERIAL,						/* Display serial driver statistics. */
+	MONDISP_UDP							/* Display UDP statistics. */
 } DisplayOptions;
 
 #define MONCMDLIST "\t\tAccu-Vote Monitor Commands\r\n\
@@ -109,7 +111,8 @@ typedef enum {
 \t  TCP     - Display TCP session statistics\r\n\
 \t  IP      - Display IP statistics\r\n\
 \t  PPP     - Display PPP session statistics\r\n\
-\t  SERIAL  - Display serial I/O statistics\r\n"
+\t  SERIAL  - Display serial I/O statistics\r\n\
+\t  UDP     - Display UDP statistics\r\n"
 
 #define TRACEMASKOPTIONS "\t\tAccu-Vote Monitor Trace Mask Options (when enabled)\r\n\
 \tUNDEF - Set trace mask for undefined modules\r\n\
@@ -119,7 +122,8 @@ typedef enum {
 \tCHAT  - Set trace mask for CHAT modem dialer\r\n\
 \tECHO   - Set trace level for ECHO service\r\n\
 \tFEEDER - Set trace level for Accu-Feed control\r\n\
-\tSCAN   - Set trace level for Accu-Vote's scanner\r\n"
+\tSCAN   - Set trace level for Accu-Vote's scanner\r\n\
+\tUDP   - Set trace mask for UDP operations\r\n"
 
 #define TRACELEVELOPTIONS "\t\tAccu-Vote Monitor Trace Mask Values\r\n\
 \tERR,1     - Log critical errors\r\n\
@@ -249,6 +253,9 @@ const TokenTable maskModuleToken[] = {
 #endif
 #if TRACESCAN > 0
 	{"SCAN",	TL_SCAN,		parseCmdArg,	traceLevelToken, TRACELEVELOPTIONS},
+#endif
+#if UDP_SUPPORT > 0
+	{"UDP",		TL_UDP,			parseCmdArg,	traceLevelToken, TRACELEVELOPTIONS},
 #endif
 	{"", 0}
 };
@@ -290,6 +297,9 @@ const TokenTable displayOptToken[] = {
 	{"IP",		MONDISP_IP,		parseEOL,	NULL},
 	{"PPP",		MONDISP_PPP,	parseEOL,	NULL},
 	{"SERIAL",	MONDISP_SERIAL,	parseEOL,	NULL},
+#if UDP_SUPPORT > 0
+	{"UDP",		MONDISP_UDP,	parseEOL,	NULL},
+#endif
 	{"", 0}
 };
 
@@ -973,6 +983,11 @@ static int monDisplay(MonitorControl *mc)
 	case MONDISP_SERIAL:				/* Display serial driver statistics. */
 		st = monSendStats(mc, (DiagStat *)&sioStats);
 		break;
+#if UDP_SUPPORT > 0
+	case MONDISP_UDP:					/* Display UDP statistics. */
+		st = monSendStats(mc, (DiagStat *)&udpStats);
+		break;
+#endif
 #endif
 	case MONDISP_MCARD:					/* Display memory card status*/
 	default:
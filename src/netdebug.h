@@ -62,6 +62,7 @@ typedef enum {
 	TL_ECHO,					/* TCP echo service. */
 	TL_FEEDER,					/* Accu-Feed */
 	TL_SCAN,					/* Scanner control. */
+	TL_UDP,						/* UDP */
 	TL_MAX						/*** Max modules - leave at end ***/
 } TraceModule;
 
@@ -113,6 +113,7 @@ static void icmpSend(
 	NBuf *opts
 );
 static u_long iptime(void);
+static u_int icmpNextMTU(IcmpHdr *icp);
 
 
 /******************************/
@@ -121,6 +122,18 @@ static u_long iptime(void);
 IcmpStats icmpStats;
 
 
+/*****************************/
+/*** LOCAL DATA STRUCTURES ***/
+/*****************************/
+/*
+ * The RFC 1191 table of common MTUs used to guess the next path MTU when
+ * a router doesn't report it.
+ */
+static const u_short mtuPlateaus[] = {
+	32000, 17914, 8166, 4352, 2002, 1492, 1006, 508, 296, 68
+};
+
+
 /***********************************/
 /*** PUBLIC FUNCTION DEFINITIONS ***/
 /***********************************/
@@ -250,7 +263,7 @@ void icmpInput(NBuf *inBuf, int ipHdrLen)
 	}
 	ip = nBUFTOPTR(inBuf, IPHdr *);
 	icp = (IcmpHdr *)(nBUFTOPTR(inBuf, char *) + ipHdrLen);
-	if (inChkSum(inBuf, icmplen, ipHdrLen)) {
+	if (!(inBuf->flags & NBF_CKSUMOK) && inChkSum(inBuf, icmplen, ipHdrLen)) {
 		icmpStats.icps_checksum++;
 		goto freeit;
 	}
@@ -326,6 +339,10 @@ void icmpInput(NBuf *inBuf, int ipHdrLen)
 		NTOHS(icp->icmp_ip.ip_len);
 		ICMPDEBUG((LOG_INFO, "icmp_input: deliver to protocol %d\n", icp->icmp_ip.ip_p));
 		icmpsrc.sin_addr = icp->icmp_ip.ip_dst;
+		
+		/* Feed fragmentation needed back to path MTU discovery. */
+		if (code == PRC_MSGSIZE)
+			ipPMTUChange(&icp->icmp_ip, icmpNextMTU(icp));
 #ifdef XXX  /* We need a method here of selecting input handlers... */
 		if (ctlfunc = inetsw[ip_protox[icp->icmp_ip.ip_p]].pr_ctlinput)
 			(*ctlfunc)(code, (struct sockaddr *)&icmpsrc,
@@ -486,11 +503,15 @@ static void icmpSend(
 	register int ipHdrLen;
 	register IcmpHdr *icp;
 
-	/* Compute the ICMP checksum on the datagram body only. */
+	/*
+	 * Compute the ICMP checksum on the datagram body only.  Looped back
+	 * messages aren't checked.
+	 */
 	ipHdrLen = ip->ip_hl << 2;
 	icp = (IcmpHdr *)(nBUFTOPTR(nb, char *) + ipHdrLen);
 	icp->icmp_cksum = 0;
-	icp->icmp_cksum = inChkSum(nb, ip->ip_len - ipHdrLen, ipHdrLen);
+	if (!ipLOCAL(ip->ip_dst.s_addr))
+		icp->icmp_cksum = inChkSum(nb, ip->ip_len - ipHdrLen, ipHdrLen);
 	ICMPDEBUG((LOG_INFO, "icmp_send %d p%d t%d c%d from %s to %s chk=%X\n", 
 				nb->len, ip->ip_p,
 				icp->icmp_type, icp->icmp_code,
@@ -521,3 +542,22 @@ static u_long iptime(void)
 	return (htonl(t));
 }
 
+
+/*
+ * icmpNextMTU - Return the next path MTU for a fragmentation needed
+ * message.  If the router didn't report one, use the next plateau below
+ * the length of the datagram that was dropped.
+ */
+static u_int icmpNextMTU(IcmpHdr *icp)
+{
+	u_int mtu = ntohs(icp->icmp_nextmtu);
+	int i;
+
+	if (mtu == 0) {
+		for (i = 0; i < sizeof(mtuPlateaus) / sizeof(mtuPlateaus[0]) - 1
+				&& mtuPlateaus[i] >= icp->icmp_ip.ip_len; i++)
+			;
+		mtu = mtuPlateaus[i];
+	}
+	return mtu;
+}
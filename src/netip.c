@@ -66,24 +66,84 @@
 #include <string.h>
 #include "net.h"
 #include "netbuf.h"
+#include "nettimer.h"
 #include "netip.h"
 #include "netiphdr.h"
+#include "netroute.h"
 
 /* The upper layer interfaces. */
 #include "nettcp.h"
+#include "nettcphd.h"
+#include "netudp.h"
 #include "neticmp.h"
 
 /* The lower layer interfaces. */
 #include "netppp.h"
+#include "netloop.h"
 
 #include <stdio.h>
 #include "netdebug.h"
 
 
+/*************************/
+/*** LOCAL DEFINITIONS ***/
+/*************************/
+/*
+ * Reassembly configuration.  The buffer space held for a datagram is
+ * counted in whole nBufs so that a flood of tiny fragments hits the caps
+ * long before it exhausts the buffer pool.
+ */
+#define IPREASS_CTXS	8				/* Datagrams being reassembled. */
+#define IPREASS_HASHSZ	8				/* Hash table size - a power of 2. */
+#define IPREASS_TTL		15				/* Seconds to wait for all fragments. */
+#define IPREASS_MAXDGRAM 4096			/* Largest datagram we reassemble. */
+#define IPREASS_CTXBYTES (IPREASS_MAXDGRAM + 8 * NBUFSZ)	/* Buffer space per datagram. */
+#define IPREASS_BYTES	(2 * IPREASS_CTXBYTES)	/* Buffer space for all datagrams. */
+#define IPREASS_RESERVE	8				/* Free nBufs we leave for everything else. */
+
+#define IPREASS_HASH(src, id) \
+	((u_int)((src) ^ ((src) >> 16) ^ (id)) & (IPREASS_HASHSZ - 1))
+
+
+/************************/
+/*** LOCAL DATA TYPES ***/
+/************************/
+/*
+ * A datagram being reassembled.  The fragments are kept without their
+ * headers in a list linked by nextChain in order of offset, with the
+ * offset in sortOrder.  The header of the first fragment is saved to
+ * head the datagram.
+ */
+typedef struct IPReass_s {
+	struct IPReass_s *next;				/* Next in hash chain or free list. */
+	u_long	src;						/* Source address. */
+	u_long	dst;						/* Destination address. */
+	u_short	id;							/* Identification. */
+	u_char	proto;						/* Protocol. */
+	u_char	hlen;						/* Saved header length - 0 until seen. */
+	u_int	total;						/* Data length - 0 until last seen. */
+	u_int	bytes;						/* Buffer space held. */
+	NBuf	*frags;						/* The fragments in order. */
+	Timer	timer;						/* Reassembly timer. */
+	char	hdr[60];					/* Header of the first fragment. */
+} IPReass;
+
+
 /***********************************/
 /*** LOCAL FUNCTION DECLARATIONS ***/
 /***********************************/
+static NBuf *ipPrepare(NBuf *nb);
 static void ipDispatch(NBuf *nb);
+static void ipDeliver(NBuf *nb);
+static u_int ipIfMTU(IfType ifType, int ifID);
+static void ipIfOutput(NBuf *nb, IfType ifType, int ifID);
+static void ipFragment(NBuf *nb, u_int mtu, IfType ifType, int ifID);
+static NBuf *ipReass(NBuf *nb);
+static NBuf *ipReassAdd(NBuf *nb);
+static IPReass *ipReassFind(IPHdr *ip);
+static void ipReassFree(IPReass *rp);
+static void ipReassTimeout(void *arg);
+static u_int ipBufSpace(NBuf *nb);
 
 
 /******************************/
@@ -94,9 +154,6 @@ IPStats		ipStats;
 #endif
 u_short		ipID;					/* IP packet ctr, for ID fields. */
 int			ip_defttl;				/* default IP ttl */
-IfType		defIfType;				/* Default route interface type. */
-int			defIfID;				/* Default route interface ID. */
-u_long		defIPAddr;				/* Default route IP address. */
 
 int	disable_defaultip;				/* Don't use hostname for default IP adrs */
 
@@ -104,6 +161,11 @@ int	disable_defaultip;				/* Don't use hostname for default IP adrs */
 /*****************************/
 /*** LOCAL DATA STRUCTURES ***/
 /*****************************/
+static IPReass ipReassTbl[IPREASS_CTXS];		/* Reassembly contexts. */
+static IPReass *ipReassHash[IPREASS_HASHSZ];	/* Hash chains of active contexts. */
+static IPReass *ipReassFreeList;				/* Free contexts. */
+static u_int ipReassBytes;						/* Buffer space held by all. */
+static OS_EVENT *ipReassMutex;					/* Guards the reassembly state. */
 
 
 /***********************************/
@@ -114,6 +176,8 @@ int	disable_defaultip;				/* Don't use hostname for default IP adrs */
  */
 void ipInit(void)
 {
+	int i;
+	
 #if STATS_SUPPORT > 0
 	memset(&ipStats, 0, sizeof(IPStats));
 	ipStats.headLine.fmtStr	    	= "\t\tIP STATISTICS\r\n";
@@ -127,14 +191,34 @@ void ipInit(void)
 	ipStats.ips_odropped.fmtStr		= "\tOTHER DROPPED  : %5lu\r\n";
 	ipStats.ips_cantforward.fmtStr	= "\tCAN'T FORWARD  : %5lu\r\n";
 	ipStats.ips_delivered.fmtStr		= "\tDELIVERED      : %5lu\r\n";
+	ipStats.ips_fragments.fmtStr		= "\tFRAGMENTS IN   : %5lu\r\n";
+	ipStats.ips_fragdropped.fmtStr	= "\tFRAGS DROPPED  : %5lu\r\n";
+	ipStats.ips_fragtimeout.fmtStr	= "\tFRAGS TIMED OUT: %5lu\r\n";
+	ipStats.ips_reassembled.fmtStr	= "\tREASSEMBLED    : %5lu\r\n";
+	ipStats.ips_ofragments.fmtStr	= "\tFRAGMENTS OUT  : %5lu\r\n";
+	ipStats.ips_cantfrag.fmtStr		= "\tCAN'T FRAGMENT : %5lu\r\n";
+	ipStats.ips_noroute.fmtStr		= "\tNO ROUTE       : %5lu\r\n";
+	ipStats.ips_pmtu.fmtStr			= "\tPMTU DECREASES : %5lu\r\n";
+	ipStats.ips_loopback.fmtStr		= "\tLOOPED BACK    : %5lu\r\n";
 #endif
+	
+	/* Put all the reassembly contexts on the free list. */
+	memset(ipReassTbl, 0, sizeof(ipReassTbl));
+	memset(ipReassHash, 0, sizeof(ipReassHash));
+	ipReassFreeList = NULL;
+	for (i = 0; i < IPREASS_CTXS; i++) {
+		timerCreate(&ipReassTbl[i].timer);
+		ipReassTbl[i].next = ipReassFreeList;
+		ipReassFreeList = &ipReassTbl[i];
+	}
+	ipReassBytes = 0;
+	ipReassMutex = OSSemCreate(1);
 
 	ipID = 1;
 	ip_defttl = IPTTLDEFAULT;
 	netMask = 0;
 	localHost = 0; /* OURADDR; */
-	defIfType = IFT_UNSPEC;
-	defIfID = 0;
+	ipRouteInit();
 	disable_defaultip = !0;
 	
 	icmpInit();
@@ -144,91 +228,58 @@ void ipInit(void)
 /*
  * ipInput - Process a raw incoming IP datagram.
  */
+#pragma argsused
 void ipInput(NBuf *inBuf, IfType ifType, int ifID)
 {
 	IPHdr	*ip;
-	u_char	hdrLen;
-	
-	/* Validate parameters. */
-	if (inBuf == NULL)
-		return;
-	
-	/* 
-	 * If we don't have a default interface, assume that this interface
-	 * is the one we want.
-	 */
-	if (defIfType == IFT_UNSPEC) {
-		defIfType = ifType;
-		defIfID = ifID;
-	}
 	
-	/* Validate IP header. */
-	STATS(ipStats.ips_total.val++;)
-	if (inBuf->len < sizeof(IPHdr) &&
-		    (inBuf = nPullup(inBuf, sizeof(IPHdr))) == NULL) {
-		STATS(ipStats.ips_toosmall.val++;)
-		IPDEBUG((LOG_ERR, TL_IP, "ipInput: Runt packet len %u", inBuf->len));
-		goto abortInput;
-	}
-	ip = nBUFTOPTR(inBuf, IPHdr *);
-	if (ip->ip_v != IPVERSION) {
-		STATS(ipStats.ips_badvers.val++;)
-		IPDEBUG((LOG_ERR, TL_IP, "ipInput: Bad version %u", ip->ip_v));
-		goto abortInput;
-	}
-	hdrLen = ip->ip_hl << 2;
-	if (hdrLen < sizeof(IPHdr)) {	/* minimum header length */
-		STATS(ipStats.ips_badhlen.val++;)
-		IPDEBUG((LOG_ERR, TL_IP, "ipInput: Bad hdr sz %u", hdrLen));
-		goto abortInput;
-	}
-	if (hdrLen > inBuf->len) {
-		if ((inBuf = nPullup(inBuf, hdrLen)) == NULL) {
-			STATS(ipStats.ips_badhlen.val++;)
-			goto abortInput;
-		}
+	if ((inBuf = ipPrepare(inBuf)) != NULL) {
 		ip = nBUFTOPTR(inBuf, IPHdr *);
+		if (ipLOCAL(ip->ip_dst.s_addr))
+			ipDeliver(inBuf);
+		else
+			ipDispatch(inBuf);
 	}
-	if ((ip->ip_sum = inChkSum(inBuf, hdrLen, 0)) != 0) {
-		STATS(ipStats.ips_badsum.val++;)
-		IPDEBUG((LOG_ERR, TL_IP, "ipInput: Bad IP chksum"));
-		goto abortInput;
-	}
-	
-	/*
-	 * Convert fields to host representation.
-	 */
-	NTOHS(ip->ip_len);
-	if (ip->ip_len < hdrLen) {
-		STATS(ipStats.ips_badlen.val++;)
-		goto abortInput;
-	}
-	NTOHS(ip->ip_id);
-	NTOHS(ip->ip_off);
+}
 
-	/*
-	 * Adjust ip_len to not reflect header.
-	 * XXX This makes it confusing since packets sent to ipRawOut()
-	 * would have a normal header but other packets would not!
-	ip->ip_len -= hdrLen;
-	 */
-	
-	/* Pass the datagram along and we're done. */
-	ipDispatch(inBuf);
-	return;
+/*
+ * ipInputBurst - Process a burst of raw incoming IP datagrams from an
+ * interface.  The TCP segments for us are passed to TCP together so that
+ * it handles each connection once per burst.
+ */
+#pragma argsused
+void ipInputBurst(NBuf *inBuf[], u_int n, IfType ifType, int ifID)
+{
+	NBuf	*tcpBuf[TCP_MAXBURST];
+	u_int	tcpCnt = 0, i;
+	IPHdr	*ip;
+	NBuf	*nb;
 	
-abortInput:
-#if DEBUG_SUPPORT > 0
-	nDumpChain(inBuf);
-#endif
-	nFreeChain(inBuf);
-	return;
+	for (i = 0; i < n; i++) {
+		if ((nb = ipPrepare(inBuf[i])) == NULL)
+			continue;
+		ip = nBUFTOPTR(nb, IPHdr *);
+		if (!ipLOCAL(ip->ip_dst.s_addr))
+			ipDispatch(nb);
+		else if (ip->ip_p != IPPROTO_TCP)
+			ipDeliver(nb);
+		else {
+			tcpBuf[tcpCnt++] = nb;
+			if (tcpCnt == TCP_MAXBURST) {
+				tcpInputBurst(tcpBuf, tcpCnt);
+				tcpCnt = 0;
+			}
+		}
+	}
+	if (tcpCnt)
+		tcpInputBurst(tcpBuf, tcpCnt);
 }
 
 /* 
  * ipSend - Build and send an IP datagram.
- * The Type-Of-Service is defaulted, we don't handle fragmentation, the
- * Time-To-Live is defaulted, and we don't support IP options.
+ * The Type-Of-Service is defaulted, the Time-To-Live is defaulted, and
+ * we don't support IP options.  Datagrams larger than the MTU are
+ * fragmented on output.
  */
 #pragma argsused
 void ipSend(
@@ -248,7 +299,7 @@ void ipSend(
 		ipHdr.ip_tos = 0;				/* Default Type-Of-Service */
 		ipHdr.ip_len = outBuf->chainLen + sizeof(IPHdr);
 		ipHdr.ip_id = IPNEWID();
-		ipHdr.ip_off = 0;				/* Sorry - no fragments. */
+		ipHdr.ip_off = 0;				/* May be fragmented. */
 		ipHdr.ip_ttl = ip_defttl;
 		ipHdr.ip_p = protocol;
 		ipHdr.ip_src.s_addr = srcAddr;
@@ -323,22 +374,25 @@ NBuf *ipOptStrip(NBuf *inBuf, u_int ipHeadLen)
 
 /*
  * ipMTU - Return the size in bytes of the Maximum Transmission Unit for the
- * given destination or zero if the destination is not reachable.
+ * given destination or zero if the destination is not reachable.  This is
+ * the smallest of the interface, route and discovered path MTUs.
  */
 u_int ipMTU(u_long dstAddr)
 {
-	u_int st;
+	Route rt;
+	u_int st, pmtu;
 	
-	if (dstAddr == htonl(localHost) || dstAddr == htonl(LOOPADDR))
-		st = NBUFSZ;
+	if (ipLOCAL(dstAddr))
+		st = ipIfMTU(IFT_LOOP, 0);
 		
-	else switch (defIfType) {
-	case IFT_PPP:
-		st = pppMTU(defIfID);
-		break;
-	default:
+	else if (ipRouteLookup(dstAddr, &rt) < 0)
 		st = 0;
-		break;
+	
+	else {
+		if ((st = ipIfMTU(rt.ifType, rt.ifID)) > rt.mtu && rt.mtu)
+			st = rt.mtu;
+		if ((pmtu = ipPMTUGet(dstAddr)) != 0 && pmtu < st)
+			st = pmtu;
 	}
 	
 	IPDEBUG((LOG_INFO, TL_IP, "ipMTU: dst %s => %u", ip_ntoa(dstAddr), st));
@@ -346,14 +400,41 @@ u_int ipMTU(u_long dstAddr)
 }
 
 /*
- * ipSetDefault - set the default route.
+ * ipPMTUChange - Lower the path MTU to a destination as reported by an
+ * ICMP fragmentation needed message and tell TCP so that it can resend
+ * with smaller segments.  The message quotes the header of the datagram
+ * that was too big followed by at least 8 bytes of its data.  A quoted
+ * TCP segment must belong to a connection or the message is ignored.
+ */
+void ipPMTUChange(struct ip *ipHdr, u_int mtu)
+{
+	u_long dstAddr = ipHdr->ip_dst.s_addr;
+	TCPHdr *tcpHdr;
+	
+	if (ipHdr->ip_p == IPPROTO_TCP) {
+		tcpHdr = (TCPHdr *)((char *)ipHdr + (ipHdr->ip_hl << 2));
+		if (!tcpPMTUValid(ipHdr->ip_src.s_addr, dstAddr,
+					tcpHdr->srcPort, tcpHdr->dstPort, ntohl(tcpHdr->seq))) {
+			IPDEBUG((LOG_WARNING, TL_IP, "ipPMTUChange: bad TCP quote for %s", 
+						ip_ntoa(dstAddr)));
+			return;
+		}
+	}
+	if (mtu < ipMTU(dstAddr)) {
+		STATS(ipStats.ips_pmtu.val++;)
+		ipPMTUSet(dstAddr, mtu);
+		tcpPMTUChange(dstAddr);
+	}
+}
+
+/*
+ * ipSetDefault - set our address and add a default route through the
+ * interface.
  */
 void ipSetDefault(u_int32_t l, u_int32_t g, IfType ifType, int ifID)
 {
 	localHost = ntohl(l);
-	defIPAddr = g;
-	defIfType = ifType;
-	defIfID = ifID;
+	ipRouteAdd(0, 0, g, ifType, ifID, 0, ROUTE_DEFMETRIC);
 	IPDEBUG((LOG_INFO, TL_IP, "ipSetDefault: %s %s %d %d",
 				ip_ntoa(l), 
 				ip_ntoa2(g),
@@ -361,13 +442,11 @@ void ipSetDefault(u_int32_t l, u_int32_t g, IfType ifType, int ifID)
 }
 
 /*
- * ipClearDefault - clear the default route.
+ * ipClearDefault - clear the default routes through all interfaces.
  */
 void ipClearDefault(void)
 {
-	defIPAddr = 0;
-	defIfType = IFT_UNSPEC;
-	defIfID = 0;
+	ipRouteDel(0, 0, IFT_UNSPEC, 0);
 	IPDEBUG((LOG_INFO, TL_IP, "ipClearDefault"));
 }
 
@@ -422,6 +501,91 @@ char *ip_htoa(u_int32_t ipaddr)
 /**********************************/
 /*** LOCAL FUNCTION DEFINITIONS ***/
 /**********************************/
+/*
+ * ipPrepare - Validate a raw incoming IP datagram and convert it to the
+ * prepared form.  Fragments for us are held until the datagram is complete.
+ * Return the prepared datagram or NULL if it was dropped or held.
+ */
+static NBuf *ipPrepare(NBuf *inBuf)
+{
+	IPHdr	*ip;
+	u_char	hdrLen;
+	
+	/* Validate parameters. */
+	if (inBuf == NULL)
+		return NULL;
+	
+	/* Validate IP header. */
+	STATS(ipStats.ips_total.val++;)
+	if (inBuf->len < sizeof(IPHdr) &&
+		    (inBuf = nPullup(inBuf, sizeof(IPHdr))) == NULL) {
+		STATS(ipStats.ips_toosmall.val++;)
+		IPDEBUG((LOG_ERR, TL_IP, "ipInput: Runt packet len %u", inBuf->len));
+		goto abortInput;
+	}
+	ip = nBUFTOPTR(inBuf, IPHdr *);
+	if (ip->ip_v != IPVERSION) {
+		STATS(ipStats.ips_badvers.val++;)
+		IPDEBUG((LOG_ERR, TL_IP, "ipInput: Bad version %u", ip->ip_v));
+		goto abortInput;
+	}
+	hdrLen = ip->ip_hl << 2;
+	if (hdrLen < sizeof(IPHdr)) {	/* minimum header length */
+		STATS(ipStats.ips_badhlen.val++;)
+		IPDEBUG((LOG_ERR, TL_IP, "ipInput: Bad hdr sz %u", hdrLen));
+		goto abortInput;
+	}
+	if (hdrLen > inBuf->len) {
+		if ((inBuf = nPullup(inBuf, hdrLen)) == NULL) {
+			STATS(ipStats.ips_badhlen.val++;)
+			goto abortInput;
+		}
+		ip = nBUFTOPTR(inBuf, IPHdr *);
+	}
+	if (!(inBuf->flags & NBF_CKSUMOK)
+			&& (ip->ip_sum = inChkSum(inBuf, hdrLen, 0)) != 0) {
+		STATS(ipStats.ips_badsum.val++;)
+		IPDEBUG((LOG_ERR, TL_IP, "ipInput: Bad IP chksum"));
+		goto abortInput;
+	}
+	
+	/*
+	 * Convert fields to host representation.
+	 */
+	NTOHS(ip->ip_len);
+	if (ip->ip_len < hdrLen) {
+		STATS(ipStats.ips_badlen.val++;)
+		goto abortInput;
+	}
+	NTOHS(ip->ip_id);
+	NTOHS(ip->ip_off);
+	
+	/* 
+	 * Hold fragments of datagrams for us until the datagram is complete.
+	 * Anything else goes to ipDispatch() to be dropped.
+	 */
+	if ((ip->ip_off & (IP_MF | IP_OFFMASK)) != 0 && ipLOCAL(ip->ip_dst.s_addr)) {
+		if ((inBuf = ipReass(inBuf)) == NULL)
+			return NULL;
+	}
+
+	/*
+	 * Adjust ip_len to not reflect header.
+	 * XXX This makes it confusing since packets sent to ipRawOut()
+	 * would have a normal header but other packets would not!
+	ip->ip_len -= hdrLen;
+	 */
+	
+	return inBuf;
+	
+abortInput:
+#if DEBUG_SUPPORT > 0
+	nDumpChain(inBuf);
+#endif
+	nFreeChain(inBuf);
+	return NULL;
+}
+
 /*
  * ipDispatch - Dispatch a "prepared" IP datagram according to it's source
  * and destination IP addresses and its protocol.
@@ -435,6 +599,8 @@ static void ipDispatch(NBuf *outBuf)
 	u_char	hdrLen		= ip->ip_hl * 4;
 	u_long	srcAddr		= ip->ip_src.s_addr;
 	u_long	dstAddr		= ip->ip_dst.s_addr;
+	Route	rt;
+	u_int	mtu;
 	
 	IPDEBUG((LOG_INFO, TL_IP, "ipDispatch: len %u proto %u to %s from %s tos %d",
 				ip->ip_len, ip->ip_p,
@@ -453,30 +619,18 @@ static void ipDispatch(NBuf *outBuf)
 		nFreeChain(outBuf);
 	}
 	
-	/* If destined for us, dispatch according to the protocol. */
-	/* 
-	 * Note: We catch the loopback address here instead of passing it
-	 * to a loopback interface so that this one dispatch function may
-	 * handle both input and output. 
+	/*
+	 * If destined for us, loop it back.  Nothing can corrupt it on the
+	 * way so it's marked to skip the checksums.  The loopback task
+	 * delivers it later so that output never recurses into input.
 	 */
-	else if (dstAddr == htonl(localHost) || dstAddr == htonl(LOOPADDR)) {
-		switch (ip->ip_p) {
-		case IPPROTO_ICMP:
-			icmpInput(outBuf, hdrLen);
-			break;
-		case IPPROTO_TCP:
-			tcpInput(outBuf, hdrLen);
-			break;
-		default:
-			IPDEBUG((LOG_ERR, TL_IP, 
-					 "ipDispatch: Dropped bad protocol %d, len %u from %s to %s",
-					 ip->ip_p,
-					 ip->ip_len,
-					 ip_ntoa(dstAddr), 
-					 ip_ntoa2(srcAddr)));
-			nFreeChain(outBuf);
-			STATS(ipStats.ips_odropped.val++;)
-		}
+	else if (ipLOCAL(dstAddr)) {
+		outBuf->flags |= NBF_CKSUMOK;
+#if LOOP_SUPPORT > 0
+		ipIfOutput(outBuf, IFT_LOOP, 0);
+#else
+		ipDeliver(outBuf);
+#endif
 	}
 	
 	/*
@@ -493,32 +647,462 @@ static void ipDispatch(NBuf *outBuf)
 		nFreeChain(outBuf);
 	}
 	
+	/* Find the interface for the longest matching route. */
+	else if (ipRouteLookup(dstAddr, &rt) < 0) {
+		IPDEBUG((LOG_ERR, TL_IP,
+				 "ipDispatch: Dropped no route len %u proto %u to %s from %s",
+				 ip->ip_len, ip->ip_p,
+				 ip_ntoa(dstAddr), 
+				 ip_ntoa2(srcAddr)));
+		STATS(ipStats.ips_noroute.val++;)
+		nFreeChain(outBuf);
+	}
+	
 	/* If we made it here, send it out. */
-	else switch (defIfType) {
+	else if ((mtu = ipIfMTU(rt.ifType, rt.ifID)) == 0) {
+		IPDEBUG((LOG_ERR, TL_IP,
+				 "ipDispatch: Dropped bad if %d.%d len %u proto %u to %s from %s", 
+				 rt.ifType, rt.ifID,
+				 ip->ip_len, ip->ip_p,
+				 ip_ntoa(dstAddr), 
+				 ip_ntoa2(srcAddr)));
+		nFreeChain(outBuf);
+		STATS(ipStats.ips_odropped.val++;)
+	} else {
+		/* A looped back chain may be reused to send elsewhere. */
+		outBuf->flags &= ~NBF_CKSUMOK;
+		if (rt.mtu && rt.mtu < mtu)
+			mtu = rt.mtu;
+		if (ip->ip_len > mtu)
+			ipFragment(outBuf, mtu, rt.ifType, rt.ifID);
+		else
+			ipIfOutput(outBuf, rt.ifType, rt.ifID);
+	}
+}
+
+/*
+ * ipDeliver - Pass a prepared datagram for us to its protocol.
+ */
+static void ipDeliver(NBuf *inBuf)
+{
+	IPHdr 	*ip			= nBUFTOPTR(inBuf, IPHdr *);
+	u_char	hdrLen		= ip->ip_hl * 4;
+	
+	switch (ip->ip_p) {
+	case IPPROTO_ICMP:
+		icmpInput(inBuf, hdrLen);
+		break;
+	case IPPROTO_TCP:
+		tcpInput(inBuf, hdrLen);
+		break;
+#if UDP_SUPPORT > 0
+	case IPPROTO_UDP:
+		udpInput(inBuf, hdrLen);
+		break;
+#endif
+	default:
+		IPDEBUG((LOG_ERR, TL_IP, 
+				 "ipDeliver: Dropped bad protocol %d, len %u from %s to %s",
+				 ip->ip_p,
+				 ip->ip_len,
+				 ip_ntoa(ip->ip_dst.s_addr), 
+				 ip_ntoa2(ip->ip_src.s_addr)));
+		nFreeChain(inBuf);
+		STATS(ipStats.ips_odropped.val++;)
+	}
+}
+
+/*
+ * ipIfMTU - Return the MTU of an interface or zero if it isn't usable.
+ */
+static u_int ipIfMTU(IfType ifType, int ifID)
+{
+	u_int st;
+	
+	switch (ifType) {
 	case IFT_PPP:
-		/* Convert fields to network representation. */
-		HTONS(ip->ip_len);
-		HTONS(ip->ip_id);
-		HTONS(ip->ip_off);
-		
-		/* Checksum the header. */
+		st = pppMTU(ifID);
+		break;
+	case IFT_LOOP:
+		st = LOOP_MTU;
+		break;
+	default:
+		st = 0;
+		break;
+	}
+	return st;
+}
+
+/*
+ * ipIfOutput - Convert a prepared datagram to network order, checksum the
+ * header and pass it to the interface.
+ */
+static void ipIfOutput(NBuf *outBuf, IfType ifType, int ifID)
+{
+	IPHdr 	*ip			= nBUFTOPTR(outBuf, IPHdr *);
+	u_char	hdrLen		= ip->ip_hl * 4;
+	
+	/* Convert fields to network representation. */
+	HTONS(ip->ip_len);
+	HTONS(ip->ip_id);
+	HTONS(ip->ip_off);
+	
+	/* Checksum the header. */
+	if (!(outBuf->flags & NBF_CKSUMOK)) {
 		ip->ip_sum = 0;
 		ip->ip_sum = inChkSum(outBuf, hdrLen, 0);
-		
-		pppOutput(defIfID, PPP_IP, outBuf);
+	}
+	
+	switch (ifType) {
+	case IFT_PPP:
+		pppOutput(ifID, PPP_IP, outBuf);
 		STATS(ipStats.ips_delivered.val++;)
 		break;
+#if LOOP_SUPPORT > 0
+	case IFT_LOOP:
+		if (loopOutput(outBuf) == 0) {
+			STATS(ipStats.ips_loopback.val++;)
+		} else {
+			STATS(ipStats.ips_odropped.val++;)
+		}
+		break;
+#endif
 	default:
-		IPDEBUG((LOG_ERR, TL_IP,
-				 "ipDispatch: Dropped bad if %d len %u proto %u to %s from %s", 
-				 defIfType,
-				 ip->ip_len, ip->ip_p,
-				 ip_ntoa(dstAddr), 
-				 ip_ntoa2(srcAddr)));
 		nFreeChain(outBuf);
 		STATS(ipStats.ips_odropped.val++;)
 		break;
 	}
 }
 
+/*
+ * ipFragment - Send a prepared datagram that is larger than the MTU as
+ * fragments.  Each fragment is split off the front of the datagram so
+ * the data buffers are reused and only the headers are copied.  We never
+ * send options that must be copied so the later fragments get just the
+ * fixed header.
+ */
+static void ipFragment(NBuf *outBuf, u_int mtu, IfType ifType, int ifID)
+{
+	IPHdr 	*ip			= nBUFTOPTR(outBuf, IPHdr *);
+	u_int	hdrLen		= ip->ip_hl * 4;
+	u_int	dataLen		= ip->ip_len - hdrLen;
+	u_int	fragLen, off;
+	IPHdr	ipHdr;
+	NBuf	*nb;
+	
+	/*
+	 * Our own datagrams are fragmented even with DF set since the link
+	 * MTU must have dropped after the transport sized them.
+	 */
+	if (ip->ip_src.s_addr == htonl(localHost))
+		ip->ip_off &= ~IP_DF;
+	
+	if ((ip->ip_off & IP_DF) || mtu < sizeof(IPHdr) + 8 || hdrLen > mtu - 8) {
+		IPDEBUG((LOG_INFO, TL_IP, "ipFragment: Can't fragment len %u to %s mtu %u", 
+					ip->ip_len, ip_ntoa(ip->ip_dst.s_addr), mtu));
+		STATS(ipStats.ips_cantfrag.val++;)
+		nFreeChain(outBuf);
+		return;
+	}
+	
+	/* Trim any padding beyond the datagram. */
+	if (nChainLen(outBuf) > ip->ip_len)
+		nTrim(NULL, &outBuf, -(int)(outBuf->chainLen - ip->ip_len));
+	
+	ipHdr = *ip;
+	ipHdr.ip_hl = sizeof(IPHdr) / 4;
+	off = 0;
+	fragLen = (mtu - hdrLen) & ~7;
+	while (outBuf) {
+		/* Split the rest of the datagram off this fragment. */
+		if (off + fragLen < dataLen) {
+			if ((nb = nSplit(outBuf, hdrLen + fragLen)) == NULL) {
+				STATS(ipStats.ips_buffers.val++;)
+				nFreeChain(outBuf);
+				return;
+			}
+			ip->ip_off = (ipHdr.ip_off + (off >> 3)) | IP_MF;
+		} else {
+			nb = NULL;
+			fragLen = dataLen - off;
+			ip->ip_off = ipHdr.ip_off + (off >> 3);
+		}
+		ip->ip_len = hdrLen + fragLen;
+		STATS(ipStats.ips_ofragments.val++;)
+		ipIfOutput(outBuf, ifType, ifID);
+		off += fragLen;
+		
+		/* Put a fixed header on the next fragment. */
+		if ((outBuf = nb) != NULL) {
+			hdrLen = sizeof(IPHdr);
+			fragLen = (mtu - hdrLen) & ~7;
+			nPREPEND(outBuf, &ipHdr, sizeof(IPHdr));
+			if (outBuf == NULL) {
+				STATS(ipStats.ips_buffers.val++;)
+				return;
+			}
+			ip = nBUFTOPTR(outBuf, IPHdr *);
+		}
+	}
+}
+
+/*
+ * ipReass - Add a fragment to its datagram.  The header is in host order
+ * and in the first buffer.  Overlapping data is trimmed from the new
+ * fragment and any fragments it completely covers are dropped.  The
+ * reassembly state is shared with the timer task so we hold
+ * ipReassMutex throughout.
+ * Return the reassembled datagram when complete, otherwise NULL.
+ */
+static NBuf *ipReass(NBuf *nb)
+{
+	NBuf	*st;
+	
+	OSSemPend(ipReassMutex, 0);
+	st = ipReassAdd(nb);
+	OSSemPost(ipReassMutex);
+	return st;
+}
 
+/*
+ * ipReassAdd - Add a fragment to its datagram with ipReassMutex held.
+ */
+static NBuf *ipReassAdd(NBuf *nb)
+{
+	IPHdr 	*ip			= nBUFTOPTR(nb, IPHdr *);
+	u_int	hdrLen		= ip->ip_hl * 4;
+	u_int	off			= (ip->ip_off & IP_OFFMASK) << 3;
+	u_int	end			= off + ip->ip_len - hdrLen;
+	u_int	space, qEnd, i;
+	IPReass	*rp;
+	NBuf	*q, *next, **pp;
+	
+	STATS(ipStats.ips_fragments.val++;)
+	
+	/* Validate the fragment and strip any padding. */
+	if (nChainLen(nb) < ip->ip_len || end > IPREASS_MAXDGRAM || end <= off
+			|| ((ip->ip_off & IP_MF) && ((end - off) & 7))) {
+		IPDEBUG((LOG_INFO, TL_IP, "ipReass: Bad fragment off %u len %u from %s", 
+					off, ip->ip_len, ip_ntoa(ip->ip_src.s_addr)));
+		goto dropFrag;
+	}
+	if (nb->chainLen > ip->ip_len)
+		nTrim(NULL, &nb, -(int)(nb->chainLen - ip->ip_len));
+	
+	/* Find or create the context. */
+	if ((rp = ipReassFind(ip)) == NULL)
+		goto dropFrag;
+	if (off == 0 && rp->hlen == 0) {
+		memcpy(rp->hdr, ip, hdrLen);
+		rp->hlen = hdrLen;
+	}
+	if (!(ip->ip_off & IP_MF)) {
+		if (rp->total != 0 && rp->total != end)
+			goto dropAll;
+		rp->total = end;
+	}
+	if (rp->total != 0 && end > rp->total)
+		goto dropAll;
+	
+	/* Keep only the data. */
+	if (nTrim(NULL, &nb, hdrLen) < hdrLen || nb == NULL)
+		goto dropFrag;
+	
+	/* Find where it goes and trim what we already have. */
+	for (q = NULL, pp = &rp->frags; *pp && (*pp)->sortOrder < off; pp = &(*pp)->nextChain)
+		q = *pp;
+	if (q && (qEnd = (u_int)q->sortOrder + q->chainLen) > off) {
+		if (qEnd >= end)
+			goto dropFrag;
+		i = qEnd - off;
+		nTrim(NULL, &nb, i);
+		off = qEnd;
+	}
+	while ((q = *pp) != NULL && q->sortOrder < end) {
+		qEnd = (u_int)q->sortOrder + q->chainLen;
+		if (qEnd <= end) {
+			/* Completely covered so drop the old one. */
+			*pp = q->nextChain;
+			space = ipBufSpace(q);
+			rp->bytes -= space;
+			ipReassBytes -= space;
+			nFreeChain(q);
+			STATS(ipStats.ips_fragdropped.val++;)
+		} else {
+			i = end - (u_int)q->sortOrder;
+			if (nTrim(NULL, &nb, -(int)i) < i || nb == NULL)
+				goto dropFrag;
+			end = (u_int)q->sortOrder;
+			break;
+		}
+	}
+	
+	/* 
+	 * Enforce the memory caps.  If all datagrams together would hold too
+	 * much, make room by dropping the others.
+	 */
+	space = ipBufSpace(nb);
+	if (rp->bytes + space > IPREASS_CTXBYTES)
+		goto dropAll;
+	for (i = 0; i < IPREASS_CTXS 
+			&& (ipReassBytes + space > IPREASS_BYTES || nBUFSFREE() < IPREASS_RESERVE); i++) {
+		if (ipReassTbl[i].frags != NULL && &ipReassTbl[i] != rp) {
+			STATS(ipStats.ips_fragdropped.val++;)
+			ipReassFree(&ipReassTbl[i]);
+		}
+	}
+	if (ipReassBytes + space > IPREASS_BYTES || nBUFSFREE() < IPREASS_RESERVE)
+		goto dropAll;
+	
+	/* Link it in. */
+	nb->sortOrder = off;
+	nb->nextChain = *pp;
+	*pp = nb;
+	rp->bytes += space;
+	ipReassBytes += space;
+	
+	/* If we have it all, put the datagram together. */
+	if (rp->hlen == 0 || rp->total == 0)
+		return NULL;
+	for (off = 0, q = rp->frags; q && q->sortOrder == off; q = q->nextChain)
+		off += q->chainLen;
+	if (off != rp->total)
+		return NULL;
+	
+	nb = rp->frags;
+	rp->frags = NULL;
+	q = nb->nextChain;
+	nb->nextChain = NULL;
+	while (q) {
+		next = q->nextChain;
+		q->nextChain = NULL;
+		nCat(nb, q);
+		q = next;
+	}
+	ip = (IPHdr *)rp->hdr;
+	ip->ip_len = rp->hlen + rp->total;
+	ip->ip_off = 0;
+	nPREPEND(nb, rp->hdr, rp->hlen);
+	ipReassFree(rp);
+	if (nb == NULL) {
+		STATS(ipStats.ips_buffers.val++;)
+		return NULL;
+	}
+	STATS(ipStats.ips_reassembled.val++;)
+	return nb;
+	
+dropAll:
+	IPDEBUG((LOG_INFO, TL_IP, "ipReass: Dropping datagram %u from %s", 
+				rp->id, ip_ntoa(rp->src)));
+	ipReassFree(rp);
+dropFrag:
+	STATS(ipStats.ips_fragdropped.val++;)
+	if (nb)
+		nFreeChain(nb);
+	return NULL;
+}
+
+/*
+ * ipReassFind - Find the reassembly context for a fragment, taking a free
+ * context if there isn't one.  If there are none free, the datagram that
+ * holds the most buffer space is dropped.
+ * Return the context or NULL if none can be found.
+ */
+static IPReass *ipReassFind(IPHdr *ip)
+{
+	u_int	h			= IPREASS_HASH(ip->ip_src.s_addr, ip->ip_id);
+	IPReass	*rp, *big;
+	u_int	i;
+	
+	for (rp = ipReassHash[h]; rp; rp = rp->next) {
+		if (rp->id == ip->ip_id && rp->src == ip->ip_src.s_addr
+				&& rp->dst == ip->ip_dst.s_addr && rp->proto == ip->ip_p)
+			return rp;
+	}
+	
+	if (ipReassFreeList == NULL) {
+		for (big = NULL, i = 0; i < IPREASS_CTXS; i++) {
+			if (big == NULL || ipReassTbl[i].bytes > big->bytes)
+				big = &ipReassTbl[i];
+		}
+		STATS(ipStats.ips_fragdropped.val++;)
+		ipReassFree(big);
+	}
+	if ((rp = ipReassFreeList) == NULL)
+		return NULL;
+	ipReassFreeList = rp->next;
+	
+	rp->src = ip->ip_src.s_addr;
+	rp->dst = ip->ip_dst.s_addr;
+	rp->id = ip->ip_id;
+	rp->proto = ip->ip_p;
+	rp->hlen = 0;
+	rp->total = 0;
+	rp->bytes = 0;
+	rp->frags = NULL;
+	rp->next = ipReassHash[h];
+	ipReassHash[h] = rp;
+	timerSeconds(&rp->timer, IPREASS_TTL, ipReassTimeout, rp);
+	
+	return rp;
+}
+
+/*
+ * ipReassFree - Drop a datagram's fragments and free its context.
+ */
+static void ipReassFree(IPReass *rp)
+{
+	IPReass **rpp;
+	NBuf *q, *next;
+	
+	timerClear(&rp->timer);
+	for (rpp = &ipReassHash[IPREASS_HASH(rp->src, rp->id)]; *rpp; rpp = &(*rpp)->next) {
+		if (*rpp == rp) {
+			*rpp = rp->next;
+			rp->next = ipReassFreeList;
+			ipReassFreeList = rp;
+			break;
+		}
+	}
+	for (q = rp->frags; q; q = next) {
+		next = q->nextChain;
+		nFreeChain(q);
+	}
+	rp->frags = NULL;
+	ipReassBytes -= rp->bytes;
+	rp->bytes = 0;
+}
+
+/*
+ * ipReassTimeout - The function invoked when a datagram has waited too
+ * long for its fragments.
+ */
+static void ipReassTimeout(void *arg)
+{
+	IPReass *rp = (IPReass *)arg;
+	
+	/* 
+	 * The context may have been reused with its timer set again while we
+	 * waited for the lock.  Freeing a free context does nothing.
+	 */
+	OSSemPend(ipReassMutex, 0);
+	if (!timerPending(&rp->timer)) {
+		IPDEBUG((LOG_INFO, TL_IP, "ipReassTimeout: Dropping datagram %u from %s", 
+					rp->id, ip_ntoa(rp->src)));
+		STATS(ipStats.ips_fragtimeout.val++;)
+		ipReassFree(rp);
+	}
+	OSSemPost(ipReassMutex);
+}
+
+/*
+ * ipBufSpace - Return the buffer space held by a chain.
+ */
+static u_int ipBufSpace(NBuf *nb)
+{
+	u_int st = 0;
+	
+	for (; nb; nb = nb->nextBuf)
+		st += NBUFSZ;
+	return st;
+}
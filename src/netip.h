@@ -36,6 +36,7 @@
 /*************************
 *** PUBLIC DEFINITIONS ***
 *************************/
+#define IP_MAXBURST 8			/* Datagrams an interface passes per burst. */
 
 
 /************************
@@ -53,6 +54,15 @@ typedef struct {
 	DiagStat ips_buffers;
 	DiagStat ips_cantforward;
 	DiagStat ips_delivered;
+	DiagStat ips_fragments;		/* Fragments received. */
+	DiagStat ips_fragdropped;	/* Fragments dropped. */
+	DiagStat ips_fragtimeout;	/* Datagrams timed out in reassembly. */
+	DiagStat ips_reassembled;	/* Datagrams reassembled. */
+	DiagStat ips_ofragments;	/* Fragments sent. */
+	DiagStat ips_cantfrag;		/* Datagrams dropped needing fragmentation. */
+	DiagStat ips_noroute;		/* Datagrams dropped without a route. */
+	DiagStat ips_pmtu;			/* Path MTU decreases. */
+	DiagStat ips_loopback;		/* Datagrams sent through loopback. */
 	DiagStat endRec;
 } IPStats;
 
@@ -65,9 +75,6 @@ extern u_short		ipID;		/* IP datagram ctr, for ID fields. */
 extern IPStats		ipStats;     /* IP statistics. */
 #endif
 extern int			ip_defttl;	/* default IP ttl */
-extern IfType		defIfType;	/* Default route interface type. */
-extern int			defIfID;	/* Default route interface ID. */
-extern u_long		defIPAddr;	/* Default route IP address. */
 
 extern int	disable_defaultip;	/* Don't use hostname for default IP adrs */
 
@@ -85,10 +92,17 @@ void ipInit(void);
  */
 void ipInput(NBuf *mb, IfType ifType, int ifID);
 
+/*
+ * ipInputBurst - Process a burst of raw incoming IP datagrams from an
+ * interface.  TCP handles each connection once per burst.
+ */
+void ipInputBurst(NBuf *inBuf[], u_int n, IfType ifType, int ifID);
+
 /* 
  * ipSend - Build and send an IP datagram.
- * The Type-Of-Service is defaulted, we don't handle fragmentation, the
- * Time-To-Live is defaulted, and we don't support IP options.
+ * The Type-Of-Service is defaulted, the Time-To-Live is defaulted, and
+ * we don't support IP options.  Datagrams larger than the MTU are
+ * fragmented on output.
  */
 void ipOutput(u_char protocol, NBuf *outBuf);
 
@@ -123,12 +137,20 @@ NBuf *ipOptStrip(NBuf *inBuf, u_int ipHeadLen);
 u_int ipMTU(u_long dstAddr);
 
 /*
- * ipSetDefault - set the default route.
+ * ipPMTUChange - Lower the path MTU to a destination as reported by an
+ * ICMP fragmentation needed message quoting the given header.
+ */
+struct ip;
+void ipPMTUChange(struct ip *ipHdr, u_int mtu);
+
+/*
+ * ipSetDefault - set our address and add a default route through the
+ * interface.
  */
 void ipSetDefault(u_int32_t l, u_int32_t g, IfType ifType, int ifID);
 
 /*
- * ipClearDefault - clear the default route.
+ * ipClearDefault - clear the default routes through all interfaces.
  */
 void ipClearDefault(void);
 
@@ -147,5 +169,11 @@ char *ip_htoa(u_int32_t ipaddr);
  */
 #define IPNEWID() (ipID++)
 
+/*
+ * ipLOCAL - Return true if an address in network byte order is ours.
+ * Datagrams to these are looped back without checksums.
+ */
+#define ipLOCAL(a) ((a) == htonl(localHost) || (a) == htonl(LOOPADDR))
+
 
 #endif
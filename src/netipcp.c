@@ -56,6 +56,9 @@
 #include "netfsm.h"
 #include "netiphdr.h"		/* Required for netvj.h. */
 #include "netvj.h"
+#if IPHC_SUPPORT > 0
+#include "netiphc.h"
+#endif
 #include "netipcp.h"
 
 #include <stdio.h>
@@ -75,6 +78,7 @@
 #define CILEN_VJ	6	/* length for RFC1332 Van-Jacobson opt. */
 #define CILEN_ADDR	6	/* new-style single address option */
 #define CILEN_ADDRS	10	/* old-style dual address option */
+#define CILEN_IPHC	14	/* RFC2509 IPHC opt. without suboptions */
 
 
 
@@ -209,6 +213,14 @@ static void ipcp_init(int unit)
 	wo->vj_protocol = IPCP_VJ_COMP;
 	wo->maxslotindex = MAX_SLOTS - 1;
 	wo->cflag = 0;
+#if IPHC_SUPPORT > 0
+	wo->neg_iphc = 1;
+	wo->tcp_space = MAX_SLOTS - 1;
+	wo->non_tcp_space = IPHC_CONTEXTS - 1;
+	wo->f_max_period = IPHC_FMAXPERIOD;
+	wo->f_max_time = IPHC_FMAXTIME;
+	wo->max_header = IPHC_MAXHDR;
+#endif
 	
 	wo->default_route = 1;
 	
@@ -220,6 +232,9 @@ static void ipcp_init(int unit)
 #endif
 	ao->maxslotindex = MAX_SLOTS - 1;
 	ao->cflag = 1;
+#if IPHC_SUPPORT > 0
+	ao->neg_iphc = 1;
+#endif
 	
 	ao->default_route = 1;
 }
@@ -294,6 +309,9 @@ static void ipcp_resetci(fsm *f)
 	if (wo->hisaddr == 0)
 		wo->accept_remote = 1;
 	ipcp_gotoptions[f->unit] = *wo;
+	/* Ask for IP header compression first and fall back to VJ. */
+	if (wo->neg_iphc)
+		ipcp_gotoptions[f->unit].neg_vj = 0;
 	cis_received[f->unit] = 0;
 }
 
@@ -309,6 +327,7 @@ static int ipcp_cilen(fsm *f)
 	
 #define LENCIVJ(neg, old)	(neg ? (old? CILEN_COMPRESS : CILEN_VJ) : 0)
 #define LENCIADDR(neg, old)	(neg ? (old? CILEN_ADDRS : CILEN_ADDR) : 0)
+#define LENCIIPHC(neg)		(neg ? CILEN_IPHC : 0)
 	
 	/*
 	 * First see if we want to change our options to the old
@@ -319,7 +338,7 @@ static int ipcp_cilen(fsm *f)
 		go->neg_addr = 1;
 		go->old_addrs = 1;
 	}
-	if (wo->neg_vj && !go->neg_vj && !go->old_vj) {
+	if (wo->neg_vj && !go->neg_vj && !go->old_vj && !go->neg_iphc) {
 		/* try an older style of VJ negotiation */
 		if (cis_received[f->unit] == 0) {
 			/* keep trying the new style until we see some CI from the peer */
@@ -335,6 +354,7 @@ static int ipcp_cilen(fsm *f)
 	}
 	
 	return (LENCIADDR(go->neg_addr, go->old_addrs)
+			+ LENCIIPHC(go->neg_iphc)
 			+ LENCIVJ(go->neg_vj, go->old_vj));
 }
 
@@ -363,6 +383,22 @@ static void ipcp_addci(fsm *f, u_char *ucp, int *lenp)
 			neg = 0; \
 	}
 	
+#define ADDCIIPHC(opt, neg, o) \
+	if (neg) { \
+		if (len >= CILEN_IPHC) { \
+			PUTCHAR(opt, ucp); \
+			PUTCHAR(CILEN_IPHC, ucp); \
+			PUTSHORT(IPCP_IPHC, ucp); \
+			PUTSHORT((o)->tcp_space, ucp); \
+			PUTSHORT((o)->non_tcp_space, ucp); \
+			PUTSHORT((o)->f_max_period, ucp); \
+			PUTSHORT((o)->f_max_time, ucp); \
+			PUTSHORT((o)->max_header, ucp); \
+			len -= CILEN_IPHC; \
+		} else \
+			neg = 0; \
+	}
+	
 #define ADDCIADDR(opt, neg, old, val1, val2) \
 	if (neg) { \
 		int addrlen = (old? CILEN_ADDRS: CILEN_ADDR); \
@@ -384,6 +420,8 @@ static void ipcp_addci(fsm *f, u_char *ucp, int *lenp)
 	ADDCIADDR((go->old_addrs? CI_ADDRS: CI_ADDR), go->neg_addr,
 			  go->old_addrs, go->ouraddr, go->hisaddr);
 	
+	ADDCIIPHC(CI_COMPRESSTYPE, go->neg_iphc, go);
+	
 	ADDCIVJ(CI_COMPRESSTYPE, go->neg_vj, go->vj_protocol, go->old_vj,
 			go->maxslotindex, go->cflag);
 	
@@ -434,6 +472,35 @@ static int ipcp_ackci(fsm *f, u_char *p, int len)
 		} \
 	}
 	
+#define ACKCIIPHC(opt, neg, o) \
+	if (neg) { \
+		if ((len -= CILEN_IPHC) < 0) \
+			goto bad; \
+		GETCHAR(citype, p); \
+		GETCHAR(cilen, p); \
+		if (cilen != CILEN_IPHC || \
+				citype != opt) \
+			goto bad; \
+		GETSHORT(cishort, p); \
+		if (cishort != IPCP_IPHC) \
+			goto bad; \
+		GETSHORT(cishort, p); \
+		if (cishort != (o)->tcp_space) \
+			goto bad; \
+		GETSHORT(cishort, p); \
+		if (cishort != (o)->non_tcp_space) \
+			goto bad; \
+		GETSHORT(cishort, p); \
+		if (cishort != (o)->f_max_period) \
+			goto bad; \
+		GETSHORT(cishort, p); \
+		if (cishort != (o)->f_max_time) \
+			goto bad; \
+		GETSHORT(cishort, p); \
+		if (cishort != (o)->max_header) \
+			goto bad; \
+	}
+	
 #define ACKCIADDR(opt, neg, old, val1, val2) \
 	if (neg) { \
 		int addrlen = (old? CILEN_ADDRS: CILEN_ADDR); \
@@ -460,6 +527,8 @@ static int ipcp_ackci(fsm *f, u_char *p, int len)
 	ACKCIADDR((go->old_addrs? CI_ADDRS: CI_ADDR), go->neg_addr,
 			  go->old_addrs, go->ouraddr, go->hisaddr);
 	
+	ACKCIIPHC(CI_COMPRESSTYPE, go->neg_iphc, go);
+	
 	ACKCIVJ(CI_COMPRESSTYPE, go->neg_vj, go->vj_protocol, go->old_vj,
 			go->maxslotindex, go->cflag);
 	
@@ -487,9 +556,10 @@ bad:
 static int ipcp_nakci(fsm *f, u_char *p, int len)
 {
 	ipcp_options *go = &ipcp_gotoptions[f->unit];
+	ipcp_options *wo = &ipcp_wantoptions[f->unit];
 	u_char cimaxslotindex, cicflag;
 	u_char citype, cilen, *next;
-	u_short cishort;
+	u_short cishort, cispace, cinonspace, ciperiod, citime, cimaxhdr;
 	u_int32_t ciaddr1, ciaddr2, l;
 	ipcp_options no;		/* options we've seen Naks for */
 	ipcp_options try;		/* options to request next time */
@@ -521,6 +591,20 @@ static int ipcp_nakci(fsm *f, u_char *p, int len)
 		code \
 	}
 	
+#define NAKCIIPHC(opt, neg, code) \
+	if (go->neg && \
+			(cilen = p[1]) >= CILEN_COMPRESS && \
+			len >= cilen && \
+			p[0] == opt) { \
+		len -= cilen; \
+		next = p + cilen; \
+		INCPTR(2, p); \
+		GETSHORT(cishort, p); \
+		no.neg = 1; \
+		code \
+		p = next; \
+	}
+	
 #define NAKCIVJ(opt, neg, code) \
 	if (go->neg && \
 			((cilen = p[1]) == CILEN_COMPRESS || cilen == CILEN_VJ) && \
@@ -550,6 +634,31 @@ static int ipcp_nakci(fsm *f, u_char *p, int len)
 	  }
 	);
 	
+	/*
+	 * Accept the peer's IPHC context spaces and header size if smaller
+	 * than we asked for and its refresh limits.  If the peer wants
+	 * another compression protocol, fall back to VJ.
+	 */
+	NAKCIIPHC(CI_COMPRESSTYPE, neg_iphc,
+		if (cishort == IPCP_IPHC && cilen == CILEN_IPHC) {
+			GETSHORT(cispace, p);
+			GETSHORT(cinonspace, p);
+			GETSHORT(ciperiod, p);
+			GETSHORT(citime, p);
+			GETSHORT(cimaxhdr, p);
+			try.tcp_space = MIN(cispace, go->tcp_space);
+			try.non_tcp_space = MIN(cinonspace, go->non_tcp_space);
+			if (ciperiod)
+				try.f_max_period = ciperiod;
+			if (citime)
+				try.f_max_time = citime;
+			try.max_header = MIN(cimaxhdr, go->max_header);
+		} else {
+			try.neg_iphc = 0;
+			try.neg_vj = wo->neg_vj;
+		}
+	);
+	
 	/*
 	 * Accept the peer's value of maxslotindex provided that it
 	 * is less than what we asked for.  Turn off slot-ID compression
@@ -594,8 +703,9 @@ static int ipcp_nakci(fsm *f, u_char *p, int len)
 		
 		switch (citype) {
 		case CI_COMPRESSTYPE:
-			if (go->neg_vj || no.neg_vj ||
-					(cilen != CILEN_VJ && cilen != CILEN_COMPRESS))
+			if (go->neg_vj || no.neg_vj || go->neg_iphc || no.neg_iphc ||
+					(cilen != CILEN_VJ && cilen != CILEN_COMPRESS
+						&& cilen < CILEN_IPHC))
 				goto bad;
 			no.neg_vj = 1;
 			break;
@@ -655,6 +765,7 @@ bad:
 static int ipcp_rejci(fsm *f, u_char *p, int len)
 {
 	ipcp_options *go = &ipcp_gotoptions[f->unit];
+	ipcp_options *wo = &ipcp_wantoptions[f->unit];
 	u_char cimaxslotindex, ciflag, cilen;
 	u_short cishort;
 	u_int32_t cilong;
@@ -689,6 +800,22 @@ static int ipcp_rejci(fsm *f, u_char *p, int len)
 		try.neg = 0; \
 	}
 	
+#define REJCIIPHC(opt, neg, o) \
+	if (go->neg && \
+			p[1] == CILEN_IPHC && \
+			len >= p[1] && \
+			p[0] == opt) { \
+		len -= p[1]; \
+		INCPTR(2, p); \
+		GETSHORT(cishort, p); \
+		/* Check rejected value. */  \
+		if (cishort != IPCP_IPHC) \
+			goto bad; \
+		INCPTR(CILEN_IPHC - 4, p); \
+		try.neg = 0; \
+		try.neg_vj = wo->neg_vj; \
+	}
+	
 #define REJCIVJ(opt, neg, val, old, maxslot, cflag) \
 	if (go->neg && \
 			p[1] == (old? CILEN_COMPRESS : CILEN_VJ) && \
@@ -714,6 +841,8 @@ static int ipcp_rejci(fsm *f, u_char *p, int len)
 	REJCIADDR((go->old_addrs? CI_ADDRS: CI_ADDR), neg_addr,
 			  go->old_addrs, go->ouraddr, go->hisaddr);
 	
+	REJCIIPHC(CI_COMPRESSTYPE, neg_iphc, go);
+	
 	REJCIVJ(CI_COMPRESSTYPE, neg_vj, go->vj_protocol, go->old_vj,
 			go->maxslotindex, go->cflag);
 	
@@ -950,6 +1079,25 @@ static int ipcp_reqci(
 			break;
 		
 		case CI_COMPRESSTYPE:
+			if (cilen >= CILEN_COMPRESS && (p[0] << 8 | p[1]) == IPCP_IPHC) {
+				if (!ao->neg_iphc || cilen != CILEN_IPHC) {
+					IPCPDEBUG((LOG_INFO, "ipcp_reqci: Rejecting IPHC len=%d", cilen));
+					orc = CONFREJ;
+					break;
+				}
+				INCPTR(2, p);
+				ho->neg_iphc = 1;
+				GETSHORT(ho->tcp_space, p);
+				GETSHORT(ho->non_tcp_space, p);
+				GETSHORT(ho->f_max_period, p);
+				GETSHORT(ho->f_max_time, p);
+				GETSHORT(ho->max_header, p);
+				IPCPDEBUG((LOG_INFO, 
+							"ipcp_reqci: received IPHC tcp=%d non-tcp=%d period=%d time=%d max=%d",
+							ho->tcp_space, ho->non_tcp_space, ho->f_max_period,
+							ho->f_max_time, ho->max_header));
+				break;
+			}
 			if (!ao->neg_vj) {
 				IPCPDEBUG((LOG_INFO, "ipcp_reqci: Rejecting COMPRESSTYPE not allowed"));
 				orc = CONFREJ;
@@ -1130,6 +1278,8 @@ static void ipcp_up(fsm *f)
 	
 	/* set tcp compression */
 	sifvjcomp(f->unit, ho->neg_vj, ho->cflag, ho->maxslotindex);
+	sifiphc(f->unit, ho->neg_iphc, go->neg_iphc, ho->tcp_space, ho->non_tcp_space,
+			ho->f_max_period, ho->f_max_time, ho->max_header);
 	
 	/*
 	 * Set IP addresses and (if specified) netmask.
@@ -1181,6 +1331,7 @@ static void ipcp_down(fsm *f)
 	IPCPDEBUG((LOG_INFO, "ipcp: down"));
 	np_down(f->unit, PPP_IP);
 	sifvjcomp(f->unit, 0, 0, 0);
+	sifiphc(f->unit, 0, 0, 0, 0, 0, 0, 0);
 	
 	sifdown(f->unit);
 	ipcp_clear_addrs(f->unit);
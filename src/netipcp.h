@@ -73,6 +73,7 @@
 
 #define IPCP_VJ_COMP 0x002d		/* current value for VJ compression option*/
 #define IPCP_VJ_COMP_OLD 0x0037	/* "old" (i.e, broken) value for VJ */
+#define IPCP_IPHC 0x0061		/* IP header compression (RFC 2509) */
 								/* compression option*/ 
 
 
@@ -90,9 +91,15 @@ typedef struct ipcp_options {
     int old_vj : 1;				/* use old (short) form of VJ option? */
     int accept_local : 1;		/* accept peer's value for ouraddr */
     int accept_remote : 1;		/* accept peer's value for hisaddr */
+    int neg_iphc : 1;			/* IP Header Compression (in place of VJ)? */
     u_short vj_protocol;		/* protocol value to use in VJ option */
     u_char maxslotindex;		/* VJ slots - 1. */
     u_char cflag;				/* VJ slot compression flag. */
+    u_short tcp_space;			/* IPHC largest TCP context ID. */
+    u_short non_tcp_space;		/* IPHC largest non-TCP context ID. */
+    u_short f_max_period;		/* IPHC max packets between full headers. */
+    u_short f_max_time;			/* IPHC max seconds between full headers. */
+    u_short max_header;			/* IPHC largest compressible header. */
     u_int32_t ouraddr, hisaddr;	/* Addresses in NETWORK BYTE ORDER */
     u_int32_t dnsaddr[2];		/* Primary and secondary MS DNS entries */
     u_int32_t winsaddr[2];		/* Primary and secondary MS WINS entries */
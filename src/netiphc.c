@@ -0,0 +1,588 @@
+/*****************************************************************************
+* netiphc.c - IP Header Compression (RFC 2507/2509) program file.
+*
+* The authors hereby grant permission to use, copy, modify, distribute,
+* and license this software and its documentation for any purpose, provided
+* that existing copyright notices are retained in all copies and that this
+* notice and the following disclaimer are included verbatim in any
+* distributions. No written agreement, license, or royalty fee is required
+* for any of the authorized uses.
+*
+* THIS SOFTWARE IS PROVIDED BY THE CONTRIBUTORS *AS IS* AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+* IN NO EVENT SHALL THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+* NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+* THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+******************************************************************************
+* THEORY OF OPERATION
+*
+*   Headers are handled as byte arrays in network order.  A full header
+* packet is the original packet with the generation and context ID in
+* place of the IP total length:
+*
+*	non-TCP:	1 0 Generation(6)	CID(8)
+*	TCP:		0 0 0 0 0 0 0 0		CID(8)
+*
+* A compressed non-TCP header is the context ID, the generation, the IP
+* identification and, if the context's UDP checksum is in use, the UDP
+* checksum.  Everything else comes from the context or the frame length.
+*
+*   A COMPRESSED_TCP_NODELTA header has the COMPRESSED_TCP layout but each
+* field flagged in the mask is sent whole: urgent pointer 2, window 2,
+* ack 4, sequence 4 and IP identification 2 octets.  It is rebuilt by
+* loading the whole values into the receive state and handing the VJ code
+* an equivalent compressed header with no deltas.
+*
+*   We send CONTEXT_STATE only for TCP (type 3) as a count and a list of
+* 8 bit CIDs.  When we receive one, all TCP contexts are refreshed.
+*
+*   16 bit context IDs, the delta list (D bit), random fields (R bit) and
+* TCP options (O bit) are never sent and received packets using them are
+* dropped.
+*
+*****************************************************************************/
+
+#include "netconf.h"
+#include <string.h>
+#include "net.h"
+#include "netbuf.h"
+#include "netiphdr.h"
+#include "nettcphd.h"
+#include "netvj.h"
+#include "netiphc.h"
+
+#include <stdio.h>
+#include "netdebug.h"
+
+
+#if IPHC_SUPPORT > 0
+
+#if VJ_SUPPORT == 0
+#error "IPHC_SUPPORT requires VJ_SUPPORT for TCP compression."
+#endif
+
+/*************************/
+/*** LOCAL DEFINITIONS ***/
+/*************************/
+#if STATS_SUPPORT > 0
+#define INCR(counter) ++comp->stats.counter.val
+#else
+#define INCR(counter)
+#endif
+
+/* Byte offsets into the headers. */
+#define IPO_LEN		2				/* IP total length. */
+#define IPO_ID		4				/* IP identification. */
+#define IPO_OFF		6				/* IP flags and fragment offset. */
+#define IPO_TTL		8				/* IP time to live. */
+#define IPO_PROTO	9				/* IP protocol. */
+#define IPO_SUM		10				/* IP header checksum. */
+#define IPO_SRC		12				/* IP source address. */
+#define UDPO_LEN	4				/* UDP length. */
+#define UDPO_SUM	6				/* UDP checksum. */
+#define UDPHDRLEN	8
+
+#define FH_NONTCP	0x80			/* Full header is non-TCP. */
+#define FH_CID16	0x40			/* Full header has a 16 bit CID. */
+#define CH_CID16	0x80			/* Compressed header has a 16 bit CID. */
+#define CH_DELTA	0x40			/* Compressed header has a delta list. */
+#define GENMASK		0x3F
+#define TCP_RANDOM	0x80			/* Compressed TCP has random fields. */
+#define CTX_TCP		3				/* CONTEXT_STATE type for TCP CIDs. */
+
+
+/***********************************/
+/*** LOCAL FUNCTION DECLARATIONS ***/
+/***********************************/
+static void iphcSetLen(NBuf *nb, u_int ipHlen, u_int len);
+static void iphcTcpLost(IPHCComp *comp, u_int cid);
+
+
+/***********************************/
+/*** PUBLIC FUNCTION DEFINITIONS ***/
+/***********************************/
+/*
+ * iphc_init - Initialize the compression state for a link.
+ */
+void iphc_init(IPHCComp *comp)
+{
+	memset(comp, 0, sizeof(*comp));
+	comp->fMaxPeriod = IPHC_FMAXPERIOD;
+	comp->fMaxTime = IPHC_FMAXTIME;
+	comp->maxHeader = IPHC_MAXHEADER;
+
+#if STATS_SUPPORT > 0
+	comp->stats.headLine.fmtStr	= "\t\tIPHC STATISTICS\r\n";
+	comp->stats.fullOut.fmtStr	= "\tFULL OUT    : %5lu\r\n";
+	comp->stats.compOut.fmtStr	= "\tCOMP OUT    : %5lu\r\n";
+	comp->stats.fullIn.fmtStr	= "\tFULL IN     : %5lu\r\n";
+	comp->stats.compIn.fmtStr	= "\tCOMP IN     : %5lu\r\n";
+	comp->stats.errorIn.fmtStr	= "\tERRORS IN   : %5lu\r\n";
+	comp->stats.ctxStateOut.fmtStr	= "\tCTX STATE   : %5lu\r\n";
+#endif
+}
+
+/*
+ * iphc_compress - Attempt to compress an IP packet whose header is in the
+ * first buffer.  TCP is passed to the VJ compressor and the result
+ * translated to the IPHC formats.
+ * Return the PPP protocol to send it with.
+ */
+u_int iphc_compress(IPHCComp *comp, struct vjcompress *vj, NBuf *nb)
+{
+	u_char *hp = nBUFTOPTR(nb, u_char *);
+	u_int ipHlen, hlen, clen, skip, nCtx, i;
+	u_char udp, changed, idHi, idLo, sumHi, sumLo;
+	IPHCContext *ctx, *victim;
+	u_char *cp;
+
+	if (nb->len < sizeof(IPHdr) || (hp[0] & 0xF0) != 0x40
+			|| (hp[IPO_OFF] & 0x3F) || hp[IPO_OFF + 1])
+		return PPP_IP;
+
+	/* 
+	 * TCP uses the VJ compressor with the CID always present and its
+	 * slots limited to the peer's TCP_SPACE.
+	 */
+	if (hp[IPO_PROTO] == IPPROTO_TCP) {
+		switch (vj_compress_tcp(vj, nb)) {
+		case TYPE_UNCOMPRESSED_TCP:
+			/* Move the CID from the protocol field to the length field. */
+			hp[IPO_LEN] = 0;
+			hp[IPO_LEN + 1] = hp[IPO_PROTO];
+			hp[IPO_PROTO] = IPPROTO_TCP;
+			INCR(fullOut);
+			return PPP_FULLHDR;
+		case TYPE_COMPRESSED_TCP:
+			*nBUFTOPTR(nb, u_char *) &= ~NEW_C;
+			return PPP_COMPTCP;
+		default:
+			return PPP_IP;
+		}
+	}
+
+	ipHlen = (hp[0] & 0x0F) << 2;
+	udp = (hp[IPO_PROTO] == IPPROTO_UDP);
+	hlen = ipHlen + (udp ? UDPHDRLEN : 0);
+	if (hlen > nb->len || hlen > IPHC_MAXHDR || hlen > comp->maxHeader)
+		return PPP_IP;
+
+	/*
+	 * Find the context by addresses, protocol and ports, otherwise take
+	 * an unused or the least recently used context.
+	 */
+	nCtx = MIN(IPHC_CONTEXTS, comp->nonTcpSpace + 1);
+	victim = NULL;
+	for (i = 0, ctx = comp->tctx; i < nCtx; i++, ctx++) {
+		if (ctx->hlen == 0) {
+			if (victim == NULL || victim->hlen != 0)
+				victim = ctx;
+		} else if (ctx->hdr[IPO_PROTO] == hp[IPO_PROTO]
+				&& !memcmp(&ctx->hdr[IPO_SRC], &hp[IPO_SRC], 8)
+				&& (!udp || !memcmp(&ctx->hdr[ipHlen], &hp[ipHlen], 4)))
+			break;
+		else if (victim == NULL
+				|| (victim->hlen != 0 && ctx->lastUse < victim->lastUse))
+			victim = ctx;
+	}
+	if (i >= nCtx) {
+		ctx = victim;
+		i = (u_int)(ctx - comp->tctx);
+		changed = 1;
+	} else {
+		/* Any change to a field we don't send needs a new generation. */
+		changed = (ctx->hlen != hlen
+				|| ctx->hdr[0] != hp[0] || ctx->hdr[1] != hp[1]
+				|| ctx->hdr[IPO_OFF] != hp[IPO_OFF]
+				|| ctx->hdr[IPO_TTL] != hp[IPO_TTL]
+				|| memcmp(&ctx->hdr[sizeof(IPHdr)], &hp[sizeof(IPHdr)],
+						ipHlen - sizeof(IPHdr))
+				|| (udp && ((ctx->hdr[ipHlen + UDPO_SUM] | ctx->hdr[ipHlen + UDPO_SUM + 1]) == 0)
+						!= ((hp[ipHlen + UDPO_SUM] | hp[ipHlen + UDPO_SUM + 1]) == 0)));
+	}
+	ctx->lastUse = ++comp->useCnt;
+
+	/* Send a full header if the context changed or needs a refresh. */
+	if (changed || ctx->fullCnt == 0
+			|| -diffTime(ctx->fullTime) >= comp->fMaxTime * 1000L) {
+		if (changed) {
+			ctx->gen = (ctx->gen + 1) & GENMASK;
+			ctx->fullInterval = 1;
+		} else if ((ctx->fullInterval <<= 1) > comp->fMaxPeriod)
+			ctx->fullInterval = comp->fMaxPeriod;
+		ctx->fullCnt = ctx->fullInterval;
+		ctx->fullTime = mtime();
+		memcpy(ctx->hdr, hp, hlen);
+		ctx->hlen = hlen;
+
+		hp[IPO_LEN] = FH_NONTCP | ctx->gen;
+		hp[IPO_LEN + 1] = i;
+		INCR(fullOut);
+		return PPP_FULLHDR;
+	}
+	ctx->fullCnt--;
+
+	/* Replace the headers with the compressed header. */
+	idHi = hp[IPO_ID];
+	idLo = hp[IPO_ID + 1];
+	clen = 4;
+	if (udp && (ctx->hdr[ipHlen + UDPO_SUM] | ctx->hdr[ipHlen + UDPO_SUM + 1])) {
+		sumHi = hp[ipHlen + UDPO_SUM];
+		sumLo = hp[ipHlen + UDPO_SUM + 1];
+		clen += 2;
+	}
+	skip = hlen - clen;
+	nb->data += skip;
+	nb->len -= skip;
+	nb->chainLen -= skip;
+	cp = nBUFTOPTR(nb, u_char *);
+	*cp++ = i;
+	*cp++ = ctx->gen;
+	*cp++ = idHi;
+	*cp++ = idLo;
+	if (clen > 4) {
+		*cp++ = sumHi;
+		*cp++ = sumLo;
+	}
+	INCR(compOut);
+	return PPP_COMPNONTCP;
+}
+
+/*
+ * iphc_uncompress_full - Restore a received full header packet in place
+ * and update its context.  TCP contexts are passed on to the VJ code.
+ * Return 0 on success, -1 if the packet was dropped and freed.
+ */
+int iphc_uncompress_full(IPHCComp *comp, struct vjcompress *vj, NBuf **nb)
+{
+	NBuf *n0 = *nb;
+	u_int len = n0->chainLen, ipHlen, hlen, cid;
+	IPHCContext *ctx;
+	u_char *hp;
+
+	if (len < sizeof(IPHdr) || (n0 = nPullup(n0, sizeof(IPHdr))) == NULL)
+		goto bad;
+	hp = nBUFTOPTR(n0, u_char *);
+	ipHlen = (hp[0] & 0x0F) << 2;
+	cid = hp[IPO_LEN + 1];
+	if ((hp[0] & 0xF0) != 0x40 || ipHlen < sizeof(IPHdr) || ipHlen > len)
+		goto bad;
+
+	if (hp[IPO_LEN] & FH_NONTCP) {
+		hlen = ipHlen + (hp[IPO_PROTO] == IPPROTO_UDP ? UDPHDRLEN : 0);
+		if ((hp[IPO_LEN] & FH_CID16) || cid >= IPHC_CONTEXTS
+				|| hlen > IPHC_MAXHDR || hlen > len
+				|| (n0 = nPullup(n0, hlen)) == NULL)
+			goto bad;
+		hp = nBUFTOPTR(n0, u_char *);
+		ctx = &comp->rctx[cid];
+		ctx->gen = hp[IPO_LEN] & GENMASK;
+		iphcSetLen(n0, ipHlen, len);
+		memcpy(ctx->hdr, hp, hlen);
+		ctx->hlen = hlen;
+	} else {
+		if (hp[IPO_LEN] != 0 || hp[IPO_PROTO] != IPPROTO_TCP)
+			goto bad;
+		/* Give the VJ code the CID in the protocol field. */
+		hp[IPO_LEN] = len >> 8;
+		hp[IPO_LEN + 1] = len;
+		hp[IPO_PROTO] = cid;
+		if (vj_uncompress_uncomp(n0, vj) < 0)
+			goto bad;
+		iphcSetLen(n0, ipHlen, len);
+		if (cid < MAX_SLOTS)
+			comp->tcpLost[cid >> 3] &= ~(1 << (cid & 7));
+	}
+	*nb = n0;
+	INCR(fullIn);
+	return 0;
+
+bad:
+	PPPDEBUG((LOG_INFO, TL_PPP, "iphc_uncompress_full: bad header len=%u", len));
+	if (n0)
+		nFreeChain(n0);
+	*nb = NULL;
+	INCR(errorIn);
+	return -1;
+}
+
+/*
+ * iphc_uncompress_nontcp - Rebuild the headers of a received compressed
+ * non-TCP packet from its context.
+ * Return 0 on success, -1 if the packet was dropped and freed.
+ */
+int iphc_uncompress_nontcp(IPHCComp *comp, NBuf **nb)
+{
+	NBuf *n0 = *nb;
+	u_int len = n0->chainLen, ipHlen, clen;
+	IPHCContext *ctx;
+	u_char *cp, *hp;
+	u_char udp, id[2], sum[2];
+
+	if (len < 4 || (n0 = nPullup(n0, MIN(len, 6))) == NULL)
+		goto bad;
+	cp = nBUFTOPTR(n0, u_char *);
+	if (cp[0] >= IPHC_CONTEXTS || (cp[1] & (CH_CID16 | CH_DELTA)))
+		goto bad;
+	ctx = &comp->rctx[cp[0]];
+	if (ctx->hlen == 0 || ctx->gen != (cp[1] & GENMASK)) {
+		PPPDEBUG((LOG_INFO, TL_PPP, "iphc_uncompress_nontcp: no context %u", cp[0]));
+		goto bad;
+	}
+	ipHlen = (ctx->hdr[0] & 0x0F) << 2;
+	udp = (ctx->hdr[IPO_PROTO] == IPPROTO_UDP);
+	clen = 4;
+	if (udp && (ctx->hdr[ipHlen + UDPO_SUM] | ctx->hdr[ipHlen + UDPO_SUM + 1])) {
+		if (len < 6)
+			goto bad;
+		sum[0] = cp[4];
+		sum[1] = cp[5];
+		clen += 2;
+	}
+	id[0] = cp[2];
+	id[1] = cp[3];
+
+	/* Replace the compressed header with the saved header. */
+	n0->data += clen;
+	n0->len -= clen;
+	n0->chainLen -= clen;
+	len = n0->chainLen + ctx->hlen;
+	nPREPEND(n0, ctx->hdr, ctx->hlen);
+	if (n0 == NULL)
+		goto bad;
+	hp = nBUFTOPTR(n0, u_char *);
+	hp[IPO_ID] = id[0];
+	hp[IPO_ID + 1] = id[1];
+	if (clen > 4) {
+		hp[ipHlen + UDPO_SUM] = sum[0];
+		hp[ipHlen + UDPO_SUM + 1] = sum[1];
+	}
+	iphcSetLen(n0, ipHlen, len);
+	*nb = n0;
+	INCR(compIn);
+	return 0;
+
+bad:
+	if (n0)
+		nFreeChain(n0);
+	*nb = NULL;
+	INCR(errorIn);
+	return -1;
+}
+
+/*
+ * iphc_uncompress_tcp - Translate a received compressed TCP header to the
+ * VJ format and uncompress it.
+ * Return 0 on success, -1 if the packet was dropped and freed.
+ */
+int iphc_uncompress_tcp(IPHCComp *comp, struct vjcompress *vj, NBuf **nb)
+{
+	u_char *cp = nBUFTOPTR(*nb, u_char *);
+	u_int cid;
+
+	if ((*nb)->len < 4 || (*cp & (TCP_RANDOM | NEW_C))
+			|| cp[1] >= MAX_SLOTS || vj->rstate[cp[1]].cs_hlen == 0) {
+		PPPDEBUG((LOG_INFO, TL_PPP, "iphc_uncompress_tcp: unsupported 0x%X", *cp));
+		vj_uncompress_err(vj);
+		if ((*nb)->len >= 2)
+			iphcTcpLost(comp, cp[1]);
+		goto bad;
+	}
+	*cp |= NEW_C;
+	cid = cp[1];
+	if (vj_uncompress_tcp(nb, vj) < 0) {
+		iphcTcpLost(comp, cid);
+		goto bad;
+	}
+	return 0;
+
+bad:
+	if (*nb)
+		nFreeChain(*nb);
+	*nb = NULL;
+	INCR(errorIn);
+	return -1;
+}
+
+/*
+ * iphc_uncompress_tcpnd - Load the whole values from a received
+ * COMPRESSED_TCP_NODELTA header into the receive state and uncompress it
+ * as a compressed TCP header without deltas.
+ * Return 0 on success, -1 if the packet was dropped and freed.
+ */
+int iphc_uncompress_tcpnd(IPHCComp *comp, struct vjcompress *vj, NBuf **nb)
+{
+	NBuf *n0 = *nb;
+	u_int len = n0->chainLen, hlen, vjlen, changes, cid;
+	struct cstate *cs;
+	struct tcphdr *th;
+	u_char *cp, vjh[10], *vp;
+	u_short urp;
+
+	if (len < 4 || (n0 = nPullup(n0, MIN(len, 18))) == NULL)
+		goto bad;
+	cp = nBUFTOPTR(n0, u_char *);
+	changes = cp[0];
+	cid = cp[1];
+	if ((changes & (TCP_RANDOM | NEW_C)) || cid >= MAX_SLOTS
+			|| vj->rstate[cid].cs_hlen == 0) {
+		PPPDEBUG((LOG_INFO, TL_PPP, "iphc_uncompress_tcpnd: unsupported 0x%X", changes));
+		vj_uncompress_err(vj);
+		iphcTcpLost(comp, cid);
+		goto bad;
+	}
+	hlen = 4 + (changes & NEW_U ? 2 : 0) + (changes & NEW_W ? 2 : 0)
+			+ (changes & NEW_A ? 4 : 0) + (changes & NEW_S ? 4 : 0)
+			+ (changes & NEW_I ? 2 : 0);
+	if (len < hlen)
+		goto bad;
+
+	/* Load the whole values and build the equivalent VJ header. */
+	cs = &vj->rstate[cid];
+	th = (struct tcphdr *)&((u_char *)&cs->cs_ip)[cs->cs_ip.ip_hl << 2];
+	vp = vjh;
+	*vp++ = NEW_C | (changes & (TCP_PUSH_BIT | NEW_U | NEW_I));
+	*vp++ = cid;
+	*vp++ = cp[2];
+	*vp++ = cp[3];
+	cp += 4;
+	if (changes & NEW_U) {
+		urp = (cp[0] << 8) | cp[1];
+		cp += 2;
+		if (urp == 0 || urp >= 256) {
+			*vp++ = 0;
+			*vp++ = urp >> 8;
+		}
+		*vp++ = urp;
+	}
+	if (changes & NEW_W) {
+		memcpy(&th->th_win, cp, 2);
+		cp += 2;
+	}
+	if (changes & NEW_A) {
+		memcpy(&th->th_ack, cp, 4);
+		cp += 4;
+	}
+	if (changes & NEW_S) {
+		memcpy(&th->th_seq, cp, 4);
+		cp += 4;
+	}
+	if (changes & NEW_I) {
+		memcpy(&cs->cs_ip.ip_id, cp, 2);
+		*vp++ = 0;
+		*vp++ = 0;
+		*vp++ = 0;
+	}
+
+	/* Replace our header with the VJ header ending in the same place. */
+	vjlen = (u_int)(vp - vjh);
+	if (vjlen > hlen && nLEADINGSPACE(n0) < vjlen - hlen)
+		goto bad;
+	n0->data += hlen;
+	n0->len -= hlen;
+	n0->data -= vjlen;
+	n0->len += vjlen;
+	n0->chainLen = n0->chainLen - hlen + vjlen;
+	memcpy(n0->data, vjh, vjlen);
+	*nb = n0;
+	if (vj_uncompress_tcp(nb, vj) < 0) {
+		iphcTcpLost(comp, cid);
+		n0 = *nb;
+		goto bad;
+	}
+	return 0;
+
+bad:
+	if (n0)
+		nFreeChain(n0);
+	*nb = NULL;
+	INCR(errorIn);
+	return -1;
+}
+
+/*
+ * iphc_context_request - Build a CONTEXT_STATE packet listing the TCP
+ * contexts lost since the last one.
+ * Return NULL if there are none or it's too soon to send one.
+ */
+NBuf *iphc_context_request(IPHCComp *comp)
+{
+	NBuf *nb;
+	u_char *cp;
+	u_int cid, cnt;
+
+	for (cid = 0; cid < sizeof(comp->tcpLost) && !comp->tcpLost[cid]; cid++)
+		;
+	if (cid >= sizeof(comp->tcpLost)
+			|| (comp->ctxStateTime != 0 
+				&& -diffTime(comp->ctxStateTime) < IPHC_CTXSTATEMS))
+		return NULL;
+	nGET(nb);
+	if (nb == NULL)
+		return NULL;
+
+	cp = nBUFTOPTR(nb, u_char *);
+	cp[0] = CTX_TCP;
+	for (cid = 0, cnt = 0; cid < MAX_SLOTS; cid++) {
+		if (comp->tcpLost[cid >> 3] & (1 << (cid & 7)))
+			cp[2 + cnt++] = cid;
+	}
+	cp[1] = cnt;
+	nb->len = nb->chainLen = 2 + cnt;
+	memset(comp->tcpLost, 0, sizeof(comp->tcpLost));
+	if ((comp->ctxStateTime = mtime()) == 0)
+		comp->ctxStateTime = 1;
+	INCR(ctxStateOut);
+	return nb;
+}
+
+/*
+ * iphc_context_state - The peer has lost TCP context state so make the
+ * VJ compressor send full headers for every connection.
+ */
+#pragma argsused
+void iphc_context_state(IPHCComp *comp, struct vjcompress *vj)
+{
+	vj_compress_flush(vj);
+}
+
+
+/**********************************/
+/*** LOCAL FUNCTION DEFINITIONS ***/
+/**********************************/
+/*
+ * iphcTcpLost - Note that a receive TCP context is lost so that the next
+ * CONTEXT_STATE asks for it to be refreshed.
+ */
+static void iphcTcpLost(IPHCComp *comp, u_int cid)
+{
+	if (cid < MAX_SLOTS)
+		comp->tcpLost[cid >> 3] |= 1 << (cid & 7);
+}
+
+/*
+ * iphcSetLen - Load the inferred lengths and the IP header checksum into
+ * a rebuilt header.
+ */
+static void iphcSetLen(NBuf *nb, u_int ipHlen, u_int len)
+{
+	u_char *hp = nBUFTOPTR(nb, u_char *);
+	IPHdr *ip = (IPHdr *)hp;
+
+	hp[IPO_LEN] = len >> 8;
+	hp[IPO_LEN + 1] = len;
+	if (hp[IPO_PROTO] == IPPROTO_UDP && nb->len >= ipHlen + UDPHDRLEN) {
+		hp[ipHlen + UDPO_LEN] = (len - ipHlen) >> 8;
+		hp[ipHlen + UDPO_LEN + 1] = len - ipHlen;
+	}
+	ip->ip_sum = 0;
+	ip->ip_sum = inChkSum(nb, ipHlen, 0);
+}
+
+#endif
@@ -0,0 +1,147 @@
+/*****************************************************************************
+* netiphc.h - IP Header Compression (RFC 2507/2509) header file.
+*
+* The authors hereby grant permission to use, copy, modify, distribute,
+* and license this software and its documentation for any purpose, provided
+* that existing copyright notices are retained in all copies and that this
+* notice and the following disclaimer are included verbatim in any
+* distributions. No written agreement, license, or royalty fee is required
+* for any of the authorized uses.
+*
+* THIS SOFTWARE IS PROVIDED BY THE CONTRIBUTORS *AS IS* AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+* IN NO EVENT SHALL THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+* NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+* THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+******************************************************************************
+* THEORY OF OPERATION
+*
+*   IP Header Compression is negotiated with the IPCP IP-Compression-Protocol
+* option in place of VJ compression.  UDP and other non-TCP IPv4 packets
+* are compressed here with 8 bit context IDs.  Each context is refreshed
+* with a full header on any change to a field that isn't expected to change
+* and otherwise after an exponentially growing number of packets up to
+* F_MAX_PERIOD or after F_MAX_TIME seconds.
+*
+*   TCP is compressed by the VJ code.  The RFC 2507 compressed TCP header
+* is the RFC 1144 format with the C bit always set and reused as the O
+* (options) bit so we only need to translate between the two.  The VJ
+* compressor is limited to the peer's TCP_SPACE.  A received TCP packet
+* that can't be rebuilt marks its context as lost and the lost contexts
+* are reported to the peer in a CONTEXT_STATE packet at most every
+* IPHC_CTXSTATEMS so that it sends them full headers.
+*
+*****************************************************************************/
+
+#ifndef NETIPHC_H
+#define NETIPHC_H
+
+/*************************
+*** PUBLIC DEFINITIONS ***
+*************************/
+#define IPHC_CONTEXTS	16		/* Non-TCP contexts each way - must be <= 256. */
+#define IPHC_MAXHDR		68		/* Largest IP plus UDP header we save. */
+#define IPHC_FMAXPERIOD	256		/* Default F_MAX_PERIOD in packets. */
+#define IPHC_FMAXTIME	5		/* Default F_MAX_TIME in seconds. */
+#define IPHC_MAXHEADER	168		/* Default MAX_HEADER in bytes. */
+#define IPHC_CTXSTATEMS	500		/* Least time between CONTEXT_STATEs (ms). */
+
+
+/************************
+*** PUBLIC DATA TYPES ***
+************************/
+/*
+ * Statistics.
+ */
+typedef struct {
+	DiagStat headLine;				/* Head line for display. */
+	DiagStat fullOut;				/* Full headers sent. */
+	DiagStat compOut;				/* Compressed non-TCP headers sent. */
+	DiagStat fullIn;				/* Full headers received. */
+	DiagStat compIn;				/* Compressed non-TCP headers received. */
+	DiagStat errorIn;				/* Received packets dropped. */
+	DiagStat ctxStateOut;			/* CONTEXT_STATE packets sent. */
+	DiagStat endRec;
+} IPHCStats;
+
+/*
+ * A non-TCP context.  The saved header is unused if hlen is zero.
+ */
+typedef struct {
+	u_long lastUse;					/* Use count when last used. */
+	u_long fullTime;				/* Time of the last full header. */
+	u_int fullInterval;				/* Packets between full headers. */
+	u_int fullCnt;					/* Packets left before the next full header. */
+	u_char gen;						/* Generation. */
+	u_char hlen;					/* Length of the saved header. */
+	u_char hdr[IPHC_MAXHDR];		/* The saved IP and UDP headers. */
+} IPHCContext;
+
+/*
+ * All the compression state for one link.  The negotiated values are
+ * those requested by the peer for our compressor.
+ */
+typedef struct {
+	u_int tcpSpace;					/* Peer's largest TCP context ID. */
+	u_int nonTcpSpace;				/* Peer's largest non-TCP context ID. */
+	u_int fMaxPeriod;				/* Max packets between full headers. */
+	u_int fMaxTime;					/* Max seconds between full headers. */
+	u_int maxHeader;				/* Largest header we may compress. */
+	u_long useCnt;					/* Packets compressed for LRU ordering. */
+	IPHCContext tctx[IPHC_CONTEXTS];	/* Transmit contexts. */
+	IPHCContext rctx[IPHC_CONTEXTS];	/* Receive contexts. */
+	u_char tcpLost[(MAX_SLOTS + 7) / 8];	/* Lost receive TCP contexts by CID. */
+	u_long ctxStateTime;			/* Time of the last CONTEXT_STATE or 0. */
+#if STATS_SUPPORT > 0
+	IPHCStats stats;
+#endif
+} IPHCComp;
+
+
+/***********************
+*** PUBLIC FUNCTIONS ***
+***********************/
+/*
+ * Initialize the compression state for a link.
+ */
+void iphc_init(IPHCComp *comp);
+
+/*
+ * Attempt to compress an IP packet whose header is in the first buffer.
+ * Return the PPP protocol to send it with.
+ */
+u_int iphc_compress(IPHCComp *comp, struct vjcompress *vj, NBuf *nb);
+
+/*
+ * Restore a received full header packet in place and update its context.
+ * Return 0 on success, -1 if the packet was dropped and freed.
+ */
+int iphc_uncompress_full(IPHCComp *comp, struct vjcompress *vj, NBuf **nb);
+
+/*
+ * Rebuild the IP header of a received compressed packet.
+ * Return 0 on success, -1 if the packet was dropped and freed.
+ */
+int iphc_uncompress_nontcp(IPHCComp *comp, NBuf **nb);
+int iphc_uncompress_tcp(IPHCComp *comp, struct vjcompress *vj, NBuf **nb);
+int iphc_uncompress_tcpnd(IPHCComp *comp, struct vjcompress *vj, NBuf **nb);
+
+/*
+ * Build a CONTEXT_STATE packet listing the TCP contexts lost since the
+ * last one.  Return NULL if there are none or it's too soon to send one.
+ */
+NBuf *iphc_context_request(IPHCComp *comp);
+
+/*
+ * The peer has lost TCP context state so send full headers.
+ */
+void iphc_context_state(IPHCComp *comp, struct vjcompress *vj);
+
+
+#endif
@@ -58,6 +58,9 @@
 #include "netrand.h"
 #include "netauth.h"
 #include "netlcp.h"
+#if LQR_SUPPORT > 0
+#include "netlqr.h"
+#endif
 
 #include <stdio.h>
 #include "netdebug.h"
@@ -86,6 +89,11 @@
 /* Interval in seconds between keepalive echo requests. */
 #define ECHOINTERVAL 10
 
+/* Smoothing gains for the echo round trip time and loss estimators. */
+#define ECHORTTGAIN 8
+#define ECHODEVGAIN 4
+#define ECHOLOSSGAIN 8
+
 
 /***********************************/
 /*** LOCAL FUNCTION DECLARATIONS ***/
@@ -230,7 +238,7 @@ void lcp_init(int unit)
 	wo->restart = 0;			/* Set to 1 in kernels or multi-line
 								 * implementations */
 	wo->neg_mru = 1;
-	wo->mru = DEFMRU;
+	wo->mru = MAXMRU;			/* Ask for the largest frames we can take. */
 	wo->neg_asyncmap = 1;
 	wo->asyncmap = 0x000A0000l;	/* Assume don't need to escape any ctl chars. */
 	wo->neg_chap = 0;			/* Set to 1 on server */
@@ -239,7 +247,8 @@ void lcp_init(int unit)
 	wo->neg_magicnumber = 1;
 	wo->neg_pcompression = 1;
 	wo->neg_accompression = 1;
-	wo->neg_lqr = 0;			/* no LQR implementation yet */
+	wo->neg_lqr = 0;			/* Only report if the peer asks. */
+	wo->lqr_period = 0;
 	wo->neg_cbcp = 0;
 	
 	ao->neg_mru = 1;
@@ -252,7 +261,10 @@ void lcp_init(int unit)
 	ao->neg_magicnumber = 1;
 	ao->neg_pcompression = 1;
 	ao->neg_accompression = 1;
-	ao->neg_lqr = 0;			/* no LQR implementation yet */
+	ao->neg_lqr = (LQR_SUPPORT != 0);
+#if LQR_SUPPORT > 0
+	ao->lqr_period = LQR_DEFPERIOD;
+#endif
 	ao->neg_cbcp = (CBCP_SUPPORT != 0);
 
 	/* 
@@ -1432,6 +1444,8 @@ static int lcp_reqci(fsm *f,
 				PUTLONG(ao->lqr_period, nakp);
 				break;
 			}
+			ho->neg_lqr = 1;		/* Remember he wants reports */
+			ho->lqr_period = cilong;	/* And how often */
 			break;
 		
 		case CI_MAGICNUMBER:
@@ -1852,7 +1866,9 @@ static void LcpEchoTimeout (void *arg)
 #pragma argsused		/* Arg id not used. */
 static void lcp_received_echo_reply (fsm *f, int id, u_char *inp, int len)
 {
-	u_int32_t magic;
+	PPPLinkQual *lq = &pppLinkQual[f->unit];
+	u_int32_t magic, sent;
+	long rtt, err;
 	
 	/* Check the magic number - don't count replies from ourselves. */
 	if (len < 4) {
@@ -1868,6 +1884,38 @@ static void lcp_received_echo_reply (fsm *f, int id, u_char *inp, int len)
 	
 	/* Reset the number of outstanding echo frames */
 	lcp_echos_pending = 0;
+	
+	/*
+	 * Update the link estimates from the time stamp that we sent in the
+	 * request.  The smoothing is the same as for the TCP round trip time.
+	 */
+	OS_ENTER_CRITICAL();
+	lq->echoRcvd++;
+	lq->echoLoss -= lq->echoLoss / ECHOLOSSGAIN;
+	OS_EXIT_CRITICAL();
+	if (len >= 8) {
+		GETLONG(sent, inp);
+		rtt = (long)(mtime() - sent);
+		if (rtt < 0 || rtt > (long)lcp_echo_interval * (lcp_echo_fails + 1) * 1000) {
+			LCPDEBUG((LOG_WARNING, "lcp: bogus Echo-Reply time stamp %lu", sent));
+		} else {
+			OS_ENTER_CRITICAL();
+			lq->echoRTT = rtt;
+			if (lq->echoSRTT == 0) {
+				lq->echoSRTT = rtt;
+				lq->echoRTTVar = rtt / 2;
+			} else {
+				err = rtt - (long)lq->echoSRTT;
+				if (err < 0)
+					err = -err;
+				lq->echoSRTT = ((ECHORTTGAIN - 1) * lq->echoSRTT + rtt) / ECHORTTGAIN;
+				lq->echoRTTVar = ((ECHODEVGAIN - 1) * lq->echoRTTVar + err) / ECHODEVGAIN;
+			}
+			OS_EXIT_CRITICAL();
+			LCPDEBUG((LOG_INFO, "lcp: Echo-Reply rtt %ld srtt %lu", 
+						rtt, lq->echoSRTT));
+		}
+	}
 }
 
 /*
@@ -1876,18 +1924,28 @@ static void lcp_received_echo_reply (fsm *f, int id, u_char *inp, int len)
 
 static void LcpSendEchoRequest (fsm *f)
 {
+	PPPLinkQual *lq = &pppLinkQual[f->unit];
 	u_int32_t lcp_magic;
-	u_char pkt[4], *pktp;
+	u_char pkt[8], *pktp;
 	
 	/*
 	* Detect the failure of the peer at this point.
 	*/
-	if (lcp_echo_fails != 0) {
-		if (lcp_echos_pending++ >= lcp_echo_fails) {
-			LcpLinkFailure(f);
-			lcp_echos_pending = 0;
-		}
+	if (lcp_echos_pending != 0) {
+		/* The last request went unanswered so count it as lost. */
+		OS_ENTER_CRITICAL();
+		lq->echoLoss += (256 - lq->echoLoss) / ECHOLOSSGAIN;
+		OS_EXIT_CRITICAL();
 	}
+	/* 
+	 * Count the outstanding requests even when we never fail the link so
+	 * that the loss estimate above still works.
+	 */
+	if (lcp_echo_fails != 0 && lcp_echos_pending >= lcp_echo_fails) {
+		LcpLinkFailure(f);
+		lcp_echos_pending = 0;
+	} else
+		lcp_echos_pending++;
 	
 	/*
 	* Make and send the echo request frame.
@@ -1896,6 +1954,8 @@ static void LcpSendEchoRequest (fsm *f)
 		lcp_magic = lcp_gotoptions[f->unit].magicnumber;
 		pktp = pkt;
 		PUTLONG(lcp_magic, pktp);
+		PUTLONG(mtime(), pktp);		/* Time stamp for the round trip time. */
+		lq->echoSent++;
 		fsm_sdata(f, ECHOREQ, (u_char)(lcp_echo_number++ & 0xFF), pkt, (int)(pktp - pkt));
 	}
 }
@@ -1913,6 +1973,9 @@ static void lcp_echo_lowerup (int unit)
 	lcp_echo_number        = 0;
 	lcp_echo_timer_running = 0;
 	
+	/* Clear the link quality estimates for the new link. */
+	memset(&pppLinkQual[unit], 0, sizeof(PPPLinkQual));
+	
 	/* If a timeout interval is specified then start the timer */
 	if (lcp_echo_interval != 0)
 		LcpEchoCheck (f);
@@ -0,0 +1,140 @@
+/*****************************************************************************
+* netloop.c - Network Loopback Interface program file.
+*
+* The authors hereby grant permission to use, copy, modify, distribute,
+* and license this software and its documentation for any purpose, provided
+* that existing copyright notices are retained in all copies and that this
+* notice and the following disclaimer are included verbatim in any
+* distributions. No written agreement, license, or royalty fee is required
+* for any of the authorized uses.
+*
+* THIS SOFTWARE IS PROVIDED BY THE CONTRIBUTORS *AS IS* AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+* IN NO EVENT SHALL THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+* NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+* THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+******************************************************************************
+* THEORY OF OPERATION
+*
+*   The loopback task pends on a counting semaphore that is posted once
+* for each datagram queued.  Each time it wakes it takes everything queued
+* up to a burst and passes it to IP together so later wakeups may find the
+* queue empty.  It runs the protocol input code so it gets a network sized
+* stack.
+*****************************************************************************/
+
+#include "netconf.h"
+#include <string.h>
+#include "net.h"
+#include "netbuf.h"
+#include "netip.h"
+#include "netloop.h"
+
+#include <stdio.h>
+#include "netdebug.h"
+
+
+/*************************/
+/*** LOCAL DEFINITIONS ***/
+/*************************/
+#define STACK_SIZE NETSTACK		/* Runs the protocol input code. */
+
+
+/***********************************/
+/*** LOCAL FUNCTION DECLARATIONS ***/
+/***********************************/
+static void loopMain(void *arg);
+
+
+/*****************************/
+/*** LOCAL DATA STRUCTURES ***/
+/*****************************/
+static NBufQHdr loopQ;					/* Datagrams waiting for input. */
+static OS_EVENT *loopSem;				/* Posted once per queued datagram. */
+static char loopStack[STACK_SIZE];		/* The loopback task stack. */
+
+
+/***********************************/
+/*** PUBLIC FUNCTION DEFINITIONS ***/
+/***********************************/
+/*
+ * loopInit - Initialize the loopback interface and start its task.
+ */
+void loopInit(void)
+{
+	memset(&loopQ, 0, sizeof(loopQ));
+	loopSem = OSSemCreate(0);
+#ifdef OS_DEPENDENT
+	OSTaskCreate(loopMain, NULL, loopStack + STACK_SIZE, PRI_LOOP);
+#endif
+}
+
+/*
+ * loopOutput - Queue a datagram to be passed back to IP input.  The
+ * datagram is always consumed.
+ * Return 0 on success, an error code if the queue is full.
+ */
+int loopOutput(NBuf *nb)
+{
+	int st = 0;
+	
+	/* Check the limit and enqueue together so that the queue can't overrun. */
+	OS_ENTER_CRITICAL();
+	if (loopQ.qLen >= LOOP_MAXQUEUE)
+		st = LOOPERR_QFULL;
+	else {
+		if (!loopQ.qTail)
+			loopQ.qHead = loopQ.qTail = nb;
+		else
+			loopQ.qTail = (loopQ.qTail->nextChain = nb);
+		loopQ.qLen++;
+	}
+	OS_EXIT_CRITICAL();
+	
+	if (st < 0) {
+		IPDEBUG((LOG_WARNING, TL_IP, "loopOutput: Queue full - dropped len %u",
+					nb->chainLen));
+		nFreeChain(nb);
+	} else
+		OSSemPost(loopSem);
+	return st;
+}
+
+
+/**********************************/
+/*** LOCAL FUNCTION DEFINITIONS ***/
+/**********************************/
+/*
+ * loopMain - The loopback task.  Pass the queued datagrams to IP input in
+ * bursts.
+ */
+#pragma argsused
+static void loopMain(void *arg)
+{
+	NBuf *burst[IP_MAXBURST];
+	u_int n, i;
+	
+	for (;;) {
+		OSSemPend(loopSem, 0);
+		
+		/* Take the whole burst off the queue in one critical section. */
+		OS_ENTER_CRITICAL();
+		for (n = 0; n < IP_MAXBURST && loopQ.qHead; n++) {
+			if ((loopQ.qHead = (burst[n] = loopQ.qHead)->nextChain) == NULL)
+				loopQ.qTail = NULL;
+			loopQ.qLen--;
+		}
+		OS_EXIT_CRITICAL();
+		
+		for (i = 0; i < n; i++)
+			burst[i]->nextChain = NULL;
+		if (n)
+			ipInputBurst(burst, n, IFT_LOOP, 0);
+	}
+}
@@ -0,0 +1,67 @@
+/*****************************************************************************
+* netloop.h - Network Loopback Interface header file.
+*
+* The authors hereby grant permission to use, copy, modify, distribute,
+* and license this software and its documentation for any purpose, provided
+* that existing copyright notices are retained in all copies and that this
+* notice and the following disclaimer are included verbatim in any
+* distributions. No written agreement, license, or royalty fee is required
+* for any of the authorized uses.
+*
+* THIS SOFTWARE IS PROVIDED BY THE CONTRIBUTORS *AS IS* AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+* IN NO EVENT SHALL THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+* NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+* THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+******************************************************************************
+* THEORY OF OPERATION
+*
+*   The loopback interface carries datagrams addressed to ourselves.  IP
+* queues them on output and a loopback task passes them back to IP input
+* so that a protocol's output never recurses into its own input and the
+* caller's stack depth stays bounded.
+*
+*   IP marks looped datagrams with NBF_CKSUMOK.  Nothing on the path can
+* corrupt them so the transports leave out their checksums when sending to
+* a local address and skip verifying them on marked datagrams.
+*
+*****************************************************************************/
+
+#ifndef NETLOOP_H
+#define NETLOOP_H
+
+
+/*************************
+*** PUBLIC DEFINITIONS ***
+*************************/
+#define LOOP_MTU (4 * NBUFSZ + 40)	/* Four nBufs of data per datagram. */
+#define LOOP_MAXQUEUE 16			/* Maximum datagrams in the queue. */
+
+/*
+ * Loopback Error codes.
+ */
+#define LOOPERR_QFULL -2			/* Queue full - datagram dropped. */
+
+
+/***********************
+*** PUBLIC FUNCTIONS ***
+***********************/
+/*
+ * loopInit - Initialize the loopback interface and start its task.
+ */
+void loopInit(void);
+
+/*
+ * loopOutput - Queue a datagram to be passed back to IP input.  The
+ * datagram is always consumed.
+ * Return 0 on success, an error code if the queue is full.
+ */
+int loopOutput(NBuf *nb);
+
+#endif
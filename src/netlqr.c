@@ -0,0 +1,338 @@
+/*****************************************************************************
+* netlqr.c - PPP Link Quality Report protocol program file.
+*
+* The authors hereby grant permission to use, copy, modify, distribute,
+* and license this software and its documentation for any purpose, provided
+* that existing copyright notices are retained in all copies and that this
+* notice and the following disclaimer are included verbatim in any 
+* distributions. No written agreement, license, or royalty fee is required
+* for any of the authorized uses.
+*
+* THIS SOFTWARE IS PROVIDED BY THE CONTRIBUTORS *AS IS* AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+* IN NO EVENT SHALL THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+* NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+* THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+******************************************************************************
+* THEORY OF OPERATION
+*
+*   When the peer asks for reports with a non-zero Reporting-Period we send
+* one each period.  Otherwise we send one in response to each report we
+* receive.  Loss is computed per RFC 1989 section 2.7 from the differences
+* between the last two reports received:
+*
+*	outbound loss = delta LastOutPackets - delta PeerInPackets
+*	inbound loss  = delta PeerOutPackets - delta SaveInPackets
+*
+*   The counters come from the unit's pppLinkCnt entry.  A received
+* packet is counted before it is dispatched so the snapshot taken for a
+* report includes the report itself as RFC 1989 requires.
+*
+*****************************************************************************/
+
+#include "netconf.h"
+#include <string.h>
+#include "net.h"
+#include "nettimer.h"
+#include "netbuf.h"
+#include "netppp.h"
+#include "netlcp.h"
+#include "netlqr.h"
+
+#include <stdio.h>
+#include "netdebug.h"
+
+
+#if LQR_SUPPORT > 0
+
+#if STATS_SUPPORT == 0
+#error "LQR_SUPPORT requires STATS_SUPPORT for the link counters."
+#endif
+
+/*************************/
+/*** LOCAL DEFINITIONS ***/
+/*************************/
+
+
+/************************/
+/*** LOCAL DATA TYPES ***/
+/************************/
+/*
+ * The RFC 1989 counters for a unit.  The Save fields are our input counters
+ * snapshot when the last report was received and the Peer fields are the
+ * peer's output counters from that report.  Both are echoed back in our
+ * next report.  The Last fields hold the previous report for computing
+ * the loss over the last interval.
+ */
+typedef struct lqr_state {
+	int unit;						/* PPP unit number. */
+	char active;					/* Non-zero if LQR was negotiated. */
+	u_int32_t period;				/* Our sending period (1/100 sec) - 0 for replies only. */
+	Timer timer;					/* The reporting timer. */
+	u_int32_t outLQRs;				/* Reports sent. */
+	u_int32_t inLQRs;				/* Reports received. */
+	u_int32_t peerOutLQRs;			/* From the last report received. */
+	u_int32_t peerOutPackets;
+	u_int32_t peerOutOctets;
+	u_int32_t saveInLQRs;			/* When the last report was received. */
+	u_int32_t saveInPackets;
+	u_int32_t saveInDiscards;
+	u_int32_t saveInErrors;
+	u_int32_t saveInOctets;
+	u_int32_t lastOutPackets;		/* From the previous report received. */
+	u_int32_t lastPeerInPackets;
+	u_int32_t lastPeerOutPackets;
+	u_int32_t lastSaveInPackets;
+} lqr_state;
+
+
+/***********************************/
+/*** LOCAL FUNCTION DECLARATIONS ***/
+/***********************************/
+/*
+ * Protocol entry points.
+ */
+static void lqr_init __P((int));
+static void lqr_lowerup __P((int));
+static void lqr_lowerdown __P((int));
+static void lqr_input __P((int, u_char *, int));
+static void lqr_protrej __P((int));
+
+static void lqr_timeout __P((void *));
+static void lqr_send __P((lqr_state *));
+
+
+
+/******************************/
+/*** PUBLIC DATA STRUCTURES ***/
+/******************************/
+struct protent lqr_protent = {
+    PPP_LQR,
+    lqr_init,
+    lqr_input,
+    lqr_protrej,
+    lqr_lowerup,
+    lqr_lowerdown,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    1,
+    "LQR",
+    NULL,
+    NULL,
+    NULL
+};
+
+
+
+/*****************************/
+/*** LOCAL DATA STRUCTURES ***/
+/*****************************/
+static lqr_state lqr[NUM_PPP];		/* LQR state; one for each unit */
+
+
+
+/**********************************/
+/*** LOCAL FUNCTION DEFINITIONS ***/
+/**********************************/
+/*
+ * lqr_init - Initialize a LQR unit.
+ */
+static void lqr_init(int unit)
+{
+	lqr_state *l = &lqr[unit];
+
+	memset(l, 0, sizeof(*l));
+	l->unit = unit;
+	timerCreate(&l->timer);
+}
+
+
+/*
+ * lqr_lowerup - LCP is up.  Start reporting if it was negotiated.
+ */
+static void lqr_lowerup(int unit)
+{
+	lqr_state *l = &lqr[unit];
+	lcp_options *go = &lcp_gotoptions[unit];
+	lcp_options *ho = &lcp_hisoptions[unit];
+
+	timerClear(&l->timer);
+	memset(l, 0, sizeof(*l));
+	l->unit = unit;
+	l->active = go->neg_lqr || ho->neg_lqr;
+	
+	/* The peer's Reporting-Period tells us how often it wants reports. */
+	l->period = ho->neg_lqr ? ho->lqr_period : 0;
+
+	PPPDEBUG((LOG_INFO, TL_PPP, "lqr_lowerup[%d]: active=%d period=%lu", 
+				unit, l->active, l->period));
+	
+	if (l->period != 0)
+		lqr_send(l);
+}
+
+
+/*
+ * lqr_lowerdown - LCP is down.  Stop reporting.
+ */
+static void lqr_lowerdown(int unit)
+{
+	lqr_state *l = &lqr[unit];
+
+	timerClear(&l->timer);
+	l->active = 0;
+	l->period = 0;
+}
+
+
+/*
+ * lqr_protrej - Peer doesn't speak this protocol.
+ */
+static void lqr_protrej(int unit)
+{
+	PPPDEBUG((LOG_WARNING, TL_PPP, "lqr_protrej[%d]: LQR rejected", unit));
+	lqr_lowerdown(unit);
+}
+
+
+/*
+ * lqr_timeout - The reporting period has expired so send another report.
+ */
+static void lqr_timeout(void *arg)
+{
+	lqr_state *l = (lqr_state *)arg;
+
+	if (l->active && l->period != 0)
+		lqr_send(l);
+}
+
+
+/*
+ * lqr_input - Process a received Link-Quality-Report.
+ */
+static void lqr_input(int unit, u_char *inp, int len)
+{
+	lqr_state *l = &lqr[unit];
+	lcp_options *go = &lcp_gotoptions[unit];
+	PPPLinkQual *lq = &pppLinkQual[unit];
+	u_int32_t magic, lastOutLQRs, lastOutPackets, lastOutOctets;
+	u_int32_t peerInLQRs, peerInPackets, peerInDiscards, peerInErrors;
+	u_int32_t peerInOctets, peerOutLQRs, peerOutPackets, peerOutOctets;
+	u_int32_t delta;
+	
+	if (!l->active) {
+		PPPDEBUG((LOG_INFO, TL_PPP, "lqr_input[%d]: Not negotiated - dropped", unit));
+		return;
+	}
+	if (len < LQR_PKTLEN) {
+		PPPDEBUG((LOG_WARNING, TL_PPP, "lqr_input[%d]: Short packet %d", unit, len));
+		return;
+	}
+	
+	/* Snapshot our input counters before anything else changes them. */
+	l->saveInLQRs = ++l->inLQRs;
+	l->saveInPackets = pppLinkCnt[unit].inPackets;
+	l->saveInDiscards = pppLinkCnt[unit].inDiscards;
+	l->saveInErrors = pppLinkCnt[unit].inErrors;
+	l->saveInOctets = pppLinkCnt[unit].inOctets;
+	
+	GETLONG(magic, inp);
+	GETLONG(lastOutLQRs, inp);
+	GETLONG(lastOutPackets, inp);
+	GETLONG(lastOutOctets, inp);
+	GETLONG(peerInLQRs, inp);
+	GETLONG(peerInPackets, inp);
+	GETLONG(peerInDiscards, inp);
+	GETLONG(peerInErrors, inp);
+	GETLONG(peerInOctets, inp);
+	GETLONG(peerOutLQRs, inp);
+	GETLONG(peerOutPackets, inp);
+	GETLONG(peerOutOctets, inp);
+	
+	if (go->neg_magicnumber && magic == go->magicnumber) {
+		PPPDEBUG((LOG_WARNING, TL_PPP, "lqr_input[%d]: Looped back report", unit));
+		return;
+	}
+	PPPDEBUG((LOG_INFO, TL_PPP, 
+				"lqr_input[%d]: lastOut %lu/%lu/%lu peerIn %lu/%lu/%lu/%lu/%lu",
+				unit, lastOutLQRs, lastOutPackets, lastOutOctets,
+				peerInLQRs, peerInPackets, peerInDiscards, peerInErrors, 
+				peerInOctets));
+	
+	/* 
+	 * A zero LastOutLQRs means that the peer has yet to see one of our
+	 * reports so we can only compute the inbound loss.
+	 */
+	OS_ENTER_CRITICAL();
+	lq->lqrRcvd++;
+	if (l->inLQRs > 1) {
+		lq->inPackets = peerOutPackets - l->lastPeerOutPackets;
+		delta = l->saveInPackets - l->lastSaveInPackets;
+		lq->inLost = lq->inPackets > delta ? lq->inPackets - delta : 0;
+		if (lastOutLQRs != 0 && l->lastOutPackets != 0) {
+			lq->outPackets = lastOutPackets - l->lastOutPackets;
+			delta = peerInPackets - l->lastPeerInPackets;
+			lq->outLost = lq->outPackets > delta ? lq->outPackets - delta : 0;
+		}
+	}
+	OS_EXIT_CRITICAL();
+	
+	l->lastOutPackets = lastOutLQRs != 0 ? lastOutPackets : 0;
+	l->lastPeerInPackets = peerInPackets;
+	l->lastPeerOutPackets = peerOutPackets;
+	l->lastSaveInPackets = l->saveInPackets;
+	
+	l->peerOutLQRs = peerOutLQRs;
+	l->peerOutPackets = peerOutPackets;
+	l->peerOutOctets = peerOutOctets;
+	
+	/* If we're not reporting periodically, we report in reply. */
+	if (l->period == 0)
+		lqr_send(l);
+}
+
+
+/*
+ * lqr_send - Send a Link-Quality-Report and restart the reporting timer.
+ */
+static void lqr_send(lqr_state *l)
+{
+	lcp_options *go = &lcp_gotoptions[l->unit];
+	u_char *outp;
+	
+	outp = outpacket_buf[l->unit];
+	MAKEHEADER(outp, PPP_LQR);
+	PUTLONG(go->neg_magicnumber ? go->magicnumber : 0, outp);
+	PUTLONG(l->peerOutLQRs, outp);			/* LastOutLQRs */
+	PUTLONG(l->peerOutPackets, outp);		/* LastOutPackets */
+	PUTLONG(l->peerOutOctets, outp);		/* LastOutOctets */
+	PUTLONG(l->saveInLQRs, outp);			/* PeerInLQRs */
+	PUTLONG(l->saveInPackets, outp);		/* PeerInPackets */
+	PUTLONG(l->saveInDiscards, outp);		/* PeerInDiscards */
+	PUTLONG(l->saveInErrors, outp);			/* PeerInErrors */
+	PUTLONG(l->saveInOctets, outp);			/* PeerInOctets */
+	PUTLONG(++l->outLQRs, outp);			/* PeerOutLQRs */
+	/* The out counters include this report. */
+	PUTLONG(pppLinkCnt[l->unit].outPackets + 1, outp);	/* PeerOutPackets */
+	PUTLONG(pppLinkCnt[l->unit].outOctets, outp);		/* PeerOutOctets */
+	
+	pppWrite(l->unit, (char *)outpacket_buf[l->unit], LQR_PKTLEN + PPP_HDRLEN);
+	pppLinkQual[l->unit].lqrSent++;
+	
+	PPPDEBUG((LOG_INFO, TL_PPP, "lqr_send[%d]: Sent %lu", l->unit, l->outLQRs));
+	
+	if (l->period != 0)
+		timerJiffys(&l->timer, 
+				MAX((l->period * TICKSPERSEC + 99) / 100, 1), 
+				lqr_timeout, l);
+}
+
+#endif
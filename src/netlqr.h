@@ -0,0 +1,50 @@
+/*****************************************************************************
+* netlqr.h - PPP Link Quality Report protocol header file.
+*
+* The authors hereby grant permission to use, copy, modify, distribute,
+* and license this software and its documentation for any purpose, provided
+* that existing copyright notices are retained in all copies and that this
+* notice and the following disclaimer are included verbatim in any 
+* distributions. No written agreement, license, or royalty fee is required
+* for any of the authorized uses.
+*
+* THIS SOFTWARE IS PROVIDED BY THE CONTRIBUTORS *AS IS* AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+* IN NO EVENT SHALL THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+* NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+* THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+******************************************************************************
+* THEORY OF OPERATION
+*
+*   Link Quality Reports (RFC 1989) are exchanged when the Quality-Protocol
+* option is negotiated by LCP.  Each report carries the sender's counters
+* and the last counters received from the peer so that each end can compute
+* the packets lost in each direction over the last reporting interval.  The
+* results are placed in pppLinkQual[] where they may be read with the
+* PPPCTLG_LINKQUAL ioctl.
+*
+*****************************************************************************/
+
+#ifndef NETLQR_H
+#define NETLQR_H
+
+/*************************
+*** PUBLIC DEFINITIONS ***
+*************************/
+#define LQR_PKTLEN		48		/* 12 32 bit counters. */
+#define LQR_DEFPERIOD	1000	/* Default reporting period in 1/100 seconds */
+
+
+/*****************************
+*** PUBLIC DATA STRUCTURES ***
+*****************************/
+extern struct protent lqr_protent;
+
+
+#endif
@@ -0,0 +1,347 @@
+/*****************************************************************************
+* netpcap.c - PPP frame capture program file.
+*
+* The authors hereby grant permission to use, copy, modify, distribute,
+* and license this software and its documentation for any purpose, provided
+* that existing copyright notices are retained in all copies and that this
+* notice and the following disclaimer are included verbatim in any 
+* distributions. No written agreement, license, or royalty fee is required
+* for any of the authorized uses.
+*
+* THIS SOFTWARE IS PROVIDED BY THE CONTRIBUTORS *AS IS* AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+* IN NO EVENT SHALL THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+* NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+* THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+******************************************************************************
+*
+* See netpcap.h for the theory of operation.
+*
+*****************************************************************************/
+
+#include "netconf.h"
+#include <string.h>
+#include "net.h"
+#include "netbuf.h"
+#include "netpcap.h"
+
+#include <stdio.h>
+#include "netdebug.h"
+
+
+#if PCAP_SUPPORT > 0
+
+/*************************/
+/*** LOCAL DEFINITIONS ***/
+/*************************/
+#define PCAP_MAGIC		0xA1B2C3D4l	/* The pcap file magic number. */
+#define PCAP_VMAJOR		2			/* The pcap file version. */
+#define PCAP_VMINOR		4
+#define PCAP_FILEHDRLEN	24			/* Length of the file header. */
+#define PCAP_RECHDRLEN	16			/* Length of a record header. */
+
+#define PCAP_DIRLEN		1			/* The direction byte. */
+#define PCAP_PPPHDRLEN	4			/* Address, control, and protocol. */
+
+
+/************************/
+/*** LOCAL DATA TYPES ***/
+/************************/
+/*
+ * A capture slot.  A claim sets ready to the claim number and the
+ * capturing task sets it to the claim number plus one once the slot is
+ * filled so that the reader never sees a partial frame or one claimed
+ * before the last restart.  The counts are long so that they take years
+ * to wrap and a claimed slot can never look filled even then.
+ */
+typedef struct {
+	u_long ready;					/* Claim number + 1 when filled. */
+	u_long capTime;					/* Capture time in milliseconds. */
+	u_int origLen;					/* Length of the record on the link. */
+	u_int capLen;					/* Length captured. */
+	u_char data[PCAP_DIRLEN + PCAP_MAXSNAP];	/* Direction and frame. */
+} PCapSlot;
+
+
+/***********************************/
+/*** LOCAL FUNCTION DECLARATIONS ***/
+/***********************************/
+static int pcapFilter(int pd, u_char dir, const u_char *hdr, NBuf *nb, const u_char *s, int len);
+static PCapSlot *pcapClaim(u_long *seq);
+
+
+/******************************/
+/*** PUBLIC DATA STRUCTURES ***/
+/******************************/
+char pcapActive = 0;
+#if STATS_SUPPORT > 0
+PCapStats pcapStats;
+#endif
+
+
+/*****************************/
+/*** LOCAL DATA STRUCTURES ***/
+/*****************************/
+static PCapSlot pcapRing[PCAP_SLOTS];
+static u_long pcapHead;				/* Count of slots claimed. */
+static u_long pcapTail;				/* Count of slots read. */
+static u_int pcapRestarts;			/* Count of calls to pcapStart(). */
+static u_int pcapSnapLen;			/* Current snap length. */
+static char pcapHdrSent;			/* File header has been read. */
+static PCapFilter pcapFilt;			/* The current filter. */
+
+
+/***********************************/
+/*** PUBLIC FUNCTION DEFINITIONS ***/
+/***********************************/
+/*
+ * Initialize the capture subsystem.
+ */
+void pcapInit(void)
+{
+	pcapActive = 0;
+	pcapHead = pcapTail = 0;
+	pcapRestarts = 0;
+	memset(pcapRing, 0, sizeof(pcapRing));
+	
+#if STATS_SUPPORT > 0
+	memset(&pcapStats, 0, sizeof(pcapStats));
+	pcapStats.headLine.fmtStr	= "\t\tPCAP STATISTICS\r\n";
+	pcapStats.captured.fmtStr	= "\tCAPTURED    : %5lu\r\n";
+	pcapStats.filtered.fmtStr	= "\tFILTERED    : %5lu\r\n";
+	pcapStats.dropped.fmtStr	= "\tRING FULL   : %5lu\r\n";
+#endif
+}
+
+/*
+ * Start capturing frames up to snapLen bytes long that pass the filter.
+ */
+void pcapStart(u_int snapLen, const PCapFilter *filter)
+{
+	pcapActive = 0;
+	
+	if (filter) {
+		pcapFilt = *filter;
+		if (pcapFilt.matchCnt > PCAP_MAXMATCH)
+			pcapFilt.matchCnt = PCAP_MAXMATCH;
+	} else {
+		pcapFilt.dirs = PCAP_IN | PCAP_OUT;
+		pcapFilt.matchCnt = 0;
+		pcapFilt.units = 0;
+	}
+	pcapSnapLen = (snapLen == 0 || snapLen > PCAP_MAXSNAP) ? PCAP_MAXSNAP : snapLen;
+	
+	/* 
+	 * Discard the ring under the same critical section as the claims and
+	 * reads.  Slots still being filled keep their old claim numbers and
+	 * so are never taken as ready.
+	 */
+	OS_ENTER_CRITICAL();
+	pcapTail = pcapHead;
+	pcapRestarts++;
+	pcapHdrSent = 0;
+	pcapActive = !0;
+	OS_EXIT_CRITICAL();
+}
+
+/*
+ * Stop capturing.
+ */
+void pcapStop(void)
+{
+	pcapActive = 0;
+}
+
+/*
+ * Drain the ring into buf as a pcap stream.
+ */
+int pcapRead(char *buf, int len)
+{
+	u_char *outp = (u_char *)buf, *recp;
+	PCapSlot *slot;
+	u_long tail;
+	u_int restarts;
+	
+	OS_ENTER_CRITICAL();
+	tail = pcapTail;
+	restarts = pcapRestarts;
+	OS_EXIT_CRITICAL();
+	
+	if (!pcapHdrSent) {
+		if (len < PCAP_FILEHDRLEN)
+			return 0;
+		PUTLONG(PCAP_MAGIC, outp);
+		PUTSHORT(PCAP_VMAJOR, outp);
+		PUTSHORT(PCAP_VMINOR, outp);
+		PUTLONG(0, outp);			/* GMT to local correction. */
+		PUTLONG(0, outp);			/* Accuracy of time stamps. */
+		PUTLONG(PCAP_DIRLEN + pcapSnapLen, outp);
+		PUTLONG(DLT_PPP_WITH_DIR, outp);
+		len -= PCAP_FILEHDRLEN;
+		pcapHdrSent = !0;
+	}
+	
+	while (tail != pcapHead) {
+		slot = &pcapRing[tail % PCAP_SLOTS];
+		if (slot->ready != tail + 1 || len < PCAP_RECHDRLEN + (int)slot->capLen)
+			break;
+		recp = outp;
+		PUTLONG(slot->capTime / 1000, outp);
+		PUTLONG((slot->capTime % 1000) * 1000, outp);
+		PUTLONG(slot->capLen, outp);
+		PUTLONG(slot->origLen, outp);
+		memcpy(outp, slot->data, slot->capLen);
+		outp += slot->capLen;
+		len -= PCAP_RECHDRLEN + slot->capLen;
+		
+		/* 
+		 * Release the slot unless capture was restarted while we copied it
+		 * in which case the record may be from the new capture.
+		 */
+		OS_ENTER_CRITICAL();
+		if (pcapRestarts != restarts) {
+			OS_EXIT_CRITICAL();
+			outp = recp;
+			break;
+		}
+		slot->ready = 0;
+		pcapTail = ++tail;
+		OS_EXIT_CRITICAL();
+	}
+	
+	return (int)(outp - (u_char *)buf);
+}
+
+/*
+ * Capture an nBuf chain holding the information field of a frame.
+ */
+void pcapCapture(int pd, u_char dir, u_int protocol, NBuf *nb)
+{
+	u_char hdr[PCAP_PPPHDRLEN], *hp = hdr;
+	PCapSlot *slot;
+	u_long seq;
+	u_int n, cnt;
+	
+	PUTCHAR(PPP_ALLSTATIONS, hp);
+	PUTCHAR(PPP_UI, hp);
+	PUTSHORT(protocol, hp);
+	
+	if (!pcapFilter(pd, dir, hdr, nb, NULL, 0) || (slot = pcapClaim(&seq)) == NULL)
+		return;
+	
+	slot->data[0] = (dir == PCAP_OUT);
+	memcpy(slot->data + PCAP_DIRLEN, hdr, PCAP_PPPHDRLEN);
+	slot->origLen = PCAP_DIRLEN + PCAP_PPPHDRLEN;
+	slot->capLen = PCAP_DIRLEN + PCAP_PPPHDRLEN;
+	for (; nb; nb = nb->nextBuf) {
+		slot->origLen += nb->len;
+		if ((n = PCAP_DIRLEN + pcapSnapLen - slot->capLen) != 0) {
+			cnt = MIN(n, nb->len);
+			memcpy(slot->data + slot->capLen, nb->data, cnt);
+			slot->capLen += cnt;
+		}
+	}
+	slot->ready = seq + 1;
+}
+
+/*
+ * Capture a frame held in a buffer starting with the address field.
+ */
+void pcapCaptureRaw(int pd, u_char dir, const u_char *s, int len)
+{
+	PCapSlot *slot;
+	u_long seq;
+	
+	if (len < PCAP_PPPHDRLEN 
+			|| !pcapFilter(pd, dir, s, NULL, s + PCAP_PPPHDRLEN, len - PCAP_PPPHDRLEN)
+			|| (slot = pcapClaim(&seq)) == NULL)
+		return;
+	
+	slot->data[0] = (dir == PCAP_OUT);
+	slot->origLen = PCAP_DIRLEN + len;
+	slot->capLen = PCAP_DIRLEN + MIN(len, pcapSnapLen);
+	memcpy(slot->data + PCAP_DIRLEN, s, slot->capLen - PCAP_DIRLEN);
+	slot->ready = seq + 1;
+}
+
+
+/**********************************/
+/*** LOCAL FUNCTION DEFINITIONS ***/
+/**********************************/
+/*
+ * pcapFilter - Apply the filter to a frame on unit pd given the header and
+ * either an nBuf chain or a buffer for the information field.
+ * Return non-zero if the frame should be captured.
+ */
+static int pcapFilter(int pd, u_char dir, const u_char *hdr, NBuf *nb, const u_char *s, int len)
+{
+	PCapMatch *m;
+	u_int off;
+	NBuf *tb;
+	u_char c;
+	int i;
+	
+	if (!(pcapFilt.dirs & dir) 
+			|| (pcapFilt.units != 0 && !(pcapFilt.units & (1 << pd)))) {
+		STATS(pcapStats.filtered.val++;)
+		return 0;
+	}
+	for (i = 0, m = &pcapFilt.match[0]; i < pcapFilt.matchCnt; i++, m++) {
+		if (m->offset < PCAP_PPPHDRLEN)
+			c = hdr[m->offset];
+		else {
+			off = m->offset - PCAP_PPPHDRLEN;
+			if (nb) {
+				for (tb = nb; tb && off >= tb->len; tb = tb->nextBuf)
+					off -= tb->len;
+				if (!tb)
+					break;
+				c = tb->data[off];
+			} else if ((int)off < len)
+				c = s[off];
+			else
+				break;
+		}
+		if ((c & m->mask) != m->value)
+			break;
+	}
+	if (i < pcapFilt.matchCnt) {
+		STATS(pcapStats.filtered.val++;)
+		return 0;
+	}
+	return !0;
+}
+
+/*
+ * pcapClaim - Claim the next free slot in the ring and load its claim
+ * number into seq.
+ * Return the slot or NULL if the ring is full.
+ */
+static PCapSlot *pcapClaim(u_long *seq)
+{
+	PCapSlot *slot = NULL;
+	
+	OS_ENTER_CRITICAL();
+	if (pcapHead - pcapTail < PCAP_SLOTS) {
+		slot = &pcapRing[pcapHead % PCAP_SLOTS];
+		slot->ready = pcapHead;		/* Not filled - never the claim + 1. */
+		*seq = pcapHead++;
+	}
+	OS_EXIT_CRITICAL();
+	
+	if (slot) {
+		slot->capTime = mtime();
+		STATS(pcapStats.captured.val++;)
+	} else {
+		STATS(pcapStats.dropped.val++;)
+	}
+	return slot;
+}
+
+#endif
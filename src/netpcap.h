@@ -0,0 +1,164 @@
+/*****************************************************************************
+* netpcap.h - PPP frame capture header file.
+*
+* The authors hereby grant permission to use, copy, modify, distribute,
+* and license this software and its documentation for any purpose, provided
+* that existing copyright notices are retained in all copies and that this
+* notice and the following disclaimer are included verbatim in any 
+* distributions. No written agreement, license, or royalty fee is required
+* for any of the authorized uses.
+*
+* THIS SOFTWARE IS PROVIDED BY THE CONTRIBUTORS *AS IS* AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+* IN NO EVENT SHALL THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+* NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+* THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+******************************************************************************
+* THEORY OF OPERATION
+*
+*   Frames are captured at pppDispatch() (inbound, after deframing) and at
+* pppOutput()/pppWrite() (outbound, before framing) into a preallocated ring
+* of fixed sized slots.  A slot is claimed with a short critical section and
+* then filled outside it so that several tasks may capture at once.  A task
+* drains the ring with pcapRead() which returns a pcap stream
+* (DLT_PPP_WITH_DIR) that may be written to a file, a serial port or a TCP
+* connection.  Each record starts with a direction byte, 0 for received
+* and 1 for sent, followed by the PPP frame from the address field.
+*
+*   A slot is marked ready by storing its claim number so that a capture
+* still filling a slot from before pcapStart() can't be mistaken for a
+* new one, and pcapRead() only advances past a slot if no restart
+* happened while it was copying it.
+*
+*   The filter selects the directions and PPP units to capture and holds
+* a list of byte tests on the PPP frame (address, control, protocol, then
+* the information field) that must all match in the manner of a BPF
+* program with only "ldb; and; jeq" instructions.  The offsets don't count
+* the direction byte.  For
+* example { 2, 0xFF, 0x00 }, { 3, 0xFF, 0x21 } selects IP frames and adding
+* { 13, 0xFF, 6 } selects only TCP.
+*
+*   When capture is off, the cost is the test of pcapActive.
+*
+*****************************************************************************/
+
+#ifndef NETPCAP_H
+#define NETPCAP_H
+
+/*************************
+*** PUBLIC DEFINITIONS ***
+*************************/
+#define PCAP_SLOTS		16			/* Frames held in the capture ring. */
+#define PCAP_MAXSNAP	128			/* Largest snap length supported. */
+#define PCAP_MAXMATCH	4			/* Byte tests in a filter. */
+
+/* Capture directions. */
+#define PCAP_IN			0x01		/* Received frames. */
+#define PCAP_OUT		0x02		/* Transmitted frames. */
+
+#define DLT_PPP_WITH_DIR	204		/* The pcap link type for PPP with direction. */
+
+/*
+ * Capture a frame if capture is active.  These cost only the test when
+ * capture is off.
+ */
+#if PCAP_SUPPORT > 0
+#define pcapCAPTURE(pd, dir, protocol, nb) { \
+	if (pcapActive) pcapCapture((pd), (dir), (protocol), (nb)); \
+}
+#define pcapCAPTURERAW(pd, dir, s, len) { \
+	if (pcapActive) pcapCaptureRaw((pd), (dir), (s), (len)); \
+}
+#else
+#define pcapCAPTURE(pd, dir, protocol, nb)
+#define pcapCAPTURERAW(pd, dir, s, len)
+#endif
+
+
+/************************
+*** PUBLIC DATA TYPES ***
+************************/
+/*
+ * A byte test - the frame byte at offset is masked and compared to value.
+ */
+typedef struct {
+	u_char offset;					/* Offset in the PPP frame. */
+	u_char mask;					/* Mask applied to the frame byte. */
+	u_char value;					/* Value to match after masking. */
+} PCapMatch;
+
+/*
+ * A capture filter.  All tests must match for a frame to be captured.
+ */
+typedef struct {
+	u_char dirs;					/* Directions to capture. */
+	u_char matchCnt;				/* Number of byte tests. */
+	PCapMatch match[PCAP_MAXMATCH];	/* The byte tests. */
+	u_char units;					/* Mask of PPP units to capture - 0 for all. */
+} PCapFilter;
+
+/*
+ * Statistics.
+ */
+typedef struct {
+	DiagStat headLine;				/* Head line for display. */
+	DiagStat captured;				/* Frames captured. */
+	DiagStat filtered;				/* Frames rejected by the filter. */
+	DiagStat dropped;				/* Frames lost because the ring was full. */
+	DiagStat endRec;
+} PCapStats;
+
+
+/*****************************
+*** PUBLIC DATA STRUCTURES ***
+*****************************/
+extern char pcapActive;				/* Non-zero while capturing. */
+#if STATS_SUPPORT > 0
+extern PCapStats pcapStats;
+#endif
+
+
+/***********************
+*** PUBLIC FUNCTIONS ***
+***********************/
+/*
+ * Initialize the capture subsystem.
+ */
+void pcapInit(void);
+
+/*
+ * Start capturing frames up to snapLen bytes long that pass the filter.
+ * A NULL filter captures everything in both directions.  Any frames still
+ * in the ring are discarded and the next read starts a new pcap stream.
+ */
+void pcapStart(u_int snapLen, const PCapFilter *filter);
+
+/*
+ * Stop capturing.  Frames already captured may still be read.
+ */
+void pcapStop(void);
+
+/*
+ * Drain the ring into buf as a pcap stream.  Only whole records are
+ * returned.  Return the number of bytes loaded.
+ */
+int pcapRead(char *buf, int len);
+
+/*
+ * Capture an nBuf chain holding the information field of a frame.
+ */
+void pcapCapture(int pd, u_char dir, u_int protocol, NBuf *nb);
+
+/*
+ * Capture a frame held in a buffer starting with the address field.
+ */
+void pcapCaptureRaw(int pd, u_char dir, const u_char *s, int len);
+
+
+#endif
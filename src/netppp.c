@@ -90,14 +90,22 @@
 #endif
 #include "netipcp.h"
 #include "netlcp.h"
+#if LQR_SUPPORT > 0
+#include "netlqr.h"
+#endif
 #include "netiphdr.h"		/* Required for netvj.h. */
 #if VJ_SUPPORT > 0
 #include "netvj.h"
 #endif
+#if IPHC_SUPPORT > 0
+#include "netiphc.h"
+#endif
 #include "netppp.h"
+#include "netpcap.h"
 
 /* Upper layer protocols. */
 #include "netip.h"
+#include "netroute.h"
 
 /* Lower layer interfaces. */
 #include <stdio.h>
@@ -113,10 +121,26 @@
  */
 #define MAXIDLEFLAG	500					/* Max Xmit idle time before resend flag char. */
 #define MAXKILLDELAY TICKSPERSEC		/* Max delay jiffys before PPP task checks kill. */
+#define TXRESERVE	8					/* Buffers held back for link control traffic. */
 #define STACK_SIZE NETSTACK+512		/* Enough to handle printf's. */
 
 #define MAX_IFS		32
 
+/*
+ * Protocols whose headers are rebuilt into headroom in the received buffer.
+ */
+#define COMPHDR_P(p) ((p) == PPP_VJC_COMP || (p) == PPP_COMPTCP \
+		|| (p) == PPP_COMPTCPND || (p) == PPP_COMPNONTCP)
+
+/*
+ * The protocol dispatch table.  The network protocols (0x00xx) carry the
+ * data and are found through an index on their odd low octet.  The rest
+ * are mostly control protocols and are searched for.
+ */
+#define MAXPROTOS	24
+#define NETPROTO_P(p) (((p) & 0xFF00) == 0)
+#define NETPROTOIDX(p) (((p) >> 1) & 0x7F)
+
 
 /*
  * The basic PPP frame.
@@ -163,7 +187,12 @@ typedef enum {
 #define PPP_IPX		0x2b		/* IPX Datagram (RFC1552) */
 #define	PPP_VJC_COMP	0x2d	/* VJ compressed TCP */
 #define	PPP_VJC_UNCOMP	0x2f	/* VJ uncompressed TCP */
+#define PPP_FULLHDR	0x61		/* IPHC full header */
+#define PPP_COMPTCP	0x63		/* IPHC compressed TCP */
+#define PPP_COMPNONTCP	0x65	/* IPHC compressed non-TCP */
 #define PPP_COMP	0xfd		/* compressed packet */
+#define PPP_COMPTCPND	0x2063	/* IPHC compressed TCP, no delta */
+#define PPP_CTXSTATE	0x2065	/* IPHC context state */
 #define PPP_IPCP	0x8021		/* IP Control Protocol */
 #define PPP_ATCP	0x8029		/* AppleTalk Control Protocol */
 #define PPP_IPXCP	0x802b		/* IPX Control Protocol (RFC1552) */
@@ -241,6 +270,7 @@ typedef struct PPPControl_s {
 	u_int inFCS;						/* Input Frame Check Sequence value. */
 	u_int inLen;						/* Input packet length. */
 	int  mtu;							/* Peer's mru */
+	int  mru;							/* Our mru - longest frame accepted. */
 	int  pcomp;							/* Does peer accept protocol compression? */
 	int  accomp;						/* Does peer accept addr/ctl compression? */
 	u_long lastXMit;					/* Time of last transmission. */
@@ -249,10 +279,29 @@ typedef struct PPPControl_s {
 #if VJ_SUPPORT > 0
 	int  vjEnabled;						/* Flag indicating VJ compression enabled. */
 	struct vjcompress vjComp;			/* Van Jabobsen compression header. */
+#endif
+#if IPHC_SUPPORT > 0
+	int  iphcEnabled;					/* Flag indicating IPHC enabled. */
+	int  iphcRcvEnabled;				/* Flag indicating IPHC accepted. */
+	IPHCComp iphcComp;					/* IP header compression state. */
 #endif
 	int traceOffset;					/* Trace level offset. */
+	int framing;						/* PPPFRAME_ framing mode. */
+	NBuf *ipBurst[IP_MAXBURST];			/* IP packets waiting to go to IP. */
+	u_int ipBurstLen;					/* Packets in ipBurst. */
 } PPPControl;
 
+/*
+ * Protocol dispatch table entry.  Entries are allocated in order and never
+ * freed so a zero protocol code (never valid) ends the table.
+ */
+typedef struct PPPProto_s {
+	u_int protocol;						/* Protocol code or 0 if unused. */
+	PPPProtoHandler handler;			/* Input handler or NULL to drop. */
+	void *arg;							/* Handler's argument. */
+	PPPProtoStats stats;				/* Input counters. */
+} PPPProto;
+
 
 /*
  * Ioctl definitions.
@@ -270,8 +319,28 @@ struct npioctl {
 /***********************************/
 static void pppMain(void *pd);
 static void pppDispatch(int pd, NBuf *nb, u_int protocol);
+static PPPProto *pppProtoLookup(u_int protocol);
+static void pppCtlInput(int pd, NBuf *nb, void *arg);
+static void pppIPInput(int pd, NBuf *nb, void *arg);
+#if VJ_SUPPORT > 0
+static void pppVJCInput(int pd, NBuf *nb, void *arg);
+static void pppVJUInput(int pd, NBuf *nb, void *arg);
+#endif
+#if IPHC_SUPPORT > 0
+static void pppFullHdrInput(int pd, NBuf *nb, void *arg);
+static void pppCompTCPInput(int pd, NBuf *nb, void *arg);
+static void pppCompTCPNDInput(int pd, NBuf *nb, void *arg);
+static void pppCompNonTCPInput(int pd, NBuf *nb, void *arg);
+static void pppCtxStateInput(int pd, NBuf *nb, void *arg);
+static void pppCtxStateOutput(int pd);
+#endif
+static void pppIPQueue(int pd, NBuf *nb);
+static void pppIPFlush(int pd);
 static void pppDrop(PPPControl *pc);
 static void pppInProc(int pd, u_char *s, int l);
+static void pppSyncInput(int pd, NBuf *nb);
+static int pppSyncOutput(int pd, NBuf *nb);
+static u_int pppChainFCS(NBuf *nb);
 static NBuf *pppMPutC(u_char c, ext_accm *outACCM, NBuf *nb);
 static NBuf *pppMPutRaw(u_char c, NBuf *nb);
 
@@ -286,7 +355,9 @@ int	auth_required = 0;			/* Peer is required to authenticate */
 PPPControl pppControl[NUM_PPP];	/* The PPP interface control blocks. */
 #if STATS_SUPPORT > 0
 PPPStats pppStats;				/* Statistics. */
+PPPLinkCnt pppLinkCnt[NUM_PPP];	/* Per unit link counters. */
 #endif
+PPPLinkQual pppLinkQual[NUM_PPP];	/* Link quality estimates. */
 
 /*
  * PPP Data Link Layer "protocol" table.
@@ -303,6 +374,9 @@ struct protent *protocols[] = {
 #endif
 #if CBCP_SUPPORT > 0
 	&cbcp_protent,
+#endif
+#if LQR_SUPPORT > 0
+	&lqr_protent,
 #endif
 	&ipcp_protent,
 #if CCP_SUPPORT	> 0
@@ -361,6 +435,9 @@ const u_short fcstab[256] = {
 	0x7bc7, 0x6a4e, 0x58d5, 0x495c, 0x3de3, 0x2c6a, 0x1ef1, 0x0f78
 };
 
+static PPPProto pppProtoTbl[MAXPROTOS];	/* Protocol dispatch table. */
+static u_char pppNetProtoIdx[128];		/* Network protocol entry + 1 or 0. */
+
 /* PPP's Asynchronous-Control-Character-Map.  The mask array is used
  * to select the specific bit for a character. */
 static u_char pppACCMMask[] = {
@@ -395,6 +472,24 @@ void pppInit(void)
 			(*protp->init)(i);
 	}
 	
+	/* Load the dispatch table. */
+	memset(pppProtoTbl, 0, sizeof(pppProtoTbl));
+	memset(pppNetProtoIdx, 0, sizeof(pppNetProtoIdx));
+	pppRegister(PPP_IP, pppIPInput, NULL);
+#if VJ_SUPPORT > 0
+	pppRegister(PPP_VJC_COMP, pppVJCInput, NULL);
+	pppRegister(PPP_VJC_UNCOMP, pppVJUInput, NULL);
+#endif
+#if IPHC_SUPPORT > 0
+	pppRegister(PPP_FULLHDR, pppFullHdrInput, NULL);
+	pppRegister(PPP_COMPTCP, pppCompTCPInput, NULL);
+	pppRegister(PPP_COMPTCPND, pppCompTCPNDInput, NULL);
+	pppRegister(PPP_COMPNONTCP, pppCompNonTCPInput, NULL);
+	pppRegister(PPP_CTXSTATE, pppCtxStateInput, NULL);
+#endif
+	for (j = 0; (protp = protocols[j]) != NULL; ++j)
+		pppRegister(protp->protocol, pppCtlInput, protp);
+	
 #if STATS_SUPPORT > 0
 	/* Clear the statistics. */
 	memset(&pppStats, 0, sizeof(pppStats));
@@ -407,6 +502,10 @@ void pppInit(void)
 	pppStats.ppp_opackets.fmtStr	= "\tPACKETS OUT : %5lu\r\n";
 	pppStats.ppp_oerrors.fmtStr		= "\tOUT ERRORS  : %5lu\r\n";
 #endif
+
+#if PCAP_SUPPORT > 0
+	pcapInit();
+#endif
 }
 
 /* Open a new PPP connection using the given I/O device.
@@ -417,6 +516,12 @@ void pppInit(void)
  * Return a new PPP connection descriptor on success or
  * an error code (negative) on failure. */
 int pppOpen(int fd)
+{
+	return pppOpenFramed(fd, PPPFRAME_ASYNC);
+}
+
+/* Open a new PPP connection as above using the given framing mode. */
+int pppOpenFramed(int fd, int framing)
 {
 	PPPControl *pc;
 	char c;
@@ -466,14 +571,22 @@ int pppOpen(int fd)
 		pc->inState = PDIDLE;
 		pc->inHead = NULL;
 		pc->inTail = NULL;
+		pc->ipBurstLen = 0;
 		pc->inEscaped = 0;
 		pc->lastXMit = mtime() - MAXIDLEFLAG;
 		pc->traceOffset = 0;
+		pc->framing = framing;
+		pc->mru = PPP_MAXMRU;			/* Until LCP configures the link. */
 		
 #if VJ_SUPPORT > 0
 		pc->vjEnabled = 0;
 		vj_compress_init(&pc->vjComp);
 #endif
+#if IPHC_SUPPORT > 0
+		pc->iphcEnabled = 0;
+		pc->iphcRcvEnabled = 0;
+		iphc_init(&pc->iphcComp);
+#endif
 
 		/* 
 		 * Default the in and out accm so that escape and flag characters
@@ -543,6 +656,7 @@ int pppOutput(int pd, u_short protocol, NBuf *nb)
 	u_char c = 0;
 	int n;
 	u_char *sPtr;
+	u_char hdr[PPP_HDRLEN];
 
 	/* Grab an output buffer. */
 	nGET(headMB);
@@ -572,12 +686,36 @@ int pppOutput(int pd, u_short protocol, NBuf *nb)
 #endif
 		st = PPPERR_OPEN;
 		
+	/* 
+	 * Apply back pressure to network layer traffic.  The device queues
+	 * frames that it hasn't yet transmitted so the free buffer pool is
+	 * our measure of how far behind it is.  Async framing copies the
+	 * frame so allow for the worst case of every byte escaped and refuse
+	 * the frame now rather than fail part way through and leave link
+	 * control traffic no buffers.  Sync framing passes the chain itself.
+	 */
+	} else if (protocol < 0x8000 
+			&& nBUFSFREE() < TXRESERVE + ((pc->framing & PPPFRAME_SYNC) 
+					? 0 : 2 * nChainLen(nb) / NBUFSZ + 1)) {
+		PPPDEBUG((LOG_INFO, TL_PPP, "pppOutput[%d]: device busy - dropping proto=%d",
+					pd, protocol));
+#if STATS_SUPPORT > 0
+		pppStats.PPPoerrors++;
+#endif
+		st = PPPERR_ALLOC;
+		
 	} else {
 #if VJ_SUPPORT > 0
 		/* 
-		 * Attempt Van Jacobson header compression if VJ is configured and
-		 * this is an IP packet. 
+		 * Attempt IP header compression if negotiated, otherwise Van
+		 * Jacobson header compression if VJ is configured and this is an
+		 * IP packet. 
 		 */
+#if IPHC_SUPPORT > 0
+		if (protocol == PPP_IP && pc->iphcEnabled)
+			protocol = iphc_compress(&pc->iphcComp, &pc->vjComp, nb);
+		else
+#endif
 		if (protocol == PPP_IP && pc->vjEnabled) {
 			switch (vj_compress_tcp(&pc->vjComp, nb)) {
 			case TYPE_IP:
@@ -600,6 +738,26 @@ int pppOutput(int pd, u_short protocol, NBuf *nb)
 			}
 		}
 #endif
+		pcapCAPTURE(pd, PCAP_OUT, protocol, nb);
+		
+		/* 
+		 * If the device delimits frames, just add the PPP header and send
+		 * the packet in place.
+		 */
+		if (pc->framing & PPPFRAME_SYNC) {
+			nFreeChain(headMB);
+			c = 0;
+			if (!pc->accomp) {
+				hdr[c++] = PPP_ALLSTATIONS;
+				hdr[c++] = PPP_UI;
+			}
+			if (!pc->pcomp || protocol > 0xFF)
+				hdr[c++] = (protocol >> 8) & 0xFF;
+			hdr[c++] = protocol & 0xFF;
+			nChainLen(nb);
+			nb = nPrepend(nb, (const char *)hdr, c);
+			return pppSyncOutput(pd, nb);
+		}
 		
 		headMB->len = 0;
 		tailMB = headMB;
@@ -663,9 +821,26 @@ int pppOutput(int pd, u_short protocol, NBuf *nb)
 						"pppOutput[%d]: proto=x%X %d:%.*H", 
 						pd, protocol,
 						headMB->chainLen, MIN(headMB->len * 2, 50), headMB->data));
-			nPut(pc->fd, headMB);
 #if STATS_SUPPORT > 0
-			pppStats.PPPopackets++;
+			n = nChainLen(headMB);
+#endif
+			/* The device takes the chain whether or not it can queue it. */
+			if (nPut(pc->fd, headMB) < 0) {
+				st = PPPERR_DEVICE;
+				PPPDEBUG((pppControl[pd].traceOffset + LOG_WARNING, TL_PPP,
+							"pppOutput[%d]: device refused proto=%d", 
+							pd, protocol));
+#if STATS_SUPPORT > 0
+				pppStats.PPPoerrors++;
+#endif
+			}
+#if STATS_SUPPORT > 0
+			else {
+				pppStats.PPPobytes += n;
+				pppLinkCnt[pd].outOctets += n;
+				pppStats.PPPopackets++;
+				pppLinkCnt[pd].outPackets++;
+			}
 #endif
 		}
 		headMB = NULL;
@@ -686,8 +861,9 @@ int pppOutput(int pd, u_short protocol, NBuf *nb)
 
 /* Process an nBuf chain received on given connection.
  * The nBuf chain is always passed on or freed making the original
- * nBuf pointer invalid.  Note that this does not check for packet
- * chains.  This does not require complete packets but if a packet
+ * nBuf pointer invalid.  A packet device may pass a queue of frames
+ * linked by nextChain and the IP packets among them are passed to IP
+ * as one burst.  This does not require complete packets but if a packet
  * spans calls, those calls must be in the correct order.  This is
  * designed to handle packets received from the serial interface
  * but could be used for a loopback interface.
@@ -697,7 +873,16 @@ int pppInput(int pd, NBuf *nb)
 {
 	NBuf *nextNBuf;
 
-	while (nb != NULL) {
+	/* A packet device gives us whole frames, possibly a queue of them. */
+	if (pppControl[pd].framing & PPPFRAME_SYNC) {
+		while (nb != NULL) {
+			nextNBuf = nb->nextChain;
+			nb->nextChain = NULL;
+			pppSyncInput(pd, nb);
+			nb = nextNBuf;
+		}
+	}
+	else while (nb != NULL) {
 		/* Consume the buffer.  Ideally we could just work on the
 		 * recieved buffer but unless we get the serial driver to
 		 * preprocess the escape sequences, it's easier to just
@@ -706,6 +891,9 @@ int pppInput(int pd, NBuf *nb)
 		nFREE(nb, nextNBuf);
 		nb = nextNBuf;
 	}
+	
+	/* Pass the IP packets received to IP together. */
+	pppIPFlush(pd);
 	return 0;
 }
 
@@ -744,6 +932,34 @@ int  pppIOCtl(int pd, int cmd, void *arg)
 			else
 				st = PPPERR_PARAM;
 			break;
+		case PPPCTLG_LINKQUAL:		/* Get the link quality estimates. */
+			if (arg) {
+				OS_ENTER_CRITICAL();
+				*(PPPLinkQual *)arg = pppLinkQual[pd];
+				OS_EXIT_CRITICAL();
+			} else
+				st = PPPERR_PARAM;
+			break;
+#if VJ_SUPPORT > 0 && STATS_SUPPORT > 0
+		case PPPCTLG_VJSTATS:		/* Get the VJ compression statistics. */
+			if (arg) {
+				OS_ENTER_CRITICAL();
+				*(VJStats *)arg = pc->vjComp.stats;
+				OS_EXIT_CRITICAL();
+			} else
+				st = PPPERR_PARAM;
+			break;
+#endif
+#if IPHC_SUPPORT > 0 && STATS_SUPPORT > 0
+		case PPPCTLG_IPHCSTATS:		/* Get the IP header compression statistics. */
+			if (arg) {
+				OS_ENTER_CRITICAL();
+				*(IPHCStats *)arg = pc->iphcComp.stats;
+				OS_EXIT_CRITICAL();
+			} else
+				st = PPPERR_PARAM;
+			break;
+#endif
 		default:
 			st = PPPERR_PARAM;
 			break;
@@ -770,6 +986,69 @@ u_int pppMTU(int pd)
 	return st;
 }
 
+/*
+ * Register the input handler for a PPP protocol, replacing any current
+ * handler.  A NULL handler drops the protocol's packets.
+ * Return 0 on success, an error code on failure.
+ */
+int pppRegister(u_int protocol, PPPProtoHandler handler, void *arg)
+{
+	PPPProto *pp, *freePP = NULL;
+	u_int i;
+	int st = PPPERR_ALLOC;
+	
+	/* The low octet must be odd and the high octet even. */
+	if ((protocol & 0x0101) != 0x0001)
+		return PPPERR_PARAM;
+	
+	OS_ENTER_CRITICAL();
+	for (i = 0; i < MAXPROTOS; i++) {
+		pp = &pppProtoTbl[i];
+		if (pp->protocol == protocol) {
+			freePP = pp;
+			break;
+		}
+		if (pp->protocol == 0) {
+			freePP = pp;
+			freePP->protocol = protocol;
+			memset(&freePP->stats, 0, sizeof(freePP->stats));
+			if (NETPROTO_P(protocol))
+				pppNetProtoIdx[NETPROTOIDX(protocol)] = (u_char)(i + 1);
+			break;
+		}
+	}
+	if (freePP) {
+		freePP->handler = handler;
+		freePP->arg = arg;
+		st = 0;
+	}
+	OS_EXIT_CRITICAL();
+	
+	if (st < 0)
+		PPPDEBUG((LOG_ERR, TL_PPP, "pppRegister: table full for 0x%X", protocol));
+	
+	return st;
+}
+
+/*
+ * Get the input counters for a registered protocol.
+ * Return 0 on success, an error code if the protocol isn't registered.
+ */
+int pppProtoStats(u_int protocol, PPPProtoStats *ps)
+{
+	PPPProto *pp;
+	int st = PPPERR_PARAM;
+	
+	OS_ENTER_CRITICAL();
+	if ((pp = pppProtoLookup(protocol)) != NULL) {
+		*ps = pp->stats;
+		st = 0;
+	}
+	OS_EXIT_CRITICAL();
+	
+	return st;
+}
+
 /*
  * Write n characters to a ppp link.
  *	RETURN: >= 0 Number of characters written
@@ -780,15 +1059,38 @@ int pppWrite(int pd, const char *s, int n)
 	PPPControl *pc = &pppControl[pd];
 	short st = 0;
 	u_char c;
-	u_int fcsOut = PPP_INITFCS;
+	u_int fcsOut = PPP_INITFCS, cnt;
 	NBuf *headMB = NULL, *tailMB;
 
+	pcapCAPTURERAW(pd, PCAP_OUT, (const u_char *)s, n);
 	nGET(headMB);
 	if (headMB == NULL) {
 		st = PPPERR_ALLOC;
 #if STATS_SUPPORT > 0
 		pppStats.PPPoerrors++;
 #endif
+	} else if (pc->framing & PPPFRAME_SYNC) {
+		/* Copy the frame as is. */
+		headMB->len = 0;
+		headMB->chainLen = 0;
+		for (tailMB = headMB; tailMB != NULL && n > 0; ) {
+			cnt = MIN((u_int)n, nTRAILINGSPACE(tailMB));
+			memcpy(tailMB->data + tailMB->len, s, cnt);
+			tailMB->len += cnt;
+			headMB->chainLen += cnt;
+			s += cnt;
+			if ((n -= cnt) > 0) {
+				nGET(tailMB->nextBuf);
+				tailMB = tailMB->nextBuf;
+				if (tailMB != NULL)
+					tailMB->len = 0;
+			}
+		}
+		if (tailMB == NULL) {
+			nFreeChain(headMB);
+			headMB = NULL;
+		}
+		st = pppSyncOutput(pd, headMB);
 	} else {
 		headMB->len = 0;
 		tailMB = headMB;
@@ -824,9 +1126,23 @@ int pppWrite(int pd, const char *s, int n)
 						"pppWrite[%d]: %d:%.*H", 
 						pd,
 						headMB->len, MIN(headMB->len * 2, 40), headMB->data));
-			nPut(pc->fd, headMB);
 #if STATS_SUPPORT > 0
-			pppStats.PPPopackets++;
+			n = nChainLen(headMB);
+#endif
+			/* The device takes the chain whether or not it can queue it. */
+			if (nPut(pc->fd, headMB) < 0) {
+				st = PPPERR_DEVICE;
+#if STATS_SUPPORT > 0
+				pppStats.PPPoerrors++;
+#endif
+			}
+#if STATS_SUPPORT > 0
+			else {
+				pppStats.PPPobytes += n;
+				pppLinkCnt[pd].outOctets += n;
+				pppStats.PPPopackets++;
+				pppLinkCnt[pd].outPackets++;
+			}
 #endif
 		}
 		else {
@@ -903,6 +1219,9 @@ void ppp_recv_config(
 	PPPControl *pc = &pppControl[unit];
 	int i;
 	
+	/* Frames longer than the MRU are dropped on input. */
+	pc->mru = MIN(mru, PPP_MAXMRU);
+	
 	/* Load the ACCM bits for the 32 control codes. */
 	for (i = 0; i < 32 / 8; i++)
 		pc->inACCM[i] = (u_char)(asyncmap >> (i * 8));
@@ -1006,7 +1325,8 @@ int sifvjcomp(
 	
 	pc->vjEnabled = vjcomp;
 	pc->vjComp.compressSlot = cidcomp;
-	pc->vjComp.maxSlotIndex = maxcid;
+	if (vjcomp)
+		vj_compress_slots(&pc->vjComp, maxcid);
 	PPPDEBUG((LOG_INFO, TL_PPP, "sifvjcomp: VJ compress enable=%d slot=%d max slot=%d",
 				vjcomp, cidcomp, maxcid));
 #endif
@@ -1014,6 +1334,53 @@ int sifvjcomp(
 	return 0;
 }
 
+/*
+ * sifiphc - config IP header compression.  The parameters are those
+ * requested by the peer for our compressor.  TCP is compressed by the
+ * VJ code which must then always send the context ID and use no more
+ * slots than the peer's TCP_SPACE allows.  rcvEnable is set if the peer
+ * agreed to compress for us.
+ */
+#pragma argsused
+int sifiphc(
+	int pd, 
+	int enable, 
+	int rcvEnable, 
+	u_int tcpSpace, 
+	u_int nonTcpSpace, 
+	u_int fMaxPeriod, 
+	u_int fMaxTime, 
+	u_int maxHeader
+)
+{
+#if IPHC_SUPPORT > 0
+	PPPControl *pc = &pppControl[pd];
+	
+	if (enable || rcvEnable) {
+		iphc_init(&pc->iphcComp);
+		pc->iphcComp.tcpSpace = tcpSpace;
+		pc->iphcComp.nonTcpSpace = nonTcpSpace;
+		pc->iphcComp.fMaxPeriod = fMaxPeriod;
+		pc->iphcComp.fMaxTime = fMaxTime;
+		pc->iphcComp.maxHeader = maxHeader;
+	}
+	if (enable) {
+		pc->vjComp.compressSlot = 0;
+		vj_compress_slots(&pc->vjComp, MIN(tcpSpace, MAX_SLOTS - 1));
+	}
+	if (rcvEnable) {
+		/* Forget any TCP contexts from an earlier session. */
+		memset(pc->vjComp.rstate, 0, sizeof(pc->vjComp.rstate));
+	}
+	pc->iphcEnabled = enable;
+	pc->iphcRcvEnabled = rcvEnable;
+	PPPDEBUG((LOG_INFO, TL_PPP, "sifiphc: IPHC enable=%d rcv=%d tcp=%u non-tcp=%u period=%u time=%u max=%u",
+				enable, rcvEnable, tcpSpace, nonTcpSpace, fMaxPeriod, fMaxTime, maxHeader));
+#endif
+
+	return 0;
+}
+
 /*
  * sifup - Config the interface up and enable IP packets to pass.
  */
@@ -1070,7 +1437,8 @@ int sifaddr(
 	u_int32_t m			/* IP broadcast address ??? */
 )
 {
-	return 1;
+	/* Add a host route to the peer. */
+	return ipRouteAdd(h, 32, 0, IFT_PPP, u, 0, 0) >= 0;
 }
 
 /*
@@ -1084,6 +1452,7 @@ int cifaddr(
 	u_int32_t h		/* IP broadcast address ??? */
 )
 {
+	ipRouteDelIf(IFT_PPP, u);
 	return 1;
 }
 
@@ -1103,7 +1472,7 @@ int sifdefaultroute(int u, u_int32_t l, u_int32_t g)
 #pragma argsused
 int cifdefaultroute(int u, u_int32_t l, u_int32_t g)
 {
-	ipClearDefault();
+	ipRouteDel(0, 0, IFT_PPP, u);
 	return !0;
 }
 
@@ -1149,101 +1518,20 @@ static void pppMain(void *pd)
  */
 static void pppDispatch(int pd, NBuf *nb, u_int protocol)
 {
+	PPPProto *pp;
+	
 	if (nb != NULL) {
-		switch(protocol) {
-		case PPP_LCP:			/* Link Control Protocol */
+		pcapCAPTURE(pd, PCAP_IN, protocol, nb);
+		if ((pp = pppProtoLookup(protocol)) != NULL && pp->handler != NULL) {
 			PPPDEBUG((pppControl[pd].traceOffset + LOG_INFO, TL_PPP,
-						"pppDispatch[%d]: lcp in %d:%.*H", 
-						pd, nb->len, MIN(nb->len * 2, 40), nb->data));
-			/* XXX Assume that LCP packet fits in single nBuf. */
-			lcp_protent.input(pd, nb->data, nb->len);
-			nFreeChain(nb);
-		    break;
-		case PPP_IPCP:			/* IP Control Protocol */
-			PPPDEBUG((pppControl[pd].traceOffset + LOG_INFO, TL_PPP,
-						"pppDispatch[%d]: ipcp in %d:%.*H", 
-						pd, nb->len, MIN(nb->len * 2, 40), nb->data));
-			/* XXX Assume that IPCP packet fits in single nBuf. */
-			ipcp_protent.input(pd, nb->data, nb->len);
-			nFreeChain(nb);
-			break;
-		case PPP_PAP:			/* Password Authentication Protocol */
-			PPPDEBUG((pppControl[pd].traceOffset + LOG_INFO, TL_PPP,
-						"pppDispatch[%d]: pap in %d:%.*H", 
-						pd, nb->len, MIN(nb->len * 2, 40), nb->data));
-			pap_protent.input(pd, nb->data, nb->len);
-			nFreeChain(nb);
-		    break;
-		case PPP_VJC_COMP:		/* VJ compressed TCP */
-#if VJ_SUPPORT > 0
-			PPPDEBUG((pppControl[pd].traceOffset + LOG_INFO, TL_PPP,
-						"pppDispatch[%d]: vj_comp in %d:%.*H", 
-						pd, nb->len, MIN(nb->len * 2, 40), nb->data));
-			/* 
-			 * Clip off the VJ header and prepend the rebuilt TCP/IP header and
-			 * pass the result to IP.
-			 */
-			if (vj_uncompress_tcp(&nb, &pppControl[pd].vjComp) >= 0) {
-				ipInput(nb, IFT_PPP, pd);
-			} else {
-				/* Something's wrong so drop it. */
-				PPPDEBUG((pppControl[pd].traceOffset + LOG_WARNING, TL_PPP,
-							"pppDispatch[%d]: Dropping VJ compressed", pd));
-				nFreeChain(nb);
-			}
-#else
-			/* No handler for this protocol so drop the packet. */
-			PPPDEBUG((pppControl[pd].traceOffset + LOG_INFO, TL_PPP,
-						"pppDispatch[%d]: drop VJ Comp in %d:.*H", 
-						pd, nb->len, MIN(nb->len * 2, 40), nb->data));
-			nFreeChain(nb);
-#if STATS_SUPPORT > 0
-			pppStats.PPPderrors++;
-#endif
-#endif
-			break;
-		case PPP_VJC_UNCOMP:	/* VJ uncompressed TCP */
-#if VJ_SUPPORT > 0
-			PPPDEBUG((pppControl[pd].traceOffset + LOG_INFO, TL_PPP,
-						"pppDispatch[%d]: vj_un in %d:%.*H", 
-						pd, nb->len, MIN(nb->len * 2, 40), nb->data));
-			/* 
-			 * Process the TCP/IP header for VJ header compression and then pass
-			 * the packet to IP.
-			 */
-			if (vj_uncompress_uncomp(nb, &pppControl[pd].vjComp) >= 0) {
-				ipInput(nb, IFT_PPP, pd);
-			} else {
-				/* Something's wrong so drop it. */
-				PPPDEBUG((pppControl[pd].traceOffset + LOG_WARNING, TL_PPP,
-							"pppDispatch[%d]: Dropping VJ uncompressed", pd));
-				nFreeChain(nb);
-			}
-#else
-			/* No handler for this protocol so drop the packet. */
-			PPPDEBUG((pppControl[pd].traceOffset + LOG_INFO, TL_PPP,
-						"pppDispatch[%d]: drop VJ UnComp in %d:.*H", 
-						pd, nb->len, MIN(nb->len * 2, 40), nb->data));
-			nFreeChain(nb);
-#if STATS_SUPPORT > 0
-			pppStats.PPPderrors++;
-#endif
-#endif
-			break;
-		case PPP_IP:			/* Internet Protocol */
-			PPPDEBUG((pppControl[pd].traceOffset + LOG_INFO, TL_PPP,
-						"pppDispatch[%d]: ip in %d:%.*H", 
-						pd, nb->len, MIN(nb->len * 2, 40), nb->data));
-			ipInput(nb, IFT_PPP, pd);
-			break;
-		case PPP_AT:			/* AppleTalk Protocol */
-		case PPP_COMP:			/* compressed packet */
-		case PPP_ATCP:			/* AppleTalk Control Protocol */
-		case PPP_CCP:			/* Compression Control Protocol */
-		case PPP_LQR:			/* Link Quality Report protocol */
-		case PPP_CHAP:			/* Cryptographic Handshake Auth. Protocol */
-		case PPP_CBCP:			/* Callback Control Protocol */
-		default:
+						"pppDispatch[%d]: 0x%X in %d:%.*H", 
+						pd, protocol, nb->len, MIN(nb->len * 2, 40), nb->data));
+			OS_ENTER_CRITICAL();
+			pp->stats.packets++;
+			pp->stats.bytes += nb->chainLen;
+			OS_EXIT_CRITICAL();
+			(*pp->handler)(pd, nb, pp->arg);
+		} else {
 			/* No handler for this protocol so drop the packet. */
 			PPPDEBUG((pppControl[pd].traceOffset + LOG_INFO, TL_PPP,
 						"pppDispatch[%d]: drop 0x%X in %d:%.*H", 
@@ -1251,12 +1539,234 @@ static void pppDispatch(int pd, NBuf *nb, u_int protocol)
 			nFreeChain(nb);
 #if STATS_SUPPORT > 0
 			pppStats.PPPderrors++;
+			pppLinkCnt[pd].inDiscards++;
 #endif
-			break;
 		}
 	}
 }
 
+/*
+ * Find a protocol's dispatch table entry.
+ * Return NULL if the protocol isn't registered.
+ */
+static PPPProto *pppProtoLookup(u_int protocol)
+{
+	PPPProto *pp;
+	u_int i;
+	
+	if (NETPROTO_P(protocol)) {
+		i = pppNetProtoIdx[NETPROTOIDX(protocol)];
+		return i != 0 && (protocol & 0x01) ? &pppProtoTbl[i - 1] : NULL;
+	}
+	for (i = 0; i < MAXPROTOS; i++) {
+		pp = &pppProtoTbl[i];
+		if (pp->protocol == protocol)
+			return pp;
+		if (pp->protocol == 0)
+			break;
+	}
+	return NULL;
+}
+
+/*
+ * Pass a control protocol packet to its protocol module.
+ */
+static void pppCtlInput(int pd, NBuf *nb, void *arg)
+{
+	/* XXX Assume that the control packet fits in a single nBuf. */
+	((struct protent *)arg)->input(pd, nb->data, nb->len);
+	nFreeChain(nb);
+}
+
+/*
+ * Pass an IP packet up to IP.
+ */
+#pragma argsused
+static void pppIPInput(int pd, NBuf *nb, void *arg)
+{
+	pppIPQueue(pd, nb);
+}
+
+#if VJ_SUPPORT > 0
+/*
+ * Clip off the VJ header and prepend the rebuilt TCP/IP header and
+ * pass the result to IP.
+ */
+#pragma argsused
+static void pppVJCInput(int pd, NBuf *nb, void *arg)
+{
+	if (vj_uncompress_tcp(&nb, &pppControl[pd].vjComp) >= 0) {
+		pppIPQueue(pd, nb);
+	} else {
+		/* Something's wrong so drop it. */
+		PPPDEBUG((pppControl[pd].traceOffset + LOG_WARNING, TL_PPP,
+					"pppDispatch[%d]: Dropping VJ compressed", pd));
+		nFreeChain(nb);
+	}
+}
+
+/*
+ * Process the TCP/IP header for VJ header compression and then pass
+ * the packet to IP.
+ */
+#pragma argsused
+static void pppVJUInput(int pd, NBuf *nb, void *arg)
+{
+	if (vj_uncompress_uncomp(nb, &pppControl[pd].vjComp) >= 0) {
+		pppIPQueue(pd, nb);
+	} else {
+		/* Something's wrong so drop it. */
+		PPPDEBUG((pppControl[pd].traceOffset + LOG_WARNING, TL_PPP,
+					"pppDispatch[%d]: Dropping VJ uncompressed", pd));
+		nFreeChain(nb);
+	}
+}
+#endif
+
+#if IPHC_SUPPORT > 0
+/*
+ * Restore an IPHC full header packet and pass it to IP.
+ */
+#pragma argsused
+static void pppFullHdrInput(int pd, NBuf *nb, void *arg)
+{
+	PPPControl *pc = &pppControl[pd];
+	
+	if (!pc->iphcRcvEnabled) {
+		PPPDEBUG((pc->traceOffset + LOG_WARNING, TL_PPP,
+					"pppDispatch[%d]: IPHC not negotiated", pd));
+		nFreeChain(nb);
+	} else if (iphc_uncompress_full(&pc->iphcComp, &pc->vjComp, &nb) >= 0) {
+		pppIPQueue(pd, nb);
+	} else {
+		/* The packet has been freed. */
+		PPPDEBUG((pc->traceOffset + LOG_WARNING, TL_PPP,
+					"pppDispatch[%d]: Dropping IPHC full header", pd));
+	}
+}
+
+/*
+ * Rebuild an IPHC compressed TCP header and pass the packet to IP.
+ */
+#pragma argsused
+static void pppCompTCPInput(int pd, NBuf *nb, void *arg)
+{
+	PPPControl *pc = &pppControl[pd];
+	
+	if (!pc->iphcRcvEnabled) {
+		PPPDEBUG((pc->traceOffset + LOG_WARNING, TL_PPP,
+					"pppDispatch[%d]: IPHC not negotiated", pd));
+		nFreeChain(nb);
+	} else if (iphc_uncompress_tcp(&pc->iphcComp, &pc->vjComp, &nb) >= 0) {
+		pppIPQueue(pd, nb);
+	} else {
+		/* The packet has been freed. */
+		PPPDEBUG((pc->traceOffset + LOG_WARNING, TL_PPP,
+					"pppDispatch[%d]: Dropping IPHC compressed TCP", pd));
+		pppCtxStateOutput(pd);
+	}
+}
+
+/*
+ * Rebuild an IPHC compressed TCP header without deltas and pass the
+ * packet to IP.
+ */
+#pragma argsused
+static void pppCompTCPNDInput(int pd, NBuf *nb, void *arg)
+{
+	PPPControl *pc = &pppControl[pd];
+	
+	if (!pc->iphcRcvEnabled) {
+		PPPDEBUG((pc->traceOffset + LOG_WARNING, TL_PPP,
+					"pppDispatch[%d]: IPHC not negotiated", pd));
+		nFreeChain(nb);
+	} else if (iphc_uncompress_tcpnd(&pc->iphcComp, &pc->vjComp, &nb) >= 0) {
+		pppIPQueue(pd, nb);
+	} else {
+		/* The packet has been freed. */
+		PPPDEBUG((pc->traceOffset + LOG_WARNING, TL_PPP,
+					"pppDispatch[%d]: Dropping IPHC compressed TCP no delta", pd));
+		pppCtxStateOutput(pd);
+	}
+}
+
+/*
+ * Rebuild an IPHC compressed non-TCP header and pass the packet to IP.
+ */
+#pragma argsused
+static void pppCompNonTCPInput(int pd, NBuf *nb, void *arg)
+{
+	PPPControl *pc = &pppControl[pd];
+	
+	if (!pc->iphcRcvEnabled) {
+		PPPDEBUG((pc->traceOffset + LOG_WARNING, TL_PPP,
+					"pppDispatch[%d]: IPHC not negotiated", pd));
+		nFreeChain(nb);
+	} else if (iphc_uncompress_nontcp(&pc->iphcComp, &nb) >= 0) {
+		pppIPQueue(pd, nb);
+	} else {
+		/* The packet has been freed. */
+		PPPDEBUG((pc->traceOffset + LOG_WARNING, TL_PPP,
+					"pppDispatch[%d]: Dropping IPHC compressed non-TCP", pd));
+	}
+}
+
+/*
+ * The peer has lost TCP context so refresh all our TCP contexts.
+ */
+#pragma argsused
+static void pppCtxStateInput(int pd, NBuf *nb, void *arg)
+{
+	PPPControl *pc = &pppControl[pd];
+	
+	if (pc->iphcEnabled)
+		iphc_context_state(&pc->iphcComp, &pc->vjComp);
+	nFreeChain(nb);
+}
+
+/*
+ * Ask the peer to refresh the TCP contexts we have lost if it's time.
+ */
+static void pppCtxStateOutput(int pd)
+{
+	PPPControl *pc = &pppControl[pd];
+	NBuf *nb;
+	
+	if ((nb = iphc_context_request(&pc->iphcComp)) != NULL) {
+		PPPDEBUG((pc->traceOffset + LOG_INFO, TL_PPP,
+					"pppCtxStateOutput[%d]: Requesting %u contexts", pd, 
+					nb->len - 2));
+		pppOutput(pd, PPP_CTXSTATE, nb);
+	}
+}
+#endif
+
+
+/*
+ * Hold an IP packet to be passed to IP with the rest of the packets
+ * received in the same input call.
+ */
+static void pppIPQueue(int pd, NBuf *nb)
+{
+	PPPControl *pc = &pppControl[pd];
+	
+	pc->ipBurst[pc->ipBurstLen++] = nb;
+	if (pc->ipBurstLen == IP_MAXBURST)
+		pppIPFlush(pd);
+}
+
+/*
+ * Pass the held IP packets to IP as a burst.
+ */
+static void pppIPFlush(int pd)
+{
+	PPPControl *pc = &pppControl[pd];
+	
+	if (pc->ipBurstLen) {
+		ipInputBurst(pc->ipBurst, pc->ipBurstLen, IFT_PPP, pd);
+		pc->ipBurstLen = 0;
+	}
+}
 
 /*
  * Drop the input packet.
@@ -1287,6 +1797,10 @@ static void pppInProc(int pd, u_char *s, int l)
 	NBuf *nextNBuf;
 	u_char curChar;
 
+#if STATS_SUPPORT > 0
+	pppStats.PPPibytes += l;
+	pppLinkCnt[pd].inOctets += l;
+#endif
 	while (l-- > 0) {
 		curChar = *s++;
 		
@@ -1319,6 +1833,7 @@ static void pppInProc(int pd, u_char *s, int l)
 					pppDrop(pc);
 #if STATS_SUPPORT > 0
 					pppStats.PPPierrors++;
+					pppLinkCnt[pd].inErrors++;
 #endif
 				}
 				/* Otherwise it's a good packet so pass it on. */
@@ -1330,14 +1845,19 @@ static void pppInProc(int pd, u_char *s, int l)
 					/* Update the packet header. */
 					pc->inHead->chainLen = pc->inLen;
 					
+					/* 
+					 * Count the packet before dispatching it so that a
+					 * Link-Quality-Report sees itself in the counters.
+					 */
+#if STATS_SUPPORT > 0
+					pppStats.PPPipackets++;
+					pppLinkCnt[pd].inPackets++;
+#endif
+
 					/* Dispatch the packet thereby consuming it. */
 					pppDispatch(pd, pc->inHead, pc->inProtocol);
 					pc->inHead = NULL;
 					pc->inTail = NULL;
-
-#if STATS_SUPPORT > 0
-					pppStats.PPPipackets++;
-#endif
 				}
 					
 				/* Prepare for a new packet. */
@@ -1408,8 +1928,24 @@ static void pppInProc(int pd, u_char *s, int l)
 				pc->inState = PDDATA;
 				break;
 			case PDDATA:					/* Process data byte. */
+				/* 
+				 * Drop anything longer than the MRU negotiated for the link
+				 * before it drains the buffer pool.
+				 */
+				if (pc->inHead != NULL && pc->inLen >= pc->mru + PPP_FCSLEN) {
+					PPPDEBUG((pc->traceOffset + LOG_WARNING, TL_PPP,
+								"pppInProc[%d]: Dropping oversize packet proto=x%X", 
+								pd, pc->inProtocol));
+					pppDrop(pc);
+#if STATS_SUPPORT > 0
+					pppStats.PPPierrors++;
+					pppLinkCnt[pd].inErrors++;
+#endif
+					pc->inState = PDSTART;	/* Wait for flag sequence. */
+					pc->inFCS = PPP_INITFCS;
+				}
 				/* Make space to receive processed data. */
-				if (pc->inTail == NULL || nTRAILINGSPACE(pc->inTail) <= 0) {
+				else if (pc->inTail == NULL || nTRAILINGSPACE(pc->inTail) <= 0) {
 					/* If we haven't started a packet, we need a packet header. */
 					nGET(nextNBuf);
 					if (nextNBuf == NULL) {
@@ -1421,6 +1957,12 @@ static void pppInProc(int pd, u_char *s, int l)
 						pc->inState = PDSTART;	/* Wait for flag sequence. */
 						pc->inFCS = PPP_INITFCS;
 					} else {
+						/*
+						 * Leave room ahead of a compressed header so that
+						 * the rebuilt header goes in front of it in place.
+						 */
+						if (pc->inHead == NULL && COMPHDR_P(pc->inProtocol))
+							nextNBuf->data = nextNBuf->body + PPP_RXHEADROOM;
 						*(nextNBuf->data) = curChar;
 						nextNBuf->len = 1;
 						nextNBuf->nextBuf = NULL;
@@ -1446,6 +1988,157 @@ static void pppInProc(int pd, u_char *s, int l)
 	}
 }
 
+/*
+ * Process a whole frame received from a packet device.
+ */
+static void pppSyncInput(int pd, NBuf *nb)
+{
+	PPPControl *pc = &pppControl[pd];
+	u_int len, protocol;
+	int hLen;
+	u_char *sPtr;
+	
+	len = nChainLen(nb);
+#if STATS_SUPPORT > 0
+	pppStats.PPPibytes += len;
+	pppLinkCnt[pd].inOctets += len;
+#endif
+	/* Check and trim off the FCS. */
+	if (!(pc->framing & PPPFRAME_NOFCS)) {
+		if (len <= PPP_FCSLEN || pppChainFCS(nb) != PPP_GOODFCS) {
+			PPPDEBUG((pc->traceOffset + LOG_INFO, TL_PPP,
+						"pppSyncInput[%d]: Dropping bad fcs", pd));
+			nFreeChain(nb);
+#if STATS_SUPPORT > 0
+			pppStats.PPPierrors++;
+			pppLinkCnt[pd].inErrors++;
+#endif
+			return;
+		}
+		nTrim(NULL, &nb, -PPP_FCSLEN);
+		len -= PPP_FCSLEN;
+	}
+	
+	/* Parse the address, control and protocol fields. */
+	if (len > pc->mru + PPP_HDRLEN
+			|| (nb = nPullup(nb, MIN(len, PPP_HDRLEN))) == NULL) {
+		PPPDEBUG((pc->traceOffset + LOG_WARNING, TL_PPP,
+					"pppSyncInput[%d]: Dropping bad length %u", pd, len));
+		if (nb)
+			nFreeChain(nb);
+#if STATS_SUPPORT > 0
+		pppStats.PPPierrors++;
+		pppLinkCnt[pd].inErrors++;
+#endif
+		return;
+	}
+	sPtr = nBUFTOPTR(nb, u_char *);
+	hLen = 0;
+	if (len >= 2 && sPtr[0] == PPP_ALLSTATIONS && sPtr[1] == PPP_UI)
+		hLen = 2;
+	if (hLen < len && (sPtr[hLen] & 1))
+		protocol = sPtr[hLen++];
+	else if (hLen + 1 < len && (sPtr[hLen + 1] & 1)) {
+		protocol = ((u_int)sPtr[hLen] << 8) | sPtr[hLen + 1];
+		hLen += 2;
+	} else {
+		PPPDEBUG((pc->traceOffset + LOG_WARNING, TL_PPP,
+					"pppSyncInput[%d]: Dropping bad header", pd));
+		nFreeChain(nb);
+#if STATS_SUPPORT > 0
+		pppStats.PPPierrors++;
+		pppLinkCnt[pd].inErrors++;
+#endif
+		return;
+	}
+	nb->chainLen = len;
+	nTrim(NULL, &nb, hLen);
+	
+	/* Dispatch the packet thereby consuming it. */
+	if (nb != NULL) {
+#if STATS_SUPPORT > 0
+		pppStats.PPPipackets++;
+		pppLinkCnt[pd].inPackets++;
+#endif
+		pppDispatch(pd, nb, protocol);
+	}
+}
+
+/*
+ * Add the FCS if required and pass a complete frame to a packet device.
+ * If nb is NULL, the frame couldn't be built.
+ * Return 0 on success, an error code on failure.
+ */
+static int pppSyncOutput(int pd, NBuf *nb)
+{
+	PPPControl *pc = &pppControl[pd];
+	NBuf *tnb;
+	u_int fcsOut, n;
+	int st = 0;
+	
+	if (nb != NULL && !(pc->framing & PPPFRAME_NOFCS)) {
+		fcsOut = ~pppChainFCS(nb);
+		for (tnb = nb; tnb->nextBuf; tnb = tnb->nextBuf);
+		if (nTRAILINGSPACE(tnb) < PPP_FCSLEN) {
+			nGET(tnb->nextBuf);
+			if ((tnb = tnb->nextBuf) != NULL)
+				tnb->len = 0;
+		}
+		if (tnb == NULL) {
+			nFreeChain(nb);
+			nb = NULL;
+		} else {
+			tnb->data[tnb->len++] = fcsOut & 0xFF;
+			tnb->data[tnb->len++] = (fcsOut >> 8) & 0xFF;
+			nb->chainLen += PPP_FCSLEN;
+		}
+	}
+	
+	if (nb == NULL) {
+		PPPDEBUG((pc->traceOffset + LOG_WARNING, TL_PPP,
+					"pppSyncOutput[%d]: Alloc err - dropping", pd));
+		st = PPPERR_ALLOC;
+#if STATS_SUPPORT > 0
+		pppStats.PPPoerrors++;
+#endif
+	} else {
+		n = nb->chainLen;
+		if (nPut(pc->fd, nb) < 0) {
+			st = PPPERR_DEVICE;
+#if STATS_SUPPORT > 0
+			pppStats.PPPoerrors++;
+#endif
+		}
+#if STATS_SUPPORT > 0
+		else {
+			pppStats.PPPobytes += n;
+			pppLinkCnt[pd].outOctets += n;
+			pppStats.PPPopackets++;
+			pppLinkCnt[pd].outPackets++;
+		}
+#endif
+	}
+	
+	return st;
+}
+
+/*
+ * Return the running FCS over an nBuf chain.
+ */
+static u_int pppChainFCS(NBuf *nb)
+{
+	u_int fcs = PPP_INITFCS;
+	u_char *sPtr;
+	int n;
+	
+	for (; nb; nb = nb->nextBuf) {
+		sPtr = nBUFTOPTR(nb, u_char *);
+		for (n = nb->len; n > 0; n--)
+			fcs = PPP_FCS(fcs, *sPtr++);
+	}
+	return fcs;
+}
+
 /* 
  * pppMPutC - append given character to end of given nBuf.  If the character
  * needs to be escaped, do so.  If nBuf is full, append another.
@@ -40,7 +40,7 @@
 /* Configuration. */
 #define DEFMRU	296		/* Try for this */
 #define MINMRU	128		/* No MRUs below this */
-#define MAXMRU	512		/* Normally limit MRU to this */
+#define MAXMRU	PPP_MAXMRU	/* Normally limit MRU to this */
 
 /* Error codes. */
 #define PPPERR_PARAM -1				/* Invalid parameter. */
@@ -63,6 +63,22 @@
 #define PPPCTLS_ERRCODE 101		// Set the error code
 #define PPPCTLG_ERRCODE 102		// Get the error code
 #define	PPPCTLG_FD		103		// Get the fd associated with the ppp
+#define PPPCTLG_LINKQUAL 104	// Get the link quality into a PPPLinkQual
+#define PPPCTLG_VJSTATS	105		// Get the VJ compression stats into a VJStats
+#define PPPCTLG_IPHCSTATS 106	// Get the IP header compression stats into an IPHCStats
+
+/*
+ * Space left ahead of received data for rebuilding compressed headers.
+ * Enough for IP and TCP headers with a timestamp option.
+ */
+#define PPP_RXHEADROOM	52
+
+/*
+ * Framing modes for pppOpenFramed().
+ */
+#define PPPFRAME_ASYNC	0		// Async HDLC-like framing (RFC 1662)
+#define PPPFRAME_SYNC	1		// Device delimits frames - no flags or escapes
+#define PPPFRAME_NOFCS	2		// With PPPFRAME_SYNC, no FCS either
 
 /************************
 *** PUBLIC DATA TYPES ***
@@ -88,17 +104,52 @@ typedef struct {
 #define PPPopackets	ppp_opackets.val	/* packets sent */
 #define PPPoerrors	ppp_oerrors.val		/* transmit errors */
 
+/*
+ * Link quality estimates from LCP echos and Link Quality Reports.  Times
+ * are in milliseconds and the echo loss rate is in 1/256ths.  The LQR
+ * packet counts are for the last reporting interval.
+ */
+typedef struct {
+	u_long echoRTT;					/* Last echo round trip time. */
+	u_long echoSRTT;				/* Smoothed echo round trip time. */
+	u_long echoRTTVar;				/* Echo round trip mean deviation. */
+	u_long echoSent;				/* Echo requests sent. */
+	u_long echoRcvd;				/* Echo replies received. */
+	u_int  echoLoss;				/* Smoothed echo loss rate. */
+	u_long lqrSent;					/* Link quality reports sent. */
+	u_long lqrRcvd;					/* Link quality reports received. */
+	u_long outPackets;				/* Packets we sent. */
+	u_long outLost;					/* Packets we sent that the peer missed. */
+	u_long inPackets;				/* Packets the peer sent. */
+	u_long inLost;					/* Packets the peer sent that we missed. */
+} PPPLinkQual;
+
+/*
+ * Per unit link counters for Link Quality Monitoring (RFC 1989).  The
+ * totals for all units are in pppStats.
+ */
 typedef struct {
-    DiagStat vjs_packets;			/* outbound packets */
-    DiagStat vjs_compressed;		/* outbound compressed packets */
-    DiagStat vjs_searches;			/* searches for connection state */
-    DiagStat vjs_misses;			/* times couldn't find conn. state */
-    DiagStat vjs_uncompressedin;	/* inbound uncompressed packets */
-    DiagStat vjs_compressedin;		/* inbound compressed packets */
-    DiagStat vjs_errorin;			/* inbound unknown type packets */
-    DiagStat vjs_tossed;			/* inbound packets tossed because of error */
-} VJStats;
+	u_long inPackets;				/* Packets received. */
+	u_long inOctets;				/* Bytes received. */
+	u_long inErrors;				/* Packets received with errors. */
+	u_long inDiscards;				/* Packets received but not dispatched. */
+	u_long outPackets;				/* Packets sent. */
+	u_long outOctets;				/* Bytes sent. */
+} PPPLinkCnt;
 
+/*
+ * Input handler for a PPP protocol.  The handler takes ownership of the
+ * packet chain and must pass it on or free it.
+ */
+typedef void (*PPPProtoHandler)(int pd, NBuf *nb, void *arg);
+
+/*
+ * Per protocol input counters.
+ */
+typedef struct {
+	u_long packets;					/* Packets dispatched. */
+	u_long bytes;					/* Bytes dispatched. */
+} PPPProtoStats;
 
 struct compstats {
     DiagStat unc_bytes;				/* total uncompressed bytes */
@@ -124,7 +175,9 @@ struct ppp_comp_stats {
 extern u_char outpacket_buf[NUM_PPP][PPP_MRU+PPP_HDRLEN];
 #if STATS_SUPPORT > 0
 extern PPPStats pppStats;			/* Statistics. */
+extern PPPLinkCnt pppLinkCnt[NUM_PPP];	/* Per unit link counters. */
 #endif
+extern PPPLinkQual pppLinkQual[NUM_PPP];	/* Link quality estimates. */
 
 
 /***********************
@@ -143,6 +196,15 @@ void pppInit(void);
  */
 int pppOpen(int fd);
 
+/*
+ * Open a new PPP connection as for pppOpen() but with the given framing
+ * mode.  With PPPFRAME_SYNC each nBuf chain passed to and from the
+ * device is exactly one frame so nothing is escaped or flagged and
+ * outgoing packets are sent in place.  Both ends must agree on the
+ * framing since it isn't negotiated.
+ */
+int pppOpenFramed(int fd, int framing);
+
 /*
  * Close a PPP connection and release the descriptor. 
  * Any outstanding packets in the queues are dropped.
@@ -152,6 +214,10 @@ int pppClose(int pd);
 
 /*
  * Send a packet on the given connection.
+ * The device's nPut() takes ownership of the frame and must return a
+ * negative value if it can't queue it.  Network layer packets are
+ * refused with PPPERR_ALLOC while the device is holding so many buffers
+ * that link control traffic could be starved.
  * Return 0 on success, an error code on failure. 
  */
 int pppOutput(int pd, u_short protocol, NBuf *nb);
@@ -159,7 +225,10 @@ int pppOutput(int pd, u_short protocol, NBuf *nb);
 /*
  * Process an mbuf chain received on given connection.
  * The mbuf chain is always passed on or freed making the original
- * parameter invalid.
+ * parameter invalid.  A packet device should start frames at least
+ * PPP_RXHEADROOM bytes into the first nBuf so that compressed TCP/IP
+ * headers can be rebuilt in place.  It may pass several frames at once
+ * linked by nextChain.
  * Return 0 on success, an error code on failure. 
  */
 int pppInput(int pd, NBuf *nb);
@@ -175,10 +244,24 @@ int  pppIOCtl(int pd, int cmd, void *arg);
  */
 u_int pppMTU(int pd);
 
+/*
+ * Register the input handler for a PPP protocol, replacing any current
+ * handler.  A NULL handler drops the protocol's packets.  The control
+ * protocols in the protocol table and IP are registered by pppInit().
+ * Return 0 on success, an error code on failure.
+ */
+int pppRegister(u_int protocol, PPPProtoHandler handler, void *arg);
+
+/*
+ * Get the input counters for a registered protocol.
+ * Return 0 on success, an error code if the protocol isn't registered.
+ */
+int pppProtoStats(u_int protocol, PPPProtoStats *ps);
+
 /*
  * Write n characters to a ppp link.
  *	RETURN: >= 0 Number of characters written
- *		 	 -1 Failed to write to device
+ *		 	 < 0 Failed to write to device
  */
 int pppWrite(int pd, const char *s, int n);
 
@@ -193,6 +276,10 @@ int  get_idle_time __P((int, struct ppp_idle *));
 
 /* Configure VJ TCP header compression */
 int  sifvjcomp __P((int, int, int, int));
+/* Configure IP header compression */
+int  sifiphc(int pd, int enable, int rcvEnable, u_int tcpSpace, 
+				u_int nonTcpSpace, u_int fMaxPeriod, u_int fMaxTime, 
+				u_int maxHeader);
 /* Configure i/f down (for IP) */
 int  sifup __P((int));		
 /* Set mode for handling packets for proto */
@@ -0,0 +1,472 @@
+/*****************************************************************************
+* netroute.c - Network IP Routing Table program file.
+*
+* The authors hereby grant permission to use, copy, modify, distribute,
+* and license this software and its documentation for any purpose, provided
+* that existing copyright notices are retained in all copies and that this
+* notice and the following disclaimer are included verbatim in any
+* distributions. No written agreement, license, or royalty fee is required
+* for any of the authorized uses.
+*
+* THIS SOFTWARE IS PROVIDED BY THE CONTRIBUTORS *AS IS* AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+* IN NO EVENT SHALL THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+* NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+* THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+******************************************************************************
+* THEORY OF OPERATION
+*
+*   Each trie node holds a prefix and, if any routes use that prefix, the
+* list of those routes.  Nodes without routes only exist where two
+* prefixes diverge so there are never more than two nodes per route.  A
+* node's children are chosen by the first address bit after its prefix.
+*
+*   The table is changed and searched with interrupts disabled.  Lookups
+* copy the route out so that callers never hold a pointer into the table.
+*****************************************************************************/
+
+#include "netconf.h"
+#include <string.h>
+#include "net.h"
+#include "netbuf.h"
+#include "nettimer.h"
+#include "netip.h"
+#include "netroute.h"
+
+#include <stdio.h>
+#include "netdebug.h"
+
+
+/*************************/
+/*** LOCAL DEFINITIONS ***/
+/*************************/
+#define MAXRTNODES (2 * MAXROUTES)		/* Trie nodes needed for MAXROUTES. */
+
+/* The mask for a prefix length in host byte order. */
+#define PFXMASK(len) ((len) ? (u_int32_t)(0xFFFFFFFFUL << (32 - (len))) : 0UL)
+
+/* Bit n of a host order address counting from the most significant. */
+#define PFXBIT(a, n) ((u_int)(((a) >> (31 - (n))) & 1))
+
+
+/************************/
+/*** LOCAL DATA TYPES ***/
+/************************/
+/*
+ * A trie node.  The key is in host byte order and masked to len bits.
+ */
+typedef struct RouteNode_s {
+	struct RouteNode_s *child[2];	/* Subtries by the bit after the prefix. */
+	Route	*routes;				/* Routes for the prefix, NULL for a branch. */
+	u_int32_t key;					/* Prefix in host byte order. */
+	u_char	len;					/* Prefix length. */
+} RouteNode;
+
+/*
+ * A path MTU cache entry.  The entry is free if mtu is zero.
+ */
+typedef struct PMTUEntry_s {
+	u_int32_t dst;					/* Destination. */
+	u_int	mtu;					/* Path MTU. */
+	u_long	expire;					/* Time in ms when the entry expires. */
+} PMTUEntry;
+
+
+/***********************************/
+/*** LOCAL FUNCTION DECLARATIONS ***/
+/***********************************/
+static RouteNode *rtNodeGet(u_int32_t key, u_int len);
+static RouteNode **rtNodeFind(u_int32_t key, u_int len, RouteNode ***parent);
+static void rtNodePrune(RouteNode **np, RouteNode **pp);
+static u_int rtCommonLen(u_int32_t a, u_int32_t b, u_int maxLen);
+
+
+/*****************************/
+/*** LOCAL DATA STRUCTURES ***/
+/*****************************/
+static Route routeTbl[MAXROUTES];		/* The routes. */
+static Route *routeFreeList;			/* Free routes. */
+static RouteNode rtNodeTbl[MAXRTNODES];	/* The trie nodes. */
+static RouteNode *rtNodeFreeList;		/* Free nodes linked by child[0]. */
+static u_int rtNodesFree;				/* Nodes on the free list. */
+static RouteNode *rtRoot;				/* The trie. */
+static u_int32_t rtCacheDst;			/* Last destination looked up. */
+static Route *rtCacheRt;				/* Its route, NULL if invalid. */
+static PMTUEntry pmtuTbl[PMTU_ENTRIES];	/* The path MTU cache. */
+
+
+/***********************************/
+/*** PUBLIC FUNCTION DEFINITIONS ***/
+/***********************************/
+/*
+ * ipRouteInit - Initialize the routing table.
+ */
+void ipRouteInit(void)
+{
+	int i;
+
+	memset(routeTbl, 0, sizeof(routeTbl));
+	memset(rtNodeTbl, 0, sizeof(rtNodeTbl));
+	routeFreeList = NULL;
+	for (i = 0; i < MAXROUTES; i++) {
+		routeTbl[i].next = routeFreeList;
+		routeFreeList = &routeTbl[i];
+	}
+	rtNodeFreeList = NULL;
+	for (i = 0; i < MAXRTNODES; i++) {
+		rtNodeTbl[i].child[0] = rtNodeFreeList;
+		rtNodeFreeList = &rtNodeTbl[i];
+	}
+	rtNodesFree = MAXRTNODES;
+	rtRoot = NULL;
+	rtCacheRt = NULL;
+	memset(pmtuTbl, 0, sizeof(pmtuTbl));
+}
+
+/*
+ * ipRouteAdd - Add a route to a destination prefix through an interface.
+ * A route to the same prefix through the same interface is replaced.
+ * Return 0 on success, an error code on failure.
+ */
+int ipRouteAdd(
+	u_int32_t dst,				/* Destination prefix. */
+	u_int prefixLen,			/* Prefix length in bits (0 to 32). */
+	u_int32_t gateway,			/* Next hop or zero. */
+	IfType ifType,				/* Interface type. */
+	int ifID,					/* Interface ID. */
+	u_int mtu,					/* Route MTU or zero. */
+	u_int metric				/* Route metric. */
+)
+{
+	u_int32_t key = ntohl(dst) & PFXMASK(prefixLen);
+	RouteNode *n, **np, **pp;
+	Route *rt, **rp;
+	int st = 0;
+
+	if (prefixLen > 32 || ifType == IFT_UNSPEC)
+		return ROUTEERR_PARAM;
+
+	OS_ENTER_CRITICAL();
+	rtCacheRt = NULL;
+	if ((n = rtNodeGet(key, prefixLen)) == NULL)
+		st = ROUTEERR_ALLOC;
+	else {
+		/* Unlink any route through the same interface for reuse. */
+		for (rp = &n->routes; (rt = *rp) != NULL; rp = &rt->next) {
+			if (rt->ifType == ifType && rt->ifID == ifID) {
+				*rp = rt->next;
+				break;
+			}
+		}
+		if (!rt && (rt = routeFreeList) != NULL)
+			routeFreeList = rt->next;
+
+		if (!rt) {
+			/* Don't leave a new node without routes. */
+			st = ROUTEERR_ALLOC;
+			if ((np = rtNodeFind(key, prefixLen, &pp)) != NULL)
+				rtNodePrune(np, pp);
+		} else {
+			rt->dst = htonl(key);
+			rt->gateway = gateway;
+			rt->prefixLen = (u_char)prefixLen;
+			rt->ifType = ifType;
+			rt->ifID = ifID;
+			rt->mtu = mtu;
+			rt->metric = metric;
+
+			/* Keep the routes for the prefix in order of metric. */
+			for (rp = &n->routes; *rp && (*rp)->metric <= metric; rp = &(*rp)->next)
+				;
+			rt->next = *rp;
+			*rp = rt;
+		}
+	}
+	OS_EXIT_CRITICAL();
+
+	IPDEBUG((LOG_INFO, TL_IP, "ipRouteAdd: %s/%u via %s if %d.%d mtu %u metric %u st %d",
+				ip_ntoa(dst), prefixLen, ip_ntoa2(gateway),
+				ifType, ifID, mtu, metric, st));
+
+	return st;
+}
+
+/*
+ * ipRouteDel - Delete the route to a destination prefix through an
+ * interface.  IFT_UNSPEC deletes the routes through all interfaces.
+ * Return 0 on success, an error code if no route was found.
+ */
+int ipRouteDel(u_int32_t dst, u_int prefixLen, IfType ifType, int ifID)
+{
+	u_int32_t key = ntohl(dst) & PFXMASK(prefixLen);
+	RouteNode **np, **pp;
+	Route *rt, **rp;
+	int st = ROUTEERR_NOROUTE;
+
+	if (prefixLen > 32)
+		return ROUTEERR_PARAM;
+
+	OS_ENTER_CRITICAL();
+	if ((np = rtNodeFind(key, prefixLen, &pp)) != NULL) {
+		for (rp = &(*np)->routes; (rt = *rp) != NULL; ) {
+			if (ifType == IFT_UNSPEC || (rt->ifType == ifType && rt->ifID == ifID)) {
+				*rp = rt->next;
+				rt->ifType = IFT_UNSPEC;
+				rt->next = routeFreeList;
+				routeFreeList = rt;
+				st = 0;
+			} else
+				rp = &rt->next;
+		}
+		rtNodePrune(np, pp);
+		rtCacheRt = NULL;
+	}
+	OS_EXIT_CRITICAL();
+
+	IPDEBUG((LOG_INFO, TL_IP, "ipRouteDel: %s/%u if %d.%d st %d",
+				ip_ntoa(dst), prefixLen, ifType, ifID, st));
+
+	return st;
+}
+
+/*
+ * ipRouteDelIf - Delete all routes through an interface.
+ */
+void ipRouteDelIf(IfType ifType, int ifID)
+{
+	int i;
+
+	/*
+	 * Deleting by prefix keeps the trie tidy.  Free routes have no
+	 * interface type so they are skipped.
+	 */
+	for (i = 0; i < MAXROUTES; i++) {
+		if (routeTbl[i].ifType == ifType && routeTbl[i].ifID == ifID)
+			ipRouteDel(routeTbl[i].dst, routeTbl[i].prefixLen, ifType, ifID);
+	}
+}
+
+/*
+ * ipRouteLookup - Find the route for a destination and copy it to *rt.
+ * Return 0 on success, an error code if there is no route.
+ */
+int ipRouteLookup(u_int32_t dst, Route *rt)
+{
+	u_int32_t key = ntohl(dst);
+	RouteNode *n;
+	Route *best;
+	int st = 0;
+
+	OS_ENTER_CRITICAL();
+	if ((best = rtCacheRt) == NULL || rtCacheDst != dst) {
+		best = NULL;
+		for (n = rtRoot; n && ((key ^ n->key) & PFXMASK(n->len)) == 0; ) {
+			if (n->routes)
+				best = n->routes;
+			if (n->len >= 32)
+				break;
+			n = n->child[PFXBIT(key, n->len)];
+		}
+		rtCacheDst = dst;
+		rtCacheRt = best;
+	}
+	if (best)
+		*rt = *best;
+	else
+		st = ROUTEERR_NOROUTE;
+	OS_EXIT_CRITICAL();
+
+	return st;
+}
+
+/*
+ * ipPMTUSet - Record a lower path MTU for a destination.  The entry for
+ * the destination is used if there is one, otherwise a free or expired
+ * entry, otherwise the one that will expire soonest.
+ */
+void ipPMTUSet(u_int32_t dst, u_int mtu)
+{
+	PMTUEntry *pe, *best;
+	int i;
+
+	if (mtu < PMTU_MIN)
+		mtu = PMTU_MIN;
+
+	OS_ENTER_CRITICAL();
+	for (i = 0, pe = &pmtuTbl[0]; i < PMTU_ENTRIES; i++, pe++) {
+		if (pe->mtu && pe->dst == dst)
+			break;
+	}
+	if (i < PMTU_ENTRIES) {
+		if (diffTime(pe->expire) <= 0)
+			pe->mtu = 0;
+	} else {
+		for (i = 0, pe = best = &pmtuTbl[0]; i < PMTU_ENTRIES; i++, pe++) {
+			if (!pe->mtu || diffTime(pe->expire) <= 0) {
+				best = pe;
+				break;
+			}
+			if ((long)(pe->expire - best->expire) < 0)
+				best = pe;
+		}
+		pe = best;
+		pe->mtu = 0;
+	}
+	if (!pe->mtu || mtu < pe->mtu) {
+		pe->dst = dst;
+		pe->mtu = mtu;
+		pe->expire = mtime() + PMTU_AGE * 1000L;
+	}
+	OS_EXIT_CRITICAL();
+
+	IPDEBUG((LOG_INFO, TL_IP, "ipPMTUSet: %s => %u", ip_ntoa(dst), mtu));
+}
+
+/*
+ * ipPMTUGet - Return the path MTU for a destination or zero if unknown.
+ * Expired entries are freed here.
+ */
+u_int ipPMTUGet(u_int32_t dst)
+{
+	PMTUEntry *pe;
+	u_int st = 0;
+	int i;
+
+	OS_ENTER_CRITICAL();
+	for (i = 0, pe = &pmtuTbl[0]; i < PMTU_ENTRIES; i++, pe++) {
+		if (pe->mtu && pe->dst == dst) {
+			if (diffTime(pe->expire) <= 0)
+				pe->mtu = 0;
+			else
+				st = pe->mtu;
+			break;
+		}
+	}
+	OS_EXIT_CRITICAL();
+
+	return st;
+}
+
+
+/**********************************/
+/*** LOCAL FUNCTION DEFINITIONS ***/
+/**********************************/
+/*
+ * rtNodeGet - Find or insert the node for a prefix.  Interrupts must be
+ * disabled.
+ * Return the node or NULL if the node table is full.
+ */
+static RouteNode *rtNodeGet(u_int32_t key, u_int len)
+{
+	RouteNode **np = &rtRoot, *n, *nn, *b;
+	u_int cl;
+
+	/* We need at most a new node and a branch node. */
+	if (rtNodesFree < 2)
+		return NULL;
+
+	while ((n = *np) != NULL) {
+		cl = rtCommonLen(key, n->key, MIN(len, n->len));
+		if (cl == n->len) {
+			if (len == n->len)
+				return n;
+			np = &n->child[PFXBIT(key, n->len)];
+			continue;
+		}
+
+		/* The new prefix diverges from or contains this node's prefix. */
+		nn = rtNodeFreeList;
+		rtNodeFreeList = nn->child[0];
+		rtNodesFree--;
+		memset(nn, 0, sizeof(RouteNode));
+		nn->key = key;
+		nn->len = (u_char)len;
+		if (cl == len) {
+			nn->child[PFXBIT(n->key, len)] = n;
+			*np = nn;
+		} else {
+			b = rtNodeFreeList;
+			rtNodeFreeList = b->child[0];
+			rtNodesFree--;
+			memset(b, 0, sizeof(RouteNode));
+			b->key = key & PFXMASK(cl);
+			b->len = (u_char)cl;
+			b->child[PFXBIT(n->key, cl)] = n;
+			b->child[PFXBIT(key, cl)] = nn;
+			*np = b;
+		}
+		return nn;
+	}
+
+	nn = rtNodeFreeList;
+	rtNodeFreeList = nn->child[0];
+	rtNodesFree--;
+	memset(nn, 0, sizeof(RouteNode));
+	nn->key = key;
+	nn->len = (u_char)len;
+	*np = nn;
+	return nn;
+}
+
+/*
+ * rtNodeFind - Find the node for a prefix.  *parent is set to the link to
+ * the node's parent, NULL for the root.  Interrupts must be disabled.
+ * Return the link to the node or NULL if not found.
+ */
+static RouteNode **rtNodeFind(u_int32_t key, u_int len, RouteNode ***parent)
+{
+	RouteNode **np = &rtRoot, **pp = NULL, *n;
+
+	while ((n = *np) != NULL && n->len <= len
+			&& ((key ^ n->key) & PFXMASK(n->len)) == 0) {
+		if (n->len == len) {
+			*parent = pp;
+			return np;
+		}
+		pp = np;
+		np = &n->child[PFXBIT(key, n->len)];
+	}
+	return NULL;
+}
+
+/*
+ * rtNodePrune - Remove a node left without routes if it no longer
+ * separates two subtries and then its parent if that is left as a
+ * branch with one child.  Interrupts must be disabled.
+ */
+static void rtNodePrune(RouteNode **np, RouteNode **pp)
+{
+	RouteNode *n;
+	int i;
+
+	for (i = 0; i < 2 && np && (n = *np) != NULL && !n->routes; i++) {
+		if (n->child[0] && n->child[1])
+			break;
+		*np = n->child[0] ? n->child[0] : n->child[1];
+		n->child[0] = rtNodeFreeList;
+		rtNodeFreeList = n;
+		rtNodesFree++;
+		np = pp;
+		pp = NULL;
+	}
+}
+
+/*
+ * rtCommonLen - Return the number of leading bits up to maxLen that two
+ * host order addresses have in common.
+ */
+static u_int rtCommonLen(u_int32_t a, u_int32_t b, u_int maxLen)
+{
+	u_int32_t x = a ^ b;
+	u_int i;
+
+	for (i = 0; i < maxLen && !(x & (0x80000000UL >> i)); i++)
+		;
+	return i;
+}
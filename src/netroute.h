@@ -0,0 +1,134 @@
+/*****************************************************************************
+* netroute.h - Network IP Routing Table header file.
+*
+* The authors hereby grant permission to use, copy, modify, distribute,
+* and license this software and its documentation for any purpose, provided
+* that existing copyright notices are retained in all copies and that this
+* notice and the following disclaimer are included verbatim in any
+* distributions. No written agreement, license, or royalty fee is required
+* for any of the authorized uses.
+*
+* THIS SOFTWARE IS PROVIDED BY THE CONTRIBUTORS *AS IS* AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+* IN NO EVENT SHALL THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+* NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+* THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+******************************************************************************
+* THEORY OF OPERATION
+*
+*   Routes are held in a path compressed binary trie keyed on the
+* destination prefix so that a lookup visits at most one node per
+* distinct prefix length on the path and returns the longest matching
+* prefix.  Several routes may share a prefix through different
+* interfaces; the one with the lowest metric is used.
+*
+*   The route found for the last destination looked up is cached since
+* most traffic goes to one peer at a time.  Any change to the table
+* invalidates the cache.
+*
+*   Path MTUs learnt by RFC 1191 discovery are held separately in a small
+* cache of destinations.  An entry expires PMTU_AGE seconds after it was
+* last lowered so that a larger path MTU is found again if the path
+* changes; the least recently lowered entry is replaced when it's full.
+*
+*   All addresses are in network byte order.
+*
+*****************************************************************************/
+
+#ifndef NETROUTE_H
+#define NETROUTE_H
+
+
+/*************************
+*** PUBLIC DEFINITIONS ***
+*************************/
+#define MAXROUTES 16				/* Maximum routes in the table. */
+#define ROUTE_DEFMETRIC 1			/* Metric for default routes. */
+#define PMTU_ENTRIES 8				/* Destinations in the path MTU cache. */
+#define PMTU_AGE 600				/* Seconds before a path MTU expires. */
+#define PMTU_MIN 296				/* Smallest path MTU we'll use. */
+
+/*
+ * Route Error codes.
+ */
+#define ROUTEERR_ALLOC -2			/* Route table full. */
+#define ROUTEERR_PARAM -3			/* Invalid parameters. */
+#define ROUTEERR_NOROUTE -4			/* No matching route. */
+
+
+/************************
+*** PUBLIC DATA TYPES ***
+************************/
+/*
+ * A route.
+ */
+typedef struct Route_s {
+	struct Route_s *next;		/* Next route for the prefix by metric. */
+	u_int32_t dst;				/* Destination prefix. */
+	u_int32_t gateway;			/* Next hop, zero if directly connected. */
+	u_char	prefixLen;			/* Prefix length in bits. */
+	IfType	ifType;				/* Interface type. */
+	int		ifID;				/* Interface ID. */
+	u_int	mtu;				/* Route MTU, zero for the interface MTU. */
+	u_int	metric;				/* Lower metrics are preferred. */
+} Route;
+
+
+/***********************
+*** PUBLIC FUNCTIONS ***
+***********************/
+/*
+ * ipRouteInit - Initialize the routing table.
+ */
+void ipRouteInit(void);
+
+/*
+ * ipRouteAdd - Add a route to a destination prefix through an interface.
+ * A route to the same prefix through the same interface is replaced.
+ * Return 0 on success, an error code on failure.
+ */
+int ipRouteAdd(
+	u_int32_t dst,				/* Destination prefix. */
+	u_int prefixLen,			/* Prefix length in bits (0 to 32). */
+	u_int32_t gateway,			/* Next hop or zero. */
+	IfType ifType,				/* Interface type. */
+	int ifID,					/* Interface ID. */
+	u_int mtu,					/* Route MTU or zero. */
+	u_int metric				/* Route metric. */
+);
+
+/*
+ * ipRouteDel - Delete the route to a destination prefix through an
+ * interface.  IFT_UNSPEC deletes the routes through all interfaces.
+ * Return 0 on success, an error code if no route was found.
+ */
+int ipRouteDel(u_int32_t dst, u_int prefixLen, IfType ifType, int ifID);
+
+/*
+ * ipRouteDelIf - Delete all routes through an interface.
+ */
+void ipRouteDelIf(IfType ifType, int ifID);
+
+/*
+ * ipRouteLookup - Find the route for a destination and copy it to *rt.
+ * Return 0 on success, an error code if there is no route.
+ */
+int ipRouteLookup(u_int32_t dst, Route *rt);
+
+/*
+ * ipPMTUSet - Record a lower path MTU for a destination.
+ */
+void ipPMTUSet(u_int32_t dst, u_int mtu);
+
+/*
+ * ipPMTUGet - Return the path MTU for a destination or zero if unknown.
+ */
+u_int ipPMTUGet(u_int32_t dst);
+
+#endif
@@ -34,6 +34,9 @@
 * allow returning error codes.  Thus our maximum segment size must be <=
 * INT_MAX (i.e. 32767) rather than MAX_UINT.  This is not a problem
 * considering that we are using a PPP link over a serial link.
+*	The windows themselves are held in 32 bits and the window scale option
+* of RFC 7323 is offered so that a receive buffer larger than 64K can be
+* used on long fat paths.
 *
 * HEADER CACHE
 *	The header values are all loaded in the header caches before being
@@ -54,8 +57,10 @@
 #include "netrand.h"
 #include "netip.h"
 #include "netiphdr.h"
+#include "netroute.h"
 #include "nettcp.h"
 #include "nettcphd.h"
+#include "netcc.h"
 
 #include <stdio.h>
 #include "netdebug.h"
@@ -65,10 +70,17 @@
 /*** LOCAL DEFINITIONS ***/
 /*************************/
 /* Configuration */
-#define MAXTCP 6			/* Maximum TCP connections incl listeners. */
+#ifndef MAXTCP
+#define MAXTCP 16			/* Maximum TCP connections incl listeners. */
+#endif
 #define TCPTTL 64			/* Default time-to-live for TCP datagrams. */
-#define OPTSPACE 5*4		/* TCP options space - must be a multiple of 4. */
-#define	NTCB	16			/* # TCB hash table headers */
+#define OPTSPACE 10*4		/* TCP options space - must be a multiple of 4. */
+#define SACKBLKS 4			/* Most SACK blocks we report. */
+#define SACKBOARD 8			/* Most SACK blocks on the sender scoreboard. */
+#define TCP_PMTUCHECK 60	/* Seconds between checks for a raised path MTU. */
+#define TCB_LOAD 2			/* Average TCBs per hash chain before growing. */
+#define TCB_MINHASH 4		/* Initial hash chains - must be a power of 2. */
+#define TCB_MAXHASH (MAXTCP / TCB_LOAD + TCB_MINHASH) /* Most hash chains. */
 #define MAXRETRANS 12		/* Maximum retransmissions. */
 #define MAXKEEPTIMES 10		/* Maximum keep alive probe timeouts. */
 #define MAXLISTEN 2			/* Maximum queued cloned listen connections. */
@@ -86,11 +98,21 @@
 #define	ACTIVE	8		/* TCB created with an active open */
 #define	SYNACK	16		/* Our SYN has been acked */
 #define KEEPALIVE 32	/* Send a keepalive probe */
+#define WSCALE	64		/* Window scaling agreed with the peer */
+#define TSTAMP	128		/* Timestamps agreed with the peer */
+#define SACKOK	256		/* Selective acknowledgements agreed with the peer */
+#define FASTREC	512		/* In fast recovery */
+#define FASTRT	1024	/* Resend the first unacknowledged segment now */
+#define DELACK	2048	/* We owe the other end an ACK but it can wait */
 
 /* Round trip timing parameters */
 #define	AGAIN	8	/* Average RTT gain = 1/8 */
 #define	DGAIN	4	/* Mean deviation gain = 1/4 */
 #define	MSL2	30	/* Guess at two maximum-segment lifetimes in seconds */
+#define DUPACKS	3	/* Duplicate ACKs that trigger a fast retransmit */
+
+/* Idle time after which a recorded timestamp is too old for PAWS (ms). */
+#define PAWSIDLE (24L * 24 * 60 * 60 * 1000)
 
 
 /* procInFlags return codes. */
@@ -114,6 +136,15 @@ typedef	struct TcpIPHdr_s {
 	char options[OPTSPACE];	/* Cache for TCP options. */
 } TCPIPHdr;
 
+/*
+ * A selective acknowledgement block - the sequence numbers from left up to
+ * but not including right.
+ */
+typedef struct SackBlk_s {
+	u_int32_t left;
+	u_int32_t right;
+} SackBlk;
+
 /*
  * TCP connection states.
  */
@@ -144,6 +175,20 @@ typedef enum {
 
 
 
+/*
+ * A poll set.  Connections in the set are put on its ready list when
+ * something happens that may have made them ready and the semaphore is
+ * posted if the waiter may be pending on it.
+ */
+typedef struct TCPPollSet_s {
+	int inUse;					/* The set has been opened. */
+	int posted;					/* The semaphore has been posted. */
+	struct TCPCB_s *ready;		/* Connections to check. */
+	struct TCPCB_s *readyTail;
+	u_int readyCnt;				/* Connections on the ready list. */
+	OS_EVENT *sem;				/* Semaphore for the waiter. */
+} TCPPollSet;
+
 /*
  * TCP connection control block.
  */
@@ -151,6 +196,7 @@ typedef struct TCPCB_s {
 	struct TCPCB_s *prev;	/* Linked list pointers for hash table */
 	struct TCPCB_s *next;
 	Connection conn;		/* Connection struct for hash lookup. */	
+	u_int32_t hash;			/* Keyed hash of conn while linked. */
 
 	TCPState state;			/* Connection state */
 
@@ -165,29 +211,43 @@ typedef struct TCPCB_s {
 	u_int32_t una;	/* First unacknowledged sequence number */
 	u_int32_t nxt;	/* Next sequence num to be sent for the first time */
 	u_int32_t ptr;	/* Working transmission pointer */
-		u_int16_t wnd;	/* Other end's offered receive window */
+	u_int32_t wnd;	/* Other end's offered receive window */
 	u_int32_t wl1;	/* Sequence number used for last window update */
 	u_int32_t wl2;	/* Ack number used for last window update */
 	} snd;
 u_int32_t iss;			/* Initial send sequence number */
-	u_int16_t cwind;		/* Congestion window */
-	u_int16_t ssthresh;		/* Slow-start threshold */
+	TCPCC cc;				/* Congestion window and control state. */
+	TCPCCOps *ccOps;		/* Congestion control module. */
+	u_char sndScale;		/* Window scale shift for the peer's window. */
+	u_int dupAcks;			/* Consecutive duplicate ACKs. */
+	u_int32_t recover;		/* snd.nxt when fast recovery began (RFC 6582). */
 u_int32_t resent;		/* Count of bytes retransmitted */
+u_int32_t sackSkipped;	/* Count of bytes not retransmitted since SACKed */
+	SackBlk sack[SACKBOARD];	/* Scoreboard of the peer's SACK blocks. */
+	u_int sackCnt;			/* Blocks on the scoreboard. */
 
 	/* Receive sequence variables */
 	struct {
 	u_int32_t nxt;		/* Incoming sequence number expected next */
-		u_int16_t wnd;		/* Our offered receive window */
+	u_int32_t wnd;		/* Our offered receive window */
 		u_int16_t up;		/* Receive urgent pointer */
 	} rcv;
+	u_int32_t rcvBufSize;	/* Receive buffer - most we'll offer in our window. */
+	u_int32_t rcvBufMax;	/* Most autotuning may grow rcvBufSize to. */
+	u_int32_t rcvSpace;		/* Most the reader has taken in a round trip. */
+	u_int32_t rcvCopied;	/* Bytes read this round trip. */
+	u_int32_t rcvSpaceTime;	/* Time this round trip began (ms). */
+	u_char rcvScale;		/* Window scale shift for our window. */
 u_int32_t irs;			/* Initial receive sequence number */
 	u_int16_t mss;			/* Maximum segment size */
+	u_int16_t mssMax;		/* Largest MSS the peer will take. */
+	u_int32_t pmtuTime;		/* Time to recheck a lowered path MTU (ms) or 0. */
 u_int32_t rerecv;		/* Count of duplicate bytes received */
 	
 	int minFreeBufs;	/* Minimum free buffers before we'll queue something. */
 
 	char backoff;		/* Backoff interval */
-	char flags;			/* Control flags */
+	u_int flags;		/* Control flags */
 
 	int listenQOpen;	/* Max queued listen connections. */
 	int listenQHead;	/* Head of cloned TCB queue. */
@@ -196,16 +256,19 @@ u_int32_t rerecv;		/* Count of duplicate bytes received */
 		*listenQ[MAXLISTEN + 1];	/* Circular queue of clones. */
 	
 	NBufQHdr rcvq;		/* Receive queue */
-	u_int16_t rcvcnt;		/* Bytes on receive queue. */
+	u_int32_t rcvcnt;		/* Bytes on receive queue. */
 	NBuf *rcvBuf;		/* Hold one buffer while we trim it. */
 
 	NBufQHdr sndq;		/* Send queue */
-	u_int16_t sndcnt;		/* Number of unacknowledged sequence numbers on
+	u_int32_t sndcnt;		/* Number of unacknowledged sequence numbers on
 						 * send queue. NB: includes SYN and FIN, which don't
 						 * actually appear on sndq!
 						 */
 
-	NBufQHdr *reseq;		/* Out-of-order segment queue */
+	NBufQHdr reseq;			/* Out-of-order segment queue */
+	SackBlk rsack[SACKBLKS];	/* SACK blocks to report from reseq. */
+	u_int rsackCnt;			/* SACK blocks to report. */
+	u_int32_t rsackRecent;	/* Sequence of the last segment queued. */
 	Timer resendTimer;			/* Timeout timer */
 	u_int32 retransTime;	/* Retransmission time - 0 for none. */
 	u_int retransCnt;		/* Retransmission count at current wl2. */
@@ -213,17 +276,29 @@ u_int32_t rerecv;		/* Count of duplicate bytes received */
 u_int32_t rttseq;			/* Sequence number being timed */
 u_int32_t srtt;				/* Smoothed round trip time, milliseconds */
 u_int32_t mdev;				/* Mean deviation, milliseconds */
+u_int32_t tsRecent;			/* Peer's timestamp to echo */
+u_int32_t tsRecentAge;		/* Time tsRecent was recorded */
+u_int32_t lastAckSent;		/* Last acknowledgement sent */
 	
 	u_long keepAlive;		/* Keepalive in Jiffys - 0 for none. */
 	int keepProbes;			/* Number of keepalive probe timeouts. */
 	u_long keepTime;		/* Jiffy time of keepalive timeout. */
 	Timer keepTimer;		/* Keep alive timer */
+
+	u_int ackDelay;			/* Most an ACK is delayed (ms) - 0 for none. */
+	u_int32_t ackPending;	/* Bytes received since our last ACK. */
+	Timer ackTimer;			/* Delayed ACK timer */
 	    
     OS_EVENT *connectSem;	/* Semaphore for connect requests. */
 	OS_EVENT *readSem;		/* Semaphore for read function. */
 	OS_EVENT *writeSem;		/* Semaphore for write function. */
 	OS_EVENT *mutex;		/* Mutex for tcpOutput TCB variables. */
 	
+	TCPPollSet *pollSet;	/* Poll set or NULL. */
+	int pollEvents;			/* TCPPOLL_ events polled for. */
+	struct TCPCB_s *pollNext;	/* Next on the poll set's ready list. */
+	int pollQueued;			/* On the poll set's ready list. */
+	
 	TCPIPHdr hdrCache;		/* Cached TCP/IP header. */
 	char *optionsPtr;		/* Ptr into TCP options area. */
 } TCPCB;
@@ -236,6 +311,7 @@ u_int32_t mdev;				/* Mean deviation, milliseconds */
 #define ipTOS		hdrCache.ipHdr.ip_tos
 #define ipLen		hdrCache.ipHdr.ip_len		/* Host byte order! */
 #define ipIdent		hdrCache.ipHdr.ip_id		/* Host byte order! */
+#define ipOffset	hdrCache.ipHdr.ip_off		/* Host byte order! */
 #define ipTTL		hdrCache.ipHdr.ip_ttl
 #define ipProto		hdrCache.ipHdr.ip_p
 #define ipSrcAddr	hdrCache.ipHdr.ip_src.s_addr /* Network byte order! */
@@ -250,6 +326,31 @@ u_int32_t mdev;				/* Mean deviation, milliseconds */
 #define tcpCkSum	hdrCache.tcpHdr.ckSum
 #define tcpUrgent	hdrCache.tcpHdr.urgent		/* Network byte order! */
 #define tcpOptions	hdrCache.options
+#define cwind		cc.cwind					/* Congestion window */
+#define ssthresh	cc.ssthresh					/* Slow-start threshold */
+
+/*
+ * The connections that have received segments in an input burst.  Their
+ * acknowledgements and reader wakeups are held until the end of the burst.
+ */
+typedef struct TCPBurst_s {
+	u_int	cnt;				/* Connections in the burst. */
+	TCPCB	*tcb[TCP_MAXBURST];	/* The connections. */
+} TCPBurst;
+
+/*
+ * The TCP options of an incoming segment that we use.
+ */
+typedef struct TCPOpts_s {
+	u_int16_t mss;			/* Maximum segment size or 0 if none. */
+	int wscale;				/* Window scale shift or -1 if none. */
+	int tsPresent;			/* Set if timestamps are present. */
+	u_int32_t tsVal;		/* Timestamp value. */
+	u_int32_t tsEcr;		/* Timestamp echo reply. */
+	int sackOK;				/* Set if SACK permitted. */
+	u_int sackCnt;			/* SACK blocks. */
+	SackBlk sack[SACKBLKS];	/* The SACK blocks. */
+} TCPOpts;
 
 
 /***********************************/
@@ -258,16 +359,37 @@ u_int32_t mdev;				/* Mean deviation, milliseconds */
 static void tcpEcho(void *arg);
 static void resendTimeout(void *arg);
 static void keepTimeout(void *arg);
+static void ackTimeout(void *arg);
 static void setState(TCPCB *tcb, TCPState newState);
-static int procInFlags(TCPCB *tcb, TCPHdr *tcpHdr, IPHdr *ipHdr);
+static int procInFlags(TCPCB *tcb, TCPHdr *tcpHdr, IPHdr *ipHdr, int segLen);
 static void tcbInit(register TCPCB *tcb);
-static void tcbUpdate(register TCPCB *tcb, register TCPHdr *tcpHdr);
+static void ccLoad(TCPCB *tcb);
+static int rcvWndOpen(TCPCB *tcb);
+static void rcvAutoTune(TCPCB *tcb, u_int copied);
+static void rcvDone(TCPCB *tcb, u_int len);
+static int pollReady(TCPCB *tcb);
+static void pollWake(TCPCB *tcb);
+static void pollQueue(TCPCB *tcb);
+static void pollRemove(TCPCB *tcb);
+static void tcbUpdate(register TCPCB *tcb, register TCPHdr *tcpHdr, int segLen);
+static void writeWake(TCPCB *tcb);
+static void tcpOptParse(TCPCB *tcb, TCPHdr *tcpHdr, TCPOpts *opts);
 static void procSyn(register TCPCB *tcb, TCPHdr *tcpHdr);
+static void sackBuild(TCPCB *tcb);
+static void sackUpdate(TCPCB *tcb, TCPOpts *opts, u_int32_t ack);
+static u_int32_t sackSkip(TCPCB *tcb);
 static void sendSyn(register TCPCB *tcb);
+static u_char wndScale(u_int32_t wnd);
 static void closeSelf(register TCPCB *tcb, int reason);
 static u_int32_t newISS(void);
 static void tcpOutput(TCPCB *tcb);
-static u_int tcbHash(Connection *conn);
+static void tcpMSS(TCPCB *tcb);
+static void tcpInputSeg(NBuf *inBuf, u_int ipHeadLen, TCPBurst *burst);
+static void tcpBurstAdd(TCPBurst *burst, TCPCB *tcb);
+static void tcpBurstEnd(TCPBurst *burst);
+static u_int32_t tcbHash(Connection *conn);
+static void tcbSplit(void);
+static TCPCB *tcbAlloc(void);
 static void tcbLink(register TCPCB *tcb);
 static void tcbUnlink(register TCPCB *tcb);
 static TCPCB * tcbLookup(Connection *conn);
@@ -368,7 +490,25 @@ TCPStats tcpStats;
  */
 TCPCB tcbs[MAXTCP];
 TCPCB *topTcpCB;					/* Ptr to top TCB on free list. */
-TCPCB *tcbTbl[NTCB];				/* Hash table for lookup. */
+
+/* The poll sets. */
+static TCPPollSet pollSets[TCP_MAXPOLL];
+
+/*
+ * The TCB hash table.  This grows by linear hashing: one chain at a time
+ * is split as the table fills so that no insert has to rehash the table.
+ * The chains below tcbNextSplit have been split and are addressed with
+ * the next larger mask.
+ */
+TCPCB *tcbTbl[TCB_MAXHASH];			/* Hash table for lookup. */
+static u_int32_t tcbMask;			/* Hash mask before splitting. */
+static u_int tcbNextSplit;			/* Next chain to split. */
+static u_int tcbCount;				/* Linked TCBs. */
+static u_int32_t tcbKey[2];			/* Secret hash key. */
+
+/* The hash chain for a hash code. */
+#define tcbCHAIN(h) ((u_int)((h) & tcbMask) < tcbNextSplit \
+	? (u_int)((h) & (tcbMask << 1 | 1)) : (u_int)((h) & tcbMask))
 
 u_int16_t tcpFreePort = TCP_DEFPORT;	/* Initial local port. */
 
@@ -449,12 +589,18 @@ void tcpInit(void)
 		tcbs[i].prev = &tcbs[i];
 		timerCreate(&tcbs[i].resendTimer);
 		timerCreate(&tcbs[i].keepTimer);
+		timerCreate(&tcbs[i].ackTimer);
 		tcbs[i].state = CLOSED;
 	}
 	tcbs[MAXTCP - 1].next = NULL;
 
 	/* The TCB hash table. */
 	memset(&tcbTbl, 0, sizeof(tcbTbl));
+	tcbMask = TCB_MINHASH - 1;
+	tcbNextSplit = 0;
+	tcbCount = 0;
+	tcbKey[0] = magic();
+	tcbKey[1] = magic();
 	
 	/* The TCP stats. */
 #if STATS_SUPPORT > 0
@@ -470,6 +616,9 @@ void tcpInit(void)
 	tcpStats.conin.fmtStr		= "\tIN CONNECTS : %5lu\r\n";
 	tcpStats.resetOut.fmtStr	= "\tRESETS SENT : %5lu\r\n";
 	tcpStats.resetIn.fmtStr		= "\tRESETS REC'D: %5lu\r\n";
+	tcpStats.resent.fmtStr		= "\tBYTES RESENT: %5lu\r\n";
+	tcpStats.sackSkip.fmtStr	= "\tSACK SKIPPED: %5lu\r\n";
+	tcpStats.fastRetrans.fmtStr	= "\tFAST RESENDS: %5lu\r\n";
 #endif
 	
 	/* The new sequence number offset. */
@@ -491,25 +640,19 @@ int tcpOpen(void)
 	int st;
 	TCPCB *tcb;
 	
-	OS_ENTER_CRITICAL();
-	if ((tcb = topTcpCB) != NULL) {
-		topTcpCB = topTcpCB->next;
-		STATS(if (--tcpStats.curFree.val < tcpStats.minFree.val)
-				tcpStats.minFree.val = tcpStats.curFree.val;)
-	}
-	OS_EXIT_CRITICAL();
-	
-	if (!tcb)
+	if ((tcb = tcbAlloc()) == NULL)
 		st = TCPERR_ALLOC;
 	else {
 		st = (int)(tcb - &tcbs[0]);
-		tcb->next = tcb;		/* Self ref => unlinked. */
-		tcb->prev = NULL;		/* Always NULL when neither free nor linked. */
 		
 		tcb->freeOnClose = 0;
 		tcb->traceLevel = LOG_INFO;
 		tcb->keepAlive = 0;
 		tcb->keepProbes = 0;
+		tcb->rcvBufSize = TCP_DEFWND;
+		tcb->rcvBufMax = MAX(TCP_AUTORCVBUF, TCP_DEFWND);
+		tcb->ccOps = ccOps(TCPCC_RENO);
+		tcb->ackDelay = TCP_ACKDELAY;
 		
 		/* Grab semaphores. */
 		if (!tcb->connectSem)
@@ -637,10 +780,14 @@ int tcpConnectJiffy(u_int td, const struct sockaddr_in *remoteAddr, u_char tos,
 		tcb->tcpDstPort = htons(remoteAddr->sin_port);
 
 		/* Initialize connection parameters. */		
-		tcb->rcv.wnd = TCP_DEFWND;
-		tcb->mss = ipMTU(tcb->ipDstAddr) - sizeof(IPHdr) - sizeof(TCPHdr);
-		tcb->mss = MAX(tcb->mss, TCP_MINMSS);
-		tcb->minFreeBufs = ((tcb->mss + NBUFSZ) / NBUFSZ);
+		tcb->rcv.wnd = tcb->rcvBufSize;
+		tcb->rcvScale = wndScale(tcb->rcvBufMax);
+		tcb->rcvSpace = 0;
+		tcb->rcvCopied = 0;
+		tcb->rcvSpaceTime = mtime();
+		tcb->sndScale = 0;
+		tcb->mssMax = 0xFFFF;
+		tcpMSS(tcb);
 
 		/* 
 		 * Load the connection structure and link the TCB into the connection
@@ -975,42 +1122,11 @@ int tcpReadJiffy(u_int td, void *s1, u_int len, u_int timeout)
 			st += i;
 			len -= i;
 			s += i;
-			
-			OS_ENTER_CRITICAL();
-			tcb->rcvcnt -= i;
-			OS_EXIT_CRITICAL();
+			rcvDone(tcb, i);
 
-		/* 
-		 * If there's something in the receive queue, dequeue the next segment. 
-		 * If successful, adjust our receive window.
-		 */
+		/* If there's something in the receive queue, dequeue the next segment. */
 		} else if (tcb->rcvcnt != 0) {
 			nDEQUEUE(&tcb->rcvq, tcb->rcvBuf);
-			if (tcb->rcvBuf) {
-				OS_ENTER_CRITICAL();
-				i = tcb->rcv.wnd;
-				/* 
-				 * Since we queue buffer chains and not characters, the receive
-				 * window is adjusted by multiples of buffer lengths.
-				 *
-				 * XXX Here we assume that normally each buffer chain is of
-				 * length 1.  If this is not the case, it may be better to
-				 * adjust the buffer size rather than complicate this.  Only
-				 * if you want to support greatly varying segment sizes would
-				 * it be worth tracking the number of buffers in each chain.
-				 */
-				if ((tcb->rcv.wnd += NBUFSZ) > TCP_DEFWND)
-					tcb->rcv.wnd = TCP_DEFWND;
-				/* Do a window update if it was closed. */
-				if (i == 0) {
-					tcb->flags |= FORCE;
-					OS_EXIT_CRITICAL();
-					
-					tcpOutput(tcb);
-				} else {
-					OS_EXIT_CRITICAL();
-				}
-			}
 		
 		/*
 		 * We've emptied the receive queue.  If we've copied something and
@@ -1055,6 +1171,102 @@ int tcpReadJiffy(u_int td, void *s1, u_int len, u_int timeout)
 	return st;
 }
 
+/*
+ * Read queued segments from a connected TCP connection without copying.
+ *	Whole segments are returned in a single chain up to maxLen bytes; a
+ *	segment longer than that is split.  If a timeout is non-zero we block
+ *	until something is received or the timeout expires.  The caller must
+ *	free the chain.
+ * Return the number of bytes in the chain on success, an error code on
+ *	failure.  *nb is NULL unless something was read.
+ */
+int tcpReadBufJiffy(u_int td, NBuf **nb, u_int maxLen, u_int timeout)
+{
+	TCPCB *tcb = &tcbs[td];
+	NBuf *n0, *n1;
+	u_long abortTime;
+	long dTime = timeout;
+	int st = 0;
+
+	if (timeout)
+		abortTime = jiffyTime() + timeout;
+		
+	if (nb)
+		*nb = NULL;
+	if (td >= MAXTCP || tcb->prev == tcb || !nb || maxLen == 0)
+		st = TCPERR_PARAM;
+		
+	else if (tcb->state == CLOSED
+				|| tcb->ipSrcAddr == 0
+				|| tcb->tcpSrcPort == 0
+				|| tcb->ipDstAddr == 0
+				|| tcb->tcpDstPort == 0)
+		st = TCPERR_CONNECT;
+	
+	/*
+	 * Loop here until either we have received something, hit a snag, or had
+	 *	our connection closed.
+	 */
+	else while (!*nb && st == 0) {
+		/* Start with what tcpRead() left or the next segment. */
+		if (!tcb->rcvBuf && tcb->rcvcnt != 0)
+			nDEQUEUE(&tcb->rcvq, tcb->rcvBuf);
+		
+		if ((n0 = tcb->rcvBuf) != NULL) {
+			/* Split off what won't fit. */
+			tcb->rcvBuf = NULL;
+			if (n0->chainLen > maxLen) {
+				if ((tcb->rcvBuf = nSplit(n0, maxLen)) == NULL) {
+					tcb->rcvBuf = n0;
+					st = TCPERR_ALLOC;
+					break;
+				}
+			
+			/* Add whole segments while they fit. */
+			} else {
+				while ((n1 = nQHEAD(&tcb->rcvq)) != NULL
+						&& n0->chainLen + n1->chainLen <= maxLen) {
+					nDEQUEUE(&tcb->rcvq, n1);
+					nCat(n0, n1);
+				}
+			}
+			*nb = n0;
+			st = (int)n0->chainLen;
+			TCPDEBUG((tcb->traceLevel + 1, TL_TCP, "tcpReadBuf[%d]: %u", td, st));
+			rcvDone(tcb, st);
+			
+		/*
+		 * If we're expecting something to come in, wait for it.  Otherwise,
+		 * return EOF.
+		 */
+		} else switch(tcb->state) {
+		case LISTEN:
+		case SYN_SENT:
+		case SYN_RECEIVED:
+		case ESTABLISHED:
+		case FINWAIT1:
+		case FINWAIT2:
+			if (!timeout || (dTime = diffJTime(abortTime)) > 0)
+				OSSemPend(tcb->readSem, (UINT)dTime);
+			else
+				st = TCPERR_TIMEOUT;
+			break;
+		case CLOSED:
+		case CLOSE_WAIT:
+		case CLOSING:
+		case LAST_ACK:
+		case TIME_WAIT:
+			if (tcb->closeReason)
+				st = tcb->closeReason;
+			else
+				st = TCPERR_EOF;
+		    break;
+		}
+	}
+	
+	return st;
+}
+
 /*
  * Write to a connected TCP connection.  This blocks until either all bytes
  *	are queued, the timeout is reached, or an error occurs.
@@ -1072,7 +1284,7 @@ int tcpWriteJiffy(u_int td, const void *s1, u_int len, u_int timeout)
 	u_long abortTime;
 	long dTime = timeout;
 	u_int segSize;
-	int sendSize;
+	long sendSize;
 	int st = 0;
 
 	if (timeout)
@@ -1099,10 +1311,13 @@ int tcpWriteJiffy(u_int td, const void *s1, u_int len, u_int timeout)
 		 * a full length segment. 
 		 */
 		OS_ENTER_CRITICAL();
-		sendSize = tcb->snd.wnd - tcb->sndcnt;
+		if (tcb->sndcnt >= tcb->snd.wnd)
+			sendSize = 0;
+		else
+			sendSize = (long)(tcb->snd.wnd - tcb->sndcnt);
 		OS_EXIT_CRITICAL();
-		sendSize = MIN(sendSize, len);
-		sendSize = MIN(sendSize, tcb->mss);
+		sendSize = MIN(sendSize, (long)len);
+		sendSize = MIN(sendSize, (long)tcb->mss);
 		
 		/*
 		 * Block if we can't send anything or if we've got our quota of 
@@ -1137,7 +1352,7 @@ int tcpWriteJiffy(u_int td, const void *s1, u_int len, u_int timeout)
 		 * Prepare and queue whatever we can.
 		 */
 		} else {
-			nAPPEND(outBuf, s, sendSize, segSize);
+			nAPPEND(outBuf, s, (u_int)sendSize, segSize);
 			if (segSize > 0) {
 				TCPDEBUG((tcb->traceLevel + 1, TL_TCP, "tcpWrite[%d]: %u:%.*H",
 							td, segSize, min(60, segSize * 2), s));
@@ -1182,6 +1397,92 @@ int tcpWriteJiffy(u_int td, const void *s1, u_int len, u_int timeout)
 	return st;
 }
 
+/*
+ * Write an nBuf chain to a connected TCP connection without copying.  The
+ *	chain is linked onto the send queue whole once there is room in the
+ *	peer's window and the queue, or the timeout is reached, or an error
+ *	occurs.  The chain is always consumed.
+ * Return the number of bytes queued on success, an error code on failure.
+ */
+int tcpWriteBufJiffy(u_int td, NBuf *nb, u_int timeout)
+{
+	TCPCB *tcb = &tcbs[td];
+	u_long abortTime;
+	long dTime = timeout;
+	long sendSize;
+	int st = 0;
+
+	if (timeout)
+		abortTime = jiffyTime() + timeout;
+		
+	if (td >= MAXTCP || tcb->prev == tcb || !nb)
+		st = TCPERR_PARAM;
+		
+	else if (tcb->state == CLOSED
+				|| tcb->ipSrcAddr == 0
+				|| tcb->tcpSrcPort == 0
+				|| tcb->ipDstAddr == 0
+				|| tcb->tcpDstPort == 0) {
+		st = TCPERR_CONNECT;
+	}
+	
+	/*
+	 * Loop here until either we have queued the chain, hit a snag, had
+	 * our connection closed, or timed out.
+	 */
+	else while (nb && nb->chainLen) {
+		OS_ENTER_CRITICAL();
+		if (tcb->sndcnt >= tcb->snd.wnd)
+			sendSize = 0;
+		else
+			sendSize = (long)(tcb->snd.wnd - tcb->sndcnt);
+		OS_EXIT_CRITICAL();
+		
+		/*
+		 * Block if the peer's window is full or if we've got our quota of
+		 * outstanding segments already in the queue.  It's up to the
+		 * input side to wake us up when things open up.
+		 */
+		if (sendSize <= 0 || tcb->sndq.qLen >= TCP_MAXQUEUE) {
+			if (!timeout || (dTime = diffJTime(abortTime)) > 0)
+				OSSemPend(tcb->writeSem, (UINT)dTime);
+			else
+				st = TCPERR_TIMEOUT;
+			
+		} else switch(tcb->state) {
+		case SYN_SENT:
+		case SYN_RECEIVED:
+		case ESTABLISHED:
+		case CLOSE_WAIT:
+			st = (int)nb->chainLen;
+			TCPDEBUG((tcb->traceLevel + 1, TL_TCP, "tcpWriteBuf[%d]: %u", td, st));
+			OSSemPend(tcb->mutex, 0);
+			nENQUEUE(&tcb->sndq, nb);
+			OSSemPost(tcb->mutex);
+			nb = NULL;
+			
+			OS_ENTER_CRITICAL();
+			tcb->sndcnt += st;
+			OS_EXIT_CRITICAL();
+			
+			tcpOutput(tcb);
+			break;
+		default:
+			if (tcb->closeReason)
+				st = tcb->closeReason;
+			else
+			    st = TCPERR_EOF;
+			break;
+		}
+		if (st < 0)
+			break;
+	}
+	
+	if (nb)
+		nFreeChain(nb);
+	return st;
+}
+
 
 /*
  * tcpWait - Wait for the connection to be closed.  Normally this will be
@@ -1215,13 +1516,50 @@ int tcpWait(u_int td)
  */
 void tcpInput(NBuf *inBuf, u_int ipHeadLen)
 {
+	TCPBurst burst;
+	
+	burst.cnt = 0;
+	tcpInputSeg(inBuf, ipHeadLen, &burst);
+	tcpBurstEnd(&burst);
+}
+
+/*
+ * Receive a burst of incoming datagrams.  Each connection is looked up
+ * once and acknowledged and its reader woken once for the whole burst.
+ * The segments of a connection must be in the order received.
+ */
+void tcpInputBurst(NBuf *inBuf[], u_int n)
+{
+	TCPBurst burst;
+	u_int i;
 	
+	burst.cnt = 0;
+	for (i = 0; i < n; i++) {
+		tcpInputSeg(inBuf[i], nBUFTOPTR(inBuf[i], IPHdr *)->ip_hl * 4, &burst);
+		/* The burst can only hold so many connections. */
+		if (burst.cnt == TCP_MAXBURST) {
+			tcpBurstEnd(&burst);
+			burst.cnt = 0;
+		}
+	}
+	tcpBurstEnd(&burst);
+}
+
+/*
+ * tcpInputSeg - Process an incoming segment.  The connection is added to
+ * the burst if it needs an acknowledgement or its reader woken.
+ */
+static void tcpInputSeg(NBuf *inBuf, u_int ipHeadLen, TCPBurst *burst)
+{
 	TCPCB *tcb;
 	Connection conn;
 	u_int tcpHeadLen;			/* Length of TCP header. */
 	int  segLen;				/* TCP segment length exclusive of flags. */
 	IPHdr *ipHdr;				/* Ptr to IP header in output buffer. */
 	TCPHdr *tcpHdr;				/* Ptr to TCP header in output buffer. */
+	TCPOpts opts;				/* The segment's options. */
+	u_int32_t segSeq;			/* The segment's sequence before trimming. */
+	u_int i;
 	
 	u_int chkSum;
 	static chkFail = 0;
@@ -1272,8 +1610,12 @@ void tcpInput(NBuf *inBuf, u_int ipHeadLen)
 	ipHdr->ip_ttl = 0;
 	ipHdr->ip_sum = htons(ipHdr->ip_len - sizeof(IPHdr));
 	
-	/* Validate the TCP checksum including fields from IP TTL. */
-	if ((chkSum = inChkSum(inBuf, ipHdr->ip_len - 8, 8)) != 0) {
+	/*
+	 * Validate the TCP checksum including fields from IP TTL unless
+	 * the segment was looped back.
+	 */
+	if (!(inBuf->flags & NBF_CKSUMOK)
+			&& (chkSum = inChkSum(inBuf, ipHdr->ip_len - 8, 8)) != 0) {
 		/* Checksum failed, ignore segment completely */
 		STATS(tcpStats.checksum.val++;)
 		TCPDEBUG((LOG_ERR, TL_TCP, "tcpInput: Bad checksum %X", chkSum));
@@ -1299,6 +1641,16 @@ void tcpInput(NBuf *inBuf, u_int ipHeadLen)
 		nFreeChain(inBuf);
 		return;
 	}
+	/* Get any TCP options into the first nBuf with the headers. */
+	if (inBuf->len < ipHeadLen + tcpHeadLen) {
+		if ((inBuf = nPullup(inBuf, ipHeadLen + tcpHeadLen)) == 0) {
+			STATS(tcpStats.runt.val++;)
+			TCPDEBUG((LOG_ERR, TL_TCP, "tcpInput: Options pullup failed - dropped"));
+			return;
+		}
+		ipHdr = nBUFTOPTR(inBuf, IPHdr *);
+		tcpHdr = (TCPHdr *)((char *)ipHdr + ipHeadLen);
+	}
 	NTOHL(tcpHdr->seq);
 	NTOHL(tcpHdr->ack);
 	NTOHS(tcpHdr->win);
@@ -1306,12 +1658,26 @@ void tcpInput(NBuf *inBuf, u_int ipHeadLen)
 
 	segLen = ipHdr->ip_len - sizeof(IPHdr) - tcpHeadLen;
 
-	/* Find the connection if any. */	
+	/* 
+	 * Find the connection if any.  Check the connections already seen in
+	 * this burst before searching the hash table.
+	 */	
 	conn.localIPAddr = ipHdr->ip_dst.s_addr;
 	conn.localPort = tcpHdr->dstPort;
 	conn.remoteIPAddr = ipHdr->ip_src.s_addr;
 	conn.remotePort = tcpHdr->srcPort;
-	if((tcb = tcbLookup(&conn)) == NULL) {
+	for (i = 0; i < burst->cnt; i++) {
+		tcb = burst->tcb[i];
+		if (tcb->conn.localPort == conn.localPort
+				&& tcb->conn.remotePort == conn.remotePort
+				&& tcb->conn.localIPAddr == conn.localIPAddr
+				&& tcb->conn.remoteIPAddr == conn.remoteIPAddr
+				&& tcb->prev != tcb)
+			break;
+	}
+	if (i < burst->cnt)
+		;
+	else if((tcb = tcbLookup(&conn)) == NULL) {
 		TCPCB *ntcb;
 		
 		if(!(tcpHdr->flags & TH_SYN)) {
@@ -1352,20 +1718,10 @@ void tcpInput(NBuf *inBuf, u_int ipHeadLen)
 			}
 		
 			/* Get a free TCB. */
-			OS_ENTER_CRITICAL();
-			if ((ntcb = topTcpCB) == NULL) {
-				OS_EXIT_CRITICAL();
-				
+			if ((ntcb = tcbAlloc()) == NULL) {
 				/* This may fail, but we should at least try */
 				tcpReset(inBuf, ipHdr, tcpHdr, segLen);
 				return;
-			} else {
-				topTcpCB = topTcpCB->next;
-				ntcb->next = ntcb;	/* Next -> self => neither free nor linked. */
-				ntcb->prev = NULL;	/* Always NULL when neither free nor linked. */
-				STATS(if (--tcpStats.curFree.val < tcpStats.minFree.val)
-						tcpStats.minFree.val = tcpStats.curFree.val;)
-				OS_EXIT_CRITICAL();
 			}
 			
 			/* Duplicate the TCB but must preserve the semaphores. */
@@ -1378,11 +1734,14 @@ void tcpInput(NBuf *inBuf, u_int ipHeadLen)
 			ntcb->readSem = readSem;
 			ntcb->writeSem = writeSem;
 			ntcb->mutex = mutex;
+			ntcb->pollSet = NULL;
+			ntcb->pollQueued = 0;
 
 			/* 
 			 * Put this on the parent's accept queue.
 			 */
 			listenQPush(tcb, ntcb);
+			pollWake(tcb);
 			
 			tcb = ntcb;
 			
@@ -1397,10 +1756,14 @@ void tcpInput(NBuf *inBuf, u_int ipHeadLen)
 		tcb->tcpDstPort = tcb->conn.remotePort = tcpHdr->srcPort;
 
 		/* Initialize connection parameters. */		
-		tcb->rcv.wnd = TCP_DEFWND;
-		tcb->mss = ipMTU(tcb->ipDstAddr) - sizeof(IPHdr) - sizeof(TCPHdr);
-		tcb->mss = MAX(tcb->mss, TCP_MINMSS);
-		tcb->minFreeBufs = ((tcb->mss + NBUFSZ) / NBUFSZ);
+		tcb->rcv.wnd = tcb->rcvBufSize;
+		tcb->rcvScale = wndScale(tcb->rcvBufMax);
+		tcb->rcvSpace = 0;
+		tcb->rcvCopied = 0;
+		tcb->rcvSpaceTime = mtime();
+		tcb->sndScale = 0;
+		tcb->mssMax = 0xFFFF;
+		tcpMSS(tcb);
 
 		/* NOW put it on the right hash chain */
 		tcbLink(tcb);
@@ -1556,7 +1919,7 @@ void tcpInput(NBuf *inBuf, u_int ipHeadLen)
 				 * Our SYN has been acked, otherwise the ACK
 				 * wouldn't have been valid.
 				 */
-				tcbUpdate(tcb, tcpHdr);
+				tcbUpdate(tcb, tcpHdr, segLen);
 				setState(tcb,ESTABLISHED);
 			} else {
 				setState(tcb,SYN_RECEIVED);
@@ -1588,6 +1951,30 @@ void tcpInput(NBuf *inBuf, u_int ipHeadLen)
 	 * fail".
 	 */
 
+	/*
+	 * Protect against wrapped sequence numbers (PAWS, RFC 7323).  A
+	 * segment with a timestamp older than the last one recorded is an old
+	 * duplicate so treat it as unacceptable.  The recorded timestamp is
+	 * ignored once the connection has been idle long enough for the peer's
+	 * clock to have wrapped.
+	 */
+	opts.tsPresent = 0;
+	if (tcb->flags & TSTAMP) {
+		tcpOptParse(tcb, tcpHdr, &opts);
+		if (opts.tsPresent && !(tcpHdr->flags & TH_RST)
+				&& seqLT(opts.tsVal, tcb->tsRecent)
+				&& diffTime(tcb->tsRecentAge + PAWSIDLE) > 0) {
+			tcb->flags |= FORCE;
+			tcpOutput(tcb);
+			TCPDEBUG((tcb->traceLevel - 1, TL_TCP, "tcpInput[%d]: PAWS dropped %lu < %lu",
+						(int)(tcb - & tcbs[0]),
+						opts.tsVal, tcb->tsRecent));
+			nFreeChain(inBuf);
+			return;
+		}
+	}
+	segSeq = tcpHdr->seq;
+
 	/*
 	 * Trim segment to fit receive window.  If none of the segment is 
 	 * acceptable, then if the segment isn't a reset, resend the last
@@ -1606,6 +1993,17 @@ void tcpInput(NBuf *inBuf, u_int ipHeadLen)
 		return;
 	}
 	
+	/*
+	 * Record the timestamp to echo if the segment covers the last ACK we
+	 * sent.  This echoes the oldest unacknowledged segment's time when
+	 * acknowledgements are delayed.
+	 */
+	if (opts.tsPresent && seqGE(opts.tsVal, tcb->tsRecent)
+			&& seqLE(segSeq, tcb->lastAckSent)) {
+		tcb->tsRecent = opts.tsVal;
+		tcb->tsRecentAge = mtime();
+	}
+	
 	/*
 	 * Check the segment's flags and if OK and the ACK field is set, process
 	 * the acknowledgement field here.  RFC 793 specifies that this is to
@@ -1614,7 +2012,7 @@ void tcpInput(NBuf *inBuf, u_int ipHeadLen)
 	 * clear what we can from the output queue BEFORE we drop this due
 	 * to a shortage of buffers or queue it in the resequencing queue.
 	 */
-	switch(procInFlags(tcb, tcpHdr, ipHdr)) {
+	switch(procInFlags(tcb, tcpHdr, ipHdr, segLen)) {
 	case ACKCLOSE:
 		closeSelf(tcb, 0);
 		/*** Fall through... ***/
@@ -1636,10 +2034,10 @@ void tcpInput(NBuf *inBuf, u_int ipHeadLen)
 	 */
 	if (nBUFSFREE() < tcb->minFreeBufs) {
 		if(tcpHdr->seq == tcb->rcv.nxt) {
-			while(nQHEAD(tcb->reseq) && nBUFSFREE() < tcb->minFreeBufs) {
+			while(nQHEAD(&tcb->reseq) && nBUFSFREE() < tcb->minFreeBufs) {
 				NBuf *segBuf;
 				
-				nDEQUEUE(tcb->reseq, segBuf);
+				nDEQUEUE(&tcb->reseq, segBuf);
 				TCPDEBUG((tcb->traceLevel - 1, TL_TCP, 
 							"tcpInput[%d]: Clearing reseq queue",
 							(int)(tcb - & tcbs[0])));
@@ -1665,8 +2063,13 @@ void tcpInput(NBuf *inBuf, u_int ipHeadLen)
 		TCPDEBUG((tcb->traceLevel, TL_TCP, "tcpInput[%d]: Queued %u", 
 					(int)(tcb - & tcbs[0]),
 					segLen));
-		nEnqSort(tcb->reseq, inBuf, tcpHdr->seq);
+		if (nEnqSort(&tcb->reseq, inBuf, tcpHdr->seq) < 0)
+			nFreeChain(inBuf);
 		inBuf = NULL;
+		if (tcb->flags & SACKOK) {
+			tcb->rsackRecent = tcpHdr->seq;
+			sackBuild(tcb);
+		}
 		tcb->flags |= FORCE;
 		tcpOutput(tcb);
 	}
@@ -1702,19 +2105,33 @@ void tcpInput(NBuf *inBuf, u_int ipHeadLen)
 				tcb->rcvcnt += segLen;
 				tcb->rcv.nxt += segLen;
 				/* 
-				 * Since we queue buffer chains and not characters, the receive
-				 * window is adjusted by multiples of buffer lengths.
-				 *
-				 * XXX Here we assume that normally each buffer chain is of
-				 * length 1.  If this is not the case, it may be better to
-				 * adjust the buffer size rather than complicate this.  Only
-				 * if you want to support greatly varying segment sizes would
-				 * it be worth tracking the number of buffers in each chain.
+				 * The data is charged to the receive buffer until it's read.
+				 * The segment was trimmed to the window so the right edge
+				 * of the window stays put.
 				 */
-				if ((tcb->rcv.wnd -= NBUFSZ) < 0)
+				if (tcb->rcv.wnd > segLen)
+					tcb->rcv.wnd -= segLen;
+				else
 					tcb->rcv.wnd = 0;
-				tcb->flags |= FORCE;
-				OS_EXIT_CRITICAL();
+				/*
+				 * Delay the ACK (RFC 1122) unless we've received two full
+				 * segments since the last one or this fills a hole.  The 
+				 * delay runs from the first unacknowledged segment.
+				 */
+				tcb->ackPending += segLen;
+				if (tcb->ackDelay == 0 || nQHEAD(&tcb->reseq)
+						|| tcb->ackPending >= 2 * (u_int32_t)tcb->mss) {
+					tcb->flags |= FORCE;
+					OS_EXIT_CRITICAL();
+				} else if (!(tcb->flags & DELACK)) {
+					tcb->flags |= DELACK;
+					OS_EXIT_CRITICAL();
+					timeoutJiffy(&tcb->ackTimer, 
+							OSTimeGet() + (tcb->ackDelay + MSPERTICK - 1) / MSPERTICK,
+							ackTimeout, tcb);
+				} else {
+					OS_EXIT_CRITICAL();
+				}
 				break;
 			default:
 				/* Ignore segment text */
@@ -1727,19 +2144,16 @@ void tcpInput(NBuf *inBuf, u_int ipHeadLen)
 		}
 		
 		/*
-		 * Signal pending reads that data has arrived.
-		 *
-		 * This is done before sending an acknowledgement in case the 
-		 * application is running at a higher priority and wants to piggyback
-		 * some reply data.
-		 *
-		 * It's also done before processing FIN so that the CLOSED
-		 * state will occur after the user has had a chance to read
-		 * the last of the incoming data with a priority higher than
-		 * we're running.
+		 * Signal pending reads that data has arrived before processing
+		 * FIN so that the CLOSED state will occur after the user has had
+		 * a chance to read the last of the incoming data with a priority
+		 * higher than we're running.  Otherwise tcpBurstEnd() signals
+		 * once for the burst.
 		 */
-		if(tcb->rcvcnt != 0)
+		if(tcb->rcvcnt != 0 && (tcpHdr->flags & TH_FIN)) {
 			OSSemPost(tcb->readSem);
+			pollWake(tcb);
+		}
 		
 		/* process FIN bit (p 75) */
 		if(tcpHdr->flags & TH_FIN){
@@ -1799,10 +2213,10 @@ void tcpInput(NBuf *inBuf, u_int ipHeadLen)
 		 * Scan the resequencing queue, looking for a segment we can handle,
 		 * and freeing all those that are now obsolete.
 		 */
-		while(segLen < 0 
-				&& nQHEAD(tcb->reseq) 
-				&& seqGE(tcb->rcv.nxt, nQHEADSORT(tcb->reseq))) {
-			nDEQUEUE(tcb->reseq, inBuf);
+		while(!inBuf
+				&& nQHEAD(&tcb->reseq) 
+				&& seqGE(tcb->rcv.nxt, nQHEADSORT(&tcb->reseq))) {
+			nDEQUEUE(&tcb->reseq, inBuf);
 			ipHdr = nBUFTOPTR(inBuf, IPHdr *);
 			ipHeadLen = ipHdr->ip_hl * 4;
 			tcpHdr = (TCPHdr *)((char *)ipHdr + ipHeadLen);
@@ -1814,7 +2228,55 @@ void tcpInput(NBuf *inBuf, u_int ipHeadLen)
 			}
 		}
 	}
-	tcpOutput(tcb);	/* Send any necessary ack */
+	/* Update the SACK blocks we report if there's been reordering. */
+	if ((tcb->flags & SACKOK) && (tcb->rsackCnt || nQHEAD(&tcb->reseq)))
+		sackBuild(tcb);
+	/*
+	 * Don't stretch the ACK over the burst - acknowledge at least every
+	 * second full segment as it arrives.
+	 */
+	if (tcb->ackPending >= 2 * (u_int32_t)tcb->mss)
+		tcpOutput(tcb);
+	tcpBurstAdd(burst, tcb);	/* Send any necessary ack at the end. */
+}
+
+/*
+ * tcpBurstAdd - Add a connection to an input burst if it isn't already.
+ */
+static void tcpBurstAdd(TCPBurst *burst, TCPCB *tcb)
+{
+	u_int i;
+	
+	for (i = 0; i < burst->cnt && burst->tcb[i] != tcb; i++)
+		;
+	if (i == burst->cnt)
+		burst->tcb[burst->cnt++] = tcb;
+}
+
+/*
+ * tcpBurstEnd - Finish an input burst by signalling pending reads and
+ * sending any acknowledgements for each connection.
+ *
+ * Reads are signalled before sending an acknowledgement in case the 
+ * application is running at a higher priority and wants to piggyback
+ * some reply data.
+ */
+static void tcpBurstEnd(TCPBurst *burst)
+{
+	TCPCB *tcb;
+	u_int i;
+	
+	for (i = 0; i < burst->cnt; i++) {
+		tcb = burst->tcb[i];
+		/* A reset in the burst may have closed and freed the connection. */
+		if (tcb->prev == tcb || tcb->state == CLOSED)
+			continue;
+		if (tcb->rcvcnt != 0) {
+			OSSemPost(tcb->readSem);
+			pollWake(tcb);
+		}
+		tcpOutput(tcb);
+	}
 }
 
 /* 
@@ -1866,15 +2328,268 @@ int  tcpIOCtl(u_int td, int cmd, void *arg)
 			else
 				st = TCPERR_PARAM;
 			break;
-		default:
-			st = TCPERR_PARAM;
+		case TCPCTLG_RCVBUF:		/* Get the receive buffer size. */
+			if (arg)
+				*(u_long *)arg = tcb->rcvBufSize;
+			else
+				st = TCPERR_PARAM;
+			break;
+		case TCPCTLS_RCVBUF:		/* Set the receive buffer size. */
+			if (!arg || *(u_long *)arg < TCP_MINMSS 
+					|| *(u_long *)arg > TCP_MAXWND)
+				st = TCPERR_PARAM;
+			else if (tcb->state != CLOSED && tcb->state != LISTEN)
+				st = TCPERR_CONFIG;
+			else {
+				/* Autotuning may still grow the buffer from here. */
+				tcb->rcvBufSize = *(u_long *)arg;
+				tcb->rcvBufMax = MAX(tcb->rcvBufSize, TCP_AUTORCVBUF);
+			}
+			break;
+		case TCPCTLG_ACKDELAY:		/* Get the delayed ACK time. */
+			if (arg)
+				*(int *)arg = (int)tcb->ackDelay;
+			else
+				st = TCPERR_PARAM;
+			break;
+		case TCPCTLS_ACKDELAY:		/* Set the delayed ACK time. */
+			if (!arg || *(int *)arg < 0 || *(int *)arg > TCP_MAXACKDELAY)
+				st = TCPERR_PARAM;
+			else
+				tcb->ackDelay = *(int *)arg;
 			break;
+		case TCPCTLG_CONGCTL:		/* Get the congestion control algorithm. */
+			if (arg)
+				*(int *)arg = (int)(tcb->ccOps - ccOps(TCPCC_RENO));
+			else
+				st = TCPERR_PARAM;
+			break;
+		case TCPCTLS_CONGCTL:		/* Set the congestion control algorithm. */
+			if (!arg || !ccOps(*(int *)arg))
+				st = TCPERR_PARAM;
+			else {
+				OSSemPend(tcb->mutex, 0);
+				tcb->ccOps = ccOps(*(int *)arg);
+				tcb->ccOps->init(&tcb->cc);
+				OSSemPost(tcb->mutex);
+				TCPDEBUG((tcb->traceLevel, TL_TCP, "tcpIOCtl[%d]: %s congestion control",
+							td, tcb->ccOps->name));
+			}
+			break;
+		default:
+			st = TCPERR_PARAM;
+			break;
+		}
+	}
+	
+	return st;
+}
+
+/*
+ * Open a poll set.
+ * Return a poll set descriptor on success, an error code on failure.
+ */
+int tcpPollOpen(void)
+{
+	TCPPollSet *ps;
+	int pd;
+	
+	OS_ENTER_CRITICAL();
+	for (pd = 0; pd < TCP_MAXPOLL && pollSets[pd].inUse; pd++)
+		;
+	if (pd < TCP_MAXPOLL)
+		pollSets[pd].inUse = !0;
+	OS_EXIT_CRITICAL();
+	if (pd == TCP_MAXPOLL)
+		return TCPERR_ALLOC;
+		
+	ps = &pollSets[pd];
+	ps->posted = 0;
+	ps->ready = ps->readyTail = NULL;
+	ps->readyCnt = 0;
+	if (!ps->sem && (ps->sem = OSSemCreate(0)) == NULL) {
+		ps->inUse = 0;
+		return TCPERR_ALLOC;
+	}
+	return pd;
+}
+
+/*
+ * Close a poll set removing all its connections.
+ * Return 0 on success, an error code on failure.
+ */
+int tcpPollClose(u_int pd)
+{
+	TCPPollSet *ps = &pollSets[pd];
+	u_int td;
+	
+	if (pd >= TCP_MAXPOLL || !ps->inUse)
+		return TCPERR_PARAM;
+	for (td = 0; td < MAXTCP; td++)
+		if (tcbs[td].pollSet == ps)
+			pollRemove(&tcbs[td]);
+	ps->inUse = 0;
+	return 0;
+}
+
+/*
+ * Set the events to poll for on a connection.  A connection can be in one
+ * poll set at a time.  Zero events removes it from the set.
+ * Return 0 on success, an error code on failure.
+ */
+int tcpPollCtl(u_int pd, u_int td, int events)
+{
+	TCPPollSet *ps = &pollSets[pd];
+	TCPCB *tcb = &tcbs[td];
+	
+	if (pd >= TCP_MAXPOLL || !ps->inUse 
+			|| td >= MAXTCP || tcb->prev == tcb
+			|| (tcb->pollSet && tcb->pollSet != ps))
+		return TCPERR_PARAM;
+	if (events == 0) {
+		pollRemove(tcb);
+	} else {
+		OS_ENTER_CRITICAL();
+		tcb->pollEvents = events;
+		tcb->pollSet = ps;
+		OS_EXIT_CRITICAL();
+		/* Report it if it's ready already. */
+		pollWake(tcb);
+	}
+	return 0;
+}
+
+/*
+ * Wait for connections in a poll set to be ready and return up to maxEv
+ * of them.  Readiness is level triggered: a connection is reported on
+ * every wait for as long as it stays ready.
+ */
+int tcpPollWaitJiffy(u_int pd, TCPPollEv *ev, u_int maxEv, u_int timeout)
+{
+	TCPPollSet *ps = &pollSets[pd];
+	TCPCB *tcb;
+	u_long abortTime;
+	long dTime = timeout;
+	u_int n;
+	int events, done = 0;
+	int st = 0;
+	
+	if (timeout)
+		abortTime = jiffyTime() + timeout;
+		
+	if (pd >= TCP_MAXPOLL || !ps->inUse || !ev || maxEv == 0)
+		return TCPERR_PARAM;
+		
+	while (!done) {
+		/* 
+		 * Check each connection on the ready list.  Those still ready are
+		 * put back at the end so stop when we've seen the ones we started
+		 * with.
+		 */
+		for (n = ps->readyCnt; n > 0; n--) {
+			OS_ENTER_CRITICAL();
+			if ((tcb = ps->ready) == NULL) {
+				OS_EXIT_CRITICAL();
+				break;
+			}
+			if ((ps->ready = tcb->pollNext) == NULL)
+				ps->readyTail = NULL;
+			ps->readyCnt--;
+			tcb->pollQueued = 0;
+			OS_EXIT_CRITICAL();
+			
+			if (tcb->pollSet != ps)
+				continue;
+			events = pollReady(tcb) & (tcb->pollEvents | TCPPOLL_CLOSE);
+			if (events && (u_int)st < maxEv) {
+				ev[st].td = (u_int)(tcb - &tcbs[0]);
+				ev[st].events = events;
+				st++;
+			}
+			/* Check it again next time if it's still ready. */
+			if (events)
+				pollQueue(tcb);
+		}
+		
+		if (st)
+			done = !0;
+		else if (timeout && (dTime = diffJTime(abortTime)) <= 0)
+			done = !0;
+		else {
+			/* Wait for a wake up unless one has come in meanwhile. */
+			OS_ENTER_CRITICAL();
+			if (ps->ready) {
+				OS_EXIT_CRITICAL();
+			} else {
+				ps->posted = 0;
+				OS_EXIT_CRITICAL();
+				OSSemPend(ps->sem, (UINT)dTime);
+			}
 		}
 	}
 	
 	return st;
 }
 
+/*
+ * tcpPMTUValid - Return non-zero if a segment quoted in an ICMP message
+ * could have been sent on a connection.  The sequence number must lie in
+ * the unacknowledged data (RFC 5927) so that a forged message can't be
+ * used to shrink a connection's segments.  The addresses and ports are in
+ * network byte order as quoted, the sequence number in host order.
+ */
+int tcpPMTUValid(u_long srcAddr, u_long dstAddr, 
+					u_int16_t srcPort, u_int16_t dstPort, u_int32_t seq)
+{
+	Connection conn;
+	TCPCB *tcb;
+	int st = 0;
+	
+	conn.localIPAddr = srcAddr;
+	conn.localPort = srcPort;
+	conn.remoteIPAddr = dstAddr;
+	conn.remotePort = dstPort;
+	if ((tcb = tcbLookup(&conn)) != NULL) {
+		OSSemPend(tcb->mutex, 0);
+		st = ((long)(seq - tcb->snd.una) >= 0 && (long)(seq - tcb->snd.nxt) < 0);
+		OSSemPost(tcb->mutex);
+		
+		TCPDEBUG((tcb->traceLevel, TL_TCP, "tcpPMTUValid[%d]: seq %lu una %lu nxt %lu => %d",
+					(int)(tcb - &tcbs[0]), seq, tcb->snd.una, tcb->snd.nxt, st));
+	}
+	return st;
+}
+
+/*
+ * tcpPMTUChange - The path MTU to a destination has dropped.  Lower the
+ * MSS of each connection to it and resend anything outstanding since the
+ * segment that was too big has been dropped.  The MSS is raised again by
+ * tcpOutput once the path MTU entry expires.
+ */
+void tcpPMTUChange(u_long dstAddr)
+{
+	TCPCB *tcb;
+	u_int mss;
+	int i, resend;
+	
+	for (i = 0, tcb = &tcbs[0]; i < MAXTCP; i++, tcb++) {
+		if (tcb->prev == tcb || tcb->ipDstAddr != dstAddr
+				|| tcb->state == CLOSED || tcb->state == LISTEN)
+			continue;
+		
+		OSSemPend(tcb->mutex, 0);
+		mss = tcb->mss;
+		tcpMSS(tcb);
+		if ((resend = (tcb->mss < mss && tcb->snd.una != tcb->snd.nxt)) != 0)
+			tcb->snd.ptr = tcb->snd.una;
+		OSSemPost(tcb->mutex);
+		
+		TCPDEBUG((tcb->traceLevel, TL_TCP, "tcpPMTUChange[%d]: mss %u", i, tcb->mss));
+		if (resend)
+			tcpOutput(tcb);
+	}
+}
+
 
 /**********************************/
 /*** LOCAL FUNCTION DEFINITIONS ***/
@@ -2016,11 +2731,18 @@ static void resendTimeout(void *arg)
 				tcb->flags |= RETRAN;	/* Indicate > 1  transmission */
 				tcb->backoff++;
 				tcb->snd.ptr = tcb->snd.una;
-				/* Reduce slowstart threshold to half current window */
-				tcb->ssthresh = tcb->cwind / 2;
-				tcb->ssthresh = MAX(tcb->ssthresh, tcb->mss);
-				/* Shrink congestion window to 1 packet */
-				tcb->cwind = tcb->mss;
+				/* Let congestion control shrink the window. */
+				ccLoad(tcb);
+				tcb->ccOps->onRTO(&tcb->cc);
+				/* Abandon any fast recovery. */
+				tcb->flags &= ~(FASTREC | FASTRT);
+				tcb->dupAcks = 0;
+				tcb->recover = tcb->snd.nxt;
+				/*
+				 * The peer may have discarded what it SACKed (RFC 2018)
+				 * so forget the scoreboard and resend go-back-N.
+				 */
+				tcb->sackCnt = 0;
 				OSSemPost(tcb->mutex);
 				
 				tcpOutput(tcb);
@@ -2093,6 +2815,27 @@ static void keepTimeout(void *arg)
 }
 
 
+/*
+ * ackTimeout - Send an ACK that we've delayed long enough.
+ */
+static void ackTimeout(void *arg)
+{
+	register TCPCB *tcb = (TCPCB *)arg;
+
+	OS_ENTER_CRITICAL();
+	if (tcb->flags & DELACK) {
+		tcb->flags = (tcb->flags & ~DELACK) | FORCE;
+		OS_EXIT_CRITICAL();
+		
+		TCPDEBUG((tcb->traceLevel + 2, TL_TCP, "ackTimeout[%d]: ACK %lu",
+					(int)(tcb - & tcbs[0]), tcb->rcv.nxt));
+		tcpOutput(tcb);
+	} else {
+		OS_EXIT_CRITICAL();
+	}
+}
+
+
 static void setState(TCPCB *tcb, TCPState newState)
 {
 	register TCPState oldState;
@@ -2140,6 +2883,7 @@ static void setState(TCPCB *tcb, TCPState newState)
 			OSSemPost(tcb->connectSem);
 			OSSemPost(tcb->readSem);
 			OSSemPost(tcb->writeSem);
+			pollWake(tcb);
 
 			break;
 			
@@ -2170,7 +2914,7 @@ static void setState(TCPCB *tcb, TCPState newState)
  * be dropped, ACKRESET if the segment should be rejected,
  * and ACKCLOSE if the connection is closed.
  */
-static int procInFlags(TCPCB *tcb, TCPHdr *tcpHdr, IPHdr *ipHdr)
+static int procInFlags(TCPCB *tcb, TCPHdr *tcpHdr, IPHdr *ipHdr, int segLen)
 {
 	int st = ACKOK;
 	
@@ -2224,7 +2968,7 @@ static int procInFlags(TCPCB *tcb, TCPHdr *tcpHdr, IPHdr *ipHdr)
 	} else switch(tcb->state) {
 	case SYN_RECEIVED:
 		if(seqWithin(tcpHdr->ack, tcb->snd.una + 1, tcb->snd.nxt)) {
-			tcbUpdate(tcb, tcpHdr);
+			tcbUpdate(tcb, tcpHdr, segLen);
 			setState(tcb, ESTABLISHED);
 		} else {
 			st = ACKRESET;
@@ -2232,17 +2976,17 @@ static int procInFlags(TCPCB *tcb, TCPHdr *tcpHdr, IPHdr *ipHdr)
 		break;
 	case ESTABLISHED:
 	case CLOSE_WAIT:
-		tcbUpdate(tcb, tcpHdr);
+		tcbUpdate(tcb, tcpHdr, segLen);
 		break;
 	case FINWAIT1:	/* p. 73 */
-		tcbUpdate(tcb, tcpHdr);
+		tcbUpdate(tcb, tcpHdr, segLen);
 		if(tcb->sndcnt == 0) {
 			/* Our FIN is acknowledged */
 			setState(tcb, FINWAIT2);
 		}
 		break;
 	case FINWAIT2:
-		tcbUpdate(tcb, tcpHdr);
+		tcbUpdate(tcb, tcpHdr, segLen);
 		/* 
 		 * We're still getting something on this connection so reset the
 		 * FINWAIT2 timeout.
@@ -2254,7 +2998,7 @@ static int procInFlags(TCPCB *tcb, TCPHdr *tcpHdr, IPHdr *ipHdr)
 		timeoutJiffy(&tcb->resendTimer, tcb->retransTime, resendTimeout, tcb);
 		break;
 	case CLOSING:
-		tcbUpdate(tcb, tcpHdr);
+		tcbUpdate(tcb, tcpHdr, segLen);
 		if(tcb->sndcnt == 0) {
 			/* Our FIN is acknowledged */
 			setState(tcb, TIME_WAIT);
@@ -2266,7 +3010,7 @@ static int procInFlags(TCPCB *tcb, TCPHdr *tcpHdr, IPHdr *ipHdr)
 		}
 		break;
 	case LAST_ACK:
-		tcbUpdate(tcb, tcpHdr);
+		tcbUpdate(tcb, tcpHdr, segLen);
 		if(tcb->sndcnt == 0) {
 			/* Our FIN is acknowledged, close connection */
 			st = ACKCLOSE;
@@ -2294,27 +3038,232 @@ static void tcbInit(register TCPCB *tcb)
 		/* Initialize TCP parameters. */
 		tcb->cwind = TCP_DEFMSS;
 		tcb->ssthresh = TCP_ISSTHRESH;
+		tcb->ccOps->init(&tcb->cc);
 		tcb->srtt = TCP_DEFRTT;
 	
 		/* Initialize header cache. */
 		tcb->ipVersion = IPVERSION;
 		tcb->ipHdrLen = sizeof(IPHdr) / 4;
 		tcb->ipTOS = 0;
+		tcb->ipOffset = IP_DF;	/* For path MTU discovery. */
 		tcb->ipTTL = 0;	/* TTL set to zero here for TCP checksum calculation. */
 		tcb->ipProto = IPPROTO_TCP;
 }
 
+
+/*
+ * rcvWndOpen - Open the receive window to the space left in the receive
+ * buffer.  To avoid a silly window (RFC 1122 4.2.3.3), the right edge only
+ * moves once it can move by a full segment or half the buffer.  Return
+ * non-zero if the peer may be waiting on the update because the window we
+ * last offered was smaller than a segment.  Call with interrupts disabled.
+ */
+static int rcvWndOpen(TCPCB *tcb)
+{
+	u_int32_t avail, oldWnd;
+
+	avail = tcb->rcvBufSize > tcb->rcvcnt ? tcb->rcvBufSize - tcb->rcvcnt : 0;
+	oldWnd = tcb->rcv.wnd;
+	if (avail < oldWnd + MIN(tcb->rcvBufSize / 2, tcb->mss))
+		return 0;
+	tcb->rcv.wnd = avail;
+	return oldWnd < tcb->mss;
+}
+
+/*
+ * rcvAutoTune - Grow the receive buffer to keep ahead of the reader.  Once
+ * every round trip, if the reader has taken more than in any earlier round
+ * trip, the buffer is made twice that so that the window never limits a
+ * reader that keeps up with the path.  The buffer doesn't grow beyond
+ * rcvBufMax or into more nBufs than are free.
+ */
+static void rcvAutoTune(TCPCB *tcb, u_int copied)
+{
+	u_int32_t now, grow;
+
+	now = mtime();
+	tcb->rcvCopied += copied;
+	if (now - tcb->rcvSpaceTime < MAX(tcb->srtt, MSPERTICK))
+		return;
+	if (tcb->rcvCopied > tcb->rcvSpace) {
+		tcb->rcvSpace = tcb->rcvCopied;
+		grow = MIN(2 * tcb->rcvSpace, tcb->rcvBufMax);
+		if (grow > tcb->rcvBufSize 
+				&& (grow - tcb->rcvBufSize) / NBUFSZ < nBUFSFREE()) {
+			TCPDEBUG((tcb->traceLevel + 1, TL_TCP, "rcvAutoTune[%d]: %lu to %lu",
+						(int)(tcb - &tcbs[0]), tcb->rcvBufSize, grow));
+			OS_ENTER_CRITICAL();
+			tcb->rcvBufSize = grow;
+			OS_EXIT_CRITICAL();
+		}
+	}
+	tcb->rcvCopied = 0;
+	tcb->rcvSpaceTime = now;
+}
+
+/*
+ * rcvDone - Free bytes taken by the reader from the receive buffer and
+ * reopen the window.  Send a window update if the peer may be waiting on it.
+ */
+static void rcvDone(TCPCB *tcb, u_int len)
+{
+	rcvAutoTune(tcb, len);
+	OS_ENTER_CRITICAL();
+	tcb->rcvcnt -= len;
+	if (rcvWndOpen(tcb)) {
+		tcb->flags |= FORCE;
+		OS_EXIT_CRITICAL();
+		
+		tcpOutput(tcb);
+	} else {
+		OS_EXIT_CRITICAL();
+	}
+}
+
+/*
+ * pollReady - Return the TCPPOLL_ events that a connection is ready for.
+ */
+static int pollReady(TCPCB *tcb)
+{
+	int events = 0;
+	
+	switch(tcb->state) {
+	case LISTEN:
+		if (!listenQEmpty(tcb))
+			events = TCPPOLL_READ;
+		break;
+	case SYN_SENT:
+	case SYN_RECEIVED:
+		break;
+	case ESTABLISHED:
+	case CLOSE_WAIT:
+		if (tcb->snd.wnd > tcb->sndcnt && tcb->sndq.qLen < TCP_MAXQUEUE)
+			events = TCPPOLL_WRITE;
+		/* FALL THROUGH... */
+	case FINWAIT1:
+	case FINWAIT2:
+		if (tcb->rcvcnt != 0 || tcb->state == CLOSE_WAIT)
+			events |= TCPPOLL_READ;
+		break;
+	case CLOSING:
+	case LAST_ACK:
+	case TIME_WAIT:
+		/* Reads return EOF. */
+		events = TCPPOLL_READ;
+		break;
+	case CLOSED:
+		events = TCPPOLL_READ | TCPPOLL_CLOSE;
+		break;
+	}
+	return events;
+}
+
+/*
+ * pollWake - Put a connection on its poll set's ready list to be checked
+ * and wake the waiter.
+ */
+static void pollWake(TCPCB *tcb)
+{
+	TCPPollSet *ps;
+	
+	OS_ENTER_CRITICAL();
+	if ((ps = tcb->pollSet) == NULL) {
+		OS_EXIT_CRITICAL();
+		return;
+	}
+	OS_EXIT_CRITICAL();
+	pollQueue(tcb);
+	
+	OS_ENTER_CRITICAL();
+	if (!ps->posted) {
+		ps->posted = !0;
+		OS_EXIT_CRITICAL();
+		OSSemPost(ps->sem);
+	} else {
+		OS_EXIT_CRITICAL();
+	}
+}
+
+/*
+ * pollQueue - Put a connection on its poll set's ready list if it isn't
+ * already.
+ */
+static void pollQueue(TCPCB *tcb)
+{
+	TCPPollSet *ps;
+	
+	OS_ENTER_CRITICAL();
+	if ((ps = tcb->pollSet) != NULL && !tcb->pollQueued) {
+		tcb->pollQueued = !0;
+		tcb->pollNext = NULL;
+		if (ps->readyTail)
+			ps->readyTail->pollNext = tcb;
+		else
+			ps->ready = tcb;
+		ps->readyTail = tcb;
+		ps->readyCnt++;
+	}
+	OS_EXIT_CRITICAL();
+}
+
+/*
+ * pollRemove - Take a connection out of its poll set.
+ */
+static void pollRemove(TCPCB *tcb)
+{
+	TCPPollSet *ps;
+	TCPCB *prev;
+	
+	OS_ENTER_CRITICAL();
+	if ((ps = tcb->pollSet) != NULL && tcb->pollQueued) {
+		if (ps->ready == tcb) {
+			prev = NULL;
+			ps->ready = tcb->pollNext;
+		} else {
+			for (prev = ps->ready; prev->pollNext != tcb; prev = prev->pollNext)
+				;
+			prev->pollNext = tcb->pollNext;
+		}
+		if (ps->readyTail == tcb)
+			ps->readyTail = prev;
+		ps->readyCnt--;
+	}
+	tcb->pollSet = NULL;
+	tcb->pollEvents = 0;
+	tcb->pollQueued = 0;
+	OS_EXIT_CRITICAL();
+}
+
+/*
+ * ccLoad - Load the fields that congestion control reads from the TCB.
+ */
+static void ccLoad(TCPCB *tcb)
+{
+	tcb->cc.sndWnd = tcb->snd.wnd;
+	tcb->cc.flight = tcb->snd.nxt - tcb->snd.una;
+	tcb->cc.mss = tcb->mss;
+}
+
 		
 /*
  * Process an incoming acknowledgement and window indication.
  * From page 72.
  */
-static void tcbUpdate(register TCPCB *tcb, register TCPHdr *tcpHdr)
+static void tcbUpdate(register TCPCB *tcb, register TCPHdr *tcpHdr, int segLen)
 {
-	u_int16_t acked;
-	u_int16_t expand;
+	u_int32_t acked;
+	u_int32_t win, oldWnd;
+	int recovering;
+	long rttElapsed;
+	TCPOpts opts;
 
 	acked = 0;
+	if (tcb->flags & (TSTAMP | SACKOK))
+		tcpOptParse(tcb, tcpHdr, &opts);
+	else {
+		opts.tsPresent = 0;
+		opts.sackCnt = 0;
+	}
 	
 	OSSemPend(tcb->mutex, 0);
 	if(seqGT(tcpHdr->ack, tcb->snd.nxt)) {
@@ -2328,6 +3277,7 @@ static void tcbUpdate(register TCPCB *tcb, register TCPHdr *tcpHdr)
 	 * even if it doesn't actually acknowledge anything,
 	 * because it might be a spontaneous window reopening.
 	 */
+	oldWnd = tcb->snd.wnd;
 	if(seqGT(tcpHdr->seq, tcb->snd.wl1) 
 			|| ((tcpHdr->seq == tcb->snd.wl1) 
 				&& seqGE(tcpHdr->ack, tcb->snd.wl2))) {
@@ -2336,80 +3286,119 @@ static void tcbUpdate(register TCPCB *tcb, register TCPHdr *tcpHdr)
 		 * send pointer so we'll immediately resume transmission.
 		 * Otherwise we'd have to wait until the next probe.
 		 */
-		if(tcb->snd.wnd == 0 && tcpHdr->win != 0)
+		/* The window in a SYN is never scaled. */
+		win = tcpHdr->win;
+		if (!(tcpHdr->flags & TH_SYN))
+			win <<= tcb->sndScale;
+		if(tcb->snd.wnd == 0 && win != 0)
 			tcb->snd.ptr = tcb->snd.una;
-		tcb->snd.wnd = tcpHdr->win;
+		tcb->snd.wnd = win;
 		tcb->snd.wl1 = tcpHdr->seq;
 		tcb->snd.wl2 = tcpHdr->ack;
 	}
+	/* Note what the peer holds beyond the acknowledgement. */
+	if ((tcb->flags & SACKOK) && (opts.sackCnt || tcb->sackCnt))
+		sackUpdate(tcb, &opts, tcpHdr->ack);
+		
 	/* See if anything new is being acknowledged */
 	if(!seqGT(tcpHdr->ack, tcb->snd.una)) {
+		/*
+		 * Count duplicate acknowledgements (RFC 5681).  The third starts
+		 * a fast retransmit of the first unacknowledged segment and fast
+		 * recovery unless we're still recovering from a loss in the same
+		 * window (RFC 6582).  Each one in fast recovery means a segment
+		 * has left the network so inflate the congestion window for it.
+		 */
+		if(tcpHdr->ack == tcb->snd.una && segLen == 0 
+				&& tcb->snd.wnd == oldWnd && tcb->snd.una != tcb->snd.nxt
+				&& !(tcpHdr->flags & (TH_SYN | TH_FIN))) {
+			if (tcb->flags & FASTREC) {
+				tcb->cwind += tcb->mss;
+			} else if (++tcb->dupAcks == DUPACKS 
+					&& seqGT(tcpHdr->ack, tcb->recover)) {
+				tcb->recover = tcb->snd.nxt;
+				ccLoad(tcb);
+				tcb->ccOps->onLoss(&tcb->cc);
+				tcb->cwind = tcb->ssthresh + DUPACKS * (u_int32_t)tcb->mss;
+				tcb->flags |= FASTREC | FASTRT;
+				STATS(tcpStats.fastRetrans.val++;)
+				TCPDEBUG((tcb->traceLevel, TL_TCP, "tcbUpdate[%d]: Fast retransmit %lu",
+							(int)(tcb - &tcbs[0]), tcb->snd.una));
+			}
+		}
 		OSSemPost(tcb->mutex);
+		
+		/* A window update alone may let a blocked writer carry on. */
+		if (tcb->snd.wnd > oldWnd)
+			writeWake(tcb);
 		return;	/* Nothing more to do */
 	}
 
 	/* We're here, so the ACK must have actually acked something */
-	acked = (u_int16_t)(tcpHdr->ack - tcb->snd.una);
+	acked = tcpHdr->ack - tcb->snd.una;
+	tcb->dupAcks = 0;
 
-	/* Expand congestion window if not already at limit */
-	if(tcb->cwind < tcb->snd.wnd) {
-		if(tcb->cwind < tcb->ssthresh){
-			/* Still doing slow start/CUTE, expand by amount acked */
-			expand = MIN(acked, tcb->mss);
+	/*
+	 * In fast recovery, a partial acknowledgement means another segment
+	 * was lost so resend it and deflate the window by what's left the
+	 * network.  A full acknowledgement ends the recovery.
+	 */
+	recovering = tcb->flags & FASTREC;
+	if (recovering) {
+		if (seqGE(tcpHdr->ack, tcb->recover)) {
+			tcb->flags &= ~FASTREC;
+			tcb->cwind = MIN(tcb->ssthresh, 
+					tcb->snd.nxt - tcpHdr->ack + tcb->mss);
 		} else {
-			/* Steady-state test of extra path capacity */
-			expand = (u_int16_t)(((long)tcb->mss * tcb->mss) / tcb->cwind);
-		}
-		/* Guard against arithmetic overflow */
-		if(tcb->cwind + expand < tcb->cwind)
-			expand = INT_MAX - tcb->cwind;
-
-		/* Don't expand beyond the offered window */
-		if(tcb->cwind + expand > tcb->snd.wnd)
-			expand = tcb->snd.wnd - tcb->cwind;
-
-		if(expand != 0){
-#ifdef	notdef
-			/* Kick up the mean deviation estimate to prevent
-			 * unnecessary retransmission should we already be
-			 * bandwidth limited
-			 */
-			tcb->mdev += ((long)tcb->srtt * expand) / tcb->cwind;
-#endif
-			tcb->cwind += expand;
+			tcb->flags |= FASTRT;
+			STATS(tcpStats.fastRetrans.val++;)
+			tcb->cwind = tcb->cwind > acked ? tcb->cwind - acked : 0;
+			if (acked >= tcb->mss)
+				tcb->cwind += tcb->mss;
 		}
+		tcb->cwind = MAX(tcb->cwind, tcb->mss);
 	}
-	/* Round trip time estimation */
-	if(tcb->rttStart && seqGE(tcpHdr->ack, tcb->rttseq)) {
-		long rttElapsed;
-		
+	/*
+	 * Round trip time estimation.  With timestamps, every ACK of new data
+	 * echoes the time that the segment it acknowledges was sent, even if
+	 * that was a retransmission.  Otherwise we time one segment at a time
+	 * and only if it was sent once (Karn's algorithm).
+	 */
+	rttElapsed = -1;
+	if (opts.tsPresent && opts.tsEcr != 0) {
+		rttElapsed = (long)(mtime() - opts.tsEcr);
+		tcb->rttStart = 0;
+	} else if(tcb->rttStart && seqGE(tcpHdr->ack, tcb->rttseq)) {
 		/* A timed sequence number has been acked */
-		rttElapsed = -diffTime(tcb->rttStart);
+		if(!(tcb->flags & RETRAN))
+			rttElapsed = -diffTime(tcb->rttStart);
 		tcb->rttStart = 0;
-		if(!(tcb->flags & RETRAN)){
+	}
+	if (rttElapsed >= 0) {
 		u_int32_t abserr;	/* abs(rtt - srtt) */
 
-			/*
-			 * This packet was sent only once and now
-			 * it's been acked, so process the round trip time.
-			 *
-			 * If this ACKs our SYN, this is the first ACK
-			 * we've received; base our entire SRTT estimate
-			 * on it. Otherwise average it in with the prior
-			 * history, also computing mean deviation.
-			 */
-			if(rttElapsed > tcb->srtt 
-					&& (tcb->state == SYN_SENT || tcb->state == SYN_RECEIVED)) {
-				tcb->srtt = rttElapsed;
-			} else {
-				abserr = (rttElapsed > tcb->srtt) 
-					? rttElapsed - tcb->srtt : tcb->srtt - rttElapsed;
-				tcb->srtt = ((AGAIN-1)*tcb->srtt + rttElapsed) / AGAIN;
-				tcb->mdev = ((DGAIN-1)*tcb->mdev + abserr) / DGAIN;
-			}
-			/* Reset the backoff level */
-			tcb->backoff = 0;
+		/*
+		 * If this ACKs our SYN, this is the first ACK
+		 * we've received; base our entire SRTT estimate
+		 * on it. Otherwise average it in with the prior
+		 * history, also computing mean deviation.
+		 */
+		if(rttElapsed > tcb->srtt 
+				&& (tcb->state == SYN_SENT || tcb->state == SYN_RECEIVED)) {
+			tcb->srtt = rttElapsed;
+		} else {
+			abserr = (rttElapsed > tcb->srtt) 
+				? rttElapsed - tcb->srtt : tcb->srtt - rttElapsed;
+			tcb->srtt = ((AGAIN-1)*tcb->srtt + rttElapsed) / AGAIN;
+			tcb->mdev = ((DGAIN-1)*tcb->mdev + abserr) / DGAIN;
 		}
+		/* Reset the backoff level */
+		tcb->backoff = 0;
+	}
+	/* Outside of fast recovery, let congestion control open the window. */
+	if (!recovering) {
+		ccLoad(tcb);
+		tcb->ccOps->onAck(&tcb->cc, acked, rttElapsed);
 	}
 	/* If we're waiting for an ack of our SYN, note it and adjust count */
 	if(!(tcb->flags & SYNACK)){
@@ -2461,7 +3450,7 @@ static void tcbUpdate(register TCPCB *tcb, register TCPHdr *tcpHdr)
 	OSSemPost(tcb->mutex);
 
 	TCPDEBUG((tcb->traceLevel + 2, TL_TCP,
-				"tcbUpdate[%d]: snd(una=%lu,nxt=%lu,ptr=%lu,wnd=%u)",
+				"tcbUpdate[%d]: snd(una=%lu,nxt=%lu,ptr=%lu,wnd=%lu)",
 				(int)(tcb - &tcbs[0]),
 				tcb->snd.una,
 				tcb->snd.nxt,
@@ -2472,15 +3461,16 @@ static void tcbUpdate(register TCPCB *tcb, register TCPHdr *tcpHdr)
 				tcb->snd.wl1,
 				tcb->snd.wl2));
 	TCPDEBUG((tcb->traceLevel + 2, TL_TCP,
-				"tcbUpdate[%d]: iss=%lu cwin=%u sst=%u res=%lu backoff=%u",
+				"tcbUpdate[%d]: iss=%lu cwin=%lu sst=%lu res=%lu sack=%lu backoff=%u",
 				(int)(tcb - &tcbs[0]),
 				tcb->iss,
 				tcb->cwind,
 				tcb->ssthresh,
 				tcb->resent,
+				tcb->sackSkipped,
 				tcb->backoff));
 	TCPDEBUG((tcb->traceLevel + 2, TL_TCP,
-				"tcbUpdate[%d]: rcv(nxt=%lu,wnd=%u,up=%u) irs=%lu mss=%u",
+				"tcbUpdate[%d]: rcv(nxt=%lu,wnd=%lu,up=%u) irs=%lu mss=%u",
 				(int)(tcb - &tcbs[0]),
 				tcb->rcv.nxt,
 				tcb->rcv.wnd,
@@ -2490,26 +3480,249 @@ static void tcbUpdate(register TCPCB *tcb, register TCPHdr *tcpHdr)
 				tcb->rerecv));
 				
 	/*
-	 * If outgoing data was acked, clear the retransmission count and
-	 * notify the user so he can send more unless we've already sent a FIN.
+	 * If outgoing data was acked, clear the retransmission count.  Notify
+	 * the writer if data was acked or the window grew.
 	 */
 	if(acked) {
 		/* Prevent resendTimeout from updating retransCnt at the same time. */
 		OS_ENTER_CRITICAL();
 		tcb->retransCnt = 0;
 		OS_EXIT_CRITICAL();
+	}
+	if (acked || tcb->snd.wnd > oldWnd)
+		writeWake(tcb);
+}
+
+/*
+ * writeWake - Wake a writer blocked on the connection and its poll set
+ * now that there may be room to send unless we've already sent a FIN.
+ */
+static void writeWake(TCPCB *tcb)
+{
+	switch(tcb->state){
+	case ESTABLISHED:
+	case CLOSE_WAIT:
+		OSSemPost(tcb->writeSem);
+		pollWake(tcb);
+		break;
+	}
+}
+
+/*
+ * tcpOptParse - Load the options we use from a segment's TCP header.  The
+ * timestamps are usually alone in the layout recommended in RFC 7323
+ * appendix A so that's checked first.
+ */
+static void tcpOptParse(TCPCB *tcb, TCPHdr *tcpHdr, TCPOpts *opts)
+{
+	u_char *optPtr, *tsPtr = NULL;
+	int optLen;
+	
+	opts->mss = 0;
+	opts->wscale = -1;
+	opts->sackOK = 0;
+	opts->sackCnt = 0;
+	
+	optPtr = (u_char *)(tcpHdr + 1);
+	optLen = tcpHdr->tcpOff * 4 - sizeof(TCPHdr);
+	if (optLen == TCPOLEN_TSTAMP_APPA
+			&& optPtr[0] == TCPOPT_NOP && optPtr[1] == TCPOPT_NOP
+			&& optPtr[2] == TCPOPT_TIMESTAMP 
+			&& optPtr[3] == TCPOLEN_TIMESTAMP) {
+		tsPtr = optPtr + 2;
+		optLen = 0;
+	}
+	while (optLen > 0 && *optPtr != TCPOPT_EOL) {
+		if (*optPtr == TCPOPT_NOP) {
+			optPtr++;
+			optLen--;
+		} else if (optLen < 2 || optPtr[1] < 2 || optPtr[1] > optLen) {
+			TCPDEBUG((LOG_WARNING, TL_TCP, "tcpOptParse[%d]: Bad option length",
+						(int)(tcb - &tcbs[0])));
+			break;
+		} else {
+			if (optPtr[0] == TCPOPT_MAXSEG && optPtr[1] == TCPOLEN_MAXSEG)
+				opts->mss = ((u_int16_t)optPtr[2] << 8) | optPtr[3];
+			else if (optPtr[0] == TCPOPT_WINDOW && optPtr[1] == TCPOLEN_WINDOW)
+				opts->wscale = MIN(optPtr[2], TCP_MAXWSCALE);
+			else if (optPtr[0] == TCPOPT_TIMESTAMP 
+					&& optPtr[1] == TCPOLEN_TIMESTAMP)
+				tsPtr = optPtr;
+			else if (optPtr[0] == TCPOPT_SACK_PERMITTED 
+					&& optPtr[1] == TCPOLEN_SACK_PERMITTED)
+				opts->sackOK = !0;
+			else if (optPtr[0] == TCPOPT_SACK 
+					&& (optPtr[1] - 2) % TCPOLEN_SACKBLK == 0) {
+				u_char *sp;
+				
+				for (sp = optPtr + 2; 
+						sp < optPtr + optPtr[1] && opts->sackCnt < SACKBLKS;
+						sp += TCPOLEN_SACKBLK, opts->sackCnt++) {
+					opts->sack[opts->sackCnt].left = ((u_int32_t)sp[0] << 24) 
+							| ((u_int32_t)sp[1] << 16) | ((u_int32_t)sp[2] << 8) 
+							| sp[3];
+					opts->sack[opts->sackCnt].right = ((u_int32_t)sp[4] << 24) 
+							| ((u_int32_t)sp[5] << 16) | ((u_int32_t)sp[6] << 8) 
+							| sp[7];
+				}
+			}
+			optLen -= optPtr[1];
+			optPtr += optPtr[1];
+		}
+	}
+	if ((opts->tsPresent = (tsPtr != NULL)) != 0) {
+		opts->tsVal = ((u_int32_t)tsPtr[2] << 24) | ((u_int32_t)tsPtr[3] << 16)
+				| ((u_int32_t)tsPtr[4] << 8) | tsPtr[5];
+		opts->tsEcr = ((u_int32_t)tsPtr[6] << 24) | ((u_int32_t)tsPtr[7] << 16)
+				| ((u_int32_t)tsPtr[8] << 8) | tsPtr[9];
+	}
+}
+
+/*
+ * sackBuild - Load the SACK blocks that we report from the resequencing
+ * queue.  The block holding the segment queued last goes first as RFC 2018
+ * requires and the lowest of the rest follow.
+ */
+static void sackBuild(TCPCB *tcb)
+{
+	NBuf *nb;
+	IPHdr *ipHdr;
+	TCPHdr *tcpHdr;
+	SackBlk blk[SACKBLKS];
+	u_int32_t segSeq, segEnd;
+	u_int maxBlks, n, i;
+	int recent = -1;
+	
+	maxBlks = (tcb->flags & TSTAMP) ? SACKBLKS - 1 : SACKBLKS;
+	n = 0;
+	for (nb = nQHEAD(&tcb->reseq); nb && n <= maxBlks; nb = nb->nextChain) {
+		ipHdr = nBUFTOPTR(nb, IPHdr *);
+		tcpHdr = (TCPHdr *)((char *)ipHdr + ipHdr->ip_hl * 4);
+		segSeq = nb->sortOrder;
+		segEnd = segSeq + ipHdr->ip_len - ipHdr->ip_hl * 4 - tcpHdr->tcpOff * 4;
+		if (!seqGT(segEnd, tcb->rcv.nxt))
+			continue;
+		if (n > 0 && seqLE(segSeq, blk[n - 1].right)) {
+			if (seqGT(segEnd, blk[n - 1].right))
+				blk[n - 1].right = segEnd;
+		} else if (n < maxBlks) {
+			blk[n].left = segSeq;
+			blk[n++].right = segEnd;
+		} else
+			break;
+		if (seqWithin(tcb->rsackRecent, blk[n - 1].left, blk[n - 1].right))
+			recent = n - 1;
+	}
+	
+	OSSemPend(tcb->mutex, 0);
+	if (recent > 0) {
+		tcb->rsack[0] = blk[recent];
+		for (i = 0; i < (u_int)recent; i++)
+			tcb->rsack[i + 1] = blk[i];
+		for (i = recent + 1; i < n; i++)
+			tcb->rsack[i] = blk[i];
+	} else {
+		for (i = 0; i < n; i++)
+			tcb->rsack[i] = blk[i];
+	}
+	tcb->rsackCnt = n;
+	OSSemPost(tcb->mutex);
+}
+
+/*
+ * sackUpdate - Merge the peer's SACK blocks into the scoreboard and drop
+ * what's been cumulatively acknowledged.  The scoreboard is kept in
+ * sequence order.  If it fills, the highest blocks are lost since it's
+ * the lowest holes that are resent first.  This must be called with the
+ * mutex held.
+ */
+static void sackUpdate(TCPCB *tcb, TCPOpts *opts, u_int32_t ack)
+{
+	SackBlk *sb = tcb->sack;
+	u_int32_t left, right;
+	u_int i, j;
+	
+	for (i = 0; i < opts->sackCnt; i++) {
+		left = opts->sack[i].left;
+		right = opts->sack[i].right;
+		/* Ignore stale and invalid blocks. */
+		if (!seqLT(left, right) || !seqGT(right, ack) 
+				|| seqGT(right, tcb->snd.nxt))
+			continue;
+		if (seqLT(left, ack))
+			left = ack;
+			
+		/* Find the first block that doesn't end before this one starts. */
+		for (j = 0; j < tcb->sackCnt && seqLT(sb[j].right, left); j++)
+			;
+		if (j < tcb->sackCnt && seqLE(sb[j].left, right)) {
+			/* It touches - extend it and absorb any blocks it now covers. */
+			if (seqLT(left, sb[j].left))
+				sb[j].left = left;
+			if (seqGT(right, sb[j].right))
+				sb[j].right = right;
+			while (j + 1 < tcb->sackCnt && seqLE(sb[j + 1].left, sb[j].right)) {
+				if (seqGT(sb[j + 1].right, sb[j].right))
+					sb[j].right = sb[j + 1].right;
+				memmove(&sb[j + 1], &sb[j + 2], 
+						(tcb->sackCnt - j - 2) * sizeof(SackBlk));
+				tcb->sackCnt--;
+			}
+		} else if (j < SACKBOARD) {
+			if (tcb->sackCnt == SACKBOARD)
+				tcb->sackCnt--;
+			memmove(&sb[j + 1], &sb[j], (tcb->sackCnt - j) * sizeof(SackBlk));
+			sb[j].left = left;
+			sb[j].right = right;
+			tcb->sackCnt++;
+		}
+	}
+	
+	/* Drop what's been cumulatively acknowledged. */
+	for (j = 0; j < tcb->sackCnt && seqLE(sb[j].right, ack); j++)
+		;
+	if (j > 0) {
+		memmove(&sb[0], &sb[j], (tcb->sackCnt - j) * sizeof(SackBlk));
+		tcb->sackCnt -= j;
+	}
+	if (tcb->sackCnt && seqLT(sb[0].left, ack))
+		sb[0].left = ack;
+}
+
+/*
+ * sackSkip - If we're resending, move the send pointer past any data that
+ * the peer has selectively acknowledged.  This must be called with the
+ * mutex held.
+ * Return the bytes that may be resent before the next SACKed block.
+ */
+static u_int32_t sackSkip(TCPCB *tcb)
+{
+	u_int32_t skip;
+	u_int i;
+	
+	if (tcb->sackCnt == 0 || !seqLT(tcb->snd.ptr, tcb->snd.nxt))
+		return 0xFFFFFFFFUL;
 		
-		switch(tcb->state){
-	 	case ESTABLISHED:
-		case CLOSE_WAIT:
-			OSSemPost(tcb->writeSem);
+	for (i = 0; i < tcb->sackCnt; i++) {
+		if (seqLT(tcb->snd.ptr, tcb->sack[i].left))
+			return tcb->sack[i].left - tcb->snd.ptr;
+		if (seqLT(tcb->snd.ptr, tcb->sack[i].right)) {
+			skip = tcb->sack[i].right - tcb->snd.ptr;
+			tcb->sackSkipped += skip;
+			STATS(tcpStats.sackSkip.val += skip;)
+			tcb->snd.ptr = tcb->sack[i].right;
 		}
 	}
+	return 0xFFFFFFFFUL;
 }
 
 /* Process an incoming SYN */
 static void procSyn(register TCPCB *tcb, TCPHdr *tcpHdr)
 {
+	TCPOpts opts;
+	
+	tcpOptParse(tcb, tcpHdr, &opts);
+	
 	OSSemPend(tcb->mutex, 0);
 	tcb->flags |= FORCE;	/* Always send a response */
 
@@ -2522,7 +3735,46 @@ static void procSyn(register TCPCB *tcb, TCPHdr *tcpHdr)
 	tcb->rcv.nxt = tcpHdr->seq + 1;	/* p 68 */
 	tcb->snd.wl1 = tcb->irs = tcpHdr->seq;
 	tcb->snd.wnd = tcpHdr->win;
-	/* XXX Should check for TCP options - especially MSS. */
+	
+	/*
+	 * Limit our segment size to the peer's MSS option.  If the peer didn't
+	 * send one then we must assume the default of RFC 1122.
+	 */
+	if (opts.mss == 0)
+		opts.mss = IP_MSS - sizeof(IPHdr) - sizeof(TCPHdr);
+	tcb->mssMax = opts.mss;
+	if (opts.mss < tcb->mss)
+		tcb->mss = opts.mss;
+		
+	/*
+	 * Windows are scaled only if both sides send the window scale option.
+	 * We always send it on an active open so we only have to check the
+	 * peer.  Without it the window we advertise is limited to 64K.
+	 */
+	if (opts.wscale >= 0) {
+		tcb->flags |= WSCALE;
+		tcb->sndScale = (u_char)opts.wscale;
+	} else {
+		tcb->flags &= ~WSCALE;
+		tcb->sndScale = 0;
+		tcb->rcvScale = 0;
+	}
+	
+	/* Likewise for timestamps.  Start echoing the peer's. */
+	if (opts.tsPresent) {
+		tcb->flags |= TSTAMP;
+		tcb->tsRecent = opts.tsVal;
+		tcb->tsRecentAge = mtime();
+	} else
+		tcb->flags &= ~TSTAMP;
+		
+	/* And for selective acknowledgements. */
+	if (opts.sackOK)
+		tcb->flags |= SACKOK;
+	else
+		tcb->flags &= ~SACKOK;
+	tcb->sackCnt = 0;
+	tcb->rsackCnt = 0;
 	OSSemPost(tcb->mutex);
 }
 
@@ -2535,13 +3787,28 @@ void sendSyn(register TCPCB *tcb)
 		= tcb->rttseq
 		= tcb->snd.wl2 
 		= tcb->snd.una 
+		= tcb->recover
 		= tcb->iss
 			= newISS();
+	tcb->dupAcks = 0;
 	tcb->sndcnt++;
 	tcb->flags |= FORCE;
 	OSSemPost(tcb->mutex);
 }
 
+/*
+ * Return the smallest window scale shift that lets a receive window of
+ * the given size be advertised.
+ */
+static u_char wndScale(u_int32_t wnd)
+{
+	u_char scale = 0;
+	
+	while (scale < TCP_MAXWSCALE && (wnd >> scale) > 65535)
+		scale++;
+	return scale;
+}
+
 /* 
  * Return an initial sequence number.  According to RFC 793 pg 27,
  * "The generator is bound to a 32 bit clock whose low order bit is
@@ -2575,11 +3842,16 @@ static void tcbFree(TCPCB *tcb)
 		tcbUnlink(tcb);
 		timerClear(&tcb->resendTimer);
 		timerClear(&tcb->keepTimer);
+		timerClear(&tcb->ackTimer);
+		tcb->flags &= ~DELACK;
+		pollRemove(tcb);
 		tcb->rttStart = 0;
-		while (nQHEAD(tcb->reseq)) {
-			nDEQUEUE(tcb->reseq, n0);
+		while (nQHEAD(&tcb->reseq)) {
+			nDEQUEUE(&tcb->reseq, n0);
 			nFreeChain(n0);
 		}
+		tcb->rsackCnt = 0;
+		tcb->sackCnt = 0;
 		while (nQHEAD(&tcb->rcvq)) {
 			nDEQUEUE(&tcb->rcvq, n0);
 			nFreeChain(n0);
@@ -2610,9 +3882,32 @@ static void tcbFree(TCPCB *tcb)
 		STATS(tcpStats.curFree.val++;)
 		OS_EXIT_CRITICAL();
 	}
-}	
+}
 
-/* 
+/*
+ * tcpMSS - Set the MSS of a connection from the MTU of the path to the
+ * peer and the largest segment the peer will take.  If the path MTU has
+ * been lowered by discovery then check again later since the lower MTU
+ * will expire.  The TCB mutex must be held once the TCB is in use.
+ */
+static void tcpMSS(TCPCB *tcb)
+{
+	u_int mtu, mss;
+
+	if ((mtu = ipMTU(tcb->ipDstAddr)) < TCP_MINMSS + sizeof(IPHdr) + sizeof(TCPHdr))
+		mss = TCP_MINMSS;
+	else
+		mss = mtu - sizeof(IPHdr) - sizeof(TCPHdr);
+	tcb->mss = MIN(mss, tcb->mssMax);
+	tcb->minFreeBufs = ((tcb->mss + NBUFSZ) / NBUFSZ);
+
+	if (ipPMTUGet(tcb->ipDstAddr) == 0)
+		tcb->pmtuTime = 0;
+	else if ((tcb->pmtuTime = mtime() + TCP_PMTUCHECK * 1000L) == 0)
+		tcb->pmtuTime = 1;
+}
+
+/*
  * tcpOutput - Send a prepared TCP segment.
  * One gets sent from the output queue only if there is data to be sent or if
  * "force" is non zero.
@@ -2626,17 +3921,45 @@ static void tcpOutput(TCPCB *tcb)
 	u_int16_t ssize;			/* Size of current segment being sent,
 							 * including SYN and FIN flags */
 	u_int16_t dsize;			/* Size of segment less SYN and FIN */
-	u_int16_t sent;				/* Sequence count (incl SYN/FIN) already in the pipe */
+	u_int32_t sent;				/* Sequence count (incl SYN/FIN) already in the pipe */
+	u_int32_t usable;			/* Usable window. */
+	u_int32_t hole;				/* Resendable bytes before a SACKed block. */
+	u_int32_t resume = 0;		/* Send pointer to resume after a fast resend. */
+	int fast = 0;				/* Set for a fast retransmission. */
+	u_int optLen;				/* Length of options on every segment. */
+	u_int i;
 
 	if (tcb == NULL || tcb->state == LISTEN || tcb->state == CLOSED)
 		;
 	else {
 		OSSemPend(tcb->mutex, 0);
+		
+		/* See if a lowered path MTU has expired so that we can send more. */
+		if (tcb->pmtuTime && diffTime(tcb->pmtuTime) <= 0)
+			tcpMSS(tcb);
+			
 		for(;;) {
+			/*
+			 * A fast retransmission resends the first unacknowledged
+			 * segment whatever the window and then we carry on from where
+			 * we were.
+			 */
+			if (tcb->flags & FASTRT) {
+				tcb->flags &= ~FASTRT;
+				fast = !0;
+				resume = tcb->snd.ptr;
+				tcb->snd.ptr = tcb->snd.una;
+			}
+			
+			/*
+			 * When resending, skip what the peer has selectively 
+			 * acknowledged so that only the holes are resent.
+			 */
+			hole = sackSkip(tcb);
 			
-			sent = (u_int16_t)(tcb->snd.ptr - tcb->snd.una);
-			if (sent < 0) {
-				TCPDEBUG((LOG_ERR, TL_TCP, "tcpOutput[%d]: sent=%d una=%lu ptr=%lu",
+			sent = tcb->snd.ptr - tcb->snd.una;
+			if ((long)sent < 0) {
+				TCPDEBUG((LOG_ERR, TL_TCP, "tcpOutput[%d]: sent=%ld una=%lu ptr=%lu",
 							(int)(tcb - & tcbs[0]),
 							sent, tcb->snd.una, tcb->snd.ptr));
 			}
@@ -2649,24 +3972,33 @@ static void tcpOutput(TCPCB *tcb)
 			if (tcb->snd.wnd == 0) {
 				/* Allow only one closed-window probe at a time */
 				if (sent != 0)
-					ssize = 0;
+					usable = 0;
 				/* Force a closed-window probe */
 				else
-					ssize = 1;
+					usable = 1;
 			} else {
 				/* 
 				 * Usable window = offered window (limited by the congestion 
 				 * window) less the unacked bytes in transit.
 				 */
-				ssize = MIN(tcb->snd.wnd, tcb->cwind) - sent;
+				usable = MIN(tcb->snd.wnd, tcb->cwind);
+				usable = usable > sent ? usable - sent : 0;
 			}
 			/*
 			 * Compute size of segment to send. This is either the usable
 			 * window, the mss, or the amount we have on hand, whichever is less.
 			 * (I don't like optimistic windows)
 			 */
-			ssize = MIN(tcb->sndcnt - sent, ssize);
-			ssize = MIN(ssize, tcb->mss);
+			if (fast)
+				usable = tcb->sndcnt - sent;
+			else
+				usable = MIN(tcb->sndcnt - sent, usable);
+			usable = MIN(usable, hole);
+			/* Leave room in the segment for the options. */
+			optLen = (tcb->flags & TSTAMP) ? TCPOLEN_TSTAMP_APPA : 0;
+			if (tcb->rsackCnt)
+				optLen += TCPOLEN_SACK_APPA + tcb->rsackCnt * TCPOLEN_SACKBLK;
+			ssize = (u_int16_t)MIN(usable, tcb->mss - optLen);
 	
 			/*
 			 * Allow only a single outstanding segment unless we are
@@ -2674,11 +4006,12 @@ static void tcpOutput(TCPCB *tcb)
 			 * (i.e. a variation on John Nagle's "single outstanding segment" 
 			 * rule which is for a maximum-size segment) or
 			 * if we have used up our quota of segments on the output queue or
-			 * if this is the very last packet.
+			 * if this is the very last packet or if we're filling a hole.
 			 */
 			if (sent != 0 && ssize < TCP_MINSEG
 					&& tcb->sndq.qLen < TCP_MAXQUEUE 
-					&& !(tcb->state == FINWAIT1 && ssize == tcb->sndcnt - sent))
+					&& !(tcb->state == FINWAIT1 && ssize == tcb->sndcnt - sent)
+					&& !seqLT(tcb->snd.ptr, tcb->snd.nxt))
 				ssize = 0;
 				
 			/*
@@ -2688,9 +4021,16 @@ static void tcpOutput(TCPCB *tcb)
 				break;
 				
 			/*
-			 * We've handled the FORCE flag (if any) so clear it.
+			 * We've handled the FORCE flag (if any) so clear it.  This
+			 * segment acknowledges everything received so far so any
+			 * delayed ACK goes with it.
 			 */	
 			tcb->flags &= ~FORCE;
+			if (tcb->flags & DELACK) {
+				tcb->flags &= ~DELACK;
+				timerClear(&tcb->ackTimer);
+			}
+			tcb->ackPending = 0;
 	
 			/*
 			 * Set the SYN and ACK flags according to the state we're in. It is
@@ -2722,10 +4062,58 @@ static void tcpOutput(TCPCB *tcb)
 					*tcb->optionsPtr++ = TCPOPT_MAXSEG;
 					*tcb->optionsPtr++ = TCPOLEN_MAXSEG;
 					put16(tcb->optionsPtr, tcb->mss);
+					
+					/* 
+					 * Offer window scaling on an active open or if the
+					 * peer offered it.
+					 */
+					if (tcb->state == SYN_SENT || (tcb->flags & WSCALE)) {
+						hsize += TCPOLEN_WINDOW + 1;
+						*tcb->optionsPtr++ = TCPOPT_NOP;
+						*tcb->optionsPtr++ = TCPOPT_WINDOW;
+						*tcb->optionsPtr++ = TCPOLEN_WINDOW;
+						*tcb->optionsPtr++ = tcb->rcvScale;
+					}
+					
+					/* Likewise for selective acknowledgements. */
+					if (tcb->state == SYN_SENT || (tcb->flags & SACKOK)) {
+						hsize += TCPOLEN_SACK_PERMITTED + 2;
+						*tcb->optionsPtr++ = TCPOPT_NOP;
+						*tcb->optionsPtr++ = TCPOPT_NOP;
+						*tcb->optionsPtr++ = TCPOPT_SACK_PERMITTED;
+						*tcb->optionsPtr++ = TCPOLEN_SACK_PERMITTED;
+					}
 				}
 				break;
 			}
 			
+			/*
+			 * Offer timestamps on an active open and send them on every
+			 * segment once they're agreed.  We use our millisecond clock.
+			 */
+			if (tcb->state == SYN_SENT || (tcb->flags & TSTAMP)) {
+				hsize += TCPOLEN_TSTAMP_APPA;
+				*tcb->optionsPtr++ = TCPOPT_NOP;
+				*tcb->optionsPtr++ = TCPOPT_NOP;
+				*tcb->optionsPtr++ = TCPOPT_TIMESTAMP;
+				*tcb->optionsPtr++ = TCPOLEN_TIMESTAMP;
+				put32(tcb->optionsPtr, mtime());
+				put32(tcb->optionsPtr, (tcb->flags & TSTAMP) ? tcb->tsRecent : 0);
+			}
+			
+			/* Report the out of order data that we're holding. */
+			if (tcb->rsackCnt && !(tcb->tcpFlags & SYN)) {
+				hsize += TCPOLEN_SACK_APPA + tcb->rsackCnt * TCPOLEN_SACKBLK;
+				*tcb->optionsPtr++ = TCPOPT_NOP;
+				*tcb->optionsPtr++ = TCPOPT_NOP;
+				*tcb->optionsPtr++ = TCPOPT_SACK;
+				*tcb->optionsPtr++ = 2 + tcb->rsackCnt * TCPOLEN_SACKBLK;
+				for (i = 0; i < tcb->rsackCnt; i++) {
+					put32(tcb->optionsPtr, tcb->rsack[i].left);
+					put32(tcb->optionsPtr, tcb->rsack[i].right);
+				}
+			}
+			
 			/* 
 			 * Set the sequence, ack, window, and urgent values for the segment
 			 * to send.  If we're sending a keep alive then we send a segment
@@ -2739,7 +4127,12 @@ static void tcpOutput(TCPCB *tcb)
 			else
 				tcb->tcpSeq = htonl(tcb->snd.ptr);
 			tcb->tcpAck = htonl(tcb->rcv.nxt);
-			tcb->tcpWin = htons(tcb->rcv.wnd);
+			tcb->lastAckSent = tcb->rcv.nxt;
+			/* The window in a SYN is never scaled. */
+			if (tcb->tcpFlags & SYN)
+				tcb->tcpWin = htons((u_int16_t)MIN(tcb->rcv.wnd, 65535));
+			else
+				tcb->tcpWin = htons((u_int16_t)MIN(tcb->rcv.wnd >> tcb->rcvScale, 65535));
 			tcb->tcpUrgent = 0;
 			
 			/*
@@ -2793,8 +4186,10 @@ static void tcpOutput(TCPCB *tcb)
 			 * snd.nxt will already be past snd.ptr. In this case,
 			 * compute the amount of retransmitted data and keep score.
 			 */
-			if (seqLT(tcb->snd.ptr, tcb->snd.nxt))
+			if (seqLT(tcb->snd.ptr, tcb->snd.nxt)) {
 				tcb->resent += min(tcb->snd.nxt - tcb->snd.ptr, ssize);
+				STATS(tcpStats.resent.val += min(tcb->snd.nxt - tcb->snd.ptr, ssize);)
+			}
 	
 			tcb->snd.ptr += ssize;
 			
@@ -2804,6 +4199,11 @@ static void tcpOutput(TCPCB *tcb)
 			 */
 			if (seqGT(tcb->snd.ptr, tcb->snd.nxt))
 				tcb->snd.nxt = tcb->snd.ptr;
+			if (fast) {
+				fast = 0;
+				if (seqGT(resume, tcb->snd.ptr))
+					tcb->snd.ptr = resume;
+			}
 	
 			/*
 			 * Complete and prepend the TCP/IP headers.  Note that some IP
@@ -2839,9 +4239,13 @@ static void tcpOutput(TCPCB *tcb)
 			/* ipHdr->ip_ttl = 0; XXX TTL is zeroed in the header. */
 			ipHdr->ip_sum = htons(ipHdr->ip_len - sizeof(IPHdr));
 	
-			/* Compute the checksum on the pseudo header. */
+			/*
+			 * Compute the checksum on the pseudo header.  Looped back
+			 * segments aren't checked so leave it zero for them.
+			 */
 			tcpHdr = (TCPHdr *)(ipHdr + 1);		/* Assuming no IP options! */
-			tcpHdr->ckSum = inChkSum(sBuf, sBuf->chainLen - 8, 8);
+			if (!ipLOCAL(tcb->ipDstAddr))
+				tcpHdr->ckSum = inChkSum(sBuf, sBuf->chainLen - 8, 8);
             
             /* Now that we've done the checksum, it's time to set the TTL. */
 			ipHdr->ip_ttl = TCPTTL;
@@ -2900,6 +4304,9 @@ static void tcpOutput(TCPCB *tcb)
 			/* Grab the mutex again while we check for another segment. */
 			OSSemPend(tcb->mutex, 0);
 		}
+		/* If a fast retransmission wasn't sent, carry on where we were. */
+		if (fast && seqGT(resume, tcb->snd.ptr))
+			tcb->snd.ptr = resume;
 		OSSemPost(tcb->mutex);
 	}
 }
@@ -2981,7 +4388,8 @@ u_int32_t tmp32;
 	ipHdr->ip_sum = htons(ipHdr->ip_len - sizeof(IPHdr));
 	
 	tcpHdr->ckSum = 0;
-	tcpHdr->ckSum = inChkSum(inBuf, inBuf->chainLen - 8, 8);
+	if (!ipLOCAL(ipHdr->ip_dst.s_addr))
+		tcpHdr->ckSum = inChkSum(inBuf, inBuf->chainLen - 8, 8);
 		
     /* Now that we've done the checksum, it's time to set the TTL. */
 	ipHdr->ip_ttl = TCPTTL;
@@ -3074,32 +4482,107 @@ static int trimSeg(
 }
 
 
-/* 
- * tcbHash - Return a hash code of a TCP/IP header for the hash chain header
- * array.
+/*
+ * tcbAlloc - Take a TCB from the free list.  The TCB is returned neither
+ * free nor linked.
+ * Return NULL if all the TCBs are in use.
  */
-static u_int tcbHash(Connection *conn)
+static TCPCB *tcbAlloc(void)
 {
-	register u_int hval;
+	TCPCB *tcb;
+	
+	OS_ENTER_CRITICAL();
+	if ((tcb = topTcpCB) != NULL) {
+		topTcpCB = topTcpCB->next;
+		tcb->next = tcb;		/* Next -> self => neither free nor linked. */
+		tcb->prev = NULL;		/* Always NULL when neither free nor linked. */
+		STATS(if (--tcpStats.curFree.val < tcpStats.minFree.val)
+				tcpStats.minFree.val = tcpStats.curFree.val;)
+	}
+	OS_EXIT_CRITICAL();
+	
+	return tcb;
+}
 
-	/* Compute hash function on connection structure */
-	hval = hiword(conn->remoteIPAddr);
-	hval ^= loword(conn->remoteIPAddr);
-	hval ^= hiword(conn->localIPAddr);
-	hval ^= loword(conn->localIPAddr);
-	hval ^= conn->remotePort;
-	hval ^= conn->localPort;
-	hval %= NTCB;
-	return hval;
+/*
+ * tcbHash - Return the keyed hash code of a connection.  This is
+ * HalfSipHash-1-3 over the addresses and ports so that the chains can't be
+ * loaded by a peer choosing its ports.
+ */
+#define ROTL32(x, b) (u_int32_t)(((x) << (b)) | ((x) >> (32 - (b))))
+#define HSIPROUND \
+	v0 += v1; v1 = ROTL32(v1, 5); v1 ^= v0; v0 = ROTL32(v0, 16); \
+	v2 += v3; v3 = ROTL32(v3, 8); v3 ^= v2; \
+	v0 += v3; v3 = ROTL32(v3, 7); v3 ^= v0; \
+	v2 += v1; v1 = ROTL32(v1, 13); v1 ^= v2; v2 = ROTL32(v2, 16)
+static u_int32_t tcbHash(Connection *conn)
+{
+	u_int32_t v0, v1, v2, v3, m[4];
+	u_int i;
+	
+	m[0] = conn->remoteIPAddr;
+	m[1] = conn->localIPAddr;
+	m[2] = ((u_int32_t)conn->remotePort << 16) | conn->localPort;
+	m[3] = (u_int32_t)sizeof(m[0]) * 3 << 24;
+	
+	v0 = tcbKey[0];
+	v1 = tcbKey[1];
+	v2 = 0x6c796765UL ^ tcbKey[0];
+	v3 = 0x74656462UL ^ tcbKey[1];
+	for (i = 0; i < 4; i++) {
+		v3 ^= m[i];
+		HSIPROUND;
+		v0 ^= m[i];
+	}
+	v2 ^= 0xff;
+	HSIPROUND;
+	HSIPROUND;
+	HSIPROUND;
+	return v1 ^ v3;
+}
+
+/*
+ * tcbSplit - Split the next hash chain in two, moving the TCBs which hash
+ * to the new chain.  This must be called from within a critical section.
+ */
+static void tcbSplit(void)
+{
+	register TCPCB *tcb, *next;
+	TCPCB **oldHead, **newHead;
+	u_int32_t newMask = tcbMask << 1 | 1;
+	
+	oldHead = &tcbTbl[tcbNextSplit];
+	newHead = &tcbTbl[tcbNextSplit + tcbMask + 1];
+	tcb = *oldHead;
+	*oldHead = NULL;
+	while (tcb) {
+		next = tcb->next;
+		if ((u_int)(tcb->hash & newMask) == tcbNextSplit) {
+			tcb->next = *oldHead;
+			*oldHead = tcb;
+		} else {
+			tcb->next = *newHead;
+			*newHead = tcb;
+		}
+		if (tcb->next)
+			tcb->next->prev = tcb;
+		tcb->prev = NULL;		/* Head of the chain. */
+		tcb = next;
+	}
+	if (++tcbNextSplit > tcbMask) {
+		tcbMask = newMask;
+		tcbNextSplit = 0;
+	}
 }
 
 /* 
- * tcbLink - Insert TCB at head of proper hash chain and update the TCP/IP
- * header.
+ * tcbLink - Insert TCB at head of proper hash chain, growing the hash table
+ * by a chain if it's getting full.
  */
 static void tcbLink(register TCPCB *tcb)
 {
 	register TCPCB **tcbHead;
+	u_int32_t hash;
 
 	if (tcb->prev == tcb) {
 		TCPDEBUG((LOG_ERR, TL_TCP, "tcbLink: Attempt to link free TCB"));
@@ -3108,9 +4591,11 @@ static void tcbLink(register TCPCB *tcb)
 			TCPDEBUG((LOG_INFO, TL_TCP, "tcbLink: Attempt to link linked TCB"));
 			tcbUnlink(tcb);
 		}
+		hash = tcbHash(&tcb->conn);
 	
 		OS_ENTER_CRITICAL();
-		tcbHead = &tcbTbl[tcbHash(&tcb->conn)];
+		tcb->hash = hash;
+		tcbHead = &tcbTbl[tcbCHAIN(hash)];
 		if ((tcb->next = *tcbHead) != NULL)
 			tcb->next->prev = tcb;
 		*tcbHead = tcb;
@@ -3118,6 +4603,9 @@ static void tcbLink(register TCPCB *tcb)
 		 * Note that tcb->prev is already NULL since it was neither linked nor 
 		 * free. 
 		 */
+		if (++tcbCount > TCB_LOAD * (tcbMask + 1 + tcbNextSplit)
+				&& tcbMask + 1 + tcbNextSplit < TCB_MAXHASH)
+			tcbSplit();
 		OS_EXIT_CRITICAL();
 	}
 }
@@ -3135,7 +4623,7 @@ static void tcbUnlink(register TCPCB *tcb)
 		TCPDEBUG((LOG_INFO, TL_TCP, "tcbUnlink: Attempt to unlink unlinked TCB"));
 	} else {
 		OS_ENTER_CRITICAL();
-		tcbHead = &tcbTbl[tcbHash(&tcb->conn)];
+		tcbHead = &tcbTbl[tcbCHAIN(tcb->hash)];
 		if (*tcbHead == tcb)
 			*tcbHead = tcb->next;	/* We're the first one on the chain */
 		else if (tcb->prev)
@@ -3144,6 +4632,7 @@ static void tcbUnlink(register TCPCB *tcb)
 			tcb->next->prev = tcb->prev;
 		tcb->next = tcb;			/* Next -> self => not linked. */
 		tcb->prev = NULL;			/* Always NULL when neither free nor linked. */
+		tcbCount--;
 		OS_EXIT_CRITICAL();
 	}
 }
@@ -3154,10 +4643,12 @@ static void tcbUnlink(register TCPCB *tcb)
 static TCPCB * tcbLookup(Connection *conn)
 {
 	register TCPCB *tcb;
+	u_int32_t hash = tcbHash(conn);
 
-	tcb = tcbTbl[tcbHash(conn)];
+	tcb = tcbTbl[tcbCHAIN(hash)];
 	while(tcb) {
-		if(conn->localIPAddr == tcb->conn.localIPAddr
+		if(hash == tcb->hash
+			 && conn->localIPAddr == tcb->conn.localIPAddr
 			 && conn->remoteIPAddr == tcb->conn.remoteIPAddr
 			 && conn->localPort == tcb->conn.localPort
 			 && conn->remotePort == tcb->conn.remotePort)
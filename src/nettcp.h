@@ -43,13 +43,20 @@
  */
 #define	TCP_DEFMSS	256			/* Default maximum TCP segment size. */
 #define TCP_MINMSS 256			/* Minimum MSS - interfaces must handle 296 - 40. */
-#define	TCP_DEFWND	512			/* Default receiver window. */
+#define	TCP_DEFWND	512			/* Default receive buffer. */
+#define TCP_AUTORCVBUF (8 * KILOBYTE) /* Most autotuning grows the buffer to. */
+#define TCP_MAXWSCALE 14		/* Largest window scale shift (RFC 7323). */
+#define TCP_MAXWND (65535UL << TCP_MAXWSCALE) /* Largest receive buffer. */
 #define	TCP_DEFRTT	500			/* Initial guess at round trip time (ms) */
 #define TCP_ISSTHRESH 64*KILOBYTE-1	/* Initial slow start threshhold. */
 #define TCP_DEFPORT 5000		/* Initial local port. */
 
 #define TCP_MAXQUEUE 8			/* Maximum packets to allow in queue. */
+#define TCP_MAXBURST 8			/* Most connections in an input burst. */
 #define TCP_MINSEG 80			/* Minimum sized segment for modified Nagle. */
+#define TCP_ACKDELAY 200		/* Default delayed ACK time (ms). */
+#define TCP_MAXACKDELAY 500		/* Longest delayed ACK time (RFC 1122). */
+#define TCP_MAXPOLL 2			/* Poll sets. */
 
 
 /*
@@ -84,6 +91,37 @@
 /* Get/set the trace level.  For debugging use only. */
 #define TCPCTLG_TRACELEVEL 104
 #define TCPCTLS_TRACELEVEL 105
+/*
+ * Get/set the receive buffer size in bytes.  This is the most we'll offer
+ * in our receive window.  The argument must point to a u_long.  It can
+ * only be set before the connection is opened since the window scale is
+ * fixed by the SYN.  The buffer starts at the size set, or TCP_DEFWND by
+ * default, and grows up to TCP_AUTORCVBUF, or the size set if larger, as
+ * the reader keeps up with the data.
+ */
+#define TCPCTLG_RCVBUF 106
+#define TCPCTLS_RCVBUF 107
+/*
+ * Get/set the congestion control algorithm, one of the TCPCC_ codes.  The
+ * argument must point to an int.  A listening connection passes its
+ * algorithm to the connections it accepts.
+ */
+#define TCPCTLG_CONGCTL 108
+#define TCPCTLS_CONGCTL 109
+/*
+ * Get/set the most time in milliseconds that we'll delay acknowledging
+ * received data - 0 to acknowledge every segment.  The argument must point
+ * to an int.  Every second full segment is acknowledged at once.
+ */
+#define TCPCTLG_ACKDELAY 110
+#define TCPCTLS_ACKDELAY 111
+
+/*
+ * Congestion control algorithms.
+ */
+#define TCPCC_RENO 0			/* Reno with NewReno recovery (default). */
+#define TCPCC_CUBIC 1			/* CUBIC for long fat paths (RFC 8312). */
+#define TCPCC_DELAY 2			/* Vegas style delay based for slow links. */
 
 
 /*
@@ -106,6 +144,12 @@
 #define TCPOLEN_WINDOW			3
 #define TCPOPT_TIMESTAMP		8
 #define TCPOLEN_TIMESTAMP		10
+#define TCPOLEN_TSTAMP_APPA		12	/* Timestamps with 2 leading NOPs. */
+#define TCPOPT_SACK_PERMITTED	4
+#define TCPOLEN_SACK_PERMITTED	2
+#define TCPOPT_SACK				5
+#define TCPOLEN_SACK_APPA		4	/* SACK kind and length with 2 leading NOPs. */
+#define TCPOLEN_SACKBLK			8	/* Length of each SACK block. */
 
 
 /************************
@@ -125,9 +169,25 @@ typedef struct TCPStats_s {
 	DiagStat conin;			/* Incoming connection attempts */
 	DiagStat resetOut;		/* Resets generated */
 	DiagStat resetIn;		/* Resets received */
+	DiagStat resent;		/* Bytes retransmitted */
+	DiagStat sackSkip;		/* Bytes not retransmitted since SACKed */
+	DiagStat fastRetrans;	/* Fast retransmissions */
 	DiagStat endRec;
 } TCPStats;
 
+/*
+ * TCP poll events.
+ */
+#define TCPPOLL_READ 1			/* Data, EOF or a connection to accept. */
+#define TCPPOLL_WRITE 2			/* Room to queue data. */
+#define TCPPOLL_CLOSE 4			/* Closed - always reported. */
+
+/* A ready connection returned by tcpPollWait(). */
+typedef struct TCPPollEv_s {
+	u_int td;				/* The TCP descriptor. */
+	int events;				/* TCPPOLL_ events it's ready for. */
+} TCPPollEv;
+
 
 /*****************************
 *** PUBLIC DATA STRUCTURES ***
@@ -240,6 +300,26 @@ int tcpWrite(u_int td, const void *s, u_int n);
 	tcpWriteJiffy(td, s, n, (t + MSPERJIFFY - 1) / MSPERJIFFY)
 int tcpWriteJiffy(u_int td, const void *s, u_int n, u_int timeout);
 
+/*
+ * Read and write nBuf chains on a connected TCP connection without copying
+ * the data.  tcpReadBuf() returns queued segments in *nb, whole if they fit
+ * in maxLen bytes, which the caller must free.  tcpWriteBuf() links the
+ * chain onto the send queue and always consumes it.  They block as
+ * tcpRead() and tcpWrite() do but time out with TCPERR_TIMEOUT.
+ * Return the number of bytes read or written on success, an error code on
+ * failure.
+ */
+#define tcpReadBuf(td, nb, maxLen) \
+	tcpReadBufJiffy(td, nb, maxLen, 0)
+#define tcpReadBufMs(td, nb, maxLen, t) \
+	tcpReadBufJiffy(td, nb, maxLen, (t + MSPERJIFFY - 1) / MSPERJIFFY)
+int tcpReadBufJiffy(u_int td, NBuf **nb, u_int maxLen, u_int timeout);
+#define tcpWriteBuf(td, nb) \
+	tcpWriteBufJiffy(td, nb, 0)
+#define tcpWriteBufMs(td, nb, t) \
+	tcpWriteBufJiffy(td, nb, (t + MSPERJIFFY - 1) / MSPERJIFFY)
+int tcpWriteBufJiffy(u_int td, NBuf *nb, u_int timeout);
+
 /*
  * tcpWait - Wait for the connection to be closed.  Normally this will be
  * done after a disconnect before trying to reuse the TCB.  This will fail
@@ -254,10 +334,49 @@ int tcpWait(u_int td);
  */
 void tcpInput(NBuf *inBuf, u_int ipHeadLen);
 
+/*
+ * Receive a burst of incoming datagrams with the IP and TCP headers intact.
+ * Each connection is acknowledged and its reader woken once per burst.
+ * This is called from IP.
+ */
+void tcpInputBurst(NBuf *inBuf[], u_int n);
+
 /* 
  * Get and set parameters for the given connection.
  * Return 0 on success, an error code on failure. 
  */
 int  tcpIOCtl(u_int td, int cmd, void *arg);
 
+/*
+ * Wait on many connections at once.  tcpPollOpen() returns a poll set
+ * descriptor and tcpPollCtl() sets the TCPPOLL_ events to wait for on a
+ * connection in the set, zero to remove it.  tcpPollWait() blocks until
+ * some connections are ready and returns up to maxEv of them in ev[].
+ * A connection is reported for as long as it stays ready.  tcpPollWaitMs()
+ * and tcpPollWaitJiffy() block at most the time given and return 0 on
+ * timeout.
+ * Return a descriptor, the number of ready connections, or 0 on success,
+ * an error code on failure.
+ */
+int tcpPollOpen(void);
+int tcpPollClose(u_int pd);
+int tcpPollCtl(u_int pd, u_int td, int events);
+#define tcpPollWait(pd, ev, maxEv) \
+	tcpPollWaitJiffy(pd, ev, maxEv, 0)
+#define tcpPollWaitMs(pd, ev, maxEv, t) \
+	tcpPollWaitJiffy(pd, ev, maxEv, (t + MSPERJIFFY - 1) / MSPERJIFFY)
+int tcpPollWaitJiffy(u_int pd, TCPPollEv *ev, u_int maxEv, u_int timeout);
+
+/*
+ * Return non-zero if a segment quoted by an ICMP message is in the unacked
+ * data of a connection.  This is called from IP.
+ */
+int tcpPMTUValid(u_long srcAddr, u_long dstAddr, 
+					u_int16_t srcPort, u_int16_t dstPort, u_int32_t seq);
+
+/*
+ * The path MTU to a destination has dropped.  This is called from IP.
+ */
+void tcpPMTUChange(u_long dstAddr);
+
 #endif
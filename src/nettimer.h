@@ -96,6 +96,14 @@ void timerInit(void);
 #define timerDelete(t) timerClear(t)
 
 
+/*
+ * timerPending - Non-zero if a timer is set and has yet to expire.  A
+ * handler may use this to detect that its timer was set again while it
+ * waited for a lock.
+ */
+#define timerPending(t) ((t)->timerPrev != NULL)
+
+
 /*
  * timeoutJiffy - Set a timer for a timeout in Jiffy time.  
  * A Jiffy is a system clock tick.  The timer will time out at the
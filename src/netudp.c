@@ -0,0 +1,684 @@
+/*****************************************************************************
+* netudp.c - Network User Datagram Protocol program file.
+*
+* The authors hereby grant permission to use, copy, modify, distribute,
+* and license this software and its documentation for any purpose, provided
+* that existing copyright notices are retained in all copies and that this
+* notice and the following disclaimer are included verbatim in any
+* distributions. No written agreement, license, or royalty fee is required
+* for any of the authorized uses.
+*
+* THIS SOFTWARE IS PROVIDED BY THE CONTRIBUTORS *AS IS* AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+* IN NO EVENT SHALL THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+* NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+* THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+******************************************************************************
+* THEORY OF OPERATION
+*
+*   Bound descriptors are linked into a hash table on their local port so
+* that udpInput() can find the owner of a datagram without a search.
+* Received datagrams are queued with their IP and UDP headers still in
+* place so that the sender's address is available when the datagram is
+* read; the headers are trimmed off then.
+*
+*   The UDP checksum is computed with the same pseudo header trick as TCP:
+* the IP TTL is cleared and the UDP length is loaded into the IP checksum
+* field so that the last 12 bytes of the IP header hold the pseudo header
+* fields.
+*****************************************************************************/
+
+#include "netconf.h"
+#include <string.h>
+#include "net.h"
+#include "netbuf.h"
+#include "netip.h"
+#include "netiphdr.h"
+#include "netudp.h"
+
+#include <stdio.h>
+#include "netdebug.h"
+
+
+/*************************/
+/*** LOCAL DEFINITIONS ***/
+/*************************/
+#define MAXUDP 4			/* Maximum UDP descriptors. */
+#define UDPTTL 64			/* Default time-to-live for UDP datagrams. */
+#define UDP_HASHSZ 8		/* Port hash table size - must be a power of 2. */
+#define UDP_DEFPORT 6000	/* Initial ephemeral port. */
+
+/* Hash a port in network byte order. */
+#define UDPHASH(p) (((p) ^ ((p) >> 8)) & (UDP_HASHSZ - 1))
+
+
+/************************/
+/*** LOCAL DATA TYPES ***/
+/************************/
+/*
+ * The UDP header.
+ */
+typedef struct UDPHdr_s {
+	u_int16_t srcPort;			/* Source port. */
+	u_int16_t dstPort;			/* Destination port. */
+	u_int16_t len;				/* UDP length including header. */
+	u_int16_t ckSum;			/* Checksum - zero if not computed. */
+} UDPHdr;
+
+/*
+ * The IP and UDP headers together as we build them.
+ */
+typedef struct UDPIPHdr_s {
+	IPHdr ipHdr;
+	UDPHdr udpHdr;
+} UDPIPHdr;
+
+/*
+ * The UDP control block.
+ */
+typedef struct UDPCB_s {
+	struct UDPCB_s *next;		/* Next in hash chain or free list. */
+	char	inUse;				/* Set while the descriptor is open. */
+	int		traceLevel;			/* Trace level this descriptor. */
+	u_int32_t ipSrcAddr;		/* Bound address in network byte order. */
+	u_int16_t udpSrcPort;		/* Bound port in network byte order. */
+	NBufQHdr rcvq;				/* Received datagrams with headers. */
+	u_int	rcvBytes;			/* Data bytes in the receive queue. */
+	u_int	maxQLen;			/* Max datagrams in the receive queue. */
+	u_int	maxQBytes;			/* Max data bytes in the receive queue. */
+	OS_EVENT *readSem;			/* Posted on each datagram received. */
+} UDPCB;
+
+
+/***********************************/
+/*** LOCAL FUNCTION DECLARATIONS ***/
+/***********************************/
+static UDPCB *udpLookup(u_int16_t port);
+static int udpBindPort(UDPCB *ucb, u_int32_t addr, u_int16_t port);
+static int udpRecvDgram(UDPCB *ucb, NBuf **nb, struct sockaddr_in *from, u_int timeout);
+
+
+/******************************/
+/*** PUBLIC DATA STRUCTURES ***/
+/******************************/
+#if STATS_SUPPORT > 0
+UDPStats udpStats;
+#endif
+
+
+/*****************************/
+/*** LOCAL DATA STRUCTURES ***/
+/*****************************/
+static UDPCB udpcbs[MAXUDP];			/* The UDP control blocks. */
+static UDPCB *topUdpCB;					/* The free list. */
+static UDPCB *udpTbl[UDP_HASHSZ];		/* Bound descriptors by port. */
+static u_int16_t udpFreePort = UDP_DEFPORT;	/* Next ephemeral port. */
+
+
+/***********************************/
+/*** PUBLIC FUNCTION DEFINITIONS ***/
+/***********************************/
+/*
+ * Initialize the UDP subsystem.
+ */
+void udpInit(void)
+{
+	int i;
+
+	memset(udpcbs, 0, sizeof(udpcbs));
+	topUdpCB = &udpcbs[0];
+	for (i = 0; i < MAXUDP - 1; i++)
+		udpcbs[i].next = &udpcbs[i + 1];
+	udpcbs[MAXUDP - 1].next = NULL;
+	memset(udpTbl, 0, sizeof(udpTbl));
+
+#if STATS_SUPPORT > 0
+	memset(&udpStats, 0, sizeof(udpStats));
+	udpStats.headLine.fmtStr	= "\t\tUDP STATISTICS\r\n";
+	udpStats.ipackets.fmtStr	= "\tPACKETS IN  : %5lu\r\n";
+	udpStats.runt.fmtStr		= "\tRUNT HEADERS: %5lu\r\n";
+	udpStats.checksum.fmtStr	= "\tBAD CHECKSUM: %5lu\r\n";
+	udpStats.noport.fmtStr		= "\tNO PORT     : %5lu\r\n";
+	udpStats.qfull.fmtStr		= "\tQUEUE FULL  : %5lu\r\n";
+	udpStats.opackets.fmtStr	= "\tPACKETS OUT : %5lu\r\n";
+#endif
+}
+
+/*
+ * Return a new UDP descriptor on success or an error code (negative) on
+ *	failure.
+ */
+int udpOpen(void)
+{
+	int st;
+	UDPCB *ucb;
+	NBuf *nb;
+
+	OS_ENTER_CRITICAL();
+	if ((ucb = topUdpCB) != NULL)
+		topUdpCB = topUdpCB->next;
+	OS_EXIT_CRITICAL();
+
+	if (!ucb)
+		st = UDPERR_ALLOC;
+	else {
+		st = (int)(ucb - &udpcbs[0]);
+		ucb->next = NULL;
+		ucb->traceLevel = LOG_INFO;
+		ucb->ipSrcAddr = 0;
+		ucb->udpSrcPort = 0;
+		/* Free anything left queued since the last close. */
+		do {
+			nDEQUEUE(&ucb->rcvq, nb);
+			nFreeChain(nb);
+		} while (nb);
+		ucb->rcvBytes = 0;
+		ucb->maxQLen = UDP_MAXQUEUE;
+		ucb->maxQBytes = UDP_MAXQBYTES;
+		if (!ucb->readSem)
+			ucb->readSem = OSSemCreate(0);
+
+		if (!ucb->readSem) {
+			OS_ENTER_CRITICAL();
+			ucb->next = topUdpCB;
+			topUdpCB = ucb;
+			OS_EXIT_CRITICAL();
+			st = UDPERR_ALLOC;
+		} else {
+			ucb->inUse = !0;
+			UDPDEBUG((ucb->traceLevel, TL_UDP, "udpOpen[%d]: Opened", st));
+		}
+	}
+
+	return st;
+}
+
+/*
+ * Close a UDP descriptor dropping any queued datagrams.
+ * Return 0 on success, an error code on failure.
+ */
+int udpClose(u_int ud)
+{
+	UDPCB *ucb = &udpcbs[ud];
+	UDPCB **pp;
+	NBuf *nb;
+
+	if (ud >= MAXUDP || !ucb->inUse)
+		return UDPERR_PARAM;
+
+	/* Unlink from the port table so that no more datagrams are queued. */
+	OS_ENTER_CRITICAL();
+	ucb->inUse = 0;
+	if (ucb->udpSrcPort) {
+		for (pp = &udpTbl[UDPHASH(ucb->udpSrcPort)]; *pp; pp = &(*pp)->next) {
+			if (*pp == ucb) {
+				*pp = ucb->next;
+				break;
+			}
+		}
+		ucb->udpSrcPort = 0;
+	}
+	OS_EXIT_CRITICAL();
+
+	do {
+		nDEQUEUE(&ucb->rcvq, nb);
+		nFreeChain(nb);
+	} while (nb);
+	ucb->rcvBytes = 0;
+
+	/* Wake any reader so that it sees the descriptor closed. */
+	OSSemPost(ucb->readSem);
+
+	UDPDEBUG((ucb->traceLevel, TL_UDP, "udpClose[%d]: Closed", ud));
+
+	OS_ENTER_CRITICAL();
+	ucb->next = topUdpCB;
+	topUdpCB = ucb;
+	OS_EXIT_CRITICAL();
+
+	return 0;
+}
+
+/*
+ * Bind an IP address and port number as our address on a UDP descriptor.
+ * Note: The IP address must be zero (wild) or equal to localHost since that
+ * is all that ipDispatch() will recognize.  A descriptor can only be bound
+ * once.
+ * Return 0 on success, an error code on failure.
+ */
+int udpBind(u_int ud, const struct sockaddr_in *myAddr)
+{
+	int st;
+	UDPCB *ucb = &udpcbs[ud];
+
+	if (ud >= MAXUDP || !ucb->inUse || !myAddr || ucb->udpSrcPort)
+		st = UDPERR_PARAM;
+	else if (myAddr->ipAddr != 0 && myAddr->ipAddr != localHost)
+		st = UDPERR_INVADDR;
+	else {
+		st = udpBindPort(ucb, htonl(myAddr->ipAddr), htons(myAddr->sin_port));
+		UDPDEBUG((ucb->traceLevel, TL_UDP, "udpBind[%d]: to %s:%u st %d",
+					ud, ip_ntoa(ucb->ipSrcAddr), ntohs(ucb->udpSrcPort), st));
+	}
+
+	return st;
+}
+
+/*
+ * Send a datagram copied from a buffer to the given address.
+ * Return the number of bytes sent on success, an error code on failure.
+ */
+int udpSendTo(u_int ud, const void *s, u_int len, const struct sockaddr_in *to)
+{
+	const char *sp = (const char *)s;
+	NBuf *nb, *n0, *n1 = NULL;
+	u_int i, left;
+
+	if (ud >= MAXUDP || !udpcbs[ud].inUse || (len && !s))
+		return UDPERR_PARAM;
+	if (len > 0xFFFFU - UDP_HDRSPACE)
+		return UDPERR_SIZE;
+
+	/*
+	 * Copy the data into a new chain leaving room for the headers in the
+	 * first buffer.
+	 */
+	nGET(n0);
+	if (!n0)
+		return UDPERR_ALLOC;
+	n0->data = n0->body + UDP_HDRSPACE;
+	for (nb = n0, left = len; left; left -= i) {
+		if (nb->len) {
+			nGET(n1);
+			if (!n1) {
+				nFreeChain(n0);
+				return UDPERR_ALLOC;
+			}
+			nb->nextBuf = n1;
+			nb = n1;
+		}
+		i = MIN(left, (u_int)nTRAILINGSPACE(nb));
+		memcpy(nb->data, sp, i);
+		nb->len = i;
+		n0->chainLen += i;
+		sp += i;
+	}
+
+	return udpSendBuf(ud, n0, to);
+}
+
+/*
+ * Send an nBuf chain as a datagram to the given address.  The chain is
+ * always consumed.
+ * Return the number of bytes sent on success, an error code on failure.
+ */
+int udpSendBuf(u_int ud, NBuf *nb, const struct sockaddr_in *to)
+{
+	UDPCB *ucb = &udpcbs[ud];
+	UDPIPHdr *hdr;
+	u_int len;
+	int st;
+
+	if (ud >= MAXUDP || !ucb->inUse || !to) {
+		nFreeChain(nb);
+		return UDPERR_PARAM;
+	}
+	if (to->ipAddr == 0 || to->sin_port == 0) {
+		nFreeChain(nb);
+		return UDPERR_INVADDR;
+	}
+	if (ucb->ipSrcAddr == 0 && localHost == 0) {
+		nFreeChain(nb);
+		return UDPERR_INVADDR;
+	}
+	len = nb ? nb->chainLen : 0;
+	if (len > 0xFFFFU - UDP_HDRSPACE) {
+		nFreeChain(nb);
+		return UDPERR_SIZE;
+	}
+
+	/* An unbound descriptor gets an ephemeral port on the first send. */
+	if (!ucb->udpSrcPort && (st = udpBindPort(ucb, 0, 0)) < 0) {
+		nFreeChain(nb);
+		return st;
+	}
+
+	if (!nb) {
+		nGET(nb);
+		if (!nb)
+			return UDPERR_ALLOC;
+		nb->data = nb->body + UDP_HDRSPACE;
+	}
+	nPREPEND(nb, NULL, sizeof(UDPIPHdr));
+	if (!nb)
+		return UDPERR_ALLOC;
+	hdr = nBUFTOPTR(nb, UDPIPHdr *);
+
+	/*
+	 * Build a prepared IP header with the TTL cleared and the UDP length
+	 * in the IP checksum field for the pseudo header checksum.
+	 */
+	hdr->ipHdr.ip_v = IPVERSION;
+	hdr->ipHdr.ip_hl = sizeof(IPHdr) / 4;
+	hdr->ipHdr.ip_tos = 0;
+	hdr->ipHdr.ip_len = len + sizeof(UDPIPHdr);
+	hdr->ipHdr.ip_id = IPNEWID();
+	hdr->ipHdr.ip_off = 0;
+	hdr->ipHdr.ip_ttl = 0;
+	hdr->ipHdr.ip_p = IPPROTO_UDP;
+	hdr->ipHdr.ip_sum = htons(len + sizeof(UDPHdr));
+	hdr->ipHdr.ip_src.s_addr = ucb->ipSrcAddr ? ucb->ipSrcAddr : htonl(localHost);
+	hdr->ipHdr.ip_dst.s_addr = htonl(to->ipAddr);
+	hdr->udpHdr.srcPort = ucb->udpSrcPort;
+	hdr->udpHdr.dstPort = htons(to->sin_port);
+	hdr->udpHdr.len = htons(len + sizeof(UDPHdr));
+	hdr->udpHdr.ckSum = 0;
+
+	/*
+	 * A computed checksum of zero is sent as all ones.  Looped back
+	 * datagrams are sent without one.
+	 */
+	if (!ipLOCAL(hdr->ipHdr.ip_dst.s_addr)
+			&& (hdr->udpHdr.ckSum = inChkSum(nb, nb->chainLen - 8, 8)) == 0)
+		hdr->udpHdr.ckSum = 0xFFFF;
+
+	/* Now that we've done the checksum, it's time to set the TTL. */
+	hdr->ipHdr.ip_ttl = UDPTTL;
+
+	UDPDEBUG((ucb->traceLevel + 1, TL_UDP, "udpSend[%d]: %u to %s:%u",
+				ud, len, ip_ntoa(hdr->ipHdr.ip_dst.s_addr), to->sin_port));
+	STATS(udpStats.opackets.val++;)
+
+	ipRawOut(nb);
+
+	return (int)len;
+}
+
+/*
+ * Receive a datagram copying up to len bytes.  The rest of the datagram
+ * is dropped.
+ * Return the number of bytes copied on success, an error code on failure.
+ */
+int udpRecvFromJiffy(u_int ud, void *s, u_int len, struct sockaddr_in *from, u_int timeout)
+{
+	NBuf *nb;
+	int st;
+
+	if (ud >= MAXUDP || !udpcbs[ud].inUse || (len && !s))
+		st = UDPERR_PARAM;
+	else if ((st = udpRecvDgram(&udpcbs[ud], &nb, from, timeout)) >= 0) {
+		st = nb ? nTrim((char *)s, &nb, (int)MIN(len, (u_int)st)) : 0;
+		nFreeChain(nb);
+	}
+
+	return st;
+}
+
+/*
+ * Receive a datagram's nBuf chain without copying.
+ * Return the datagram length on success, an error code on failure.
+ */
+int udpRecvBufJiffy(u_int ud, NBuf **nb, struct sockaddr_in *from, u_int timeout)
+{
+	int st;
+
+	if (ud >= MAXUDP || !udpcbs[ud].inUse || !nb)
+		st = UDPERR_PARAM;
+	else
+		st = udpRecvDgram(&udpcbs[ud], nb, from, timeout);
+
+	return st;
+}
+
+/*
+ * udpInput - Receive an incoming datagram.  The IP header has been
+ * validated and the length, ID and offset are in host byte order.
+ */
+void udpInput(NBuf *inBuf, u_int ipHeadLen)
+{
+	UDPCB *ucb;
+	IPHdr *ipHdr;
+	UDPHdr *udpHdr;
+	u_int udpLen, len;
+	OS_EVENT *readSem = NULL;
+	int st;
+
+	if (inBuf == NULL) {
+		UDPDEBUG((LOG_ERR, TL_UDP, "udpInput: Null input dropped"));
+		return;
+	}
+
+	/*
+	 * Strip off the IP options.  The UDP checksum includes fields from the
+	 * IP header but without the options.
+	 */
+	if (ipHeadLen > sizeof(IPHdr)) {
+		if ((inBuf = ipOptStrip(inBuf, ipHeadLen)) == NULL) {
+			STATS(udpStats.runt.val++;)
+			return;
+		}
+		ipHeadLen = sizeof(IPHdr);
+	}
+
+	/* Get the IP and UDP headers together in the first nBuf. */
+	if (inBuf->len < sizeof(UDPIPHdr)) {
+		if ((inBuf = nPullup(inBuf, sizeof(UDPIPHdr))) == NULL) {
+			STATS(udpStats.runt.val++;)
+			UDPDEBUG((LOG_ERR, TL_UDP, "udpInput: Runt packet dropped"));
+			return;
+		}
+	}
+	ipHdr = nBUFTOPTR(inBuf, IPHdr *);
+	udpHdr = (UDPHdr *)(ipHdr + 1);
+	STATS(udpStats.ipackets.val++;)
+
+	/* Validate the UDP length and trim any link padding. */
+	udpLen = ntohs(udpHdr->len);
+	if (udpLen < sizeof(UDPHdr) || udpLen > ipHdr->ip_len - sizeof(IPHdr)) {
+		STATS(udpStats.runt.val++;)
+		UDPDEBUG((LOG_ERR, TL_UDP, "udpInput: Bad length %u", udpLen));
+		nFreeChain(inBuf);
+		return;
+	}
+	if (inBuf->chainLen > udpLen + sizeof(IPHdr)) {
+		nTrim(NULL, &inBuf, -(int)(inBuf->chainLen - udpLen - sizeof(IPHdr)));
+		ipHdr->ip_len = udpLen + sizeof(IPHdr);
+	}
+
+	/* Validate the checksum if the sender computed one. */
+	if (udpHdr->ckSum != 0 && !(inBuf->flags & NBF_CKSUMOK)) {
+		ipHdr->ip_ttl = 0;
+		ipHdr->ip_sum = htons(udpLen);
+		if (inChkSum(inBuf, inBuf->chainLen - 8, 8) != 0) {
+			STATS(udpStats.checksum.val++;)
+			UDPDEBUG((LOG_ERR, TL_UDP, "udpInput: Bad checksum from %s",
+						ip_ntoa(ipHdr->ip_src.s_addr)));
+			nFreeChain(inBuf);
+			return;
+		}
+	}
+
+	/* 
+	 * Find the owner and queue the datagram if there's room.  This is done
+	 * in one critical section so that udpClose() can't unlink and drain
+	 * the descriptor between the lookup and the enqueue.  The queue is
+	 * linked here since nENQUEUE takes its own critical section.
+	 */
+	len = udpLen - sizeof(UDPHdr);
+	OS_ENTER_CRITICAL();
+	if ((ucb = udpLookup(udpHdr->dstPort)) == NULL)
+		st = UDPERR_PARAM;
+	else if (ucb->rcvq.qLen >= ucb->maxQLen
+			|| ucb->rcvBytes + len > ucb->maxQBytes)
+		st = UDPERR_ALLOC;
+	else {
+		if (!ucb->rcvq.qTail)
+			ucb->rcvq.qHead = ucb->rcvq.qTail = inBuf;
+		else
+			ucb->rcvq.qTail = (ucb->rcvq.qTail->nextChain = inBuf);
+		ucb->rcvq.qLen++;
+		ucb->rcvBytes += len;
+		readSem = ucb->readSem;
+		st = 0;
+	}
+	OS_EXIT_CRITICAL();
+
+	if (st == UDPERR_PARAM) {
+		STATS(udpStats.noport.val++;)
+		UDPDEBUG((LOG_INFO, TL_UDP, "udpInput: No port %u from %s",
+					ntohs(udpHdr->dstPort), ip_ntoa(ipHdr->ip_src.s_addr)));
+		nFreeChain(inBuf);
+
+	} else if (st < 0) {
+		STATS(udpStats.qfull.val++;)
+		UDPDEBUG((ucb->traceLevel, TL_UDP, "udpInput[%d]: Queue full",
+					(int)(ucb - &udpcbs[0])));
+		nFreeChain(inBuf);
+
+	} else
+		OSSemPost(readSem);
+}
+
+/*
+ * Get and set parameters for the given descriptor.
+ * Return 0 on success, an error code on failure.
+ */
+int  udpIOCtl(u_int ud, int cmd, void *arg)
+{
+	UDPCB *ucb = &udpcbs[ud];
+	int st = 0;
+
+	if (ud >= MAXUDP || !ucb->inUse || !arg)
+		st = UDPERR_PARAM;
+	else {
+		switch(cmd) {
+		case UDPCTLG_RCVCNT:		/* Get the datagrams in the receive queue. */
+			*(int *)arg = (int)ucb->rcvq.qLen;
+			break;
+		case UDPCTLG_RCVQLEN:		/* Get the receive queue datagram limit. */
+			*(int *)arg = (int)ucb->maxQLen;
+			break;
+		case UDPCTLS_RCVQLEN:		/* Set the receive queue datagram limit. */
+			if (*(int *)arg > 0)
+				ucb->maxQLen = (u_int)*(int *)arg;
+			else
+				st = UDPERR_PARAM;
+			break;
+		case UDPCTLG_RCVQBYTES:		/* Get the receive queue byte limit. */
+			*(int *)arg = (int)ucb->maxQBytes;
+			break;
+		case UDPCTLS_RCVQBYTES:		/* Set the receive queue byte limit. */
+			if (*(int *)arg > 0)
+				ucb->maxQBytes = (u_int)*(int *)arg;
+			else
+				st = UDPERR_PARAM;
+			break;
+		default:
+			st = UDPERR_PARAM;
+			break;
+		}
+	}
+
+	return st;
+}
+
+
+/**********************************/
+/*** LOCAL FUNCTION DEFINITIONS ***/
+/**********************************/
+/*
+ * udpLookup - Find the descriptor bound to a port in network byte order.
+ */
+static UDPCB *udpLookup(u_int16_t port)
+{
+	UDPCB *ucb;
+
+	for (ucb = udpTbl[UDPHASH(port)]; ucb && ucb->udpSrcPort != port; ucb = ucb->next)
+		;
+	return ucb;
+}
+
+/*
+ * udpBindPort - Bind an address and port in network byte order and link
+ * the descriptor into the port table.  A zero port selects the next free
+ * ephemeral port.
+ * Return 0 on success, an error code on failure.
+ */
+static int udpBindPort(UDPCB *ucb, u_int32_t addr, u_int16_t port)
+{
+	int st = 0;
+	u_int i;
+
+	OS_ENTER_CRITICAL();
+	if (port == 0) {
+		for (i = 0; i < MAXUDP + 1; i++) {
+			if (udpFreePort < UDP_DEFPORT)
+				udpFreePort = UDP_DEFPORT;
+			port = htons(udpFreePort++);
+			if (!udpLookup(port))
+				break;
+		}
+	} else if (udpLookup(port))
+		st = UDPERR_INUSE;
+
+	if (!st) {
+		ucb->ipSrcAddr = addr;
+		ucb->udpSrcPort = port;
+		ucb->next = udpTbl[UDPHASH(port)];
+		udpTbl[UDPHASH(port)] = ucb;
+	}
+	OS_EXIT_CRITICAL();
+
+	return st;
+}
+
+/*
+ * udpRecvDgram - Wait for the next datagram, load the sender's address
+ * and trim off the headers.  *nb is set to NULL for an empty datagram.
+ * Return the data length on success, an error code on failure.
+ */
+static int udpRecvDgram(UDPCB *ucb, NBuf **nb, struct sockaddr_in *from, u_int timeout)
+{
+	UDPIPHdr *hdr;
+	u_long abortTime;
+	long dTime = timeout;
+	int st;
+
+	if (timeout)
+		abortTime = jiffyTime() + timeout;
+
+	for (;;) {
+		nDEQUEUE(&ucb->rcvq, *nb);
+		if (*nb)
+			break;
+		if (!ucb->inUse)
+			return UDPERR_PARAM;
+		if (timeout && (dTime = diffJTime(abortTime)) <= 0)
+			return UDPERR_TIMEOUT;
+		OSSemPend(ucb->readSem, (UINT)dTime);
+	}
+
+	hdr = nBUFTOPTR(*nb, UDPIPHdr *);
+	st = ntohs(hdr->udpHdr.len) - sizeof(UDPHdr);
+	if (from) {
+		from->ipAddr = ntohl(hdr->ipHdr.ip_src.s_addr);
+		from->sin_port = ntohs(hdr->udpHdr.srcPort);
+	}
+	OS_ENTER_CRITICAL();
+	ucb->rcvBytes -= st;
+	OS_EXIT_CRITICAL();
+
+	UDPDEBUG((ucb->traceLevel + 1, TL_UDP, "udpRecv[%d]: %d from %s",
+				(int)(ucb - &udpcbs[0]), st, ip_ntoa(hdr->ipHdr.ip_src.s_addr)));
+
+	/* The headers may fill the first buffer so hdr is invalid after this. */
+	nTrim(NULL, nb, sizeof(UDPIPHdr));
+
+	return st;
+}
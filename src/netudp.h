@@ -0,0 +1,167 @@
+/*****************************************************************************
+* netudp.h - Network User Datagram Protocol header file.
+*
+* The authors hereby grant permission to use, copy, modify, distribute,
+* and license this software and its documentation for any purpose, provided
+* that existing copyright notices are retained in all copies and that this
+* notice and the following disclaimer are included verbatim in any
+* distributions. No written agreement, license, or royalty fee is required
+* for any of the authorized uses.
+*
+* THIS SOFTWARE IS PROVIDED BY THE CONTRIBUTORS *AS IS* AND ANY EXPRESS OR
+* IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+* OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+* IN NO EVENT SHALL THE CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT,
+* INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+* NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+* DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+* THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+* (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+* THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*
+******************************************************************************
+* THEORY OF OPERATION
+*
+*   A UDP descriptor is opened with udpOpen(), bound to a local port with
+* udpBind() and then used to send datagrams to and receive datagrams from
+* any peer.  If the descriptor isn't bound before the first send, an
+* ephemeral port is bound.
+*
+*   udpSendTo() and udpRecvFrom() copy the data.  udpSendBuf() and
+* udpRecvBuf() pass nBuf chains without copying.  A chain passed to
+* udpSendBuf() should leave UDP_HDRSPACE bytes free in its first buffer
+* so that the headers can be added in place.
+*
+*   Each descriptor queues at most a set number of datagrams and bytes.
+* Datagrams arriving while the queue is full are dropped.
+*
+*****************************************************************************/
+
+#ifndef NETUDP_H
+#define NETUDP_H
+
+
+/*************************
+*** PUBLIC DEFINITIONS ***
+*************************/
+/*
+ * UDP configuration.
+ */
+#define UDP_MAXQUEUE	4			/* Default datagrams queued per descriptor. */
+#define UDP_MAXQBYTES	1024		/* Default bytes queued per descriptor. */
+#define UDP_HDRSPACE	28			/* IP and UDP header space. */
+
+/*
+ * UDP Error codes.
+ */
+#define UDPERR_ALLOC -2				/* Unable to allocate a descriptor or buffers. */
+#define UDPERR_PARAM -3				/* Invalid parameters. */
+#define UDPERR_INVADDR -4			/* Invalid address. */
+#define UDPERR_INUSE -5				/* Port already bound. */
+#define UDPERR_TIMEOUT -8			/* Nothing received in time. */
+#define UDPERR_SIZE -12				/* Datagram too large. */
+
+/*
+ * UDP IOCTL commands.  The argument must point to an int.
+ */
+/* Get the number of datagrams in the receive queue. */
+#define UDPCTLG_RCVCNT 101
+/* Get/set the maximum number of datagrams in the receive queue. */
+#define UDPCTLG_RCVQLEN 102
+#define UDPCTLS_RCVQLEN 103
+/* Get/set the maximum bytes in the receive queue. */
+#define UDPCTLG_RCVQBYTES 104
+#define UDPCTLS_RCVQBYTES 105
+
+
+/************************
+*** PUBLIC DATA TYPES ***
+************************/
+/* UDP statistics counters */
+typedef struct UDPStats_s {
+	DiagStat headLine;		/* Head line for display. */
+	DiagStat ipackets;		/* Datagrams received. */
+	DiagStat runt;			/* Smaller than header or bad length. */
+	DiagStat checksum;		/* Checksum errors. */
+	DiagStat noport;		/* No descriptor bound to the port. */
+	DiagStat qfull;			/* Dropped with the receive queue full. */
+	DiagStat opackets;		/* Datagrams sent. */
+	DiagStat endRec;
+} UDPStats;
+
+
+/*****************************
+*** PUBLIC DATA STRUCTURES ***
+*****************************/
+#if STATS_SUPPORT > 0
+extern UDPStats udpStats;
+#endif
+
+
+/***********************
+*** PUBLIC FUNCTIONS ***
+***********************/
+/*
+ * Initialize the UDP subsystem.
+ */
+void udpInit(void);
+
+/*
+ * Return a new UDP descriptor on success or an error code (negative) on
+ * failure.
+ */
+int udpOpen(void);
+
+/*
+ * Close a UDP descriptor dropping any queued datagrams.
+ * Return 0 on success, an error code on failure.
+ */
+int udpClose(u_int ud);
+
+/*
+ * Bind an IP address and port number as our address on a UDP descriptor.
+ * The IP address must be zero (wild) or equal to localHost.  A zero port
+ * number binds an ephemeral port.
+ * Return 0 on success, an error code on failure.
+ */
+int udpBind(u_int ud, const struct sockaddr_in *myAddr);
+
+/*
+ * Send a datagram to the given address.  udpSendTo() copies the data.
+ * udpSendBuf() sends the nBuf chain itself which is always consumed.
+ * Return the number of bytes sent on success, an error code on failure.
+ */
+int udpSendTo(u_int ud, const void *s, u_int len, const struct sockaddr_in *to);
+int udpSendBuf(u_int ud, NBuf *nb, const struct sockaddr_in *to);
+
+/*
+ * Receive a datagram and the address that sent it if from is not NULL.
+ * udpRecvFrom() copies up to len bytes and drops the rest of the datagram.
+ * udpRecvBuf() returns the datagram's nBuf chain with the headers removed
+ * in *nb which the caller must free.  A zero timeout waits forever.
+ * Return the number of bytes received on success, an error code on
+ * failure or timeout.
+ */
+#define udpRecvFrom(ud, s, len, from) \
+	udpRecvFromJiffy(ud, s, len, from, 0)
+#define udpRecvFromMs(ud, s, len, from, t) \
+	udpRecvFromJiffy(ud, s, len, from, (t + MSPERJIFFY - 1) / MSPERJIFFY)
+int udpRecvFromJiffy(u_int ud, void *s, u_int len, struct sockaddr_in *from, u_int timeout);
+#define udpRecvBuf(ud, nb, from) \
+	udpRecvBufJiffy(ud, nb, from, 0)
+#define udpRecvBufMs(ud, nb, from, t) \
+	udpRecvBufJiffy(ud, nb, from, (t + MSPERJIFFY - 1) / MSPERJIFFY)
+int udpRecvBufJiffy(u_int ud, NBuf **nb, struct sockaddr_in *from, u_int timeout);
+
+/*
+ * Receive an incoming datagram.  This is called from IP.
+ */
+void udpInput(NBuf *inBuf, u_int ipHeadLen);
+
+/*
+ * Get and set parameters for the given descriptor.
+ * Return 0 on success, an error code on failure.
+ */
+int  udpIOCtl(u_int ud, int cmd, void *arg);
+
+#endif
@@ -43,8 +43,12 @@
 
 #if VJ_SUPPORT > 0
 
-#ifndef VJ_NO_STATS
-#define INCR(counter) ++comp->stats.counter
+#if VJ_HASHSZ < 2 * MAX_SLOTS || (VJ_HASHSZ & (VJ_HASHSZ - 1)) != 0
+#error VJ_HASHSZ must be a power of 2 >= 2 * MAX_SLOTS
+#endif
+
+#if STATS_SUPPORT > 0
+#define INCR(counter) ++comp->stats.counter.val
 #else
 #define INCR(counter)
 #endif
@@ -52,26 +56,78 @@
 #define getip_hl(base)	((base).ip_hl)
 #define getth_off(base)	((base).th_off)
 
+/* The TCP ports of a saved connection state. */
+#define cs_ports(cs) (((long *)&(cs)->cs_ip)[getip_hl((cs)->cs_ip)])
+
+static u_int vjHash(struct ip *ip, long ports);
+static struct cstate *vjLookup(struct vjcompress *comp, struct ip *ip, long ports);
+static void vjHashAdd(struct vjcompress *comp, struct cstate *cs);
+static int vjHashDel(struct vjcompress *comp, struct cstate *cs);
+
 void vj_compress_init(struct vjcompress *comp)
 {
-	register u_int i;
-	register struct cstate *tstate = comp->tstate;
-	
 #if MAX_SLOTS == 0
 	bzero((char *)comp, sizeof(*comp));
 #endif
-	comp->maxSlotIndex = MAX_SLOTS - 1;
 	comp->compressSlot = 0;		/* Disable slot ID compression by default. */
-	for (i = MAX_SLOTS - 1; i > 0; --i) {
+	vj_compress_slots(comp, MAX_SLOTS - 1);
+	comp->last_recv = 255;
+	comp->flags = VJF_TOSS;
+	
+#if STATS_SUPPORT > 0
+	memset(&comp->stats, 0, sizeof(comp->stats));
+	comp->stats.headLine.fmtStr				= "\t\tVJ STATISTICS\r\n";
+	comp->stats.vjs_packets.fmtStr			= "\tPACKETS OUT : %5lu\r\n";
+	comp->stats.vjs_compressed.fmtStr		= "\tCOMPRESSED  : %5lu\r\n";
+	comp->stats.vjs_searches.fmtStr			= "\tSEARCHES    : %5lu\r\n";
+	comp->stats.vjs_hits.fmtStr				= "\tHITS        : %5lu\r\n";
+	comp->stats.vjs_misses.fmtStr			= "\tMISSES      : %5lu\r\n";
+	comp->stats.vjs_evicts.fmtStr			= "\tEVICTS      : %5lu\r\n";
+	comp->stats.vjs_uncompressedin.fmtStr	= "\tUNCOMP IN   : %5lu\r\n";
+	comp->stats.vjs_compressedin.fmtStr		= "\tCOMP IN     : %5lu\r\n";
+	comp->stats.vjs_errorin.fmtStr			= "\tERRORS IN   : %5lu\r\n";
+	comp->stats.vjs_tossed.fmtStr			= "\tTOSSED IN   : %5lu\r\n";
+	comp->stats.vjs_prepends.fmtStr			= "\tPREPENDS IN : %5lu\r\n";
+#endif
+}
+
+/*
+ * Use only the transmit connection states up to maxSlotIndex, the largest
+ * slot number the peer can hold, and forget those in use.
+ */
+void vj_compress_slots(struct vjcompress *comp, u_int maxSlotIndex)
+{
+	register u_int i;
+	register struct cstate *tstate = comp->tstate;
+	
+	if (maxSlotIndex > MAX_SLOTS - 1)
+		maxSlotIndex = MAX_SLOTS - 1;
+	comp->maxSlotIndex = maxSlotIndex;
+	for (i = maxSlotIndex; i > 0; --i) {
 		tstate[i].cs_id = i;
 		tstate[i].cs_next = &tstate[i - 1];
+		tstate[i - 1].cs_prev = &tstate[i];
 	}
-	tstate[0].cs_next = &tstate[MAX_SLOTS - 1];
+	tstate[0].cs_next = &tstate[maxSlotIndex];
+	tstate[maxSlotIndex].cs_prev = &tstate[0];
 	tstate[0].cs_id = 0;
 	comp->last_cs = &tstate[0];
-	comp->last_recv = 255;
+	vj_compress_flush(comp);
+}
+
+/*
+ * Forget all transmit connection states so that the next packet on every
+ * connection is sent uncompressed.  Used when the peer reports that it
+ * has lost its context state.
+ */
+void vj_compress_flush(struct vjcompress *comp)
+{
+	register u_int i;
+	
+	for (i = 0; i < MAX_SLOTS; i++)
+		memset(comp->tstate[i].cs_hdr, 0, MAX_HDR);
+	memset(comp->hash, 0, sizeof(comp->hash));
 	comp->last_xmit = 255;
-	comp->flags = VJF_TOSS;
 }
 
 
@@ -181,57 +237,58 @@ u_int vj_compress_tcp(
 	INCR(vjs_packets);
 	if (ip->ip_src.s_addr != cs->cs_ip.ip_src.s_addr 
 			|| ip->ip_dst.s_addr != cs->cs_ip.ip_dst.s_addr 
-			|| *(long *)th != ((long *)&cs->cs_ip)[getip_hl(cs->cs_ip)]) {
+			|| *(long *)th != cs_ports(cs)) {
 		/*
-		 * Wasn't the first -- search for it.
+		 * Wasn't the first -- look it up.
 		 *
-		 * States are kept in a circularly linked list with
-		 * last_cs pointing to the end of the list.  The
-		 * list is kept in lru order by moving a state to the
-		 * head of the list whenever it is referenced.  Since
-		 * the list is short and, empirically, the connection
-		 * we want is almost always near the front, we locate
-		 * states via linear search.  If we don't find a state
+		 * States are kept in a circular doubly linked list with
+		 * last_cs pointing to the end of the list.  The list is
+		 * kept in lru order by moving a state to the head of the
+		 * list whenever it is referenced.  States in use are also
+		 * hashed by address and ports so that finding one doesn't
+		 * depend on the number of slots.  If we don't find a state
 		 * for the datagram, the oldest state is (re-)used.
 		 */
-		register struct cstate *lcs;
 		register struct cstate *lastcs = comp->last_cs;
 		
-		do {
-			lcs = cs; cs = cs->cs_next;
-			INCR(vjs_searches);
-			if (ip->ip_src.s_addr == cs->cs_ip.ip_src.s_addr
-					&& ip->ip_dst.s_addr == cs->cs_ip.ip_dst.s_addr
-					&& *(long *)th == ((long *)&cs->cs_ip)[getip_hl(cs->cs_ip)])
-				goto found;
-		} while (cs != lastcs);
-		
-		/*
-		 * Didn't find it -- re-use oldest cstate.  Send an
-		 * uncompressed packet that tells the other side what
-		 * connection number we're using for this conversation.
-		 * Note that since the state list is circular, the oldest
-		 * state points to the newest and we only need to set
-		 * last_cs to update the lru linkage.
-		 */
-		INCR(vjs_misses);
-		comp->last_cs = lcs;
-		hlen += getth_off(*th);
-		hlen <<= 2;
-		/* Check that the IP/TCP headers are contained in the first buffer. */
-		if (hlen > nb->len)
-			return (TYPE_IP);
-		goto uncompressed;
+		if ((cs = vjLookup(comp, ip, *(long *)th)) == NULL) {
+			/*
+			 * Didn't find it -- re-use oldest cstate.  Send an
+			 * uncompressed packet that tells the other side what
+			 * connection number we're using for this conversation.
+			 * Note that since the state list is circular, the oldest
+			 * state points to the newest and we only need to set
+			 * last_cs to update the lru linkage.
+			 */
+			INCR(vjs_misses);
+			hlen += getth_off(*th);
+			hlen <<= 2;
+			/* Check that the IP/TCP headers are contained in the first buffer. */
+			if (hlen > nb->len)
+				return (TYPE_IP);
+			cs = lastcs;
+			if (vjHashDel(comp, cs))
+				INCR(vjs_evicts);
+			comp->last_cs = cs->cs_prev;
+			BCOPY(ip, &cs->cs_ip, hlen);
+			vjHashAdd(comp, cs);
+			ip->ip_p = cs->cs_id;
+			comp->last_xmit = cs->cs_id;
+			return (TYPE_UNCOMPRESSED_TCP);
+		}
 		
-		found:
 		/*
 		 * Found it -- move to the front on the connection list.
 		 */
+		INCR(vjs_hits);
 		if (cs == lastcs)
-			comp->last_cs = lcs;
+			comp->last_cs = cs->cs_prev;
 		else {
-			lcs->cs_next = cs->cs_next;
+			cs->cs_prev->cs_next = cs->cs_next;
+			cs->cs_next->cs_prev = cs->cs_prev;
 			cs->cs_next = lastcs->cs_next;
+			cs->cs_prev = lastcs;
+			lastcs->cs_next->cs_prev = cs;
 			lastcs->cs_next = cs;
 		}
 	}
@@ -455,7 +512,8 @@ int vj_uncompress_uncomp(
  * must contain an accurate chain length.
  * The first buffer must include the entire compressed TCP/IP header. 
  * This procedure replaces the compressed header with the uncompressed
- * header and returns the length of the VJ header.
+ * header, in place if the buffer has PPP_RXHEADROOM ahead of it, and
+ * returns the length of the VJ header.
  */
 int vj_uncompress_tcp(
 	NBuf **nb,
@@ -574,10 +632,16 @@ int vj_uncompress_tcp(
 	tmp = (tmp & 0xffff) + (tmp >> 16);
 	cs->cs_ip.ip_sum = (u_short)(~tmp);
 	
-	/* Remove the compressed header and prepend the uncompressed header. */
+	/* 
+	 * Remove the compressed header and prepend the uncompressed header.
+	 * The receiver leaves headroom ahead of the compressed header so the
+	 * header normally goes in place with no allocation or payload copy.
+	 */
 	n0->data += vjlen;
 	n0->len -= vjlen;
 	n0->chainLen -= vjlen;
+	if (nLEADINGSPACE(n0) < cs->cs_hlen)
+		INCR(vjs_prepends);
 	nPREPEND(n0, &cs->cs_ip, cs->cs_hlen);
 	if (n0) {
 		*nb = n0;
@@ -595,5 +659,82 @@ bad:
 	return (-1);
 }
 
+
+/*
+ * vjHash - Return the hash table index for a connection's addresses and
+ * ports.
+ */
+static u_int vjHash(struct ip *ip, long ports)
+{
+	register u_long k = ip->ip_src.s_addr ^ ip->ip_dst.s_addr ^ ports;
+	
+	k ^= k >> 16;
+	k ^= k >> 8;
+	return (u_int)k & (VJ_HASHSZ - 1);
+}
+
+/*
+ * vjLookup - Find the transmit state for a connection.
+ * Return NULL if the connection has no state.
+ */
+static struct cstate *vjLookup(struct vjcompress *comp, struct ip *ip, long ports)
+{
+	register u_int h = vjHash(ip, ports);
+	register struct cstate *cs;
+	register u_char id;
+	
+	/* The table is never full so there is always an empty entry. */
+	while ((id = comp->hash[h]) != 0) {
+		INCR(vjs_searches);
+		cs = &comp->tstate[id - 1];
+		if (ip->ip_src.s_addr == cs->cs_ip.ip_src.s_addr
+				&& ip->ip_dst.s_addr == cs->cs_ip.ip_dst.s_addr
+				&& ports == cs_ports(cs))
+			return cs;
+		h = (h + 1) & (VJ_HASHSZ - 1);
+	}
+	return NULL;
+}
+
+/*
+ * vjHashAdd - Hash a transmit state by its saved header.
+ */
+static void vjHashAdd(struct vjcompress *comp, struct cstate *cs)
+{
+	register u_int h = vjHash(&cs->cs_ip, cs_ports(cs));
+	
+	while (comp->hash[h] != 0)
+		h = (h + 1) & (VJ_HASHSZ - 1);
+	comp->hash[h] = cs->cs_id + 1;
+}
+
+/*
+ * vjHashDel - Remove a transmit state from the hash table and close the
+ * gap by moving back any following entries that could use it.
+ * Return non-zero if the state was in the table.
+ */
+static int vjHashDel(struct vjcompress *comp, struct cstate *cs)
+{
+	register u_int i, j, k;
+	
+	i = vjHash(&cs->cs_ip, cs_ports(cs));
+	while (comp->hash[i] != cs->cs_id + 1) {
+		if (comp->hash[i] == 0)
+			return 0;
+		i = (i + 1) & (VJ_HASHSZ - 1);
+	}
+	for (j = i; comp->hash[j = (j + 1) & (VJ_HASHSZ - 1)] != 0; ) {
+		cs = &comp->tstate[comp->hash[j] - 1];
+		k = vjHash(&cs->cs_ip, cs_ports(cs));
+		/* Leave the entry if its home is cyclically in (i, j]. */
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+		comp->hash[i] = comp->hash[j];
+		i = j;
+	}
+	comp->hash[i] = 0;
+	return 1;
+}
+
 #endif
 
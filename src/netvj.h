@@ -26,6 +26,7 @@
 #define VJCOMPRESS_H
 
 #define MAX_SLOTS	16			/* must be > 2 and < 256 */
+#define VJ_HASHSZ	32			/* must be a power of 2 >= 2 * MAX_SLOTS */
 #define MAX_HDR		128
 
 /*
@@ -71,9 +72,6 @@
  * means "IP packet".
  */
 
-/* Undefine this to enable statistics. */
-#define VJ_NO_STATS
-
 /* packet types */
 #define TYPE_IP 0x40
 #define TYPE_UNCOMPRESSED_TCP 0x70
@@ -104,6 +102,7 @@
  */
 struct cstate {
     struct cstate *cs_next;	/* next most recently used state (xmit only) */
+    struct cstate *cs_prev;	/* previous state in the lru list (xmit only) */
     u_short cs_hlen;		/* size of hdr (receive only) */
     u_char cs_id;			/* connection # associated with this state */
     u_char cs_filler;
@@ -115,6 +114,25 @@ struct cstate {
 #define cs_ip vjcs_u.csu_ip
 #define cs_hdr vjcs_u.csu_hdr
 
+/*
+ * Statistics.
+ */
+typedef struct {
+	DiagStat headLine;				/* Head line for display. */
+    DiagStat vjs_packets;			/* outbound packets */
+    DiagStat vjs_compressed;		/* outbound compressed packets */
+    DiagStat vjs_searches;			/* searches for connection state */
+    DiagStat vjs_hits;				/* times found conn. state in hash */
+    DiagStat vjs_misses;			/* times couldn't find conn. state */
+    DiagStat vjs_evicts;			/* conn. states reused for a new conn. */
+    DiagStat vjs_uncompressedin;	/* inbound uncompressed packets */
+    DiagStat vjs_compressedin;		/* inbound compressed packets */
+    DiagStat vjs_errorin;			/* inbound unknown type packets */
+    DiagStat vjs_tossed;			/* inbound packets tossed because of error */
+    DiagStat vjs_prepends;			/* inbound headers without headroom */
+	DiagStat endRec;
+} VJStats;
+
 /*
  * all the state data for one serial line (we need one of these per line).
  */
@@ -125,9 +143,10 @@ struct vjcompress {
     u_short flags;
     u_char maxSlotIndex;
     u_char compressSlot;	/* Flag indicating OK to compress slot ID. */
-#ifndef VJ_NO_STATS
-    struct vjstat stats;
+#if STATS_SUPPORT > 0
+    VJStats stats;
 #endif
+    u_char hash[VJ_HASHSZ];				/* xmit state id + 1 by address/ports */
     struct cstate tstate[MAX_SLOTS];	/* xmit connection states */
     struct cstate rstate[MAX_SLOTS];	/* receive connection states */
 };
@@ -136,6 +155,8 @@ struct vjcompress {
 #define VJF_TOSS 1		/* tossing rcvd frames because of input err */
 
 extern void  vj_compress_init __P((struct vjcompress *comp));
+extern void  vj_compress_slots(struct vjcompress *comp, u_int maxSlotIndex);
+extern void  vj_compress_flush(struct vjcompress *comp);
 extern u_int vj_compress_tcp __P((
 					struct vjcompress *comp,
 					NBuf *nb));